@@ -15,17 +15,17 @@
 
 #include "auxfan.h"
 
-#include <QFile>
 #include <QString>
 #include <QStringList>
-#include <QDir>
 
-AuxFan::AuxFan(QObject *parent, EbmModbusSystem *ebmModbusSystem, Loghandler *loghandler) : QObject(parent)
+AuxFan::AuxFan(QObject *parent, EbmModbusSystem *ebmModbusSystem, TransactionRegistry *transactionRegistry, Loghandler *loghandler) : QObject(parent)
 {
     m_ebmModbusSystem = ebmModbusSystem;
+    m_transactionRegistry = transactionRegistry;
     m_loghandler = loghandler;
 
     m_dataChanged = false;
+    m_persistence = nullptr;
     setAutoSave(true);
 
     m_id = -1;
@@ -88,6 +88,7 @@ void AuxFan::setBusID(int busID)
         m_busID = busID;
         m_dataChanged = true;
         emit signal_needsSaving();
+        emit signal_addressChanged();
     }
 }
 
@@ -103,6 +104,7 @@ void AuxFan::setFanAddress(int fanAddress)
         m_fanAddress = fanAddress;
         m_dataChanged = true;
         emit signal_needsSaving();
+        emit signal_addressChanged();
     }
 }
 
@@ -131,7 +133,7 @@ void AuxFan::setSpeedRaw(int value, bool refreshOnly)
             if (bus == nullptr)
                 return;     // Drop requests for non existing bus ids
 
-            m_transactionIDs.append(m_ebmModbusSystem->writeHoldingRegister(m_busID, m_fanAddress, EbmModbus::HOLDING_REG_D001_DefaultSetValue, m_setpointSpeedRaw));
+            m_transactionRegistry->registerTransaction(m_ebmModbusSystem->writeHoldingRegister(m_busID, m_fanAddress, EbmModbus::HOLDING_REG_D001_DefaultSetValue, m_setpointSpeedRaw), this, TransactionRegistry::RequestRegisterWrite);
 //            m_transactionIDs.append(bus->setSpeedSetpoint(m_fanAddress, m_setpointSpeedRaw));
         }
         else
@@ -320,14 +322,14 @@ void AuxFan::requestStatus()
     if (!m_configData.valid)
         requestConfig();
 
-    m_transactionIDs.append(m_ebmModbusSystem->readInputRegister(m_busID, m_fanAddress, EbmModbus::INPUT_REG_D010_ActualSpeed));
-//    m_transactionIDs.append(m_ebmModbusSystem->readInputRegister(m_busID, m_fanAddress, EbmModbus::INPUT_REG_D021_CurrentPower));
-    m_transactionIDs.append(m_ebmModbusSystem->readInputRegister(m_busID, m_fanAddress, EbmModbus::INPUT_REG_D013_DClinkVoltage));
-    m_transactionIDs.append(m_ebmModbusSystem->readInputRegister(m_busID, m_fanAddress, EbmModbus::INPUT_REG_D014_DClinkCurrent));
-    m_transactionIDs.append(m_ebmModbusSystem->readInputRegister(m_busID, m_fanAddress, EbmModbus::INPUT_REG_D01A_CurrentSetValue));
-    m_transactionIDs.append(m_ebmModbusSystem->readInputRegister(m_busID, m_fanAddress, EbmModbus::INPUT_REG_D011_MotorStatus));
-    m_transactionIDs.append(m_ebmModbusSystem->readInputRegister(m_busID, m_fanAddress, EbmModbus::INPUT_REG_D012_Warning));
-    m_transactionIDs.append(m_ebmModbusSystem->readInputRegister(m_busID, m_fanAddress, EbmModbus::INPUT_REG_D015_ModuleTemperature));
+    m_transactionRegistry->registerTransaction(m_ebmModbusSystem->readInputRegister(m_busID, m_fanAddress, EbmModbus::INPUT_REG_D010_ActualSpeed), this, TransactionRegistry::RequestRegisterRead);
+//    m_transactionRegistry->registerTransaction(m_ebmModbusSystem->readInputRegister(m_busID, m_fanAddress, EbmModbus::INPUT_REG_D021_CurrentPower), this, TransactionRegistry::RequestRegisterRead);
+    m_transactionRegistry->registerTransaction(m_ebmModbusSystem->readInputRegister(m_busID, m_fanAddress, EbmModbus::INPUT_REG_D013_DClinkVoltage), this, TransactionRegistry::RequestRegisterRead);
+    m_transactionRegistry->registerTransaction(m_ebmModbusSystem->readInputRegister(m_busID, m_fanAddress, EbmModbus::INPUT_REG_D014_DClinkCurrent), this, TransactionRegistry::RequestRegisterRead);
+    m_transactionRegistry->registerTransaction(m_ebmModbusSystem->readInputRegister(m_busID, m_fanAddress, EbmModbus::INPUT_REG_D01A_CurrentSetValue), this, TransactionRegistry::RequestRegisterRead);
+    m_transactionRegistry->registerTransaction(m_ebmModbusSystem->readInputRegister(m_busID, m_fanAddress, EbmModbus::INPUT_REG_D011_MotorStatus), this, TransactionRegistry::RequestRegisterRead);
+    m_transactionRegistry->registerTransaction(m_ebmModbusSystem->readInputRegister(m_busID, m_fanAddress, EbmModbus::INPUT_REG_D012_Warning), this, TransactionRegistry::RequestRegisterRead);
+    m_transactionRegistry->registerTransaction(m_ebmModbusSystem->readInputRegister(m_busID, m_fanAddress, EbmModbus::INPUT_REG_D015_ModuleTemperature), this, TransactionRegistry::RequestRegisterRead);
 }
 
 void AuxFan::requestConfig()
@@ -339,10 +341,10 @@ void AuxFan::requestConfig()
     if (bus == nullptr)
         return;
 
-    m_transactionIDs.append(m_ebmModbusSystem->readHoldingRegister(m_busID, m_fanAddress, EbmModbus::HOLDING_REG_D119_MaximumSpeed));
-    m_transactionIDs.append(m_ebmModbusSystem->readHoldingRegister(m_busID, m_fanAddress, EbmModbus::HOLDING_REG_D1A1_ReferenceValueOfDClinkCurrent));
+    m_transactionRegistry->registerTransaction(m_ebmModbusSystem->readHoldingRegister(m_busID, m_fanAddress, EbmModbus::HOLDING_REG_D119_MaximumSpeed), this, TransactionRegistry::RequestRegisterRead);
+    m_transactionRegistry->registerTransaction(m_ebmModbusSystem->readHoldingRegister(m_busID, m_fanAddress, EbmModbus::HOLDING_REG_D1A1_ReferenceValueOfDClinkCurrent), this, TransactionRegistry::RequestRegisterRead);
     // Last Request DC link voltage triggers processing of config data if response telegram is processed
-    m_transactionIDs.append(m_ebmModbusSystem->readHoldingRegister(m_busID, m_fanAddress, EbmModbus::HOLDING_REG_D1A0_ReferenceValueOfDClinkVoltage));
+    m_transactionRegistry->registerTransaction(m_ebmModbusSystem->readHoldingRegister(m_busID, m_fanAddress, EbmModbus::HOLDING_REG_D1A0_ReferenceValueOfDClinkVoltage), this, TransactionRegistry::RequestRegisterRead);
 }
 
 void AuxFan::setAutostart(bool enabled)
@@ -356,10 +358,6 @@ void AuxFan::save()
     if (!m_dataChanged)
         return;
 
-    QFile file(myFilename());
-    if (!file.open(QIODevice::WriteOnly))
-        return;
-
     QString wdata;
 
     wdata.append(QString().sprintf("id=%i ", m_id));
@@ -368,29 +366,15 @@ void AuxFan::save()
     wdata.append(QString().sprintf("setpointSpeedRaw=%i ", m_setpointSpeedRaw));
     wdata.append(QString().sprintf("speedSettingLostCount=%i\n", m_actualData.speedSettingLostCount));    // Todo: decide when to save this. Do not write flash to dead!
 
-    file.write(wdata.toUtf8());
-
-    file.close();
-}
-
-void AuxFan::setFiledirectory(QString path)
-{
-    if (!path.endsWith("/"))
-        path.append("/");
-    m_filepath = path;
+    m_dataChanged = false;
 
-    QDir dir;
-    dir.mkpath(path);
+    if (m_persistence != nullptr)
+        m_persistence->write(myRecordKey(), wdata.toUtf8());
 }
 
-void AuxFan::load(QString filename)
+void AuxFan::load(const QByteArray &record)
 {
-    QFile file(filename);
-
-    if (!file.open(QIODevice::ReadOnly))
-        return;
-
-    QString rdata = QString().fromUtf8(file.readLine());
+    QString rdata = QString().fromUtf8(record).trimmed();
 
     QStringList dataList = rdata.split(" ");
     foreach (QString data, dataList)
@@ -419,8 +403,6 @@ void AuxFan::load(QString filename)
             m_actualData.speedSettingLostCount = value.toInt();
         }
     }
-
-    file.close();
 }
 
 void AuxFan::setAutoSave(bool on)
@@ -432,10 +414,15 @@ void AuxFan::setAutoSave(bool on)
         disconnect(this, SIGNAL(signal_needsSaving()), this, SLOT(slot_save()));
 }
 
+void AuxFan::setPersistence(Persistence *persistence)
+{
+    m_persistence = persistence;
+}
+
 void AuxFan::deleteFromHdd()
 {
-    QFile file(myFilename());
-    file.remove();
+    if (m_persistence != nullptr)
+        m_persistence->remove(myRecordKey());    // Also drops a pending write of this record
 }
 
 void AuxFan::deleteAllErrors()
@@ -444,21 +431,9 @@ void AuxFan::deleteAllErrors()
     m_loghandler->slot_entryGone(LogEntry::Warning, "AuxFan id=" + QString().setNum(m_id), "Warnings present.");
 }
 
-bool AuxFan::isThisYourTelegram(quint64 telegramID, bool deleteID)
-{
-    bool found = m_transactionIDs.contains(telegramID);
-
-    if (found && deleteID)
-    {
-        m_transactionIDs.removeOne(telegramID);
-    }
-
-    return found;
-}
-
-QString AuxFan::myFilename()
+QString AuxFan::myRecordKey()
 {
-    return (m_filepath + QString().sprintf("auxfan-%06i.csv", m_id));
+    return QString().sprintf("auxfan-%06i", m_id);
 }
 
 bool AuxFan::isConfigured()
@@ -21,13 +21,15 @@
 #include <QMap>
 #include <QDateTime>
 #include "ebmmodbussystem.h"
+#include "transactionregistry.h"
+#include "persistence.h"
 #include "loghandler.h"
 
 class AuxFan : public QObject
 {
     Q_OBJECT
 public:
-    explicit AuxFan(QObject *parent, EbmModbusSystem *ebmModbusSystem, Loghandler* loghandler);
+    explicit AuxFan(QObject *parent, EbmModbusSystem *ebmModbusSystem, TransactionRegistry* transactionRegistry, Loghandler* loghandler);
     ~AuxFan();
 
     typedef struct {
@@ -90,20 +92,20 @@ public:
     void setAutostart(bool enabled);
 
     void save();
-    void setFiledirectory(QString path);
-    void load(QString filename);
+    void load(const QByteArray& record);
 
     void setAutoSave(bool on);
 
+    // Records are written to the device journal by persistence in the background. Without persistence nothing is saved.
+    void setPersistence(Persistence* persistence);
+
     void deleteFromHdd();
     void deleteAllErrors();
 
-    bool isThisYourTelegram(quint64 telegramID, bool deleteID = true);
-
 private:
     EbmModbusSystem* m_ebmModbusSystem;
     Loghandler* m_loghandler;
-    QList<quint64> m_transactionIDs;
+    TransactionRegistry* m_transactionRegistry;
 
     int m_id;
     int m_setpointSpeedRaw;
@@ -118,9 +120,9 @@ private:
 
     bool m_dataChanged;
     bool m_autosave;
-    QString m_filepath;
+    Persistence* m_persistence;
 
-    QString myFilename();
+    QString myRecordKey();
 
     bool isConfigured();    // Returns false if either fanAddress or busID is not set
     void markAsOnline();
@@ -133,6 +135,7 @@ private:
 
 signals:
     void signal_needsSaving();
+    void signal_addressChanged();   // Emitted if busID or fanAddress changed
     void signal_FanActualDataHasChanged(int id);
 
 public slots:
@@ -0,0 +1,223 @@
+/**********************************************************************
+** ebmbus-cmd - a commandline tool to control ebm papst fans
+** Copyright (C) 2018 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+#include "auxfancommissioning.h"
+
+#include <QTimer>
+#include <QStringList>
+
+AuxFanCommissioning::AuxFanCommissioning(QObject *parent, EbmModbusSystem *ebmModbusSystem, int busID, QList<quint16> fanAddresses, int baudrate, char parity) : QObject(parent)
+{
+    m_ebmModbusSystem = ebmModbusSystem;
+    m_busID = busID;
+    m_fanAddresses = fanAddresses;
+    m_newBaudrate = baudrate;
+    m_newParity = parity;
+    m_oldBaudrate = 19200;
+    m_oldParity = 'E';
+    m_state = StateDone;
+
+    connect(m_ebmModbusSystem, &EbmModbusSystem::signal_transactionLost, this, &AuxFanCommissioning::slot_transactionLost);
+    connect(m_ebmModbusSystem, &EbmModbusSystem::signal_receivedInputRegisterData, this, &AuxFanCommissioning::slot_receivedInputRegisterData);
+    connect(m_ebmModbusSystem, &EbmModbusSystem::signal_wroteHoldingRegisterData, this, &AuxFanCommissioning::slot_wroteHoldingRegisterData);
+}
+
+void AuxFanCommissioning::start()
+{
+    EbmModbus* bus = m_ebmModbusSystem->getBusByID(m_busID);
+    if (bus == nullptr)
+    {
+        finish(false, "Bus not found.");
+        return;
+    }
+
+    m_oldBaudrate = bus->getBaudrate();
+    m_oldParity = bus->getParity();
+
+    enterState(StateCheckFans);
+}
+
+int AuxFanCommissioning::getBusID() const
+{
+    return m_busID;
+}
+
+void AuxFanCommissioning::readActualSpeeds(QList<quint16> fanAddresses)
+{
+    foreach (quint16 fanAddress, fanAddresses)
+        m_pendingTelegrams.insert(m_ebmModbusSystem->readInputRegister(m_busID, fanAddress, EbmModbus::INPUT_REG_D010_ActualSpeed), fanAddress);
+
+    if (m_pendingTelegrams.isEmpty())
+        stepFinished();
+}
+
+void AuxFanCommissioning::writeParameters(QList<quint16> fanAddresses, int baudrate, char parity)
+{
+    foreach (quint16 fanAddress, fanAddresses)
+    {
+        m_pendingTelegrams.insert(m_ebmModbusSystem->writeHoldingRegister(m_busID, fanAddress, EbmModbus::HOLDING_REG_D14A_ParityConfiguration, EbmModbus::parityCode(parity)), fanAddress);
+        m_pendingTelegrams.insert(m_ebmModbusSystem->writeHoldingRegister(m_busID, fanAddress, EbmModbus::HOLDING_REG_D149_TransferRate, EbmModbus::transferRateCode(baudrate)), fanAddress);
+    }
+
+    if (m_pendingTelegrams.isEmpty())
+        stepFinished();
+}
+
+// Writes the old parameters to all fans which listen at the given line parameters. Fans at other parameters do not answer.
+void AuxFanCommissioning::rollbackAt(int baudrate, char parity)
+{
+    m_ebmModbusSystem->setLineParameters(m_busID, baudrate, parity);
+    QTimer::singleShot(SettleTime, this, [this]() { writeParameters(m_fanAddresses, m_oldBaudrate, m_oldParity); });
+}
+
+void AuxFanCommissioning::enterState(AuxFanCommissioning::State state)
+{
+    m_state = state;
+    m_failedFans.clear();
+    m_pendingTelegrams.clear();
+
+    switch (m_state)
+    {
+    case StateCheckFans:
+        readActualSpeeds(m_fanAddresses);
+        break;
+    case StateWriteParameters:
+        writeParameters(m_fanAddresses, m_newBaudrate, m_newParity);
+        break;
+    case StateVerify:
+        m_ebmModbusSystem->setLineParameters(m_busID, m_newBaudrate, m_newParity);
+        QTimer::singleShot(SettleTime, this, [this]() { readActualSpeeds(m_fanAddresses); });
+        break;
+    case StateRollbackAtNewParameters:
+        rollbackAt(m_newBaudrate, m_newParity);
+        break;
+    case StateRollbackAtNewParity:
+        rollbackAt(m_oldBaudrate, m_newParity);
+        break;
+    case StateRollbackAtOldParameters:
+        rollbackAt(m_oldBaudrate, m_oldParity);
+        break;
+    case StateRollbackVerify:
+        QTimer::singleShot(SettleTime, this, [this]() { readActualSpeeds(m_fanAddresses); });
+        break;
+    case StateDone:
+        break;
+    }
+}
+
+void AuxFanCommissioning::stepFinished()
+{
+    QStringList failedFans;
+    foreach (quint16 fanAddress, m_failedFans)
+        failedFans.append(QString().setNum(fanAddress));
+    failedFans.sort();
+
+    switch (m_state)
+    {
+    case StateCheckFans:
+        if (!m_failedFans.isEmpty())
+            finish(false, "Fans " + failedFans.join(",") + " do not answer at the current line parameters. Nothing has been changed.");
+        else
+            enterState(StateWriteParameters);
+        break;
+    case StateWriteParameters:
+        if (!m_failedFans.isEmpty())
+        {
+            // Fans may have switched to the new parity or to both new parameters before a write failed
+            m_failureReason = "Fans " + failedFans.join(",") + " did not accept the new line parameters.";
+            enterState(StateRollbackAtNewParameters);
+        }
+        else
+            enterState(StateVerify);
+        break;
+    case StateVerify:
+        if (!m_failedFans.isEmpty())
+        {
+            m_failureReason = "Fans " + failedFans.join(",") + " do not answer at the new line parameters.";
+            enterState(StateRollbackAtNewParameters);
+        }
+        else
+        {
+            // Only now the fans are known to answer at the new parameters, so the line starts with them next time
+            if (m_ebmModbusSystem->saveLineParameters(m_busID, m_newBaudrate, m_newParity))
+                finish(true, QString().sprintf("All %i fans switched to %i baud, parity %c.", m_fanAddresses.count(), m_newBaudrate, m_newParity));
+            else
+                finish(false, QString().sprintf("All %i fans switched to %i baud, parity %c, but the line parameters could not be saved.", m_fanAddresses.count(), m_newBaudrate, m_newParity));
+        }
+        break;
+    case StateRollbackAtNewParameters:
+        // With only one of baud rate and parity changed, the old baud rate with the new parity is one of the others
+        if ((m_newBaudrate != m_oldBaudrate) && (m_newParity != m_oldParity))
+            enterState(StateRollbackAtNewParity);
+        else
+            enterState(StateRollbackAtOldParameters);
+        break;
+    case StateRollbackAtNewParity:
+        enterState(StateRollbackAtOldParameters);
+        break;
+    case StateRollbackAtOldParameters:
+        enterState(StateRollbackVerify);
+        break;
+    case StateRollbackVerify:
+        if (m_failedFans.isEmpty())
+            finish(false, m_failureReason + QString().sprintf(" All fans are back at %i baud, parity %c.", m_oldBaudrate, m_oldParity));
+        else
+            finish(false, m_failureReason + " Fans " + failedFans.join(",") + " do not answer anymore.");
+        break;
+    case StateDone:
+        break;
+    }
+}
+
+void AuxFanCommissioning::finish(bool success, QString message)
+{
+    m_state = StateDone;
+    m_pendingTelegrams.clear();
+    emit signal_finished(m_busID, success, message);
+}
+
+void AuxFanCommissioning::slot_transactionLost(quint64 telegramID)
+{
+    if (!m_pendingTelegrams.contains(telegramID))
+        return;
+
+    m_failedFans.insert(m_pendingTelegrams.take(telegramID));
+    if (m_pendingTelegrams.isEmpty())
+        stepFinished();
+}
+
+void AuxFanCommissioning::slot_receivedInputRegisterData(quint64 telegramID, quint16 adr, EbmModbus::EbmModbusInputRegister reg, quint16 rawdata)
+{
+    Q_UNUSED(adr)
+    Q_UNUSED(reg)
+    Q_UNUSED(rawdata)
+
+    if (!m_pendingTelegrams.contains(telegramID))
+        return;
+
+    m_pendingTelegrams.remove(telegramID);
+    if (m_pendingTelegrams.isEmpty())
+        stepFinished();
+}
+
+void AuxFanCommissioning::slot_wroteHoldingRegisterData(quint64 telegramID)
+{
+    if (!m_pendingTelegrams.contains(telegramID))
+        return;
+
+    m_pendingTelegrams.remove(telegramID);
+    if (m_pendingTelegrams.isEmpty())
+        stepFinished();
+}
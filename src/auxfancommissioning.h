@@ -0,0 +1,86 @@
+/**********************************************************************
+** ebmbus-cmd - a commandline tool to control ebm papst fans
+** Copyright (C) 2018 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+#ifndef AUXFANCOMMISSIONING_H
+#define AUXFANCOMMISSIONING_H
+
+#include <QObject>
+#include <QList>
+#include <QHash>
+#include <QSet>
+#include "ebmmodbussystem.h"
+
+// Moves all auxfans of a modbus line to another baud rate and parity:
+// 1. All fans have to answer at the current line parameters, otherwise nothing is changed.
+// 2. Transfer rate and parity registers are written to all fans.
+// 3. The master switches the line and all fans have to answer at the new parameters.
+// If step 2 or 3 fails, the fans are written back to the old parameters at every line parameters a fan can be at:
+// the new ones, the old baud rate with the new parity (only the parity write got through) and the old ones.
+// The master ends at the old ones. So no fan is left behind at parameters nobody talks.
+
+class AuxFanCommissioning : public QObject
+{
+    Q_OBJECT
+public:
+    explicit AuxFanCommissioning(QObject *parent, EbmModbusSystem* ebmModbusSystem, int busID, QList<quint16> fanAddresses, int baudrate, char parity);
+
+    void start();
+    int getBusID() const;
+
+private:
+    typedef enum {
+        StateCheckFans,
+        StateWriteParameters,
+        StateVerify,
+        StateRollbackAtNewParameters,
+        StateRollbackAtNewParity,
+        StateRollbackAtOldParameters,
+        StateRollbackVerify,
+        StateDone
+    } State;
+
+    EbmModbusSystem* m_ebmModbusSystem;
+    int m_busID;
+    QList<quint16> m_fanAddresses;
+
+    int m_oldBaudrate;
+    char m_oldParity;
+    int m_newBaudrate;
+    char m_newParity;
+
+    static const int SettleTime = 1000;     // Unit ms, time for the fans to switch before they are asked at new parameters
+
+    State m_state;
+    QHash<quint64, quint16> m_pendingTelegrams;     // Telegram id and fan address
+    QSet<quint16> m_failedFans;
+    QString m_failureReason;
+
+    void readActualSpeeds(QList<quint16> fanAddresses);
+    void writeParameters(QList<quint16> fanAddresses, int baudrate, char parity);
+    void rollbackAt(int baudrate, char parity);
+    void enterState(State state);
+    void stepFinished();
+    void finish(bool success, QString message);
+
+signals:
+    void signal_finished(int busID, bool success, QString message);
+
+private slots:
+    void slot_transactionLost(quint64 telegramID);
+    void slot_receivedInputRegisterData(quint64 telegramID, quint16 adr, EbmModbus::EbmModbusInputRegister reg, quint16 rawdata);
+    void slot_wroteHoldingRegisterData(quint64 telegramID);
+};
+
+#endif // AUXFANCOMMISSIONING_H
@@ -14,14 +14,17 @@
 **********************************************************************/
 
 #include "auxfandatabase.h"
+#include <stdio.h>
 
-AuxFanDatabase::AuxFanDatabase(QObject *parent,  EbmModbusSystem *ebmModbusSystem, Loghandler *loghandler) : QObject(parent)
+AuxFanDatabase::AuxFanDatabase(QObject *parent,  EbmModbusSystem *ebmModbusSystem, Persistence *persistence, Loghandler *loghandler) : QObject(parent)
 {
     m_ebmModbusSystem = ebmModbusSystem;
 
     m_ebmModbusList = ebmModbusSystem->ebmModbuslist(); // Try to eliminate this!
 
+    m_persistence = persistence;
     m_loghandler = loghandler;
+    m_commissioning = nullptr;
 
     // High level bus-system response connections
     connect(m_ebmModbusSystem, &EbmModbusSystem::signal_receivedHoldingRegisterData, this, &AuxFanDatabase::slot_receivedHoldingRegisterData);
@@ -29,50 +32,39 @@ AuxFanDatabase::AuxFanDatabase(QObject *parent,  EbmModbusSystem *ebmModbusSyste
     connect(m_ebmModbusSystem, &EbmModbusSystem::signal_wroteHoldingRegisterData, this, &AuxFanDatabase::slot_wroteHoldingRegisterData);
     connect(m_ebmModbusSystem, &EbmModbusSystem::signal_transactionLost, this, &AuxFanDatabase::slot_transactionLost);
 
-    connect(&m_timer_pollStatus, &QTimer::timeout, this, &AuxFanDatabase::slot_timer_pollStatus_fired);
-    m_timer_pollStatus.setInterval(2000);
-    m_timer_pollStatus.start();
+    m_pollScheduler = new AuxFanPollScheduler(this, m_ebmModbusSystem);
 }
 
 void AuxFanDatabase::loadFromHdd()
 {
-    QString directory = "/var/openffucontrol/auxfans/";
-    QDirIterator iterator(directory, QStringList() << "*.csv", QDir::Files, QDirIterator::NoIteratorFlags);
+    QMap<QString, QByteArray> records = m_persistence->takeRecords("auxfan-");
+    if (records.isEmpty())
+        records = m_persistence->importFiles("/var/openffucontrol/auxfans/");
 
-    QStringList filepaths;
-
-    while(iterator.hasNext())
-    {
-        filepaths.append(iterator.next());
-    }
-
-    filepaths.sort();
-
-    foreach(QString filepath, filepaths)
+    foreach(QByteArray record, records)
     {
-        AuxFan* newAuxFan = new AuxFan(this, m_ebmModbusSystem, m_loghandler);
-        newAuxFan->load(filepath);
-        newAuxFan->setFiledirectory(directory);
+        AuxFan* newAuxFan = new AuxFan(this, m_ebmModbusSystem, &m_transactionRegistry, m_loghandler);
+        newAuxFan->load(record);
+        newAuxFan->setPersistence(m_persistence);
         connect(newAuxFan, &AuxFan::signal_FanActualDataHasChanged, this, &AuxFanDatabase::signal_AuxFanActualDataHasChanged);
+        connect(newAuxFan, &AuxFan::signal_addressChanged, this, &AuxFanDatabase::slot_auxFanAddressChanged);
         m_auxfans.append(newAuxFan);
+        indexAuxFan(newAuxFan);
     }
 }
 
 void AuxFanDatabase::saveToHdd()
 {
-    QString path = "/var/openffucontrol/auxfans/";
-
-    foreach (AuxFan* auxFan, m_auxfans)
+    foreach (AuxFan* auxFan, m_auxfans.list())
     {
-        auxFan->setFiledirectory(path);
         auxFan->save();
     }
 }
 
 QString AuxFanDatabase::addAuxFan(int id, int busID, int fanAddress)
 {
-    AuxFan* newAuxFan = new AuxFan(this, m_ebmModbusSystem, m_loghandler);
-    newAuxFan->setFiledirectory("/var/openffucontrol/auxfans/");
+    AuxFan* newAuxFan = new AuxFan(this, m_ebmModbusSystem, &m_transactionRegistry, m_loghandler);
+    newAuxFan->setPersistence(m_persistence);
     newAuxFan->setAutoSave(false);
     newAuxFan->setId(id);
     newAuxFan->setBusID(busID);
@@ -80,7 +72,9 @@ QString AuxFanDatabase::addAuxFan(int id, int busID, int fanAddress)
     newAuxFan->setAutoSave(true);
     newAuxFan->save();
     connect(newAuxFan, &AuxFan::signal_FanActualDataHasChanged, this, &AuxFanDatabase::signal_AuxFanActualDataHasChanged);
+    connect(newAuxFan, &AuxFan::signal_addressChanged, this, &AuxFanDatabase::slot_auxFanAddressChanged);
     m_auxfans.append(newAuxFan);
+    indexAuxFan(newAuxFan);
 
     return "OK[AuxFanDatabase]: Added AuxFan ID " + QString().setNum(id);
 }
@@ -91,10 +85,13 @@ QString AuxFanDatabase::deleteAuxFan(int id)
     if (auxFan == nullptr)
         return "Warning[AuxFanDatabase]: ID " + QString().setNum(id) + " not found.";
 
-    bool ok = m_auxfans.removeOne(auxFan);
+    bool ok = m_auxfans.remove(auxFan);
     if (ok)
     {
         disconnect(auxFan, &AuxFan::signal_FanActualDataHasChanged, this, &AuxFanDatabase::signal_AuxFanActualDataHasChanged);
+        disconnect(auxFan, &AuxFan::signal_addressChanged, this, &AuxFanDatabase::slot_auxFanAddressChanged);
+        unindexAuxFan(auxFan);
+        m_transactionRegistry.removeOwner(auxFan);
         auxFan->deleteFromHdd();
         auxFan->deleteAllErrors();
         delete auxFan;
@@ -105,41 +102,113 @@ QString AuxFanDatabase::deleteAuxFan(int id)
 
 QList<AuxFan *> AuxFanDatabase::getAuxFans(int busNr)
 {
-    QList<AuxFan *> auxFanList;
     if (busNr == -1)
-        return m_auxfans;
-    else
-    {
-        foreach (AuxFan* auxFan, m_auxfans) {
-            if (auxFan->getBusID() == busNr)
-                auxFanList.append(auxFan);
-        }
-    }
+        return m_auxfans.list();
 
-    return auxFanList;
+    return m_auxFansPerBus.value(busNr).list();
 }
 
 AuxFan *AuxFanDatabase::getAuxFanByID(int id)
 {
-    foreach (AuxFan* auxFan, m_auxfans)
+    return m_auxFansByID.value(id, nullptr);    // nullptr if not found
+}
+
+void AuxFanDatabase::indexAuxFan(AuxFan *auxFan)
+{
+    unindexAuxFan(auxFan);
+
+    m_auxFansByID.insert(auxFan->getId(), auxFan);
+
+    m_auxFansPerBus[auxFan->getBusID()].append(auxFan);
+    m_indexedBusIDs.insert(auxFan, auxFan->getBusID());
+    m_pollScheduler->addAuxFan(auxFan);
+}
+
+void AuxFanDatabase::unindexAuxFan(AuxFan *auxFan)
+{
+    m_pollScheduler->removeAuxFan(auxFan);
+
+    // Only remove the id entry if it still points to this fan, another one might have been added with the same id
+    if (m_auxFansByID.value(auxFan->getId(), nullptr) == auxFan)
+        m_auxFansByID.remove(auxFan->getId());
+
+    QHash<AuxFan*, int>::iterator busIt = m_indexedBusIDs.find(auxFan);
+    if (busIt == m_indexedBusIDs.end())
+        return;
+
+    QMap<int, IndexedList<AuxFan*>>::iterator listIt = m_auxFansPerBus.find(busIt.value());
+    if (listIt != m_auxFansPerBus.end())
     {
-        if (auxFan->getId() == id)
-            return auxFan;
+        listIt.value().remove(auxFan);
+        if (listIt.value().isEmpty())
+            m_auxFansPerBus.erase(listIt);
     }
-    return nullptr;    // Not found
+    m_indexedBusIDs.erase(busIt);
 }
 
 AuxFan *AuxFanDatabase::getAuxFanByTelegramID(quint64 telegramID)
 {
-    foreach (AuxFan* auxFan, m_auxfans) {
-        bool found = auxFan->isThisYourTelegram(telegramID);
-        if (found)
-        {
-            return auxFan;
-        }
+    // Returns nullptr if the transactionID was not initiated by auxfan requests, so it came frome somebody else
+    return qobject_cast<AuxFan*>(m_transactionRegistry.takeOwner(telegramID));
+}
+
+EbmModbusSystem *AuxFanDatabase::getEbmModbusSystem()
+{
+    return m_ebmModbusSystem;
+}
+
+AuxFanPollScheduler *AuxFanDatabase::getPollScheduler()
+{
+    return m_pollScheduler;
+}
+
+Persistence *AuxFanDatabase::getPersistence()
+{
+    return m_persistence;
+}
+
+// Log module of the commissioning of a line. Its error entry has a fixed text, so the next commissioning can clear it.
+static QString commissioningModule(int busID)
+{
+    return "AuxFanDatabase bus=" + QString().setNum(busID);
+}
+
+QString AuxFanDatabase::startCommissioning(int busID, int baudrate, char parity)
+{
+    if (m_commissioning != nullptr)
+        return QString().sprintf("Error[AuxFanDatabase]: Commissioning of bus %i is still running.", m_commissioning->getBusID());
+
+    if (m_ebmModbusSystem->getBusByID(busID) == nullptr)
+        return "Error[AuxFanDatabase]: Bus not found.";
+
+    if (EbmModbus::transferRateCode(baudrate) < 0)
+        return "Error[AuxFanDatabase]: Baudrate not supported by the fans.";
+
+    if (EbmModbus::parityCode(parity) < 0)
+        return "Error[AuxFanDatabase]: Parity not supported by the fans.";
+
+    QList<quint16> fanAddresses;
+    foreach (AuxFan* auxFan, m_auxFansPerBus.value(busID).list())
+    {
+        if ((auxFan->getFanAddress() >= 0) && !fanAddresses.contains(auxFan->getFanAddress()))
+            fanAddresses.append(auxFan->getFanAddress());
     }
 
-    return nullptr;    // TransactionID not initiated by ffu requests, so it came frome somebody else
+    if (fanAddresses.isEmpty())
+        return "Error[AuxFanDatabase]: No auxfans on that bus.";
+
+    m_commissioning = new AuxFanCommissioning(this, m_ebmModbusSystem, busID, fanAddresses, baudrate, parity);
+    connect(m_commissioning, &AuxFanCommissioning::signal_finished, this, &AuxFanDatabase::slot_commissioningFinished);
+    m_pollScheduler->setLinePaused(busID, true);    // Polls would only fail while the line changes its parameters
+    m_loghandler->slot_entryGone(LogEntry::Error, commissioningModule(busID), "Commissioning failed.");
+    m_commissioning->start();
+
+    return "OK[AuxFanDatabase]: Commissioning started.";
+}
+
+TransactionRegistry *AuxFanDatabase::getTransactionRegistry()
+{
+    return &m_transactionRegistry;
 }
 
 QString AuxFanDatabase::getAuxFanData(int id, QString key)
@@ -207,18 +276,46 @@ QString AuxFanDatabase::setAuxFanData(int id, QMap<QString, QString> dataMap)
 
 void AuxFanDatabase::slot_remoteControlActivated()
 {
-    foreach (AuxFan* auxFan, m_auxfans) {
+    foreach (AuxFan* auxFan, m_auxfans.list()) {
         auxFan->setRemoteControlled(true);
     }
 }
 
 void AuxFanDatabase::slot_remoteControlDeactivated()
 {
-    foreach (AuxFan* auxFan, m_auxfans) {
+    foreach (AuxFan* auxFan, m_auxfans.list()) {
         auxFan->setRemoteControlled(false);
     }
 }
 
+void AuxFanDatabase::slot_auxFanAddressChanged()
+{
+    AuxFan* auxFan = qobject_cast<AuxFan*>(sender());
+    if (auxFan == nullptr)
+        return;
+
+    indexAuxFan(auxFan);
+}
+
+void AuxFanDatabase::slot_commissioningFinished(int busID, bool success, QString message)
+{
+    QString module = commissioningModule(busID);
+
+    fprintf(stderr, "AuxFanDatabase::slot_commissioningFinished(): bus %i: %s\n", busID, message.toLocal8Bit().data());
+    if (success)
+        m_loghandler->slot_newEntry(LogEntry::Info, module, "Commissioning: " + message);
+    else
+    {
+        // The details change with every attempt, so they go to an info entry
+        m_loghandler->slot_newEntry(LogEntry::Info, module, "Commissioning failed: " + message);
+        m_loghandler->slot_newEntry(LogEntry::Error, module, "Commissioning failed.");
+    }
+
+    m_commissioning->deleteLater();
+    m_commissioning = nullptr;
+    m_pollScheduler->setLinePaused(busID, false);
+}
+
 void AuxFanDatabase::slot_transactionFinished()
 {
     // Do nothing
@@ -232,6 +329,7 @@ void AuxFanDatabase::slot_transactionLost(quint64 telegramID)
         // Somebody other than the ffu requested that response, so do nothing with the response at this point
         return;
     }
+    m_pollScheduler->auxFanLost(auxFan);
     auxFan->slot_transactionLost(telegramID);
 }
 
@@ -254,6 +352,8 @@ void AuxFanDatabase::slot_receivedInputRegisterData(quint64 telegramID, quint16
         // Somebody other than the ffu requested that response, so do nothing with the response at this point
         return;
     }
+    if (reg == EbmModbus::INPUT_REG_D010_ActualSpeed)
+        m_pollScheduler->auxFanAnswered(auxFan);
     auxFan->slot_receivedInputRegisterData(telegramID, adr, reg, rawdata);
 }
 
@@ -267,18 +367,3 @@ void AuxFanDatabase::slot_wroteHoldingRegisterData(quint64 telegramID)
     }
     auxFan->slot_wroteHoldingRegisterData(telegramID);
 }
-
-void AuxFanDatabase::slot_timer_pollStatus_fired()
-{
-    static int currentAuxFanId = 0;
-
-    if (m_auxfans.count() > currentAuxFanId)
-    {
-        AuxFan* auxFan = m_auxfans.at(currentAuxFanId);
-        auxFan->requestStatus();
-    }
-
-    currentAuxFanId++;
-    if (m_auxfans.count() <= currentAuxFanId)
-        currentAuxFanId = 0;
-}
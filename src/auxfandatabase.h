@@ -25,9 +25,15 @@
 #include <QDirIterator>
 #include <QTimer>
 #include <QMap>
+#include <QHash>
 #include "ebmmodbussystem.h"
+#include "persistence.h"
 #include "loghandler.h"
 #include "auxfan.h"
+#include "indexedlist.h"
+#include "transactionregistry.h"
+#include "auxfancommissioning.h"
+#include "auxfanpollscheduler.h"
 
 // AuxFans are managed via Modbus
 
@@ -35,7 +41,7 @@ class AuxFanDatabase : public QObject
 {
     Q_OBJECT
 public:
-    explicit AuxFanDatabase(QObject *parent, EbmModbusSystem *ebmModbusSystem, Loghandler *loghandler);
+    explicit AuxFanDatabase(QObject *parent, EbmModbusSystem *ebmModbusSystem, Persistence* persistence, Loghandler *loghandler);
 
     void loadFromHdd();
     void saveToHdd();
@@ -50,6 +56,14 @@ public:
     QString setAuxFanData(int id, QString key, QString value);
     QString setAuxFanData(int id, QMap<QString,QString> dataMap);
 
+    TransactionRegistry* getTransactionRegistry();
+    Persistence* getPersistence();
+    EbmModbusSystem* getEbmModbusSystem();
+    AuxFanPollScheduler* getPollScheduler();
+
+    // Moves all auxfans of busID and the line itself to baudrate and parity, see auxfancommissioning.h
+    QString startCommissioning(int busID, int baudrate, char parity);
+
     // Broadcast is not implemented yet
     //QString broadcast(int busID, QMap<QString,QString> dataMap);
 
@@ -58,12 +72,21 @@ public:
 private:
     EbmModbusSystem* m_ebmModbusSystem;
     QList<EbmModbus*>* m_ebmModbusList;
+    Persistence* m_persistence;
     Loghandler* m_loghandler;
-    QList<AuxFan*> m_auxfans;
-    QTimer m_timer_pollStatus;
+    IndexedList<AuxFan*> m_auxfans;
+    QHash<int, AuxFan*> m_auxFansByID;
+    QMap<int, IndexedList<AuxFan*>> m_auxFansPerBus;
+    QHash<AuxFan*, int> m_indexedBusIDs;
+    TransactionRegistry m_transactionRegistry;
+    AuxFanPollScheduler* m_pollScheduler;
+    AuxFanCommissioning* m_commissioning;   // Only one line is commissioned at a time, nullptr if none
 
     AuxFan* getAuxFanByTelegramID(quint64 telegramID);
 
+    void indexAuxFan(AuxFan* auxFan);     // Keeps id and bus lookups in sync with the fan
+    void unindexAuxFan(AuxFan* auxFan);
+
 signals:
     void signal_AuxFanActualDataHasChanged(int id);
 
@@ -72,6 +95,10 @@ public slots:
     void slot_remoteControlDeactivated();
 
 private slots:
+    // AuxFan management slots
+    void slot_auxFanAddressChanged();
+    void slot_commissioningFinished(int busID, bool success, QString message);
+
     // High level bus response slots
     void slot_transactionFinished();
     void slot_transactionLost(quint64 telegramID);
@@ -86,9 +113,6 @@ private slots:
     //void slot_EEPROMhasBeenWritten(quint64 telegramID, quint8 fanAddress, quint8 fanGroup);
     //void slot_EEPROMdata(quint64 telegramID, quint8 fanAddress, quint8 fanGroup, EbmBusEEPROM::EEPROMaddress eepromAddress, quint8 dataByte);
 
-    // Timer slots
-    void slot_timer_pollStatus_fired();
-
 };
 
 #endif // AUXFANDATABASE_H
@@ -0,0 +1,244 @@
+/**********************************************************************
+** ebmbus-cmd - a commandline tool to control ebm papst fans
+** Copyright (C) 2018 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+#include "auxfanpollscheduler.h"
+#include <QSettings>
+
+AuxFanPollScheduler::AuxFanPollScheduler(QObject *parent, EbmModbusSystem *ebmModbusSystem) : QObject(parent)
+{
+    m_ebmModbusSystem = ebmModbusSystem;
+
+    QSettings settings("/etc/openffucontrol/ebmbus-cmd/ebmbus-cmd.ini", QSettings::IniFormat);
+    settings.beginGroup("auxFanPolling");
+    int tickInterval = settings.value("tickInterval", 20).toInt();
+    m_utilisationTarget = qBound(1, settings.value("utilisationTarget", 70).toInt(), 100) / 100.0;
+    m_maxRefreshAge = settings.value("maxRefreshAge", 10000).toLongLong();
+    m_minRefreshInterval = settings.value("minRefreshInterval", 1000).toLongLong();
+    m_backoffStart = settings.value("backoffStart", 2000).toLongLong();
+    m_backoffMax = settings.value("backoffMax", 60000).toLongLong();
+    settings.endGroup();
+
+    m_clock.start();
+
+    connect(&m_timer_tick, &QTimer::timeout, this, &AuxFanPollScheduler::slot_timer_tick_fired);
+    m_timer_tick.setInterval(tickInterval);
+    m_timer_tick.start();
+}
+
+void AuxFanPollScheduler::addAuxFan(AuxFan *auxFan)
+{
+    FanState state;
+    state.lastRefresh = m_clock.elapsed();
+    state.refreshed = false;
+    state.lastPoll = -1;
+    state.pollPending = false;
+    state.failures = 0;
+    state.backoffUntil = 0;
+    m_fanStates.insert(auxFan, state);
+}
+
+void AuxFanPollScheduler::removeAuxFan(AuxFan *auxFan)
+{
+    m_fanStates.remove(auxFan);
+}
+
+void AuxFanPollScheduler::auxFanAnswered(AuxFan *auxFan)
+{
+    if (!m_fanStates.contains(auxFan))
+        return;
+
+    FanState& state = m_fanStates[auxFan];
+    qint64 now = m_clock.elapsed();
+
+    if (state.refreshed && m_lineStates.contains(auxFan->getBusID()))
+    {
+        LineState& line = m_lineStates[auxFan->getBusID()];
+        qint64 age = now - state.lastRefresh;
+        line.refreshes++;
+        line.totalRefreshAge += age;
+        line.maxRefreshAge = qMax(line.maxRefreshAge, age);
+    }
+
+    state.lastRefresh = now;
+    state.refreshed = true;
+    state.pollPending = false;
+    state.failures = 0;
+    state.backoffUntil = 0;
+}
+
+void AuxFanPollScheduler::auxFanLost(AuxFan *auxFan)
+{
+    if (!m_fanStates.contains(auxFan))
+        return;
+
+    FanState& state = m_fanStates[auxFan];
+    if (!state.pollPending)
+        return;     // Each poll consists of several transactions, but counts as one failure
+
+    state.pollPending = false;
+    state.failures++;
+    qint64 backoff = qMin(m_backoffStart << qMin(state.failures - 1, 16), m_backoffMax);
+    state.backoffUntil = m_clock.elapsed() + backoff;
+}
+
+void AuxFanPollScheduler::setLinePaused(int busID, bool paused)
+{
+    if (paused)
+        m_pausedLines.insert(busID);
+    else
+        m_pausedLines.remove(busID);
+}
+
+QList<int> AuxFanPollScheduler::getBusIDs() const
+{
+    return m_lineStates.keys();
+}
+
+AuxFanPollScheduler::LineStatistics AuxFanPollScheduler::getLineStatistics(int busID) const
+{
+    LineState line = m_lineStates.value(busID);
+    qint64 now = m_clock.elapsed();
+
+    LineStatistics statistics;
+    statistics.fans = 0;
+    statistics.backedOffFans = 0;
+    statistics.utilisation = qRound(line.utilisation * 100);
+    statistics.polls = line.polls;
+    statistics.overduePolls = line.overduePolls;
+    statistics.refreshes = line.refreshes;
+    statistics.avgRefreshAge = line.refreshes > 0 ? line.totalRefreshAge / (qint64)line.refreshes : 0;
+    statistics.maxRefreshAge = line.maxRefreshAge;
+    statistics.oldestAge = 0;
+
+    QHash<AuxFan*, FanState>::const_iterator it = m_fanStates.constBegin();
+    while (it != m_fanStates.constEnd())
+    {
+        if (it.key()->getBusID() == busID)
+        {
+            statistics.fans++;
+            if (now < it.value().backoffUntil)
+                statistics.backedOffFans++;
+            statistics.oldestAge = qMax(statistics.oldestAge, now - it.value().lastRefresh);
+        }
+        ++it;
+    }
+
+    return statistics;
+}
+
+void AuxFanPollScheduler::scheduleLine(int busID, const QList<AuxFan *> &auxFans, qint64 now)
+{
+    if (m_ebmModbusSystem->getSizeOfRequestQueue(busID) > 1)
+        return;     // The line has not caught up with the last poll yet
+
+    AuxFan* oldestAuxFan = nullptr;
+    qint64 oldestAge = -1;
+
+    foreach (AuxFan* auxFan, auxFans)
+    {
+        const FanState& state = m_fanStates[auxFan];
+        if (now < state.backoffUntil)
+            continue;
+        if ((state.lastPoll >= 0) && (now - state.lastPoll < m_minRefreshInterval))
+            continue;
+        if (state.pollPending && (now - state.lastPoll < m_maxRefreshAge))
+            continue;
+
+        qint64 age = now - state.lastRefresh;
+        if (age > oldestAge)
+        {
+            oldestAge = age;
+            oldestAuxFan = auxFan;
+        }
+    }
+
+    if (oldestAuxFan == nullptr)
+        return;
+
+    LineState& line = m_lineStates[busID];
+    if (line.utilisation < m_utilisationTarget)
+        poll(oldestAuxFan, now);
+    else if (oldestAge >= m_maxRefreshAge)
+    {
+        line.overduePolls++;
+        poll(oldestAuxFan, now);
+    }
+}
+
+void AuxFanPollScheduler::poll(AuxFan *auxFan, qint64 now)
+{
+    FanState& state = m_fanStates[auxFan];
+    state.lastPoll = now;
+    state.pollPending = true;
+
+    m_lineStates[auxFan->getBusID()].polls++;
+    auxFan->requestStatus();
+}
+
+void AuxFanPollScheduler::slot_timer_tick_fired()
+{
+    qint64 now = m_clock.elapsed();
+
+    QMap<int, QList<AuxFan*>> auxFansPerBus;
+    QHash<AuxFan*, FanState>::const_iterator it = m_fanStates.constBegin();
+    while (it != m_fanStates.constEnd())
+    {
+        if (it.key()->getBusID() >= 0)
+            auxFansPerBus[it.key()->getBusID()].append(it.key());
+        ++it;
+    }
+
+    QMap<int, QList<AuxFan*>>::const_iterator busIt = auxFansPerBus.constBegin();
+    while (busIt != auxFansPerBus.constEnd())
+    {
+        int busID = busIt.key();
+        EbmModbus* bus = m_ebmModbusSystem->getBusByID(busID);
+        if (bus == nullptr)
+        {
+            ++busIt;
+            continue;
+        }
+
+        if (!m_lineStates.contains(busID))
+        {
+            LineState line;
+            line.lastBusyTime = bus->getTimingStatistics().totalDuration;
+            line.lastTick = now;
+            line.utilisation = 0;
+            line.polls = 0;
+            line.overduePolls = 0;
+            line.refreshes = 0;
+            line.totalRefreshAge = 0;
+            line.maxRefreshAge = 0;
+            m_lineStates.insert(busID, line);
+        }
+
+        // Utilisation is the share of time the line spent in transactions, smoothed over roughly ten ticks
+        LineState& line = m_lineStates[busID];
+        qint64 busyTime = bus->getTimingStatistics().totalDuration;
+        if (now > line.lastTick)
+        {
+            double sample = qBound(0.0, (busyTime - line.lastBusyTime) / 1000.0 / (now - line.lastTick), 1.0);
+            line.utilisation = 0.9 * line.utilisation + 0.1 * sample;
+            line.lastBusyTime = busyTime;
+            line.lastTick = now;
+        }
+
+        if (!m_pausedLines.contains(busID))
+            scheduleLine(busID, busIt.value(), now);
+
+        ++busIt;
+    }
+}
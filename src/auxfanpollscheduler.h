@@ -0,0 +1,108 @@
+/**********************************************************************
+** ebmbus-cmd - a commandline tool to control ebm papst fans
+** Copyright (C) 2018 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+#ifndef AUXFANPOLLSCHEDULER_H
+#define AUXFANPOLLSCHEDULER_H
+
+#include <QObject>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QSet>
+#include <QMap>
+#include "ebmmodbussystem.h"
+#include "auxfan.h"
+
+// Decides which auxfan is polled next on each modbus line.
+// A line gets another poll as long as its measured utilisation (time the line is busy with transactions) is below
+// the target, so fast lines refresh their fans more often. The fan which has not been refreshed for the longest
+// time is polled first. A fan reaching maxRefreshAge is polled even if the line is above its target.
+// Fans not answering are backed off exponentially, so a dead fan does not eat the time of the others.
+
+class AuxFanPollScheduler : public QObject
+{
+    Q_OBJECT
+public:
+    explicit AuxFanPollScheduler(QObject *parent, EbmModbusSystem* ebmModbusSystem);
+
+    void addAuxFan(AuxFan* auxFan);
+    void removeAuxFan(AuxFan* auxFan);
+
+    // The fan sent its actual speed, or one of its poll transactions got lost
+    void auxFanAnswered(AuxFan* auxFan);
+    void auxFanLost(AuxFan* auxFan);
+
+    void setLinePaused(int busID, bool paused);    // E.g. while commissioning
+
+    typedef struct {
+        int fans;
+        int backedOffFans;
+        int utilisation;            // Unit percent, smoothed
+        quint64 polls;
+        quint64 overduePolls;       // Polls beyond the utilisation target because of maxRefreshAge
+        quint64 refreshes;
+        qint64 avgRefreshAge;       // Unit ms, time between two refreshes of a fan
+        qint64 maxRefreshAge;
+        qint64 oldestAge;           // Unit ms, current age of the fan refreshed longest ago
+    } LineStatistics;
+
+    QList<int> getBusIDs() const;
+    LineStatistics getLineStatistics(int busID) const;
+
+private:
+    typedef struct {
+        qint64 lastRefresh;     // Unit ms of m_clock, the time the fan was added until its first answer
+        bool refreshed;         // Answered at least once
+        qint64 lastPoll;        // -1 if never polled
+        bool pollPending;       // The outcome of the last poll is not known yet
+        int failures;           // Consecutive polls without answer
+        qint64 backoffUntil;
+    } FanState;
+
+    typedef struct {
+        qint64 lastBusyTime;        // Unit us, totalDuration of the line at the last tick
+        qint64 lastTick;            // Unit ms of m_clock
+        double utilisation;         // 0..1, smoothed
+        quint64 polls;
+        quint64 overduePolls;
+        quint64 refreshes;
+        qint64 totalRefreshAge;
+        qint64 maxRefreshAge;
+    } LineState;
+
+    EbmModbusSystem* m_ebmModbusSystem;
+    QTimer m_timer_tick;
+    QElapsedTimer m_clock;
+
+    double m_utilisationTarget;
+    qint64 m_maxRefreshAge;         // Unit ms
+    qint64 m_minRefreshInterval;    // Unit ms
+    qint64 m_backoffStart;          // Unit ms
+    qint64 m_backoffMax;            // Unit ms
+
+    QHash<AuxFan*, FanState> m_fanStates;
+    QMap<int, LineState> m_lineStates;
+    QSet<int> m_pausedLines;
+
+    void scheduleLine(int busID, const QList<AuxFan*>& auxFans, qint64 now);
+    void poll(AuxFan* auxFan, qint64 now);
+
+signals:
+
+private slots:
+    void slot_timer_tick_fired();
+};
+
+#endif // AUXFANPOLLSCHEDULER_H
@@ -0,0 +1,370 @@
+/**********************************************************************
+** ebmbus-cmd - a commandline tool to control ebm papst fans
+** Copyright (C) 2018 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+#include "devicejournal.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static void putLE16(uchar* dest, quint16 value)
+{
+    dest[0] = value & 0xff;
+    dest[1] = (value >> 8) & 0xff;
+}
+
+static void putLE32(uchar* dest, quint32 value)
+{
+    dest[0] = value & 0xff;
+    dest[1] = (value >> 8) & 0xff;
+    dest[2] = (value >> 16) & 0xff;
+    dest[3] = (value >> 24) & 0xff;
+}
+
+static quint16 getLE16(const uchar* src)
+{
+    return (quint16)(src[0] | (src[1] << 8));
+}
+
+static quint32 getLE32(const uchar* src)
+{
+    return (quint32)src[0] | ((quint32)src[1] << 8) | ((quint32)src[2] << 16) | ((quint32)src[3] << 24);
+}
+
+DeviceJournal::DeviceJournal()
+{
+    m_fd = -1;
+    m_size = 0;
+    m_liveSize = FileHeaderSize;
+}
+
+DeviceJournal::~DeviceJournal()
+{
+    close();
+}
+
+bool DeviceJournal::open(QString filename)
+{
+    close();
+
+    m_filename = filename;
+    QDir().mkpath(QFileInfo(m_filename).absolutePath());
+
+    if (!load())
+        return false;
+
+    m_fd = ::open(m_filename.toLocal8Bit().data(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (m_fd < 0)
+    {
+        fprintf(stderr, "DeviceJournal::open(): Unable to open %s for writing: %s\n", m_filename.toLocal8Bit().data(), strerror(errno));
+        return false;
+    }
+
+    if (m_size == 0)
+    {
+        QByteArray header = fileHeader();
+        if (!writeAll(m_fd, header))
+        {
+            close();
+            return false;
+        }
+        m_size = header.size();
+    }
+
+    if (needsCompaction())
+        compact(true);
+
+    return true;
+}
+
+void DeviceJournal::close()
+{
+    if (m_fd >= 0)
+        ::close(m_fd);
+    m_fd = -1;
+}
+
+const QHash<QString, QByteArray> &DeviceJournal::records() const
+{
+    return m_records;
+}
+
+qint64 DeviceJournal::append(const QMap<QString, QByteArray> &writes, const QStringList &removals, bool sync)
+{
+    if (m_fd < 0)
+        return -1;
+
+    QByteArray buffer;
+
+    foreach (QString key, removals)
+    {
+        if (m_records.contains(key))
+            appendRecord(&buffer, OpRemove, key.toUtf8(), QByteArray());
+    }
+
+    QMap<QString, QByteArray>::const_iterator it = writes.constBegin();
+    while (it != writes.constEnd())
+    {
+        appendRecord(&buffer, OpPut, it.key().toUtf8(), it.value());
+        ++it;
+    }
+
+    if (buffer.isEmpty())
+        return 0;
+
+    if (!writeAll(m_fd, buffer) || (sync && (fdatasync(m_fd) != 0)))
+    {
+        // Cut off what has been written partly, otherwise all following records would be lost at the next startup
+        if (ftruncate(m_fd, m_size) != 0)
+            fprintf(stderr, "DeviceJournal::append(): Unable to truncate %s: %s\n", m_filename.toLocal8Bit().data(), strerror(errno));
+        return -1;
+    }
+
+    m_size += buffer.size();
+
+    foreach (QString key, removals)
+    {
+        if (m_records.contains(key))
+        {
+            m_liveSize -= recordSize(key, m_records.value(key));
+            m_records.remove(key);
+        }
+    }
+
+    it = writes.constBegin();
+    while (it != writes.constEnd())
+    {
+        if (m_records.contains(it.key()))
+            m_liveSize -= recordSize(it.key(), m_records.value(it.key()));
+        m_liveSize += recordSize(it.key(), it.value());
+        m_records.insert(it.key(), it.value());
+        ++it;
+    }
+
+    return buffer.size();
+}
+
+bool DeviceJournal::needsCompaction() const
+{
+    return (m_size > CompactionMinSize) && (m_size > 2 * m_liveSize);
+}
+
+bool DeviceJournal::compact(bool sync)
+{
+    QString tempFilename = m_filename + ".tmp";
+
+    // Sorted by key, so the compacted journal is in id order
+    QMap<QString, QByteArray> sortedRecords;
+    QHash<QString, QByteArray>::const_iterator it = m_records.constBegin();
+    while (it != m_records.constEnd())
+    {
+        sortedRecords.insert(it.key(), it.value());
+        ++it;
+    }
+
+    QByteArray buffer = fileHeader();
+    QMap<QString, QByteArray>::const_iterator sortedIt = sortedRecords.constBegin();
+    while (sortedIt != sortedRecords.constEnd())
+    {
+        appendRecord(&buffer, OpPut, sortedIt.key().toUtf8(), sortedIt.value());
+        ++sortedIt;
+    }
+
+    int fd = ::open(tempFilename.toLocal8Bit().data(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+
+    bool ok = writeAll(fd, buffer);
+    if (ok && sync)
+        ok = (fsync(fd) == 0);
+    ::close(fd);
+
+    if (ok)
+        ok = (::rename(tempFilename.toLocal8Bit().data(), m_filename.toLocal8Bit().data()) == 0);
+
+    if (!ok)
+    {
+        fprintf(stderr, "DeviceJournal::compact(): Unable to compact %s: %s\n", m_filename.toLocal8Bit().data(), strerror(errno));
+        QFile::remove(tempFilename);
+        return false;
+    }
+
+    if (sync)
+        syncDirectory();
+
+    // The old file descriptor still points to the replaced file
+    close();
+    m_fd = ::open(m_filename.toLocal8Bit().data(), O_WRONLY | O_APPEND, 0644);
+    m_size = buffer.size();
+    m_liveSize = buffer.size();
+
+    return (m_fd >= 0);
+}
+
+qint64 DeviceJournal::size() const
+{
+    return m_size;
+}
+
+bool DeviceJournal::load()
+{
+    m_records.clear();
+    m_size = 0;
+    m_liveSize = FileHeaderSize;
+
+    QFile file(m_filename);
+    if (!file.exists())
+        return true;
+
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        fprintf(stderr, "DeviceJournal::load(): Unable to open %s.\n", m_filename.toLocal8Bit().data());
+        return false;
+    }
+
+    qint64 fileSize = file.size();
+    if (fileSize < FileHeaderSize)
+        return (::truncate(m_filename.toLocal8Bit().data(), 0) == 0);     // Torn header, the journal is started again
+
+    QByteArray readData;
+    uchar* mappedData = file.map(0, fileSize);
+    const uchar* data = mappedData;
+    if (data == nullptr)
+    {
+        readData = file.readAll();
+        data = (const uchar*)readData.constData();
+    }
+
+    if ((memcmp(data, "OFCJ", 4) != 0) || (getLE32(data + 4) != Version))
+    {
+        fprintf(stderr, "DeviceJournal::load(): %s is no device journal of version %u.\n", m_filename.toLocal8Bit().data(), Version);
+        if (mappedData != nullptr)
+            file.unmap(mappedData);
+        return false;
+    }
+
+    qint64 offset = FileHeaderSize;
+    while (offset + RecordHeaderSize <= fileSize)
+    {
+        const uchar* record = data + offset;
+        quint8 op = record[0];
+        quint16 keyLength = getLE16(record + 2);
+        quint32 valueLength = getLE32(record + 4);
+        quint16 checksum = getLE16(record + 8);
+
+        qint64 end = offset + RecordHeaderSize + keyLength + valueLength;
+        if (end > fileSize)
+            break;
+        if (qChecksum((const char*)record + RecordHeaderSize, keyLength + valueLength) != checksum)
+            break;
+
+        QString key = QString::fromUtf8((const char*)record + RecordHeaderSize, keyLength);
+        if (op == OpPut)
+            m_records.insert(key, QByteArray((const char*)record + RecordHeaderSize + keyLength, valueLength));
+        else if (op == OpRemove)
+            m_records.remove(key);
+        else
+            break;
+
+        offset = end;
+    }
+
+    if (mappedData != nullptr)
+        file.unmap(mappedData);
+    file.close();
+
+    if (offset < fileSize)
+    {
+        fprintf(stderr, "DeviceJournal::load(): Cutting off %lli bytes of a torn record at the end of %s.\n", fileSize - offset, m_filename.toLocal8Bit().data());
+        if (::truncate(m_filename.toLocal8Bit().data(), offset) != 0)
+            return false;
+    }
+
+    m_size = offset;
+    QHash<QString, QByteArray>::const_iterator it = m_records.constBegin();
+    while (it != m_records.constEnd())
+    {
+        m_liveSize += recordSize(it.key(), it.value());
+        ++it;
+    }
+
+    return true;
+}
+
+QByteArray DeviceJournal::fileHeader()
+{
+    QByteArray header(FileHeaderSize, 0);
+    memcpy(header.data(), "OFCJ", 4);
+    putLE32((uchar*)header.data() + 4, Version);
+    return header;
+}
+
+void DeviceJournal::appendRecord(QByteArray *buffer, DeviceJournal::Op op, const QByteArray &key, const QByteArray &value)
+{
+    QByteArray payload = key + value;
+
+    uchar header[RecordHeaderSize];
+    header[0] = op;
+    header[1] = 0;
+    putLE16(header + 2, key.size());
+    putLE32(header + 4, value.size());
+    putLE16(header + 8, qChecksum(payload.constData(), payload.size()));
+    putLE16(header + 10, 0);
+
+    buffer->append((const char*)header, RecordHeaderSize);
+    buffer->append(payload);
+}
+
+qint64 DeviceJournal::recordSize(const QString &key, const QByteArray &value)
+{
+    return RecordHeaderSize + key.toUtf8().size() + value.size();
+}
+
+bool DeviceJournal::writeAll(int fd, const QByteArray &data)
+{
+    const char* p = data.constData();
+    qint64 remaining = data.size();
+
+    while (remaining > 0)
+    {
+        ssize_t written = ::write(fd, p, remaining);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "DeviceJournal::writeAll(): Unable to write %s: %s\n", m_filename.toLocal8Bit().data(), strerror(errno));
+            return false;
+        }
+        p += written;
+        remaining -= written;
+    }
+
+    return true;
+}
+
+// A rename is only durable after the directory itself has been synced
+void DeviceJournal::syncDirectory()
+{
+    int fd = ::open(QFileInfo(m_filename).absolutePath().toLocal8Bit().data(), O_RDONLY);
+    if (fd < 0)
+        return;
+    fsync(fd);
+    ::close(fd);
+}
@@ -0,0 +1,78 @@
+/**********************************************************************
+** ebmbus-cmd - a commandline tool to control ebm papst fans
+** Copyright (C) 2018 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+#ifndef DEVICEJOURNAL_H
+#define DEVICEJOURNAL_H
+
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QHash>
+#include <QMap>
+
+// All device records (ffus and auxfans) live in one append-only journal file. Each write cycle appends
+// its changed and removed records with a single write. When most of the file consists of outdated
+// records, it is compacted by writing the live records to a new file which replaces the journal.
+//
+// File layout (little endian):
+//   header: "OFCJ", quint32 version
+//   record: quint8 op, quint8 reserved, quint16 keyLength, quint32 valueLength, quint16 checksum, quint16 reserved, key, value
+// The checksum (CRC-16) covers key and value. A torn record at the end, e.g. after a power loss, is cut off at startup.
+
+class DeviceJournal
+{
+public:
+    DeviceJournal();
+    ~DeviceJournal();
+
+    bool open(QString filename);    // Loads all records and opens the journal for appending
+    void close();
+
+    const QHash<QString, QByteArray>& records() const;
+
+    // Appends all writes and removals with one write. Returns the number of bytes written or -1 on errors.
+    qint64 append(const QMap<QString, QByteArray>& writes, const QStringList& removals, bool sync);
+
+    bool needsCompaction() const;
+    bool compact(bool sync);
+
+    qint64 size() const;
+
+private:
+    typedef enum {
+        OpPut = 1,
+        OpRemove = 2
+    } Op;
+
+    static const quint32 Version = 1;
+    static const int FileHeaderSize = 8;
+    static const int RecordHeaderSize = 12;
+    static const qint64 CompactionMinSize = 65536;
+
+    QString m_filename;
+    int m_fd;
+    qint64 m_size;
+    qint64 m_liveSize;      // Bytes the live records would take in a compacted journal
+    QHash<QString, QByteArray> m_records;
+
+    bool load();
+    static QByteArray fileHeader();
+    static void appendRecord(QByteArray* buffer, Op op, const QByteArray& key, const QByteArray& value);
+    static qint64 recordSize(const QString& key, const QByteArray& value);
+    bool writeAll(int fd, const QByteArray& data);
+    void syncDirectory();
+};
+
+#endif // DEVICEJOURNAL_H
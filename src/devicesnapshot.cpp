@@ -0,0 +1,276 @@
+/**********************************************************************
+** ebmbus-cmd - a commandline tool to control ebm papst fans
+** Copyright (C) 2018 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+
+#include "devicesnapshot.h"
+
+#include <QSettings>
+#include <QMutexLocker>
+#include <algorithm>
+
+const DeviceSnapshot::Device *DeviceSnapshot::findDevice(int id, bool *isFFU) const
+{
+    QMap<int, Device>::const_iterator it = ffus.constFind(id);
+    if (it != ffus.constEnd())
+    {
+        if (isFFU != nullptr)
+            *isFFU = true;
+        return &it.value();
+    }
+
+    it = auxFans.constFind(id);
+    if (it != auxFans.constEnd())
+    {
+        if (isFFU != nullptr)
+            *isFFU = false;
+        return &it.value();
+    }
+
+    return nullptr;
+}
+
+QByteArray DeviceSnapshot::formatActualLine(int id, const QMap<QString, QString> &actualData, const QMap<QString, QString> *previousData, const char *errorPrefix)
+{
+    QByteArray fields;
+
+    QMap<QString, QString>::const_iterator it = actualData.constBegin();
+    while (it != actualData.constEnd())
+    {
+        bool changed = (previousData == nullptr) || !previousData->contains(it.key()) || (previousData->value(it.key()) != it.value());
+        if (changed && !it.value().startsWith(errorPrefix))
+            fields.append(" " + it.key().toUtf8() + "=" + it.value().toUtf8());
+        ++it;
+    }
+
+    if (fields.isEmpty() && (previousData != nullptr))
+        return QByteArray();
+
+    return "ActualData from id=" + QByteArray().setNum(id) + fields + "\r\n";
+}
+
+DeviceSnapshotPublisher::DeviceSnapshotPublisher(QObject *parent, FFUdatabase *ffuDB, AuxFanDatabase *auxFanDB) : QObject(parent)
+{
+    qRegisterMetaType<DeviceSnapshotPtr>("DeviceSnapshotPtr");
+
+    m_ffuDB = ffuDB;
+    m_auxFanDB = auxFanDB;
+
+    QSettings settings("/etc/openffucontrol/ebmbus-cmd/ebmbus-cmd.ini", QSettings::IniFormat);
+    settings.beginGroup("remoteController");
+    int publishInterval = settings.value("snapshotPublishInterval", 50).toInt();
+    int fullRefreshInterval = settings.value("snapshotFullRefreshInterval", 5000).toInt();
+    settings.endGroup();
+
+    DeviceSnapshot* empty = new DeviceSnapshot;
+    empty->version = 0;
+    empty->layoutVersion = 0;
+    m_current = DeviceSnapshotPtr(empty);
+
+    connect(m_ffuDB, SIGNAL(signal_FFUactualDataHasChanged(int)), this, SLOT(slot_FFUactualDataHasChanged(int)));
+    connect(m_auxFanDB, &AuxFanDatabase::signal_AuxFanActualDataHasChanged, this, &DeviceSnapshotPublisher::slot_AuxFanActualDataHasChanged);
+
+    // Changes are collected for publishInterval ms, so a burst of bus responses ends up in one version
+    connect(&m_timer_publish, &QTimer::timeout, this, &DeviceSnapshotPublisher::slot_timer_publish_fired);
+    m_timer_publish.setSingleShot(true);
+    m_timer_publish.setInterval(publishInterval);
+
+    // Setpoints and other static data change without a signal, e.g. by the buttons of the controller
+    connect(&m_timer_fullRefresh, &QTimer::timeout, this, &DeviceSnapshotPublisher::slot_timer_fullRefresh_fired);
+    m_timer_fullRefresh.start(fullRefreshInterval);
+
+    publish(true);
+}
+
+DeviceSnapshotPtr DeviceSnapshotPublisher::current()
+{
+    QMutexLocker locker(&m_mutex);
+    return m_current;
+}
+
+void DeviceSnapshotPublisher::publish(bool fullRefresh)
+{
+    m_timer_publish.stop();
+
+    DeviceSnapshotPtr previous = current();     // Only the main thread publishes, so nobody else replaces it meanwhile
+    DeviceSnapshot* snapshot = new DeviceSnapshot;
+    snapshot->version = previous->version + 1;
+
+    // Looking up many single devices costs more than reading all of them
+    if (m_dirtyFFUs.count() + m_dirtyAuxFans.count() > (previous->ffus.count() + previous->auxFans.count()) / 2)
+        fullRefresh = true;
+
+    if (fullRefresh)
+    {
+        // Records of unchanged devices are taken over, so their preformatted lines stay valid
+        foreach (FFU* ffu, m_ffuDB->getFFUs())
+        {
+            DeviceSnapshot::Device device = readFFU(ffu);
+            QMap<int, DeviceSnapshot::Device>::const_iterator it = previous->ffus.constFind(device.id);
+            if ((it != previous->ffus.constEnd()) && (it.value().actualData == device.actualData) && (it.value().staticData == device.staticData))
+            {
+                snapshot->ffus.insert(device.id, it.value());
+                continue;
+            }
+            if ((it == previous->ffus.constEnd()) || (it.value().actualData != device.actualData))
+                snapshot->changedFFUs.append(device.id);
+            device.actualLine = DeviceSnapshot::formatActualLine(device.id, device.actualData, nullptr, "Error[FFU]:");
+            snapshot->ffus.insert(device.id, device);
+        }
+        foreach (AuxFan* auxFan, m_auxFanDB->getAuxFans())
+        {
+            DeviceSnapshot::Device device = readAuxFan(auxFan);
+            QMap<int, DeviceSnapshot::Device>::const_iterator it = previous->auxFans.constFind(device.id);
+            if ((it != previous->auxFans.constEnd()) && (it.value().actualData == device.actualData) && (it.value().staticData == device.staticData))
+            {
+                snapshot->auxFans.insert(device.id, it.value());
+                continue;
+            }
+            if ((it == previous->auxFans.constEnd()) || (it.value().actualData != device.actualData))
+                snapshot->changedAuxFans.append(device.id);
+            device.actualLine = DeviceSnapshot::formatActualLine(device.id, device.actualData, nullptr, "Error[AuxFan]:");
+            snapshot->auxFans.insert(device.id, device);
+        }
+    }
+    else
+    {
+        // Copy on write: records of unchanged devices are shared with the previous version
+        snapshot->ffus = previous->ffus;
+        snapshot->auxFans = previous->auxFans;
+
+        foreach (int id, m_dirtyFFUs)
+        {
+            FFU* ffu = m_ffuDB->getFFUbyID(id);
+            if (ffu == nullptr)
+            {
+                snapshot->ffus.remove(id);
+                continue;
+            }
+            DeviceSnapshot::Device device = readFFU(ffu);
+            device.actualLine = DeviceSnapshot::formatActualLine(id, device.actualData, nullptr, "Error[FFU]:");
+            snapshot->ffus.insert(id, device);
+            snapshot->changedFFUs.append(id);
+        }
+        foreach (int id, m_dirtyAuxFans)
+        {
+            AuxFan* auxFan = m_auxFanDB->getAuxFanByID(id);
+            if (auxFan == nullptr)
+            {
+                snapshot->auxFans.remove(id);
+                continue;
+            }
+            DeviceSnapshot::Device device = readAuxFan(auxFan);
+            device.actualLine = DeviceSnapshot::formatActualLine(id, device.actualData, nullptr, "Error[AuxFan]:");
+            snapshot->auxFans.insert(id, device);
+            snapshot->changedAuxFans.append(id);
+        }
+    }
+    std::sort(snapshot->changedFFUs.begin(), snapshot->changedFFUs.end());
+    std::sort(snapshot->changedAuxFans.begin(), snapshot->changedAuxFans.end());
+
+    snapshot->layoutVersion = previous->layoutVersion;
+    if (!sameLayout(snapshot->ffus, previous->ffus) || !sameLayout(snapshot->auxFans, previous->auxFans))
+        snapshot->layoutVersion++;
+
+    m_dirtyFFUs.clear();
+    m_dirtyAuxFans.clear();
+
+    DeviceSnapshotPtr published(snapshot);
+    m_mutex.lock();
+    m_current = published;
+    m_mutex.unlock();
+
+    emit signal_published(published);
+}
+
+void DeviceSnapshotPublisher::markFFUdirty(int id)
+{
+    m_dirtyFFUs.insert(id);
+}
+
+void DeviceSnapshotPublisher::markAuxFanDirty(int id)
+{
+    m_dirtyAuxFans.insert(id);
+}
+
+DeviceSnapshot::Device DeviceSnapshotPublisher::readFFU(FFU *ffu)
+{
+    DeviceSnapshot::Device device;
+    device.id = ffu->getId();
+    device.busID = ffu->getBusID();
+
+    foreach (QString key, QStringList() << "id" << "busID" << "unit" << "fanAddress" << "fanGroup" << "nSet" << "rawspeed")
+        device.staticData.insert(key, ffu->getData(key));
+    foreach (QString key, ffu->getActualKeys())
+        device.actualData.insert(key, ffu->getData(key));
+
+    return device;
+}
+
+DeviceSnapshot::Device DeviceSnapshotPublisher::readAuxFan(AuxFan *auxFan)
+{
+    DeviceSnapshot::Device device;
+    device.id = auxFan->getId();
+    device.busID = auxFan->getBusID();
+
+    foreach (QString key, QStringList() << "id" << "busID" << "fanAddress" << "nSet" << "rawspeed")
+        device.staticData.insert(key, auxFan->getData(key));
+    foreach (QString key, auxFan->getActualKeys())
+        device.actualData.insert(key, auxFan->getData(key));
+
+    return device;
+}
+
+bool DeviceSnapshotPublisher::sameLayout(const QMap<int, DeviceSnapshot::Device> &devices, const QMap<int, DeviceSnapshot::Device> &previousDevices)
+{
+    if (devices.count() != previousDevices.count())
+        return false;
+
+    // Both are sorted by id
+    QMap<int, DeviceSnapshot::Device>::const_iterator it = devices.constBegin();
+    QMap<int, DeviceSnapshot::Device>::const_iterator previousIt = previousDevices.constBegin();
+    while (it != devices.constEnd())
+    {
+        if ((it.key() != previousIt.key()) || (it.value().busID != previousIt.value().busID))
+            return false;
+        ++it;
+        ++previousIt;
+    }
+
+    return true;
+}
+
+void DeviceSnapshotPublisher::slot_FFUactualDataHasChanged(int id)
+{
+    m_dirtyFFUs.insert(id);
+    if (!m_timer_publish.isActive())
+        m_timer_publish.start();
+}
+
+void DeviceSnapshotPublisher::slot_AuxFanActualDataHasChanged(int id)
+{
+    m_dirtyAuxFans.insert(id);
+    if (!m_timer_publish.isActive())
+        m_timer_publish.start();
+}
+
+void DeviceSnapshotPublisher::slot_timer_publish_fired()
+{
+    publish(false);
+}
+
+void DeviceSnapshotPublisher::slot_timer_fullRefresh_fired()
+{
+    publish(true);
+}
@@ -0,0 +1,106 @@
+/**********************************************************************
+** ebmbus-cmd - a commandline tool to control ebm papst fans
+** Copyright (C) 2018 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+
+#ifndef DEVICESNAPSHOT_H
+#define DEVICESNAPSHOT_H
+
+#include <QObject>
+#include <QMap>
+#include <QList>
+#include <QString>
+#include <QTimer>
+#include <QMutex>
+#include <QSet>
+#include <QSharedPointer>
+#include "ffudatabase.h"
+#include "auxfandatabase.h"
+
+// Remote clients are served by the network thread, which must not touch FFUs and auxfans of the main thread.
+// Instead it reads immutable snapshots of all devices. DeviceSnapshotPublisher builds a new version from the
+// previous one, replacing only records of changed devices, and swaps it in. Readers keep the version they hold
+// as long as they need it, so a snapshot is never modified once published.
+
+class DeviceSnapshot
+{
+public:
+    typedef struct {
+        int id;
+        int busID;
+        QMap<QString, QString> staticData;  // Keys like id, busID, unit, fanAddress, nSet
+        QMap<QString, QString> actualData;  // Keys of getActualKeys()
+        QByteArray actualLine;              // Live mode line with all actual fields, formatted once per change
+    } Device;
+
+    quint64 version;
+    quint64 layoutVersion;      // Changes when devices are added, removed or moved to another bus
+    QMap<int, Device> ffus;     // By id
+    QMap<int, Device> auxFans;
+    QList<int> changedFFUs;     // Ids of devices with actual data changed since the previous version
+    QList<int> changedAuxFans;
+
+    const Device* findDevice(int id, bool* isFFU = nullptr) const;
+
+    // Live mode line "ActualData from id=...". With previousData, only fields which differ from it are included
+    // and an empty array is returned if there are none. Fields starting with errorPrefix are left out.
+    static QByteArray formatActualLine(int id, const QMap<QString, QString>& actualData, const QMap<QString, QString>* previousData, const char* errorPrefix);
+};
+
+typedef QSharedPointer<const DeviceSnapshot> DeviceSnapshotPtr;
+
+Q_DECLARE_METATYPE(DeviceSnapshotPtr)
+
+class DeviceSnapshotPublisher : public QObject
+{
+    Q_OBJECT
+public:
+    explicit DeviceSnapshotPublisher(QObject *parent, FFUdatabase* ffuDB, AuxFanDatabase* auxFanDB);
+
+    DeviceSnapshotPtr current();    // Thread safe
+
+    // Main thread. With fullRefresh all devices are read again, e.g. after devices have been added or removed.
+    void publish(bool fullRefresh);
+
+    // Main thread. The device is read again with the next publish, e.g. after a client has changed its setpoint.
+    void markFFUdirty(int id);
+    void markAuxFanDirty(int id);
+
+private:
+    FFUdatabase* m_ffuDB;
+    AuxFanDatabase* m_auxFanDB;
+
+    QMutex m_mutex;     // Protects the pointer only, never held while a snapshot is read or built
+    DeviceSnapshotPtr m_current;
+
+    QSet<int> m_dirtyFFUs;
+    QSet<int> m_dirtyAuxFans;
+    QTimer m_timer_publish;
+    QTimer m_timer_fullRefresh;
+
+    static DeviceSnapshot::Device readFFU(FFU* ffu);
+    static DeviceSnapshot::Device readAuxFan(AuxFan* auxFan);
+    static bool sameLayout(const QMap<int, DeviceSnapshot::Device>& devices, const QMap<int, DeviceSnapshot::Device>& previousDevices);
+
+signals:
+    void signal_published(DeviceSnapshotPtr snapshot);
+
+private slots:
+    void slot_FFUactualDataHasChanged(int id);
+    void slot_AuxFanActualDataHasChanged(int id);
+    void slot_timer_publish_fired();
+    void slot_timer_fullRefresh_fired();
+};
+
+#endif // DEVICESNAPSHOT_H
@@ -61,7 +61,21 @@ SOURCES += main.cpp \
     ebmmodbussystem.cpp \
     ebmmodbus.cpp \
     auxfandatabase.cpp \
-    auxfan.cpp
+    auxfan.cpp \
+    transactionregistry.cpp \
+    ffupollscheduler.cpp \
+    ffupollingplan.cpp \
+    persistence.cpp \
+    devicejournal.cpp \
+    auxfancommissioning.cpp \
+    auxfanpollscheduler.cpp \
+    ebmbuslinktuner.cpp \
+    serialinterfacetuning.cpp \
+    ebmbusline.cpp \
+    devicesnapshot.cpp \
+    remotecommandexecutor.cpp \
+    remoteserver.cpp \
+    livesubscription.cpp
 
 LIBS     += -lebmbus
 LIBS     += -lmodbus
@@ -83,7 +97,23 @@ HEADERS += \
     ebmmodbussystem.h \
     ebmmodbus.h \
     auxfandatabase.h \
-    auxfan.h
+    auxfan.h \
+    transactionregistry.h \
+    ffupollscheduler.h \
+    ffupollingplan.h \
+    persistence.h \
+    devicejournal.h \
+    auxfancommissioning.h \
+    auxfanpollscheduler.h \
+    ebmbuslinktuner.h \
+    serialinterfacetuning.h \
+    ebmbusline.h \
+    spscqueue.h \
+    indexedlist.h \
+    devicesnapshot.h \
+    remotecommandexecutor.h \
+    remoteserver.h \
+    livesubscription.h
 
 DISTFILES += \
     ../etc/ebmbus-cmd.ini.example \
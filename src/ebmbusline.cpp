@@ -0,0 +1,448 @@
+/**********************************************************************
+** ebmbus-cmd - a commandline tool to control ebm papst fans
+** Copyright (C) 2018 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+#include "ebmbusline.h"
+
+std::atomic<quint64> EbmBusLine::s_lastTelegramID(0);
+
+EbmBusLineWorker::EbmBusLineWorker(EbmBusLine *line, QString interfaceStartOfLoop, QString interfaceEndOfLoop) : QObject(nullptr),
+    m_timer_expiry(this)    // Child of the worker, so it moves to the bus thread as well
+{
+    m_line = line;
+    m_clock.start();
+    m_ebmBus = new EbmBus(this, interfaceStartOfLoop, interfaceEndOfLoop);     // Moves to the bus thread together with the worker
+
+    connect(m_ebmBus, SIGNAL(signal_actualSpeed(quint64,quint8,quint8,quint8)), this, SLOT(slot_actualSpeed(quint64,quint8,quint8,quint8)));
+    connect(m_ebmBus, SIGNAL(signal_EEPROMdata(quint64,quint8,quint8,EbmBusEEPROM::EEPROMaddress,quint8)), this, SLOT(slot_EEPROMdata(quint64,quint8,quint8,EbmBusEEPROM::EEPROMaddress,quint8)));
+    connect(m_ebmBus, SIGNAL(signal_EEPROMhasBeenWritten(quint64,quint8,quint8)), this, SLOT(slot_EEPROMhasBeenWritten(quint64,quint8,quint8)));
+    connect(m_ebmBus, SIGNAL(signal_setPointHasBeenSet(quint64,quint8,quint8)), this, SLOT(slot_setPointHasBeenSet(quint64,quint8,quint8)));
+    connect(m_ebmBus, SIGNAL(signal_simpleStatus(quint64,quint8,quint8,QString)), this, SLOT(slot_simpleStatus(quint64,quint8,quint8,QString)));
+    connect(m_ebmBus, SIGNAL(signal_status(quint64,quint8,quint8,quint8,QString,quint8)), this, SLOT(slot_status(quint64,quint8,quint8,quint8,QString,quint8)));
+    connect(m_ebmBus, SIGNAL(signal_responseRaw(quint64,quint8,quint8,quint8,QByteArray)), this, SLOT(slot_responseRaw(quint64,quint8,quint8,quint8,QByteArray)));
+    connect(m_ebmBus, SIGNAL(signal_transactionFinished()), this, SLOT(slot_transactionFinished()));
+    connect(m_ebmBus, SIGNAL(signal_transactionLost(quint64)), this, SLOT(slot_transactionLost(quint64)));
+    connect(m_ebmBus, SIGNAL(signal_DaisyChainAdressingFinished()), this, SLOT(slot_DaisyChainAdressingFinished()));
+    connect(m_ebmBus, SIGNAL(signal_DaisyChainAddressingGotSerialNumber(quint8,quint8,quint8,quint32)), this, SLOT(slot_DaisyChainAddressingGotSerialNumber(quint8,quint8,quint8,quint32)));
+
+    connect(&m_timer_expiry, SIGNAL(timeout()), this, SLOT(slot_timer_expiry_fired()));
+    m_timer_expiry.setInterval(ExpiryTime / 4);
+}
+
+EbmBus *EbmBusLineWorker::ebmBus()
+{
+    return m_ebmBus;
+}
+
+quint64 EbmBusLineWorker::lineTelegramID(quint64 telegramID)
+{
+    m_answeredTelegramIDs.append(telegramID);
+    return m_telegramIDs.value(telegramID).lineTelegramID;     // 0 for telegrams nobody asked for, e.g. during dci addressing
+}
+
+void EbmBusLineWorker::retireTelegramIDs()
+{
+    foreach (quint64 telegramID, m_retiringTelegramIDs)
+        m_telegramIDs.remove(telegramID);
+    m_retiringTelegramIDs = m_answeredTelegramIDs;
+    m_answeredTelegramIDs.clear();
+}
+
+void EbmBusLineWorker::publishQueueSizes()
+{
+    m_line->m_publishedQueueSize[0].store(m_ebmBus->getSizeOfTelegramQueue(false));
+    m_line->m_publishedQueueSize[1].store(m_ebmBus->getSizeOfTelegramQueue(true));
+}
+
+bool EbmBusLineWorker::slot_open()
+{
+    m_timer_expiry.start();     // Timers have to be started in the thread they run in
+    return m_ebmBus->open();
+}
+
+void EbmBusLineWorker::slot_processCommands()
+{
+    // Cleared first, so a command pushed while this runs schedules the next call
+    m_line->m_commandsScheduled.store(false);
+
+    EbmBusLine::Command command;
+    while (m_line->m_commands.pop(&command))
+    {
+        quint64 telegramID = command.request(m_ebmBus);
+        if ((command.telegramID != 0) && (telegramID != 0))
+        {
+            LineTelegram lineTelegram;
+            lineTelegram.lineTelegramID = command.telegramID;
+            lineTelegram.submitTime = m_clock.elapsed();
+            m_telegramIDs.insert(telegramID, lineTelegram);
+        }
+        m_line->m_commandsInFlight[command.highPriority ? 1 : 0]--;
+    }
+
+    publishQueueSizes();
+}
+
+// Drop all mappings which neither got a response nor a transactionLost signal in time
+void EbmBusLineWorker::slot_timer_expiry_fired()
+{
+    qint64 now = m_clock.elapsed();
+
+    QHash<quint64, LineTelegram>::iterator it = m_telegramIDs.begin();
+    while (it != m_telegramIDs.end())
+    {
+        if ((now - it.value().submitTime) > ExpiryTime)
+            it = m_telegramIDs.erase(it);
+        else
+            ++it;
+    }
+}
+
+void EbmBusLineWorker::slot_actualSpeed(quint64 telegramID, quint8 fanAddress, quint8 fanGroup, quint8 actualRawSpeed)
+{
+    EbmBusLine::Telemetry telemetry;
+    telemetry.type = EbmBusLine::TelemetryActualSpeed;
+    telemetry.telegramID = lineTelegramID(telegramID);
+    telemetry.fanAddress = fanAddress;
+    telemetry.fanGroup = fanGroup;
+    telemetry.value = actualRawSpeed;
+    m_line->pushTelemetry(telemetry);
+}
+
+void EbmBusLineWorker::slot_EEPROMdata(quint64 telegramID, quint8 fanAddress, quint8 fanGroup, EbmBusEEPROM::EEPROMaddress eepromAddress, quint8 dataByte)
+{
+    EbmBusLine::Telemetry telemetry;
+    telemetry.type = EbmBusLine::TelemetryEEPROMdata;
+    telemetry.telegramID = lineTelegramID(telegramID);
+    telemetry.fanAddress = fanAddress;
+    telemetry.fanGroup = fanGroup;
+    telemetry.eepromAddress = eepromAddress;
+    telemetry.value = dataByte;
+    m_line->pushTelemetry(telemetry);
+}
+
+void EbmBusLineWorker::slot_EEPROMhasBeenWritten(quint64 telegramID, quint8 fanAddress, quint8 fanGroup)
+{
+    EbmBusLine::Telemetry telemetry;
+    telemetry.type = EbmBusLine::TelemetryEEPROMhasBeenWritten;
+    telemetry.telegramID = lineTelegramID(telegramID);
+    telemetry.fanAddress = fanAddress;
+    telemetry.fanGroup = fanGroup;
+    m_line->pushTelemetry(telemetry);
+}
+
+void EbmBusLineWorker::slot_setPointHasBeenSet(quint64 telegramID, quint8 fanAddress, quint8 fanGroup)
+{
+    EbmBusLine::Telemetry telemetry;
+    telemetry.type = EbmBusLine::TelemetrySetPointHasBeenSet;
+    telemetry.telegramID = lineTelegramID(telegramID);
+    telemetry.fanAddress = fanAddress;
+    telemetry.fanGroup = fanGroup;
+    m_line->pushTelemetry(telemetry);
+}
+
+void EbmBusLineWorker::slot_simpleStatus(quint64 telegramID, quint8 fanAddress, quint8 fanGroup, QString status)
+{
+    EbmBusLine::Telemetry telemetry;
+    telemetry.type = EbmBusLine::TelemetrySimpleStatus;
+    telemetry.telegramID = lineTelegramID(telegramID);
+    telemetry.fanAddress = fanAddress;
+    telemetry.fanGroup = fanGroup;
+    telemetry.status = status;
+    m_line->pushTelemetry(telemetry);
+}
+
+void EbmBusLineWorker::slot_status(quint64 telegramID, quint8 fanAddress, quint8 fanGroup, quint8 statusAddress, QString status, quint8 rawValue)
+{
+    EbmBusLine::Telemetry telemetry;
+    telemetry.type = EbmBusLine::TelemetryStatus;
+    telemetry.telegramID = lineTelegramID(telegramID);
+    telemetry.fanAddress = fanAddress;
+    telemetry.fanGroup = fanGroup;
+    telemetry.value = statusAddress;
+    telemetry.status = status;
+    telemetry.rawValue = rawValue;
+    m_line->pushTelemetry(telemetry);
+}
+
+void EbmBusLineWorker::slot_responseRaw(quint64 telegramID, quint8 preamble, quint8 commandAndFanaddress, quint8 fanGroup, QByteArray data)
+{
+    EbmBusLine::Telemetry telemetry;
+    telemetry.type = EbmBusLine::TelemetryResponseRaw;
+    telemetry.telegramID = lineTelegramID(telegramID);
+    telemetry.value = preamble;
+    telemetry.rawValue = commandAndFanaddress;
+    telemetry.fanGroup = fanGroup;
+    telemetry.data = data;
+    m_line->pushTelemetry(telemetry);
+}
+
+bool EbmBusLineWorker::lineBusy() const
+{
+    return (m_ebmBus->getSizeOfTelegramQueue(false) + m_ebmBus->getSizeOfTelegramQueue(true)
+            + m_line->m_commandsInFlight[0].load() + m_line->m_commandsInFlight[1].load()) > 0;
+}
+
+void EbmBusLineWorker::slot_transactionFinished()
+{
+    retireTelegramIDs();
+    publishQueueSizes();
+
+    EbmBusLine::Telemetry telemetry;
+    telemetry.type = EbmBusLine::TelemetryTransactionFinished;
+    telemetry.telegramID = 0;
+    telemetry.timestamp = m_line->clockElapsed();
+    telemetry.lineBusy = lineBusy();
+    m_line->pushTelemetry(telemetry);
+}
+
+void EbmBusLineWorker::slot_transactionLost(quint64 telegramID)
+{
+    EbmBusLine::Telemetry telemetry;
+    telemetry.type = EbmBusLine::TelemetryTransactionLost;
+    telemetry.telegramID = m_telegramIDs.take(telegramID).lineTelegramID;
+    telemetry.timestamp = m_line->clockElapsed();
+    telemetry.lineBusy = lineBusy();
+    m_line->pushTelemetry(telemetry);
+
+    retireTelegramIDs();
+    publishQueueSizes();
+}
+
+void EbmBusLineWorker::slot_DaisyChainAdressingFinished()
+{
+    EbmBusLine::Telemetry telemetry;
+    telemetry.type = EbmBusLine::TelemetryDaisyChainAdressingFinished;
+    telemetry.telegramID = 0;
+    m_line->pushTelemetry(telemetry);
+}
+
+void EbmBusLineWorker::slot_DaisyChainAddressingGotSerialNumber(quint8 unit, quint8 fanAddress, quint8 fanGroup, quint32 serialNumber)
+{
+    EbmBusLine::Telemetry telemetry;
+    telemetry.type = EbmBusLine::TelemetryDaisyChainAddressingGotSerialNumber;
+    telemetry.telegramID = 0;
+    telemetry.value = unit;
+    telemetry.fanAddress = fanAddress;
+    telemetry.fanGroup = fanGroup;
+    telemetry.serialNumber = serialNumber;
+    m_line->pushTelemetry(telemetry);
+}
+
+EbmBusLine::EbmBusLine(QObject *parent, QString interfaceStartOfLoop, QString interfaceEndOfLoop) : QObject(parent),
+    m_commands(QueueCapacity),
+    m_telemetry(QueueCapacity)
+{
+    m_commandsScheduled.store(false);
+    m_telemetryScheduled.store(false);
+    m_commandsInFlight[0].store(0);
+    m_commandsInFlight[1].store(0);
+    m_publishedQueueSize[0].store(0);
+    m_publishedQueueSize[1].store(0);
+    m_queueOverflows.store(0);
+    m_clock.start();
+
+    m_worker = new EbmBusLineWorker(this, interfaceStartOfLoop, interfaceEndOfLoop);   // parent must be 0 in order to be moved to the bus thread
+    m_worker->moveToThread(&m_thread);
+    connect(&m_thread, &QThread::finished, m_worker, &QObject::deleteLater);
+    m_thread.start(QThread::HighPriority);
+}
+
+EbmBusLine::~EbmBusLine()
+{
+    m_thread.quit();
+    m_thread.wait();
+}
+
+bool EbmBusLine::open()
+{
+    // The serial port has to be opened in the thread it is used in
+    bool ok = false;
+    QMetaObject::invokeMethod(m_worker, "slot_open", Qt::BlockingQueuedConnection, Q_RETURN_ARG(bool, ok));
+    return ok;
+}
+
+void EbmBusLine::connectDaisyChainInterface(DaisyChainInterface *dci)
+{
+    // The dci io stays in the main thread, both directions are queued connections
+    connect(m_worker->ebmBus(), SIGNAL(signal_setDCIoutput(bool)), dci, SLOT(slot_setDCIoutput(bool)));
+    connect(dci, SIGNAL(signal_DCIloopResponse(bool)), m_worker->ebmBus(), SLOT(slot_DCIloopResponse(bool)));
+}
+
+quint64 EbmBusLine::getActualSpeed(quint8 fanAddress, quint8 fanGroup, bool highPriority)
+{
+    return submit(highPriority, [=](EbmBus* ebmBus) { return ebmBus->getActualSpeed(fanAddress, fanGroup, highPriority); });
+}
+
+quint64 EbmBusLine::setSpeedSetpoint(quint8 fanAddress, quint8 fanGroup, quint8 speed)
+{
+    return submit(false, [=](EbmBus* ebmBus) { return ebmBus->setSpeedSetpoint(fanAddress, fanGroup, speed); });
+}
+
+quint64 EbmBusLine::readEEPROM(quint8 fanAddress, quint8 fanGroup, EbmBusEEPROM::EEPROMaddress eepromAddress)
+{
+    return submit(false, [=](EbmBus* ebmBus) { return ebmBus->readEEPROM(fanAddress, fanGroup, eepromAddress); });
+}
+
+quint64 EbmBusLine::writeEEPROM(quint8 fanAddress, quint8 fanGroup, EbmBusEEPROM::EEPROMaddress eepromAddress, quint8 dataByte)
+{
+    return submit(false, [=](EbmBus* ebmBus) { return ebmBus->writeEEPROM(fanAddress, fanGroup, eepromAddress, dataByte); });
+}
+
+quint64 EbmBusLine::softwareReset(quint8 fanAddress, quint8 fanGroup)
+{
+    return submit(false, [=](EbmBus* ebmBus) { return ebmBus->softwareReset(fanAddress, fanGroup); });
+}
+
+void EbmBusLine::setRequestTimeout(int requestTimeout)
+{
+    post([=](EbmBus* ebmBus) { ebmBus->setRequestTimeout(requestTimeout); });
+}
+
+void EbmBusLine::setTelegramRepeatCount(int telegramRepeatCount)
+{
+    post([=](EbmBus* ebmBus) { ebmBus->setTelegramRepeatCount(telegramRepeatCount); });
+}
+
+void EbmBusLine::clearTelegramQueue(bool highPriority)
+{
+    post([=](EbmBus* ebmBus) { ebmBus->clearTelegramQueue(highPriority); });
+}
+
+void EbmBusLine::startDaisyChainAddressing()
+{
+    post([=](EbmBus* ebmBus) { ebmBus->startDaisyChainAddressing(); });
+}
+
+int EbmBusLine::getSizeOfTelegramQueue(bool highPriority) const
+{
+    int index = highPriority ? 1 : 0;
+    return m_publishedQueueSize[index].load() + m_commandsInFlight[index].load();
+}
+
+int EbmBusLine::getTelemetryQueueLevel() const
+{
+    return (int)m_telemetry.size();
+}
+
+quint64 EbmBusLine::getQueueOverflows() const
+{
+    return m_queueOverflows.load();
+}
+
+qint64 EbmBusLine::clockElapsed() const
+{
+    return m_clock.elapsed();
+}
+
+quint64 EbmBusLine::submit(bool highPriority, std::function<quint64 (EbmBus *)> request)
+{
+    Command command;
+    command.telegramID = ++s_lastTelegramID;
+    command.highPriority = highPriority;
+    command.request = request;
+
+    m_commandsInFlight[highPriority ? 1 : 0]++;
+    if (!m_commands.push(command))
+    {
+        m_commandsInFlight[highPriority ? 1 : 0]--;
+        m_queueOverflows++;
+        return 0;
+    }
+
+    if (!m_commandsScheduled.exchange(true))
+        QMetaObject::invokeMethod(m_worker, "slot_processCommands", Qt::QueuedConnection);
+
+    return command.telegramID;
+}
+
+void EbmBusLine::post(std::function<void (EbmBus *)> request)
+{
+    Command command;
+    command.telegramID = 0;
+    command.highPriority = false;
+    command.request = [=](EbmBus* ebmBus) { request(ebmBus); return (quint64)0; };
+
+    m_commandsInFlight[0]++;
+    if (!m_commands.push(command))
+    {
+        m_commandsInFlight[0]--;
+        m_queueOverflows++;
+        return;
+    }
+
+    if (!m_commandsScheduled.exchange(true))
+        QMetaObject::invokeMethod(m_worker, "slot_processCommands", Qt::QueuedConnection);
+}
+
+void EbmBusLine::pushTelemetry(const EbmBusLine::Telemetry &telemetry)
+{
+    if (!m_telemetry.push(telemetry))
+    {
+        m_queueOverflows++;     // The main thread is far behind, the telegram ends up as expired in the registry
+        return;
+    }
+
+    if (!m_telemetryScheduled.exchange(true))
+        QMetaObject::invokeMethod(this, "slot_processTelemetry", Qt::QueuedConnection);
+}
+
+void EbmBusLine::slot_processTelemetry()
+{
+    m_telemetryScheduled.store(false);
+
+    Telemetry telemetry;
+    while (m_telemetry.pop(&telemetry))
+    {
+        switch (telemetry.type)
+        {
+        case TelemetryActualSpeed:
+            emit signal_actualSpeed(telemetry.telegramID, telemetry.fanAddress, telemetry.fanGroup, telemetry.value);
+            break;
+        case TelemetryEEPROMdata:
+            emit signal_EEPROMdata(telemetry.telegramID, telemetry.fanAddress, telemetry.fanGroup, (EbmBusEEPROM::EEPROMaddress)telemetry.eepromAddress, telemetry.value);
+            break;
+        case TelemetryEEPROMhasBeenWritten:
+            emit signal_EEPROMhasBeenWritten(telemetry.telegramID, telemetry.fanAddress, telemetry.fanGroup);
+            break;
+        case TelemetrySetPointHasBeenSet:
+            emit signal_setPointHasBeenSet(telemetry.telegramID, telemetry.fanAddress, telemetry.fanGroup);
+            break;
+        case TelemetrySimpleStatus:
+            emit signal_simpleStatus(telemetry.telegramID, telemetry.fanAddress, telemetry.fanGroup, telemetry.status);
+            break;
+        case TelemetryStatus:
+            emit signal_status(telemetry.telegramID, telemetry.fanAddress, telemetry.fanGroup, telemetry.value, telemetry.status, telemetry.rawValue);
+            break;
+        case TelemetryResponseRaw:
+            emit signal_responseRaw(telemetry.telegramID, telemetry.value, telemetry.rawValue, telemetry.fanGroup, telemetry.data);
+            break;
+        case TelemetryTransactionFinished:
+            emit signal_transactionFinished();
+            emit signal_telegramCompleted(false, telemetry.timestamp, telemetry.lineBusy);
+            break;
+        case TelemetryTransactionLost:
+            emit signal_transactionLost(telemetry.telegramID);
+            emit signal_telegramCompleted(true, telemetry.timestamp, telemetry.lineBusy);
+            break;
+        case TelemetryDaisyChainAdressingFinished:
+            emit signal_DaisyChainAdressingFinished();
+            break;
+        case TelemetryDaisyChainAddressingGotSerialNumber:
+            emit signal_DaisyChainAddressingGotSerialNumber(telemetry.value, telemetry.fanAddress, telemetry.fanGroup, telemetry.serialNumber);
+            break;
+        case TelemetryNone:
+            break;
+        }
+    }
+}
@@ -0,0 +1,200 @@
+/**********************************************************************
+** ebmbus-cmd - a commandline tool to control ebm papst fans
+** Copyright (C) 2018 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+#ifndef EBMBUSLINE_H
+#define EBMBUSLINE_H
+
+#include <QObject>
+#include <QThread>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QList>
+#include <atomic>
+#include <functional>
+#include <libebmbus/ebmbus.h>
+#include "spscqueue.h"
+#include "daisychaininterface.h"
+
+// Runs one EbmBus on a thread of its own, so serial io, request timeouts and repeats of a line do not wait for
+// anything else going on in the main event loop, e.g. remote clients or other lines.
+// EbmBusLine offers the requests and signals of EbmBus to the main thread. Requests are handed to the bus thread
+// and responses back through lock-free single producer/single consumer queues. Telegram ids are assigned by
+// EbmBusLine right away, so callers get them synchronously as before; the bus thread maps them to the ids of EbmBus.
+// The ids are unique across all lines, as the transaction registry of FFUdatabase is shared by all of them.
+
+class EbmBusLine;
+
+class EbmBusLineWorker : public QObject
+{
+    Q_OBJECT
+public:
+    explicit EbmBusLineWorker(EbmBusLine* line, QString interfaceStartOfLoop, QString interfaceEndOfLoop);
+
+    EbmBus* ebmBus();
+
+private:
+    EbmBusLine* m_line;
+    EbmBus* m_ebmBus;
+
+    typedef struct {
+        quint64 lineTelegramID;
+        qint64 submitTime;      // Milliseconds of m_clock
+    } LineTelegram;
+
+    QHash<quint64, LineTelegram> m_telegramIDs;     // EbmBus telegram id to EbmBusLine telegram id
+    QList<quint64> m_answeredTelegramIDs;       // Dropped from m_telegramIDs one transaction later, as a telegram
+    QList<quint64> m_retiringTelegramIDs;       // may be answered by several signals
+    QElapsedTimer m_clock;
+    QTimer m_timer_expiry;      // Broadcasts and telegrams dropped by clearTelegramQueue are never answered nor lost
+
+    static const int ExpiryTime = 60000;    // Unit ms, same as the transaction registry
+
+    quint64 lineTelegramID(quint64 telegramID);
+    void retireTelegramIDs();
+    bool lineBusy() const;
+    void publishQueueSizes();
+
+public slots:
+    bool slot_open();
+    void slot_processCommands();
+
+private slots:
+    void slot_timer_expiry_fired();
+    void slot_actualSpeed(quint64 telegramID, quint8 fanAddress, quint8 fanGroup, quint8 actualRawSpeed);
+    void slot_EEPROMdata(quint64 telegramID, quint8 fanAddress, quint8 fanGroup, EbmBusEEPROM::EEPROMaddress eepromAddress, quint8 dataByte);
+    void slot_EEPROMhasBeenWritten(quint64 telegramID, quint8 fanAddress, quint8 fanGroup);
+    void slot_setPointHasBeenSet(quint64 telegramID, quint8 fanAddress, quint8 fanGroup);
+    void slot_simpleStatus(quint64 telegramID, quint8 fanAddress, quint8 fanGroup, QString status);
+    void slot_status(quint64 telegramID, quint8 fanAddress, quint8 fanGroup, quint8 statusAddress, QString status, quint8 rawValue);
+    void slot_responseRaw(quint64 telegramID, quint8 preamble, quint8 commandAndFanaddress, quint8 fanGroup, QByteArray data);
+    void slot_transactionFinished();
+    void slot_transactionLost(quint64 telegramID);
+    void slot_DaisyChainAdressingFinished();
+    void slot_DaisyChainAddressingGotSerialNumber(quint8 unit, quint8 fanAddress, quint8 fanGroup, quint32 serialNumber);
+};
+
+class EbmBusLine : public QObject
+{
+    Q_OBJECT
+    friend class EbmBusLineWorker;
+public:
+    explicit EbmBusLine(QObject *parent, QString interfaceStartOfLoop, QString interfaceEndOfLoop);
+    ~EbmBusLine();
+
+    bool open();
+    void connectDaisyChainInterface(DaisyChainInterface* dci);
+
+    // Requests, see EbmBus. Return the telegram id or 0 if the request could not be handed to the bus thread.
+    template <typename StatusAddress>
+    quint64 getStatus(quint8 fanAddress, quint8 fanGroup, StatusAddress statusAddress)
+    {
+        return submit(false, [=](EbmBus* ebmBus) { return ebmBus->getStatus(fanAddress, fanGroup, statusAddress); });
+    }
+    quint64 getActualSpeed(quint8 fanAddress, quint8 fanGroup, bool highPriority = false);
+    quint64 setSpeedSetpoint(quint8 fanAddress, quint8 fanGroup, quint8 speed);
+    quint64 readEEPROM(quint8 fanAddress, quint8 fanGroup, EbmBusEEPROM::EEPROMaddress eepromAddress);
+    quint64 writeEEPROM(quint8 fanAddress, quint8 fanGroup, EbmBusEEPROM::EEPROMaddress eepromAddress, quint8 dataByte);
+    quint64 softwareReset(quint8 fanAddress, quint8 fanGroup);
+
+    // Executed in order with the requests
+    void setRequestTimeout(int requestTimeout);
+    void setTelegramRepeatCount(int telegramRepeatCount);
+    void clearTelegramQueue(bool highPriority);
+    void startDaisyChainAddressing();
+
+    int getSizeOfTelegramQueue(bool highPriority) const;   // Including requests not yet handed to EbmBus
+
+    int getTelemetryQueueLevel() const;
+    quint64 getQueueOverflows() const;
+
+    qint64 clockElapsed() const;    // Unit ms, the clock of the timestamps of signal_telegramCompleted
+
+private:
+    typedef struct {
+        quint64 telegramID;
+        bool highPriority;
+        std::function<quint64(EbmBus*)> request;
+    } Command;
+
+    typedef enum {
+        TelemetryNone,
+        TelemetryActualSpeed,
+        TelemetryEEPROMdata,
+        TelemetryEEPROMhasBeenWritten,
+        TelemetrySetPointHasBeenSet,
+        TelemetrySimpleStatus,
+        TelemetryStatus,
+        TelemetryResponseRaw,
+        TelemetryTransactionFinished,
+        TelemetryTransactionLost,
+        TelemetryDaisyChainAdressingFinished,
+        TelemetryDaisyChainAddressingGotSerialNumber
+    } TelemetryType;
+
+    typedef struct {
+        TelemetryType type;
+        quint64 telegramID;
+        quint8 fanAddress;
+        quint8 fanGroup;
+        quint8 value;           // Actual speed, data byte, status address, unit or preamble
+        quint8 rawValue;        // Raw status value or command and fan address
+        int eepromAddress;
+        quint32 serialNumber;
+        QString status;
+        QByteArray data;
+        qint64 timestamp;       // Unit ms of m_clock, taken in the bus thread when the transaction ended
+        bool lineBusy;          // Further telegrams were waiting when the transaction ended
+    } Telemetry;
+
+    static const int QueueCapacity = 4096;
+
+    QThread m_thread;
+    EbmBusLineWorker* m_worker;
+    QElapsedTimer m_clock;      // Read by both threads, but only written before the bus thread starts
+
+    static std::atomic<quint64> s_lastTelegramID;   // Shared by all lines
+
+    SpscQueue<Command> m_commands;          // Main thread to bus thread
+    SpscQueue<Telemetry> m_telemetry;       // Bus thread to main thread
+    std::atomic<bool> m_commandsScheduled;
+    std::atomic<bool> m_telemetryScheduled;
+    std::atomic<int> m_commandsInFlight[2];     // Index is highPriority
+    std::atomic<int> m_publishedQueueSize[2];   // Queue sizes of EbmBus, published by the bus thread
+    std::atomic<quint64> m_queueOverflows;
+
+    quint64 submit(bool highPriority, std::function<quint64(EbmBus*)> request);
+    void post(std::function<void(EbmBus*)> request);
+    void pushTelemetry(const Telemetry& telemetry);    // Bus thread
+
+signals:
+    void signal_actualSpeed(quint64 telegramID, quint8 fanAddress, quint8 fanGroup, quint8 actualRawSpeed);
+    void signal_EEPROMdata(quint64 telegramID, quint8 fanAddress, quint8 fanGroup, EbmBusEEPROM::EEPROMaddress eepromAddress, quint8 dataByte);
+    void signal_EEPROMhasBeenWritten(quint64 telegramID, quint8 fanAddress, quint8 fanGroup);
+    void signal_setPointHasBeenSet(quint64 telegramID, quint8 fanAddress, quint8 fanGroup);
+    void signal_simpleStatus(quint64 telegramID, quint8 fanAddress, quint8 fanGroup, QString status);
+    void signal_status(quint64 telegramID, quint8 fanAddress, quint8 fanGroup, quint8 statusAddress, QString status, quint8 rawValue);
+    void signal_responseRaw(quint64 telegramID, quint8 preamble, quint8 commandAndFanaddress, quint8 fanGroup, QByteArray data);
+    void signal_transactionFinished();
+    void signal_transactionLost(quint64 telegramID);
+    void signal_telegramCompleted(bool lost, qint64 timestamp, bool lineBusy);     // Along with signal_transactionFinished/Lost
+    void signal_DaisyChainAdressingFinished();
+    void signal_DaisyChainAddressingGotSerialNumber(quint8 unit, quint8 fanAddress, quint8 fanGroup, quint32 serialNumber);
+
+private slots:
+    void slot_processTelemetry();
+};
+
+#endif // EBMBUSLINE_H
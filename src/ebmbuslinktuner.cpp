@@ -0,0 +1,208 @@
+/**********************************************************************
+** ebmbus-cmd - a commandline tool to control ebm papst fans
+** Copyright (C) 2018 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+#include "ebmbuslinktuner.h"
+
+#include <QSettings>
+#include <algorithm>
+#include <stdio.h>
+
+EbmBusLinkTuner::EbmBusLinkTuner(QObject *parent, QList<EbmBusLine*> *ebmbuslist, int requestTimeout, int telegramRepeatCount) : QObject(parent)
+{
+    m_ebmbuslist = ebmbuslist;
+
+    QSettings settings("/etc/openffucontrol/ebmbus-cmd/ebmbus-cmd.ini", QSettings::IniFormat);
+    settings.beginGroup("configEbmBus");
+    m_enabled = settings.value("linkTuning", true).toBool();
+    int tuningInterval = settings.value("linkTuningInterval", 10000).toInt();
+    m_requestTimeoutMin = settings.value("requestTimeoutMin", 50).toInt();
+    m_requestTimeoutMax = qMax(m_requestTimeoutMin, settings.value("requestTimeoutMax", 500).toInt());
+    m_telegramRepeatCountMin = settings.value("telegramRepeatCountMin", 1).toInt();
+    m_telegramRepeatCountMax = qMax(m_telegramRepeatCountMin, settings.value("telegramRepeatCountMax", 3).toInt());
+    m_lossThreshold = settings.value("linkLossThreshold", 2.0).toDouble();
+    settings.endGroup();
+
+    for (int busID = 0; busID < m_ebmbuslist->count(); busID++)
+    {
+        EbmBusLine* ebmBus = m_ebmbuslist->at(busID);
+        m_busIDs.insert(ebmBus, busID);
+
+        LineState state;
+        state.requestTimeout = requestTimeout;
+        state.telegramRepeatCount = telegramRepeatCount;
+        state.lastCompletion = -1;
+        state.busyAtLastCompletion = false;
+        state.nextSample = 0;
+        state.finished = 0;
+        state.lost = 0;
+        state.repeated = 0;
+        state.windowFinished = 0;
+        state.windowLost = 0;
+        state.windowRepeated = 0;
+        state.lossRate = 0.0;
+        state.repeatRate = 0.0;
+        state.cleanIntervals = 0;
+        state.adjustments = 0;
+        m_lineStates.insert(busID, state);
+
+        connect(ebmBus, SIGNAL(signal_telegramCompleted(bool,qint64,bool)), this, SLOT(slot_telegramCompleted(bool,qint64,bool)));
+    }
+
+    connect(&m_timer_tune, SIGNAL(timeout()), this, SLOT(slot_timer_tune_fired()));
+    m_timer_tune.setInterval(tuningInterval);
+    if (m_enabled)
+        m_timer_tune.start();
+}
+
+EbmBusLinkTuner::LineStatistics EbmBusLinkTuner::getLineStatistics(int busID) const
+{
+    LineState state = m_lineStates.value(busID);
+
+    LineStatistics statistics;
+    statistics.requestTimeout = state.requestTimeout;
+    statistics.telegramRepeatCount = state.telegramRepeatCount;
+    statistics.finished = state.finished;
+    statistics.lost = state.lost;
+    statistics.repeated = state.repeated;
+    statistics.lossRate = state.lossRate;
+    statistics.repeatRate = state.repeatRate;
+    statistics.responseTime50 = responseTimePercentile(state, 50);
+    statistics.responseTime95 = responseTimePercentile(state, 95);
+    statistics.adjustments = state.adjustments;
+
+    return statistics;
+}
+
+// Timestamps are taken in the bus thread, so telegrams handed to the main thread together still have their own times
+void EbmBusLinkTuner::slot_telegramCompleted(bool lost, qint64 timestamp, bool lineBusy)
+{
+    QHash<int, LineState>::iterator it = m_lineStates.find(m_busIDs.value(sender(), -1));
+    if (it == m_lineStates.end())
+        return;
+
+    LineState& state = it.value();
+
+    if (lost)
+    {
+        state.lost++;
+        state.windowLost++;
+    }
+    else
+    {
+        state.finished++;
+        state.windowFinished++;
+
+        // Only back-to-back telegrams tell the response time, otherwise the line was idle in between
+        if (state.busyAtLastCompletion && (state.lastCompletion >= 0))
+        {
+            int responseTime = (int)(timestamp - state.lastCompletion);
+            if (responseTime > state.requestTimeout)
+            {
+                // The first try timed out and a repeat got through
+                state.repeated++;
+                state.windowRepeated++;
+            }
+            else
+            {
+                if (state.responseTimes.count() < ResponseTimeHistory)
+                    state.responseTimes.append(responseTime);
+                else
+                    state.responseTimes[state.nextSample] = responseTime;
+                state.nextSample = (state.nextSample + 1) % ResponseTimeHistory;
+            }
+        }
+    }
+
+    state.lastCompletion = timestamp;
+    state.busyAtLastCompletion = lineBusy;
+}
+
+int EbmBusLinkTuner::responseTimePercentile(const EbmBusLinkTuner::LineState &state, int percentile)
+{
+    if (state.responseTimes.isEmpty())
+        return 0;
+
+    QVector<int> sorted = state.responseTimes;
+    std::sort(sorted.begin(), sorted.end());
+    int index = (sorted.count() * percentile + 99) / 100 - 1;
+    return sorted.at(qBound(0, index, sorted.count() - 1));
+}
+
+void EbmBusLinkTuner::tune(int busID, EbmBusLinkTuner::LineState &state)
+{
+    quint64 telegrams = state.windowFinished + state.windowLost;
+    if (telegrams < MinTelegramsPerInterval)
+        return;     // Keep collecting
+
+    state.lossRate = 100.0 * state.windowLost / telegrams;
+    state.repeatRate = state.windowFinished > 0 ? 100.0 * state.windowRepeated / state.windowFinished : 0.0;
+    state.windowFinished = 0;
+    state.windowLost = 0;
+    state.windowRepeated = 0;
+
+    int requestTimeout = state.requestTimeout;
+    int telegramRepeatCount = state.telegramRepeatCount;
+
+    if (state.repeatRate > m_lossThreshold)
+    {
+        // Slow answers are cut off by the timeout, so give the fans more time instead of trusting the percentile
+        requestTimeout = qMin(m_requestTimeoutMax, requestTimeout * 3 / 2);
+    }
+    else if (state.responseTimes.count() >= ResponseTimeHistory / 2)
+    {
+        requestTimeout = qBound(m_requestTimeoutMin, 2 * responseTimePercentile(state, 95), m_requestTimeoutMax);
+    }
+
+    if (state.lossRate > m_lossThreshold)
+    {
+        telegramRepeatCount = qMin(m_telegramRepeatCountMax, telegramRepeatCount + 1);
+        state.cleanIntervals = 0;
+    }
+    else if ((state.lossRate == 0.0) && (state.repeatRate == 0.0))
+    {
+        state.cleanIntervals++;
+        if (state.cleanIntervals >= CleanIntervalsToLower)
+        {
+            telegramRepeatCount = qMax(m_telegramRepeatCountMin, telegramRepeatCount - 1);
+            state.cleanIntervals = 0;
+        }
+    }
+    else
+        state.cleanIntervals = 0;
+
+    if ((requestTimeout == state.requestTimeout) && (telegramRepeatCount == state.telegramRepeatCount))
+        return;
+
+    EbmBusLine* ebmBus = m_ebmbuslist->at(busID);
+    ebmBus->setRequestTimeout(requestTimeout);
+    ebmBus->setTelegramRepeatCount(telegramRepeatCount);
+
+    fprintf(stderr, "EbmBusLinkTuner::tune(): Line %i: requestTimeout %i -> %i ms, telegramRepeatCount %i -> %i (loss %.1lf%%, repeats %.1lf%%).\n",
+            busID, state.requestTimeout, requestTimeout, state.telegramRepeatCount, telegramRepeatCount, state.lossRate, state.repeatRate);
+
+    state.requestTimeout = requestTimeout;
+    state.telegramRepeatCount = telegramRepeatCount;
+    state.adjustments++;
+}
+
+void EbmBusLinkTuner::slot_timer_tune_fired()
+{
+    QHash<int, LineState>::iterator it = m_lineStates.begin();
+    while (it != m_lineStates.end())
+    {
+        tune(it.key(), it.value());
+        ++it;
+    }
+}
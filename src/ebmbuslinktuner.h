@@ -0,0 +1,101 @@
+/**********************************************************************
+** ebmbus-cmd - a commandline tool to control ebm papst fans
+** Copyright (C) 2018 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+#ifndef EBMBUSLINKTUNER_H
+#define EBMBUSLINKTUNER_H
+
+#include <QObject>
+#include <QList>
+#include <QHash>
+#include <QVector>
+#include <QTimer>
+#include "ebmbusline.h"
+
+// Adjusts requestTimeout and telegramRepeatCount of each ebmBus line to what the line actually needs.
+// The response time of a telegram is taken as the time between two completed telegrams while the line was
+// busy without a break, both taken in the bus thread when the telegram ended. requestTimeout follows twice the 95th percentile of it. telegramRepeatCount is raised
+// while telegrams are lost despite the repeats and lowered again when the line has been clean for a while.
+// Telegrams which only got through by a repeat (response time above requestTimeout) indicate a timeout too short.
+
+class EbmBusLinkTuner : public QObject
+{
+    Q_OBJECT
+public:
+    explicit EbmBusLinkTuner(QObject *parent, QList<EbmBusLine*>* ebmbuslist, int requestTimeout, int telegramRepeatCount);
+
+    typedef struct {
+        int requestTimeout;         // Unit ms, currently set
+        int telegramRepeatCount;    // Currently set
+        quint64 finished;
+        quint64 lost;
+        quint64 repeated;           // Finished, but only after at least one repeat
+        double lossRate;            // Unit percent, last tuning interval
+        double repeatRate;          // Unit percent, last tuning interval
+        int responseTime50;         // Unit ms, recent samples
+        int responseTime95;
+        quint64 adjustments;
+    } LineStatistics;
+
+    LineStatistics getLineStatistics(int busID) const;
+
+private:
+    typedef struct {
+        int requestTimeout;
+        int telegramRepeatCount;
+        qint64 lastCompletion;          // Unit ms of the line's clock, -1 before the first
+        bool busyAtLastCompletion;      // Further telegrams were queued, so the next one started right away
+        QVector<int> responseTimes;     // Ring buffer of the last ResponseTimeHistory samples
+        int nextSample;
+        quint64 finished;
+        quint64 lost;
+        quint64 repeated;
+        quint64 windowFinished;         // Counters of the current tuning interval
+        quint64 windowLost;
+        quint64 windowRepeated;
+        double lossRate;
+        double repeatRate;
+        int cleanIntervals;             // Tuning intervals in a row without loss and repeats
+        quint64 adjustments;
+    } LineState;
+
+    static const int ResponseTimeHistory = 64;
+    static const int MinTelegramsPerInterval = 20;  // Fewer telegrams are no base for a decision
+    static const int CleanIntervalsToLower = 6;
+
+    QList<EbmBusLine*>* m_ebmbuslist;
+    QHash<QObject*, int> m_busIDs;
+    QHash<int, LineState> m_lineStates;
+    QTimer m_timer_tune;
+
+    bool m_enabled;
+    int m_requestTimeoutMin;
+    int m_requestTimeoutMax;
+    int m_telegramRepeatCountMin;
+    int m_telegramRepeatCountMax;
+    double m_lossThreshold;         // Unit percent
+
+    static int responseTimePercentile(const LineState& state, int percentile);
+    void tune(int busID, LineState& state);
+
+signals:
+
+public slots:
+
+private slots:
+    void slot_telegramCompleted(bool lost, qint64 timestamp, bool lineBusy);
+    void slot_timer_tune_fired();
+};
+
+#endif // EBMBUSLINKTUNER_H
@@ -67,17 +67,22 @@ EbmBusSystem::EbmBusSystem(QObject *parent, RevPiDIO *io) : QObject(parent)
             continue;
 
 
+        // Low latency has to be set before the interfaces are opened
+        SerialInterfaceTuning::apply(interface_startOfLoop);
+        SerialInterfaceTuning::apply(interface_endOfLoop);
+
         // Now create bus system **********************************************************************************************
-        EbmBus* newEbmBus = new EbmBus(this, interface_startOfLoop, interface_endOfLoop);
+        // Each line runs on a thread of its own, see ebmbusline.h
+        EbmBusLine* newEbmBus = new EbmBusLine(this, interface_startOfLoop, interface_endOfLoop);
         newEbmBus->setRequestTimeout(requestTimeout);
         newEbmBus->setTelegramRepeatCount(telegramRepeatCount);
         m_ebmbuslist.append(newEbmBus);
+        m_interfaces.append(QStringList() << interface_startOfLoop << interface_endOfLoop);
 
         DaisyChainInterface* newDCI = new DaisyChainInterface(this, m_io, i, i);
         m_dcilist.append(newDCI);
 
-        connect(newEbmBus, SIGNAL(signal_setDCIoutput(bool)), newDCI, SLOT(slot_setDCIoutput(bool)));
-        connect(newDCI, SIGNAL(signal_DCIloopResponse(bool)), newEbmBus, SLOT(slot_DCIloopResponse(bool)));
+        newEbmBus->connectDaisyChainInterface(newDCI);
 
         connect(newEbmBus, SIGNAL(signal_responseRaw(quint64,quint8,quint8,quint8,QByteArray)), this, SLOT(slot_showResponseRaw(quint64,quint8,quint8,quint8,QByteArray)));
         connect(newEbmBus, SIGNAL(signal_transactionLost(quint64)), this, SLOT(slot_transactionLost(quint64)));
@@ -89,29 +94,44 @@ EbmBusSystem::EbmBusSystem(QObject *parent, RevPiDIO *io) : QObject(parent)
             fprintf(stderr, "EbmBusSystem::EbmBusSystem(): Activated on %s!\n", interface_startOfLoop.toUtf8().data()); // Tbd.: Write log if redundancy is active
         fflush(stderr);
     }
+
+    // requestTimeout and telegramRepeatCount are only the starting point, each line is tuned on its own from now on
+    m_linkTuner = new EbmBusLinkTuner(this, &m_ebmbuslist, requestTimeout, telegramRepeatCount);
 }
 
-QList<EbmBus*>* EbmBusSystem::ebmbuslist()
+QList<EbmBusLine*>* EbmBusSystem::ebmbuslist()
 {
     return (&m_ebmbuslist);
 }
 
-EbmBus *EbmBusSystem::getBusByID(int busID)
+EbmBusLine *EbmBusSystem::getBusByID(int busID)
 {
     if (m_ebmbuslist.length() <= busID)
         return nullptr; // Bus id not available
 
-    EbmBus* bus = m_ebmbuslist.at(busID);
+    EbmBusLine* bus = m_ebmbuslist.at(busID);
 
     return bus;
 }
 
+EbmBusLinkTuner *EbmBusSystem::getLinkTuner()
+{
+    return m_linkTuner;
+}
+
+QStringList EbmBusSystem::getInterfaces(int busID) const
+{
+    QStringList interfaces = m_interfaces.value(busID);
+    interfaces.removeAll(QString());
+    return interfaces;
+}
+
 QString EbmBusSystem::broadcast(int busID, QMap<QString, QString> dataMap)
 {
     if (busID >= m_ebmbuslist.count())
         return "Warning[EbmBusSystem]: busID " + QString().setNum(busID) + " invalid";
 
-    EbmBus* ebmBus = m_ebmbuslist.at(busID);
+    EbmBusLine* ebmBus = m_ebmbuslist.at(busID);
     QString response;
 
     foreach (QString key, dataMap.keys()) {
@@ -127,7 +147,7 @@ QString EbmBusSystem::broadcast(int busID, QMap<QString, QString> dataMap)
 
 void EbmBusSystem::broadcastSpeed(quint8 speed, bool disableAutosaveAndAutostart)
 {
-    foreach (EbmBus* ebmbus, m_ebmbuslist)
+    foreach (EbmBusLine* ebmbus, m_ebmbuslist)
     {
         if (disableAutosaveAndAutostart)
         {
@@ -19,10 +19,14 @@
 #include <QObject>
 #include <QList>
 #include <QMap>
+#include <QStringList>
 #include <QSettings>
 #include <libebmbus/ebmbus.h>
 #include "revpidio.h"
 #include "daisychaininterface.h"
+#include "ebmbusline.h"
+#include "ebmbuslinktuner.h"
+#include "serialinterfacetuning.h"
 
 class EbmBusSystem : public QObject
 {
@@ -30,17 +34,21 @@ class EbmBusSystem : public QObject
 public:
     explicit EbmBusSystem(QObject *parent, RevPiDIO* io);
 
-    QList<EbmBus*> *ebmbuslist();
+    QList<EbmBusLine*> *ebmbuslist();
 
-    EbmBus* getBusByID(int busID);
+    EbmBusLine* getBusByID(int busID);
+    EbmBusLinkTuner* getLinkTuner();
+    QStringList getInterfaces(int busID) const;     // Device paths, the second one for redundant lines
 
     QString broadcast(int busID, QMap<QString,QString> dataMap);
     void broadcastSpeed(quint8 speed, bool disableAutosaveAndAutostart = false);
 
 private:
-    QList<EbmBus*> m_ebmbuslist;
+    QList<EbmBusLine*> m_ebmbuslist;
     QList<DaisyChainInterface*> m_dcilist;
+    QList<QStringList> m_interfaces;
     RevPiDIO* m_io;
+    EbmBusLinkTuner* m_linkTuner;
 
 signals:
 
@@ -15,10 +15,31 @@
 
 #include "ebmmodbus.h"
 #include <QThread>
+#include <QVector>
+#include <QMutexLocker>
+#include <errno.h>
+#include <algorithm>
 
 EbmModbus::EbmModbus(QObject *parent, QString interface) : QObject(parent)
 {
     m_interface = interface;
+    m_bus = nullptr;
+
+    m_dataBits = 8;
+    m_turnaroundDelay = 0;
+    setLineParameters(19200, 'E');
+
+    m_minResponseTimeout = 30000;
+    m_maxResponseTimeout = 500000;     // The default of libmodbus
+    m_deadSlaveTimeout = 50000;
+    m_byteTimeout = 50000;
+    m_appliedResponseTimeout = -1;
+
+    m_timingStatistics.transactions = 0;
+    m_timingStatistics.lastDuration = 0;
+    m_timingStatistics.maxDuration = 0;
+    m_timingStatistics.totalDuration = 0;
+    m_timingStatistics.totalGapWait = 0;
 }
 
 EbmModbus::~EbmModbus()
@@ -29,7 +50,7 @@ EbmModbus::~EbmModbus()
 bool EbmModbus::open()
 {
     QByteArray interface_ba = m_interface.toLocal8Bit();
-    m_bus = modbus_new_rtu(interface_ba.data(), 19200, 'E', 8, 1);
+    m_bus = modbus_new_rtu(interface_ba.data(), m_baudrate, m_parity, m_dataBits, m_stopBits);
     if (m_bus == nullptr) {
         emit signal_newEntry(LogEntry::Error, "EbmModbus", "Unable to open interface");
         return false;
@@ -38,17 +59,27 @@ bool EbmModbus::open()
     if (modbus_connect(m_bus) == -1) {
         emit signal_newEntry(LogEntry::Info, "EbmModbus", QString("Unable to connect to device: ") + QString(modbus_strerror(errno)));
         modbus_free(m_bus);
+        m_bus = nullptr;
         return false;
     }
 
-    fprintf(stderr, "EbmModbus::open(): Modbus interface configured and connected.\n");
+    m_busSilentSince.start();
+
+    modbus_set_byte_timeout(m_bus, m_byteTimeout / 1000000, m_byteTimeout % 1000000);
+    m_appliedResponseTimeout = -1;  // Set before the first request
+
+    fprintf(stderr, "EbmModbus::open(): Modbus interface configured and connected. Inter-frame gap is %i us.\n", m_interFrameGap);
     return true;
 }
 
 void EbmModbus::close()
 {
+    if (m_bus == nullptr)
+        return;
+
     modbus_close(m_bus);
     modbus_free(m_bus);
+    m_bus = nullptr;
 }
 
 void EbmModbus::setSlaveAddress(quint16 adr)
@@ -56,13 +87,256 @@ void EbmModbus::setSlaveAddress(quint16 adr)
     modbus_set_slave(m_bus, adr);
 }
 
-void EbmModbus::slot_writeHoldingRegisterData(quint64 telegramID, quint16 adr, EbmModbus::EbmModbusHoldingRegister reg, quint16 rawdata)
+QString EbmModbus::getInterface() const
 {
-    int result;
+    return m_interface;
+}
+
+// Line parameters are only written in the worker thread of the line, but read from others, so they change under the mutex
+void EbmModbus::setLineParameters(int baudrate, char parity)
+{
+    QMutexLocker locker(&m_statisticsMutex);
+    m_baudrate = baudrate;
+    m_parity = parity;
+    m_stopBits = (parity == 'N') ? 2 : 1;    // Modbus RTU keeps 11 bits per character, so no parity means two stop bits
+    calculateInterFrameGap();
+}
+
+int EbmModbus::getBaudrate() const
+{
+    QMutexLocker locker(&m_statisticsMutex);
+    return m_baudrate;
+}
+
+char EbmModbus::getParity() const
+{
+    QMutexLocker locker(&m_statisticsMutex);
+    return m_parity;
+}
+
+// Coding of the transfer rate and parity registers of the ebm-papst modbus parameter set
+int EbmModbus::transferRateCode(int baudrate)
+{
+    switch (baudrate)
+    {
+    case 1200:
+        return 2;
+    case 2400:
+        return 3;
+    case 4800:
+        return 4;
+    case 9600:
+        return 5;
+    case 19200:
+        return 6;
+    case 38400:
+        return 7;
+    case 57600:
+        return 8;
+    case 115200:
+        return 9;
+    }
+
+    return -1;
+}
+
+int EbmModbus::parityCode(char parity)
+{
+    switch (parity)
+    {
+    case 'E':
+        return 0;   // 8E1
+    case 'O':
+        return 1;   // 8O1
+    case 'N':
+        return 2;   // 8N2
+    }
+
+    return -1;
+}
+
+QList<int> EbmModbus::supportedBaudrates()
+{
+    return QList<int>() << 1200 << 2400 << 4800 << 9600 << 19200 << 38400 << 57600 << 115200;
+}
+
+void EbmModbus::setTurnaroundDelay(int turnaroundDelay)
+{
+    m_turnaroundDelay = qMax(0, turnaroundDelay);
+}
+
+int EbmModbus::getInterFrameGap() const
+{
+    QMutexLocker locker(&m_statisticsMutex);
+    return m_interFrameGap;
+}
+
+EbmModbus::TimingStatistics EbmModbus::getTimingStatistics()
+{
+    QMutexLocker locker(&m_statisticsMutex);
+    return m_timingStatistics;
+}
+
+void EbmModbus::setResponseTimeoutLimits(int minimum, int maximum, int deadSlaveTimeout)
+{
+    QMutexLocker locker(&m_statisticsMutex);
+    m_minResponseTimeout = qMax(1, minimum) * 1000;
+    m_maxResponseTimeout = qMax(minimum, maximum) * 1000;
+    m_deadSlaveTimeout = qBound(minimum, deadSlaveTimeout, maximum) * 1000;
+}
+
+void EbmModbus::setByteTimeout(int byteTimeout)
+{
+    m_byteTimeout = qMax(1, byteTimeout) * 1000;
+}
+
+QMap<quint16, EbmModbus::SlaveTiming> EbmModbus::getSlaveTimings()
+{
+    QMutexLocker locker(&m_statisticsMutex);
+
+    QMap<quint16, SlaveTiming> slaveTimings;
+    QHash<quint16, SlaveHistory>::const_iterator it = m_slaveHistories.constBegin();
+    while (it != m_slaveHistories.constEnd())
+    {
+        SlaveTiming slaveTiming;
+        slaveTiming.responseTimeout = it.value().responseTimeout;
+        slaveTiming.responseTime95 = responseTimePercentile(it.value(), 95);
+        slaveTiming.samples = it.value().responseTimes.count();
+        slaveTiming.timeouts = it.value().timeouts;
+        slaveTiming.consecutiveTimeouts = it.value().consecutiveTimeouts;
+        slaveTimings.insert(it.key(), slaveTiming);
+        ++it;
+    }
+
+    return slaveTimings;
+}
+
+// Called with m_statisticsMutex locked
+int EbmModbus::calculateResponseTimeout(const EbmModbus::SlaveHistory &history) const
+{
+    int responseTimeout = m_maxResponseTimeout;
+    if (history.responseTimes.count() >= ResponseTimeMinSamples)
+    {
+        // Half again the 95th percentile plus a frame gap, so jitter of a healthy slave does not cause timeouts
+        qint64 adaptive = responseTimePercentile(history, 95) * 3 / 2 + m_interFrameGap;
+        responseTimeout = (int)qBound((qint64)m_minResponseTimeout, adaptive, (qint64)m_maxResponseTimeout);
+    }
+
+    if (history.consecutiveTimeouts >= DeadSlaveTimeouts)
+    {
+        // A dead slave must not block the line, but a slow one coming back has to be noticed as well
+        if ((history.consecutiveTimeouts % DeadSlaveProbeInterval) == 0)
+            responseTimeout = m_maxResponseTimeout;
+        else
+            responseTimeout = qMin(responseTimeout, m_deadSlaveTimeout);
+    }
+
+    return responseTimeout;
+}
+
+qint64 EbmModbus::responseTimePercentile(const EbmModbus::SlaveHistory &history, int percentile)
+{
+    if (history.responseTimes.isEmpty())
+        return 0;
+
+    QVector<qint64> sorted = history.responseTimes;
+    std::sort(sorted.begin(), sorted.end());
+    int index = (sorted.count() * percentile + 99) / 100 - 1;
+    return sorted.at(qBound(0, index, sorted.count() - 1));
+}
+
+// The RTU line has to be silent for 3.5 character times between two frames. Above 19200 baud the
+// modbus specification uses a fixed 1750 us. Called with m_statisticsMutex locked.
+void EbmModbus::calculateInterFrameGap()
+{
+    int bitsPerCharacter = 1 + m_dataBits + ((m_parity == 'N') ? 0 : 1) + m_stopBits;
+
+    if (m_baudrate > 19200)
+        m_interFrameGap = 1750;
+    else
+        m_interFrameGap = (int)(3.5 * bitsPerCharacter * 1000000.0 / m_baudrate + 0.5);
+}
+
+// Waits until the line has been silent for the inter-frame gap. Time which has already passed since the last
+// transaction, e.g. while the worker was idle, counts, so back-to-back transactions only wait for the remainder.
+void EbmModbus::beginTransaction(quint16 adr)
+{
+    m_transactionTimer.start();
+
     modbus_set_slave(m_bus, adr);
-    // Bus clearance time
-    QThread::msleep(100);
+
+    int responseTimeout;
+    {
+        QMutexLocker locker(&m_statisticsMutex);
+        SlaveHistory& history = m_slaveHistories[adr];
+        if (history.responseTimeout == 0)
+            history.responseTimeout = calculateResponseTimeout(history);
+        responseTimeout = history.responseTimeout;
+    }
+    if (responseTimeout != m_appliedResponseTimeout)
+    {
+        modbus_set_response_timeout(m_bus, responseTimeout / 1000000, responseTimeout % 1000000);
+        m_appliedResponseTimeout = responseTimeout;
+    }
+
+    qint64 silence = m_busSilentSince.isValid() ? m_busSilentSince.nsecsElapsed() / 1000 : m_interFrameGap + m_turnaroundDelay;
+    qint64 wait = m_interFrameGap + m_turnaroundDelay - silence;
+    if (wait > 0)
+        QThread::usleep(wait);
+
+    m_responseTimer.start();
+
+    QMutexLocker locker(&m_statisticsMutex);
+    m_timingStatistics.totalGapWait += qMax(wait, (qint64)0);
+}
+
+// Keeps errno of the transaction, the callers still evaluate it
+void EbmModbus::endTransaction(quint16 adr, bool timedOut)
+{
+    int transactionErrno = errno;
+    m_busSilentSince.start();
+
+    qint64 duration = m_transactionTimer.nsecsElapsed() / 1000;
+    qint64 responseTime = m_responseTimer.nsecsElapsed() / 1000;
+
+    QMutexLocker locker(&m_statisticsMutex);
+    m_timingStatistics.transactions++;
+    m_timingStatistics.lastDuration = duration;
+    m_timingStatistics.maxDuration = qMax(m_timingStatistics.maxDuration, duration);
+    m_timingStatistics.totalDuration += duration;
+
+    SlaveHistory& history = m_slaveHistories[adr];
+    if (timedOut)
+    {
+        history.timeouts++;
+        history.consecutiveTimeouts++;
+    }
+    else
+    {
+        // Any answer counts, exception responses as well, as the slave is alive
+        history.consecutiveTimeouts = 0;
+        if (history.responseTimes.count() < ResponseTimeHistory)
+            history.responseTimes.append(responseTime);
+        else
+            history.responseTimes[history.nextSample] = responseTime;
+        history.nextSample = (history.nextSample + 1) % ResponseTimeHistory;
+    }
+    history.responseTimeout = calculateResponseTimeout(history);
+
+    errno = transactionErrno;
+}
+
+void EbmModbus::writeHoldingRegisterData(quint64 telegramID, quint16 adr, EbmModbus::EbmModbusHoldingRegister reg, quint16 rawdata)
+{
+    int result;
+    if (m_bus == nullptr)
+    {
+        emit signal_transactionLost(telegramID);    // Interface is not open
+        return;
+    }
+    beginTransaction(adr);
     result = modbus_write_register(m_bus, reg, rawdata);
+    endTransaction(adr, (result < 0) && (errno == ETIMEDOUT));
     if (result >= 0)
         emit signal_wroteHoldingRegisterData(telegramID);
     else
@@ -73,14 +347,18 @@ void EbmModbus::slot_writeHoldingRegisterData(quint64 telegramID, quint16 adr, E
     }
 }
 
-void EbmModbus::slot_readHoldingRegisterData(quint64 telegramID, quint16 adr, EbmModbus::EbmModbusHoldingRegister reg)
+void EbmModbus::readHoldingRegisterData(quint64 telegramID, quint16 adr, EbmModbus::EbmModbusHoldingRegister reg)
 {
     int result;
     uint16_t rawdata;
-    modbus_set_slave(m_bus, adr);
-    // Bus clearance time
-    QThread::msleep(100);
+    if (m_bus == nullptr)
+    {
+        emit signal_transactionLost(telegramID);    // Interface is not open
+        return;
+    }
+    beginTransaction(adr);
     result = modbus_read_registers(m_bus, reg, 1, &rawdata);
+    endTransaction(adr, (result < 0) && (errno == ETIMEDOUT));
     if (result >= 0)
         emit signal_receivedHoldingRegisterData(telegramID, adr, reg, rawdata);
     else
@@ -91,14 +369,18 @@ void EbmModbus::slot_readHoldingRegisterData(quint64 telegramID, quint16 adr, Eb
     }
 }
 
-void EbmModbus::slot_readInputRegisterData(quint64 telegramID, quint16 adr, EbmModbus::EbmModbusInputRegister reg)
+void EbmModbus::readInputRegisterData(quint64 telegramID, quint16 adr, EbmModbus::EbmModbusInputRegister reg)
 {
     int result;
     uint16_t rawdata;
-    modbus_set_slave(m_bus, adr);
-    // Bus clearance time
-    QThread::msleep(100);
+    if (m_bus == nullptr)
+    {
+        emit signal_transactionLost(telegramID);    // Interface is not open
+        return;
+    }
+    beginTransaction(adr);
     result = modbus_read_input_registers(m_bus, reg, 1, &rawdata);
+    endTransaction(adr, (result < 0) && (errno == ETIMEDOUT));
     if (result >= 0)
         emit signal_receivedInputRegisterData(telegramID, adr, reg, rawdata);
     else
@@ -108,3 +390,111 @@ void EbmModbus::slot_readInputRegisterData(quint64 telegramID, quint16 adr, EbmM
         emit signal_transactionLost(telegramID);
     }
 }
+
+void EbmModbus::readHoldingRegisterBlock(const EbmModbus::RegisterBlock &block)
+{
+    if (m_bus == nullptr)
+    {
+        foreach (quint64 telegramID, block.telegramIDs)
+            emit signal_transactionLost(telegramID);    // Interface is not open
+        return;
+    }
+
+    int result;
+    QVector<uint16_t> rawdata(block.count);
+    beginTransaction(block.adr);
+    result = modbus_read_registers(m_bus, block.startRegister, block.count, rawdata.data());
+    endTransaction(block.adr, (result < 0) && (errno == ETIMEDOUT));
+    if (result == block.count)
+    {
+        for (int i = 0; i < block.telegramIDs.count(); i++)
+            emit signal_receivedHoldingRegisterData(block.telegramIDs.at(i), block.adr, (EbmModbus::EbmModbusHoldingRegister)block.registers.at(i), rawdata.at(block.registers.at(i) - block.startRegister));
+    }
+    else if ((result < 0) && (errno == EMBXILADD) && (block.count > 1))
+    {
+        // The block spans a register the fan does not know, so read the requested registers one by one
+        for (int i = 0; i < block.telegramIDs.count(); i++)
+            readHoldingRegisterData(block.telegramIDs.at(i), block.adr, (EbmModbus::EbmModbusHoldingRegister)block.registers.at(i));
+    }
+    else
+    {
+        emit signal_newEntry(LogEntry::Info, "EbmModbus", QString("modbus_read_registers returned: ") + QString(modbus_strerror(errno) +
+                                            QString().sprintf(". adr=%i, reg=%i, count=%i.", block.adr, block.startRegister, block.count)));
+        foreach (quint64 telegramID, block.telegramIDs)
+            emit signal_transactionLost(telegramID);
+    }
+}
+
+void EbmModbus::readInputRegisterBlock(const EbmModbus::RegisterBlock &block)
+{
+    if (m_bus == nullptr)
+    {
+        foreach (quint64 telegramID, block.telegramIDs)
+            emit signal_transactionLost(telegramID);    // Interface is not open
+        return;
+    }
+
+    int result;
+    QVector<uint16_t> rawdata(block.count);
+    beginTransaction(block.adr);
+    result = modbus_read_input_registers(m_bus, block.startRegister, block.count, rawdata.data());
+    endTransaction(block.adr, (result < 0) && (errno == ETIMEDOUT));
+    if (result == block.count)
+    {
+        for (int i = 0; i < block.telegramIDs.count(); i++)
+            emit signal_receivedInputRegisterData(block.telegramIDs.at(i), block.adr, (EbmModbus::EbmModbusInputRegister)block.registers.at(i), rawdata.at(block.registers.at(i) - block.startRegister));
+    }
+    else if ((result < 0) && (errno == EMBXILADD) && (block.count > 1))
+    {
+        // The block spans a register the fan does not know, so read the requested registers one by one
+        for (int i = 0; i < block.telegramIDs.count(); i++)
+            readInputRegisterData(block.telegramIDs.at(i), block.adr, (EbmModbus::EbmModbusInputRegister)block.registers.at(i));
+    }
+    else
+    {
+        emit signal_newEntry(LogEntry::Info, "EbmModbus", QString("modbus_read_input_registers returned: ") + QString(modbus_strerror(errno) +
+                                            QString().sprintf(". adr=%i, reg=%i, count=%i.", block.adr, block.startRegister, block.count)));
+        foreach (quint64 telegramID, block.telegramIDs)
+            emit signal_transactionLost(telegramID);
+    }
+}
+
+// Each slot is one request of the queue in EbmModbusSystem, which sends the next request once it is finished
+
+void EbmModbus::slot_writeHoldingRegisterData(quint64 telegramID, quint16 adr, EbmModbus::EbmModbusHoldingRegister reg, quint16 rawdata)
+{
+    writeHoldingRegisterData(telegramID, adr, reg, rawdata);
+    emit signal_transactionFinished();
+}
+
+void EbmModbus::slot_readHoldingRegisterData(quint64 telegramID, quint16 adr, EbmModbus::EbmModbusHoldingRegister reg)
+{
+    readHoldingRegisterData(telegramID, adr, reg);
+    emit signal_transactionFinished();
+}
+
+void EbmModbus::slot_readInputRegisterData(quint64 telegramID, quint16 adr, EbmModbus::EbmModbusInputRegister reg)
+{
+    readInputRegisterData(telegramID, adr, reg);
+    emit signal_transactionFinished();
+}
+
+void EbmModbus::slot_readHoldingRegisterBlock(EbmModbus::RegisterBlock block)
+{
+    readHoldingRegisterBlock(block);
+    emit signal_transactionFinished();
+}
+
+void EbmModbus::slot_readInputRegisterBlock(EbmModbus::RegisterBlock block)
+{
+    readInputRegisterBlock(block);
+    emit signal_transactionFinished();
+}
+
+void EbmModbus::slot_changeLineParameters(int baudrate, char parity)
+{
+    close();
+    setLineParameters(baudrate, parity);
+    if (!open())
+        emit signal_newEntry(LogEntry::Error, "EbmModbus", QString().sprintf("Unable to reopen interface with %i baud, parity %c.", baudrate, parity));
+}
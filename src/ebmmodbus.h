@@ -17,9 +17,18 @@
 #define EBMMODBUS_H
 
 #include <QObject>
+#include <QList>
+#include <QMap>
+#include <QHash>
+#include <QVector>
+#include <QMutex>
+#include <QElapsedTimer>
 #include <loghandler.h>
 #include <modbus/modbus-rtu.h>
 
+// One modbus RTU line. Transactions are blocking libmodbus calls in the worker thread of the line, one at a time, as
+// RTU is half duplex and a slave only answers after the whole request. Requests wait in the queues of EbmModbusSystem.
+
 class EbmModbus : public QObject
 {
     Q_OBJECT
@@ -31,6 +40,46 @@ public:
     bool open();
     void close();
     void setSlaveAddress(quint16 adr);
+    QString getInterface() const;
+
+    // Must be set before open(). While the line is in use, see slot_changeLineParameters().
+    void setLineParameters(int baudrate, char parity);
+    int getBaudrate() const;
+    char getParity() const;
+
+    // Values of HOLDING_REG_D149_TransferRate and HOLDING_REG_D14A_ParityConfiguration, -1 if not supported by the fans
+    static int transferRateCode(int baudrate);
+    static int parityCode(char parity);
+    static QList<int> supportedBaudrates();     // Ascending
+
+    // Additional silence in us after each transaction on top of the RTU inter-frame gap (T3.5), for slow slaves
+    void setTurnaroundDelay(int turnaroundDelay);
+    int getInterFrameGap() const;   // Unit us
+
+    typedef struct {
+        quint64 transactions;
+        qint64 lastDuration;        // Unit us, request and response including waiting for the bus to be silent
+        qint64 maxDuration;
+        qint64 totalDuration;
+        qint64 totalGapWait;        // Time spent waiting for the inter-frame gap
+    } TimingStatistics;
+
+    TimingStatistics getTimingStatistics();
+
+    // The response timeout is adapted per slave to a high percentile of its measured response times, bounded by
+    // minimum and maximum. Slaves which stopped answering get deadSlaveTimeout, with a probe at maximum now and then.
+    void setResponseTimeoutLimits(int minimum, int maximum, int deadSlaveTimeout);   // Unit ms
+    void setByteTimeout(int byteTimeout);   // Unit ms, applies at the next open()
+
+    typedef struct {
+        int responseTimeout;        // Unit us, used for the next request
+        qint64 responseTime95;      // Unit us, 95th percentile of the recent response times
+        int samples;
+        quint64 timeouts;
+        int consecutiveTimeouts;
+    } SlaveTiming;
+
+    QMap<quint16, SlaveTiming> getSlaveTimings();
 
     typedef enum {
         HOLDING_REG_D000_Reset = 0xD000,
@@ -221,16 +270,74 @@ public:
 
     } EbmModbusInputRegister;
 
+    // Reads of several registers of one slave, done with a single request from startRegister to startRegister + count - 1.
+    // Each read keeps its own telegram id, results are emitted per register in the order of telegramIDs.
+    typedef struct {
+        quint16 adr;
+        quint16 startRegister;
+        quint16 count;
+        QList<quint64> telegramIDs;
+        QList<quint16> registers;
+    } RegisterBlock;
+
 signals:
 
 private:
     QString m_interface;
     modbus_t *m_bus;
 
+    int m_baudrate;
+    char m_parity;
+    int m_dataBits;
+    int m_stopBits;
+    int m_interFrameGap;        // Unit us
+    int m_turnaroundDelay;      // Unit us
+
+    QElapsedTimer m_busSilentSince;
+    QElapsedTimer m_transactionTimer;
+    mutable QMutex m_statisticsMutex;     // Also protects the line parameters against readers in other threads
+    TimingStatistics m_timingStatistics;
+
+    typedef struct {
+        QVector<qint64> responseTimes;  // Unit us, ring buffer of the last ResponseTimeHistory answers
+        int nextSample;
+        int responseTimeout;            // Unit us
+        quint64 timeouts;
+        int consecutiveTimeouts;
+    } SlaveHistory;
+
+    static const int ResponseTimeHistory = 32;
+    static const int ResponseTimeMinSamples = 5;    // Below the maximum timeout is used
+    static const int DeadSlaveTimeouts = 3;         // Consecutive timeouts until a slave is considered dead
+    static const int DeadSlaveProbeInterval = 10;   // Each n-th request to a dead slave waits the maximum timeout
+
+    int m_minResponseTimeout;   // Unit us
+    int m_maxResponseTimeout;
+    int m_deadSlaveTimeout;
+    int m_byteTimeout;
+    int m_appliedResponseTimeout;
+    QElapsedTimer m_responseTimer;
+    QHash<quint16, SlaveHistory> m_slaveHistories;  // Protected by m_statisticsMutex
+
+    void calculateInterFrameGap();
+    int calculateResponseTimeout(const SlaveHistory& history) const;
+    static qint64 responseTimePercentile(const SlaveHistory& history, int percentile);
+    void beginTransaction(quint16 adr);
+    void endTransaction(quint16 adr, bool timedOut);
+
+    void writeHoldingRegisterData(quint64 telegramID, quint16 adr, EbmModbus::EbmModbusHoldingRegister reg, quint16 rawdata);
+    void readHoldingRegisterData(quint64 telegramID, quint16 adr, EbmModbus::EbmModbusHoldingRegister reg);
+    void readInputRegisterData(quint64 telegramID, quint16 adr, EbmModbus::EbmModbusInputRegister reg);
+    void readHoldingRegisterBlock(const EbmModbus::RegisterBlock& block);
+    void readInputRegisterBlock(const EbmModbus::RegisterBlock& block);
+
 public slots:
     void slot_writeHoldingRegisterData(quint64 telegramID, quint16 adr, EbmModbus::EbmModbusHoldingRegister reg, quint16 rawdata);
     void slot_readHoldingRegisterData(quint64 telegramID, quint16 adr, EbmModbus::EbmModbusHoldingRegister reg);
     void slot_readInputRegisterData(quint64 telegramID, quint16 adr, EbmModbus::EbmModbusInputRegister reg);
+    void slot_readHoldingRegisterBlock(EbmModbus::RegisterBlock block);
+    void slot_readInputRegisterBlock(EbmModbus::RegisterBlock block);
+    void slot_changeLineParameters(int baudrate, char parity);     // Reopens the interface
 
 signals:
     // Modbus result signals
@@ -238,10 +345,13 @@ signals:
     void signal_receivedHoldingRegisterData(quint64 telegramID, quint16 adr, EbmModbus::EbmModbusHoldingRegister reg, quint16 rawdata);
     void signal_receivedInputRegisterData(quint64 telegramID, quint16 adr, EbmModbus::EbmModbusInputRegister reg, quint16 rawdata);
     void signal_wroteHoldingRegisterData(quint64 telegramID);
+    void signal_transactionFinished();      // Emitted once per request slot, after all its results
 
     // Log output signals
     void signal_newEntry(LogEntry::LoggingCategory loggingCategory, QString module, QString text);
     void signal_entryGone(LogEntry::LoggingCategory loggingCategory, QString module, QString text);
 };
 
+Q_DECLARE_METATYPE(EbmModbus::RegisterBlock)
+
 #endif // EBMMODBUS_H
@@ -14,23 +14,55 @@
 **********************************************************************/
 
 #include "ebmmodbussystem.h"
+#include <QHash>
+#include <QMap>
+#include <QRegExp>
+#include <QDir>
+#include <QFileInfo>
+#include "serialinterfacetuning.h"
 
-EbmModbusSystem::EbmModbusSystem(QObject *parent, Loghandler *loghandler) : QObject(parent)
+EbmModbusSystem::EbmModbusSystem(QObject *parent, Loghandler *loghandler, QString settingsFile) : QObject(parent)
 {
     m_loghandler = loghandler;
 
     qRegisterMetaType<EbmModbus::EbmModbusHoldingRegister>("EbmModbus::EbmModbusHoldingRegister");
     qRegisterMetaType<EbmModbus::EbmModbusInputRegister>("EbmModbus::EbmModbusInputRegister");
+    qRegisterMetaType<EbmModbus::RegisterBlock>("EbmModbus::RegisterBlock");
+
+    m_registerReadCount = 0;
+    m_blockReadCount = 0;
+    m_replacedWriteCount = 0;
+    m_droppedReadCount = 0;
+
+    QSettings settings(settingsFile, QSettings::IniFormat);
+    settings.beginGroup("configEbmModBus");
+    m_blockReadMaxGap = settings.value("blockReadMaxGap", 4).toInt();
+    m_blockReadMaxLength = qBound(1, settings.value("blockReadMaxLength", 16).toInt(), 125);    // 125 is the modbus limit
+    int turnaroundDelay = settings.value("turnaroundDelay", 0).toInt();
+    int responseTimeoutMin = settings.value("responseTimeoutMin", 30).toInt();
+    int responseTimeoutMax = settings.value("responseTimeoutMax", 500).toInt();
+    int deadSlaveTimeout = settings.value("deadSlaveTimeout", 50).toInt();
+    int byteTimeout = settings.value("byteTimeout", 50).toInt();
+    m_lineStateFile = settings.value("lineStateFile", "/var/openffucontrol/modbus-lines.ini").toString();
+    settings.endGroup();
+
+    // Line parameters negotiated by modbus-commission take precedence over the configured ones
+    QSettings lineState(m_lineStateFile, QSettings::IniFormat);
+    lineState.beginGroup("lines");
+
+    // Fires once the caller returned to the event loop, so all reads it issued are merged
+    connect(&m_timer_coalesceReads, &QTimer::timeout, this, &EbmModbusSystem::slot_timer_coalesceReads_fired);
+    m_timer_coalesceReads.setSingleShot(true);
+    m_timer_coalesceReads.setInterval(0);
 
-    QSettings settings("/etc/openffucontrol/ebmbus-cmd/ebmbus-cmd.ini", QSettings::IniFormat);
     settings.beginGroup("interfacesEbmModBus");
 
     QStringList interfaceKeyList = settings.childKeys();
 
     foreach(QString interfacesKey, interfaceKeyList)
     {
-        if (!interfacesKey.startsWith("ebmmodbus"))
-            continue;
+        if (!QRegExp("ebmmodbus\\d+").exactMatch(interfacesKey))
+            continue;   // Line parameters like ebmmodbus0Baudrate
         QString interfacesString = settings.value(interfacesKey).toString();
         QStringList interfaces = interfacesString.split(",", QString::SkipEmptyParts);
 
@@ -39,31 +71,46 @@ EbmModbusSystem::EbmModbusSystem(QObject *parent, Loghandler *loghandler) : QObj
             QString interface_0 = interfaces.at(0);
 
             EbmModbus* newEbmModbus = new EbmModbus(nullptr, QString("/dev/").append(interface_0));    // parent must be 0 in order to be moved to workerThread later
+            newEbmModbus->setTurnaroundDelay(turnaroundDelay);
+            newEbmModbus->setResponseTimeoutLimits(responseTimeoutMin, responseTimeoutMax, deadSlaveTimeout);
+            newEbmModbus->setByteTimeout(byteTimeout);
+            int baudrate = lineState.value(interfacesKey + "Baudrate", settings.value(interfacesKey + "Baudrate", 19200)).toInt();
+            QString parity = lineState.value(interfacesKey + "Parity", settings.value(interfacesKey + "Parity", "E")).toString().toUpper();
+            if ((EbmModbus::transferRateCode(baudrate) < 0) || (parity.length() != 1) || (EbmModbus::parityCode(parity.at(0).toLatin1()) < 0))
+            {
+                fprintf(stderr, "EbmModbusSystem::EbmModbusSystem(): Invalid line parameters for %s, using 19200 baud 8E1.\n", interfacesKey.toUtf8().data());
+                baudrate = 19200;
+                parity = "E";
+            }
+            newEbmModbus->setLineParameters(baudrate, parity.at(0).toLatin1());
+            m_interfaceKeys.append(interfacesKey);
+            m_busIDs.insert(newEbmModbus, m_ebmModbuslist.count());
+            m_lineQueues[m_ebmModbuslist.count()].busy = false;
             m_ebmModbuslist.append(newEbmModbus);
-            newEbmModbus->moveToThread(&m_workerThread);
-            m_workerThread.start();
-            connect(&m_workerThread, &QThread::finished, newEbmModbus, &QObject::deleteLater);
 
             connect(newEbmModbus, SIGNAL(signal_newEntry(LogEntry::LoggingCategory,QString,QString)), m_loghandler, SLOT(slot_newEntry(LogEntry::LoggingCategory,QString,QString)));
             connect(newEbmModbus, SIGNAL(signal_entryGone(LogEntry::LoggingCategory,QString,QString)), m_loghandler, SLOT(slot_entryGone(LogEntry::LoggingCategory,QString,QString)));
-            m_ebmModbuslist.append(newEbmModbus);
 
-            // Routing of calls to bus
-            connect(this, &EbmModbusSystem::signal_readHoldingRegisterData, newEbmModbus, &EbmModbus::slot_readHoldingRegisterData);
-            connect(this, &EbmModbusSystem::signal_readInputRegisterData, newEbmModbus, &EbmModbus::slot_readInputRegisterData);
-            connect(this, &EbmModbusSystem::signal_writeHoldingRegisterData, newEbmModbus, &EbmModbus::slot_writeHoldingRegisterData);
-
-            // Routing of bus results to master
-            connect(newEbmModbus, &EbmModbus::signal_transactionLost, this, &EbmModbusSystem::signal_transactionLost);
+            // Routing of bus results to master. Calls to the bus are routed by busID, see dispatchNextRequest().
+            connect(newEbmModbus, &EbmModbus::signal_transactionLost, this, &EbmModbusSystem::slot_busTransactionLost);
             connect(newEbmModbus, &EbmModbus::signal_receivedHoldingRegisterData, this, &EbmModbusSystem::signal_receivedHoldingRegisterData);
             connect(newEbmModbus, &EbmModbus::signal_receivedInputRegisterData, this, &EbmModbusSystem::signal_receivedInputRegisterData);
-            connect(newEbmModbus, &EbmModbus::signal_wroteHoldingRegisterData, this, &EbmModbusSystem::signal_wroteHoldingRegisterData);
+            connect(newEbmModbus, &EbmModbus::signal_wroteHoldingRegisterData, this, &EbmModbusSystem::slot_busWroteHoldingRegisterData);
+            connect(newEbmModbus, &EbmModbus::signal_transactionFinished, this, &EbmModbusSystem::slot_busTransactionFinished);
 
+            SerialInterfaceTuning::apply(newEbmModbus->getInterface());    // Before the interface is opened
             if (!newEbmModbus->open())
                 fprintf(stderr, "EbmModbusSystem::EbmModbusSystem(): Unable to open serial line %s!\n", interface_0.toUtf8().data());
             else
                 fprintf(stderr, "EbmModbusSystem::EbmModbusSystem(): Activated on %s!\n", interface_0.toUtf8().data());
             fflush(stderr);
+
+            // Each line has its own worker thread, so transactions on different lines run in parallel
+            QThread* workerThread = new QThread(this);
+            m_workerThreads.append(workerThread);
+            newEbmModbus->moveToThread(workerThread);
+            connect(workerThread, &QThread::finished, newEbmModbus, &QObject::deleteLater);
+            workerThread->start();
         }
         else if (interfaces.length() == 2)  // Redundant bus
         {
@@ -76,8 +123,11 @@ EbmModbusSystem::EbmModbusSystem(QObject *parent, Loghandler *loghandler) : QObj
 
 EbmModbusSystem::~EbmModbusSystem()
 {
-    m_workerThread.quit();
-    m_workerThread.wait();
+    foreach (QThread* workerThread, m_workerThreads)
+    {
+        workerThread->quit();
+        workerThread->wait();
+    }
 }
 
 QList<EbmModbus *> *EbmModbusSystem::ebmModbuslist()
@@ -87,7 +137,7 @@ QList<EbmModbus *> *EbmModbusSystem::ebmModbuslist()
 
 EbmModbus *EbmModbusSystem::getBusByID(int busID)
 {
-    if (m_ebmModbuslist.length() <= busID)
+    if ((busID < 0) || (m_ebmModbuslist.length() <= busID))
         return nullptr; // Bus id not available
 
     EbmModbus* bus = m_ebmModbuslist.at(busID);
@@ -97,28 +147,359 @@ EbmModbus *EbmModbusSystem::getBusByID(int busID)
 
 quint64 EbmModbusSystem::readHoldingRegister(int busID, quint16 adr, EbmModbus::EbmModbusHoldingRegister reg)
 {
-    Q_UNUSED(busID)
+    if (getBusByID(busID) == nullptr)
+        return 0;
+
     quint64 telegramID = getNewTelegramID();
-    emit signal_readHoldingRegisterData(telegramID, adr, reg);
+    queueRead(busID, adr, true, reg, telegramID);
     return telegramID;
 }
 
 quint64 EbmModbusSystem::writeHoldingRegister(int busID, quint16 adr, EbmModbus::EbmModbusHoldingRegister reg, quint16 rawdata)
 {
-    Q_UNUSED(busID)
+    if (getBusByID(busID) == nullptr)
+        return 0;   // There will never be a response
+
     quint64 telegramID = getNewTelegramID();
-    emit signal_writeHoldingRegisterData(telegramID, adr, reg, rawdata);
+
+    // Only the last value matters, so a pending write to the same register gets the new value and telegram id
+    QList<Request>& writes = m_lineQueues[busID].queues[PriorityWrite];
+    for (int i = 0; i < writes.count(); i++)
+    {
+        Request& pending = writes[i];
+        if ((pending.block.adr != adr) || (pending.block.startRegister != reg))
+            continue;
+
+        quint64 replacedTelegramID = pending.block.telegramIDs.first();
+        QList<quint64> replaced = m_replacedWrites.take(replacedTelegramID);
+        replaced.append(replacedTelegramID);
+        m_replacedWrites.insert(telegramID, replaced);
+
+        pending.block.telegramIDs[0] = telegramID;
+        pending.rawdata = rawdata;
+        m_replacedWriteCount++;
+        return telegramID;
+    }
+
+    Request request;
+    request.write = true;
+    request.holding = true;
+    request.block.adr = adr;
+    request.block.startRegister = reg;
+    request.block.count = 1;
+    request.block.telegramIDs.append(telegramID);
+    request.block.registers.append(reg);
+    request.rawdata = rawdata;
+    writes.append(request);
+
+    dispatchNextRequest(busID);
+
     return telegramID;
 }
 
 quint64 EbmModbusSystem::readInputRegister(int busID, quint16 adr, EbmModbus::EbmModbusInputRegister reg)
 {
-    Q_UNUSED(busID)
+    if (getBusByID(busID) == nullptr)
+        return 0;
+
     quint64 telegramID = getNewTelegramID();
-    emit signal_readInputRegisterData(telegramID, adr, reg);
+    queueRead(busID, adr, false, reg, telegramID);
     return telegramID;
 }
 
+// The line switches after the request in progress
+bool EbmModbusSystem::setLineParameters(int busID, int baudrate, char parity)
+{
+    EbmModbus* bus = getBusByID(busID);
+    if (bus == nullptr)
+        return false;
+
+    QMetaObject::invokeMethod(bus, "slot_changeLineParameters", Qt::QueuedConnection, Q_ARG(int, baudrate), Q_ARG(char, parity));
+
+    return true;
+}
+
+// The line starts with these parameters next time. Must only be called once the fans are known to answer at them.
+bool EbmModbusSystem::saveLineParameters(int busID, int baudrate, char parity)
+{
+    if (getBusByID(busID) == nullptr)
+        return false;
+
+    QDir().mkpath(QFileInfo(m_lineStateFile).absolutePath());
+    QSettings lineState(m_lineStateFile, QSettings::IniFormat);
+    lineState.beginGroup("lines");
+    lineState.setValue(m_interfaceKeys.at(busID) + "Baudrate", baudrate);
+    lineState.setValue(m_interfaceKeys.at(busID) + "Parity", QString(QChar(parity)));
+    lineState.endGroup();
+    lineState.sync();
+
+    if (lineState.status() != QSettings::NoError)
+    {
+        fprintf(stderr, "EbmModbusSystem::saveLineParameters(): Unable to write %s.\n", m_lineStateFile.toLocal8Bit().data());
+        return false;
+    }
+
+    return true;
+}
+
+quint64 EbmModbusSystem::getRegisterReadCount() const
+{
+    return m_registerReadCount;
+}
+
+quint64 EbmModbusSystem::getBlockReadCount() const
+{
+    return m_blockReadCount;
+}
+
+quint64 EbmModbusSystem::getFramesSaved() const
+{
+    return m_registerReadCount - m_blockReadCount;
+}
+
+int EbmModbusSystem::getSizeOfRequestQueue(int busID) const
+{
+    QHash<int, LineQueue>::const_iterator it = m_lineQueues.constFind(busID);
+    if (it == m_lineQueues.constEnd())
+        return 0;
+
+    int size = it.value().busy ? 1 : 0;
+    for (int priorityClass = 0; priorityClass < PriorityClassCount; priorityClass++)
+        size += it.value().queues[priorityClass].count();
+
+    return size;
+}
+
+int EbmModbusSystem::getSizeOfRequestQueue(int busID, EbmModbusSystem::PriorityClass priorityClass) const
+{
+    QHash<int, LineQueue>::const_iterator it = m_lineQueues.constFind(busID);
+    if (it == m_lineQueues.constEnd())
+        return 0;
+
+    return it.value().queues[priorityClass].count();
+}
+
+quint64 EbmModbusSystem::getReplacedWriteCount() const
+{
+    return m_replacedWriteCount;
+}
+
+quint64 EbmModbusSystem::getDroppedReadCount() const
+{
+    return m_droppedReadCount;
+}
+
+void EbmModbusSystem::queueRead(int busID, quint16 adr, bool holding, quint16 reg, quint64 telegramID)
+{
+    PendingRead read;
+    read.busID = busID;
+    read.adr = adr;
+    read.holding = holding;
+    read.reg = reg;
+    read.telegramID = telegramID;
+    m_pendingReads.append(read);
+    m_registerReadCount++;
+
+    if (!m_timer_coalesceReads.isActive())
+        m_timer_coalesceReads.start();
+}
+
+void EbmModbusSystem::slot_timer_coalesceReads_fired()
+{
+    // Group the reads by bus, slave and register type. Groups and the reads in them stay in request order.
+    QList<QList<PendingRead> > groups;
+    QHash<quint64, int> groupIndex;
+    foreach (PendingRead read, m_pendingReads)
+    {
+        quint64 key = ((quint64)(quint32)read.busID << 32) | ((quint64)read.holding << 16) | read.adr;
+        if (!groupIndex.contains(key))
+        {
+            groupIndex.insert(key, groups.count());
+            groups.append(QList<PendingRead>());
+        }
+        groups[groupIndex.value(key)].append(read);
+    }
+    m_pendingReads.clear();
+
+    foreach (QList<PendingRead> group, groups)
+    {
+        QMap<quint16, QList<PendingRead> > readsByRegister;     // Sorted by register
+        foreach (PendingRead read, group)
+            readsByRegister[read.reg].append(read);
+
+        QList<EbmModbus::RegisterBlock> blocks;
+        QMap<quint16, QList<PendingRead> >::const_iterator it = readsByRegister.constBegin();
+        while (it != readsByRegister.constEnd())
+        {
+            quint16 reg = it.key();
+            bool joinLastBlock = false;
+            if (!blocks.isEmpty())
+            {
+                const EbmModbus::RegisterBlock& last = blocks.last();
+                int gap = reg - (last.startRegister + last.count);
+                int length = reg - last.startRegister + 1;
+                joinLastBlock = (gap <= m_blockReadMaxGap) && (length <= m_blockReadMaxLength);
+            }
+
+            if (!joinLastBlock)
+            {
+                EbmModbus::RegisterBlock block;
+                block.adr = group.first().adr;
+                block.startRegister = reg;
+                block.count = 0;
+                blocks.append(block);
+            }
+
+            EbmModbus::RegisterBlock& block = blocks.last();
+            block.count = reg - block.startRegister + 1;
+            foreach (PendingRead read, it.value())
+            {
+                block.telegramIDs.append(read.telegramID);
+                block.registers.append(read.reg);
+            }
+            ++it;
+        }
+
+        // Results are emitted in request order, e.g. auxfans rely on the last requested register to be processed last.
+        // Telegram ids are increasing, so sorting them restores request order within and across the blocks.
+        QMap<quint64, EbmModbus::RegisterBlock> blocksInRequestOrder;
+        foreach (EbmModbus::RegisterBlock block, blocks)
+        {
+            QMap<quint64, quint16> registersByTelegramID;
+            for (int i = 0; i < block.telegramIDs.count(); i++)
+                registersByTelegramID.insert(block.telegramIDs.at(i), block.registers.at(i));
+            block.telegramIDs = registersByTelegramID.keys();
+            block.registers = registersByTelegramID.values();
+            blocksInRequestOrder.insert(block.telegramIDs.first(), block);
+        }
+
+        foreach (EbmModbus::RegisterBlock block, blocksInRequestOrder)
+            enqueueReadBlock(group.first().busID, group.first().holding, block);
+    }
+
+    foreach (int busID, m_lineQueues.keys())
+        dispatchNextRequest(busID);
+}
+
+void EbmModbusSystem::enqueueReadBlock(int busID, bool holding, EbmModbus::RegisterBlock block)
+{
+    if (!m_lineQueues.contains(busID))
+        return;     // Unknown bus, the reads expire in the transaction registry
+
+    LineQueue& lineQueue = m_lineQueues[busID];
+
+    // A register which is already waiting to be read is not read again. The waiting read answers for both telegram ids.
+    EbmModbus::RegisterBlock remaining = block;
+    remaining.telegramIDs.clear();
+    remaining.registers.clear();
+    for (int i = 0; i < block.telegramIDs.count(); i++)
+    {
+        quint16 reg = block.registers.at(i);
+        bool dropped = false;
+        for (int priorityClass = PrioritySpeed; (priorityClass < PriorityClassCount) && !dropped; priorityClass++)
+        {
+            QList<Request>& queue = lineQueue.queues[priorityClass];
+            for (int j = 0; j < queue.count(); j++)
+            {
+                EbmModbus::RegisterBlock& pending = queue[j].block;
+                if ((queue[j].holding != holding) || (pending.adr != block.adr) || (reg < pending.startRegister) || (reg >= pending.startRegister + pending.count))
+                    continue;
+                pending.telegramIDs.append(block.telegramIDs.at(i));
+                pending.registers.append(reg);
+                m_droppedReadCount++;
+                dropped = true;
+                break;
+            }
+        }
+        if (!dropped)
+        {
+            remaining.telegramIDs.append(block.telegramIDs.at(i));
+            remaining.registers.append(reg);
+        }
+    }
+
+    if (remaining.registers.isEmpty())
+        return;
+
+    // Shrink the block to the registers which are still needed
+    quint16 first = remaining.registers.first();
+    quint16 last = first;
+    foreach (quint16 reg, remaining.registers)
+    {
+        first = qMin(first, reg);
+        last = qMax(last, reg);
+    }
+    remaining.startRegister = first;
+    remaining.count = last - first + 1;
+
+    Request request;
+    request.write = false;
+    request.holding = holding;
+    request.block = remaining;
+    request.rawdata = 0;
+
+    PriorityClass priorityClass = PriorityDiagnostics;
+    if (!holding && remaining.registers.contains(EbmModbus::INPUT_REG_D010_ActualSpeed))
+        priorityClass = PrioritySpeed;
+    lineQueue.queues[priorityClass].append(request);
+
+    m_blockReadCount++;
+}
+
+void EbmModbusSystem::dispatchNextRequest(int busID)
+{
+    QHash<int, LineQueue>::iterator it = m_lineQueues.find(busID);
+    if ((it == m_lineQueues.end()) || it.value().busy)
+        return;
+
+    for (int priorityClass = 0; priorityClass < PriorityClassCount; priorityClass++)
+    {
+        QList<Request>& queue = it.value().queues[priorityClass];
+        if (queue.isEmpty())
+            continue;
+
+        EbmModbus* bus = getBusByID(busID);
+        Request request = queue.takeFirst();
+        it.value().busy = true;
+
+        if (request.write)
+            QMetaObject::invokeMethod(bus, "slot_writeHoldingRegisterData", Qt::QueuedConnection,
+                                      Q_ARG(quint64, request.block.telegramIDs.first()), Q_ARG(quint16, request.block.adr),
+                                      Q_ARG(EbmModbus::EbmModbusHoldingRegister, (EbmModbus::EbmModbusHoldingRegister)request.block.startRegister), Q_ARG(quint16, request.rawdata));
+        else if (request.holding)
+            QMetaObject::invokeMethod(bus, "slot_readHoldingRegisterBlock", Qt::QueuedConnection, Q_ARG(EbmModbus::RegisterBlock, request.block));
+        else
+            QMetaObject::invokeMethod(bus, "slot_readInputRegisterBlock", Qt::QueuedConnection, Q_ARG(EbmModbus::RegisterBlock, request.block));
+        return;
+    }
+}
+
+void EbmModbusSystem::slot_busTransactionFinished()
+{
+    int busID = m_busIDs.value(sender(), -1);
+    QHash<int, LineQueue>::iterator it = m_lineQueues.find(busID);
+    if (it == m_lineQueues.end())
+        return;
+
+    it.value().busy = false;
+    dispatchNextRequest(busID);
+}
+
+void EbmModbusSystem::slot_busTransactionLost(quint64 telegramID)
+{
+    emit signal_transactionLost(telegramID);
+    foreach (quint64 replacedTelegramID, m_replacedWrites.take(telegramID))
+        emit signal_transactionLost(replacedTelegramID);
+}
+
+void EbmModbusSystem::slot_busWroteHoldingRegisterData(quint64 telegramID)
+{
+    // Replaced writes are done as well, as their register holds a newer value now
+    emit signal_wroteHoldingRegisterData(telegramID);
+    foreach (quint64 replacedTelegramID, m_replacedWrites.take(telegramID))
+        emit signal_wroteHoldingRegisterData(replacedTelegramID);
+}
+
 
 quint64 EbmModbusSystem::getNewTelegramID()
 {
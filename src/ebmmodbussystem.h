@@ -19,6 +19,7 @@
 #include <QObject>
 #include <QThread>
 #include <QSettings>
+#include <QTimer>
 #include "loghandler.h"
 #include "ebmmodbus.h"
 
@@ -26,7 +27,8 @@ class EbmModbusSystem : public QObject
 {
     Q_OBJECT
 public:
-    explicit EbmModbusSystem(QObject *parent, Loghandler* loghandler);
+    // The settings file is only given by tests, the daemon uses the one in /etc
+    explicit EbmModbusSystem(QObject *parent, Loghandler* loghandler, QString settingsFile = "/etc/openffucontrol/ebmbus-cmd/ebmbus-cmd.ini");
     ~EbmModbusSystem();
 
     QList<EbmModbus*> *ebmModbuslist();
@@ -37,13 +39,71 @@ public:
     quint64 writeHoldingRegister(int busID, quint16 adr, EbmModbus::EbmModbusHoldingRegister reg, quint16 rawdata);
     quint64 readInputRegister(int busID, quint16 adr, EbmModbus::EbmModbusInputRegister reg);
 
+    bool setLineParameters(int busID, int baudrate, char parity);
+    bool saveLineParameters(int busID, int baudrate, char parity);
+
+    quint64 getRegisterReadCount() const;
+    quint64 getBlockReadCount() const;
+    quint64 getFramesSaved() const;
+
+    // Requests wait in a queue per line and are served by priority class. The line's worker only gets one request at a time.
+    typedef enum {
+        PriorityWrite,          // Register writes, e.g. setpoints
+        PrioritySpeed,          // Reads including the actual speed
+        PriorityDiagnostics,    // All other reads
+        PriorityClassCount
+    } PriorityClass;
+
+    int getSizeOfRequestQueue(int busID) const;     // Including the request in progress
+    int getSizeOfRequestQueue(int busID, PriorityClass priorityClass) const;
+    quint64 getReplacedWriteCount() const;
+    quint64 getDroppedReadCount() const;
 
 private:
     Loghandler* m_loghandler;
     QList<EbmModbus*> m_ebmModbuslist;
-    QThread m_workerThread;
+    QList<QThread*> m_workerThreads;     // One per line, same index as m_ebmModbuslist
+    QStringList m_interfaceKeys;         // Ini keys of the lines, same index as m_ebmModbuslist
+    QString m_lineStateFile;             // Line parameters negotiated by commissioning, the ini in /etc is never written
+
+    // Register reads issued within one event loop cycle are collected and merged into block reads
+    typedef struct {
+        int busID;
+        quint16 adr;
+        bool holding;
+        quint16 reg;
+        quint64 telegramID;
+    } PendingRead;
+
+    QList<PendingRead> m_pendingReads;
+    QTimer m_timer_coalesceReads;
+    int m_blockReadMaxGap;          // Number of unrequested registers which may be read to join two blocks
+    int m_blockReadMaxLength;
+    quint64 m_registerReadCount;
+    quint64 m_blockReadCount;
+
+    typedef struct {
+        bool write;
+        bool holding;
+        EbmModbus::RegisterBlock block;     // A write has one register and one telegram id
+        quint16 rawdata;
+    } Request;
+
+    typedef struct {
+        QList<Request> queues[PriorityClassCount];
+        bool busy;
+    } LineQueue;
+
+    QHash<int, LineQueue> m_lineQueues;
+    QHash<QObject*, int> m_busIDs;
+    QHash<quint64, QList<quint64> > m_replacedWrites;    // Telegram ids of writes which were replaced by a newer one
+    quint64 m_replacedWriteCount;
+    quint64 m_droppedReadCount;
 
     quint64 getNewTelegramID();
+    void queueRead(int busID, quint16 adr, bool holding, quint16 reg, quint64 telegramID);
+    void enqueueReadBlock(int busID, bool holding, EbmModbus::RegisterBlock block);
+    void dispatchNextRequest(int busID);
 
 signals:
 
@@ -54,15 +114,14 @@ signals:
     void signal_wroteHoldingRegisterData(quint64 telegramID);
 
 
-    // Outgoing signals to bus
-    void signal_writeHoldingRegisterData(quint64 telegramID, quint16 adr, EbmModbus::EbmModbusHoldingRegister reg, quint16 rawdata);
-    void signal_readHoldingRegisterData(quint64 telegramID, quint16 adr, EbmModbus::EbmModbusHoldingRegister reg);
-    void signal_readInputRegisterData(quint64 telegramID, quint16 adr, EbmModbus::EbmModbusInputRegister reg);
-
-
 public slots:
 
 private slots:
+    void slot_timer_coalesceReads_fired();
+    void slot_busTransactionFinished();
+    void slot_busTransactionLost(quint64 telegramID);
+    void slot_busWroteHoldingRegisterData(quint64 telegramID);
+
     // Signals coming from bus to this slots
 //    void slot_receivedHoldingRegisterData(quint64 telegramID, quint16 adr, EbmModbus::EbmModbusHoldingRegister reg, quint16 rawdata);
 //    void slot_receivedInputRegisterData(quint64 telegramID, quint16 adr, EbmModbus::EbmModbusInputRegister reg, quint16 rawdata);
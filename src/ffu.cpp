@@ -15,17 +15,17 @@
 
 #include "ffu.h"
 
-#include <QFile>
 #include <QString>
 #include <QStringList>
-#include <QDir>
 
-FFU::FFU(QObject *parent, EbmBusSystem* ebmbusSystem, Loghandler *loghandler) : QObject(parent)
+FFU::FFU(QObject *parent, EbmBusSystem* ebmbusSystem, TransactionRegistry *transactionRegistry, Loghandler *loghandler) : QObject(parent)
 {
     m_ebmbusSystem = ebmbusSystem;
+    m_transactionRegistry = transactionRegistry;
     m_loghandler = loghandler;
 
     m_dataChanged = false;
+    m_persistence = nullptr;
     setAutoSave(true);
 
     m_id = -1;
@@ -53,6 +53,9 @@ FFU::FFU(QObject *parent, EbmBusSystem* ebmbusSystem, Loghandler *loghandler) :
     m_actualData.dcVoltage = 0.0;
     m_actualData.temperatureOfPowerModule = 0;
 
+    m_linkState = LinkSuspect;      // Nothing heard yet, but give it a full poll first
+    m_consecutiveLostTelegrams = 0;
+
     m_configData.speedMax = 0;
     m_configData.speedMax_LSB_valid = false;
     m_configData.speedMax_MID_valid = false;
@@ -73,6 +76,13 @@ FFU::FFU(QObject *parent, EbmBusSystem* ebmbusSystem, Loghandler *loghandler) :
     m_configData.referenceDClinkCurrent = 0;
     m_configData.referenceDClinkCurrent_LSB_valid = false;
     m_configData.referenceDClinkCurrent_MSB_valid = false;
+    m_configDataCached = false;
+    m_verifyingSerialNumber = false;
+    m_cachedSerialNumber = 0;
+
+    m_pollingPlan = nullptr;
+    m_pollClock.start();
+    resetMetrics();
 }
 
 FFU::~FFU()
@@ -113,14 +123,15 @@ void FFU::setSpeedRaw(int value, bool refreshOnly)
             m_setpointSpeedRaw = value;
             m_dataChanged = true;
             emit signal_needsSaving();
+            m_metricInterval[FFUpollingPlan::MetricSetPoint] = 0;   // Verify the new setpoint with the next poll
         }
         if (isConfigured())
         {
-            EbmBus* bus = m_ebmbusSystem->getBusByID(m_busID);
+            EbmBusLine* bus = m_ebmbusSystem->getBusByID(m_busID);
             if (bus == nullptr)
                 return;     // Drop requests for non existing bus ids
 
-            m_transactionIDs.append(bus->setSpeedSetpoint(m_fanAddress, m_fanGroup, m_setpointSpeedRaw));
+            m_transactionRegistry->registerTransaction(bus->setSpeedSetpoint(m_fanAddress, m_fanGroup, m_setpointSpeedRaw), this, TransactionRegistry::RequestSetpoint);
         }
         else
         {
@@ -150,9 +161,31 @@ void FFU::setNmaxFromConfigData()
 
 void FFU::processConfigData()
 {
+    if (m_verifyingSerialNumber && m_configData.serialNumber_LSB_valid && m_configData.serialNumber_MID_valid && m_configData.serialNumber_MSB_valid)
+    {
+        m_verifyingSerialNumber = false;
+        if (m_configData.serialNumber != m_cachedSerialNumber)
+        {
+            // Another fan answers at this address, so the rest of the config data has to be read again
+            setConfigDataValid(false);
+            m_configData.serialNumber_LSB_valid = true;
+            m_configData.serialNumber_MID_valid = true;
+            m_configData.serialNumber_MSB_valid = true;
+            m_configDataCached = false;
+            return;
+        }
+    }
+
     if (!isConfigDataValid())
         return;
 
+    if (!m_configDataCached)
+    {
+        m_configDataCached = true;
+        m_dataChanged = true;
+        emit signal_needsSaving();
+    }
+
     setNmaxFromConfigData();
 }
 
@@ -263,6 +296,18 @@ QString FFU::getData(QString key)
     {
         return QString().sprintf("%i", m_actualData.temperatureOfPowerModule);
     }
+    else if (key == "linkState")
+    {
+        if (m_linkState == LinkOnline)
+            return "online";
+        else if (m_linkState == LinkSuspect)
+            return "suspect";
+        return "offline";
+    }
+    else if (key == "refreshAge")
+    {
+        return QString().sprintf("%lli", getRefreshAge());
+    }
 
     return "Error[FFU]: Key " + key + " not available";
 }
@@ -318,6 +363,7 @@ QStringList FFU::getActualKeys()
     QStringList keys;
 
     keys += "online";
+    keys += "linkState";
     keys += "lostTelegrams";
     keys += "lastSeen";
     keys += "speedSettingLostCount";
@@ -339,54 +385,161 @@ FFU::ActualData FFU::getActualData() const
     return m_actualData;
 }
 
-void FFU::requestStatus(bool actualSpeedOnly)
+int FFU::requestStatus(bool actualSpeedOnly)
 {
     if (!isConfigured())
-        return;
+        return 0;
 
-    EbmBus* bus = m_ebmbusSystem->getBusByID(m_busID);
+    EbmBusLine* bus = m_ebmbusSystem->getBusByID(m_busID);
     if (bus == nullptr)
-        return;
+        return 0;
 
-    if (!isConfigDataValid())
-        requestConfig();
+    int telegramCount = 0;
+
+    // Missing config data is requested by the poll scheduler, which limits the rate of those requests for the whole fleet
 
     if (!actualSpeedOnly)
     {
-        m_transactionIDs.append(bus->getStatus(m_fanAddress, m_fanGroup, EbmBusStatus::SetPoint));
-        m_transactionIDs.append(bus->getStatus(m_fanAddress, m_fanGroup, EbmBusStatus::MotorStatusLowByte));
-        m_transactionIDs.append(bus->getStatus(m_fanAddress, m_fanGroup, EbmBusStatus::MotorStatusHighByte));
-        m_transactionIDs.append(bus->getStatus(m_fanAddress, m_fanGroup, EbmBusStatus::Warnings));
-        m_transactionIDs.append(bus->getStatus(m_fanAddress, m_fanGroup, EbmBusStatus::DCvoltage));
-        m_transactionIDs.append(bus->getStatus(m_fanAddress, m_fanGroup, EbmBusStatus::DCcurrent));
-        m_transactionIDs.append(bus->getStatus(m_fanAddress, m_fanGroup, EbmBusStatus::TemperatureOfPowerModule));
+        qint64 now = m_pollClock.elapsed();
+
+        if (isMetricDue(FFUpollingPlan::MetricSetPoint, now))
+            telegramCount += registerStatusRequest(bus->getStatus(m_fanAddress, m_fanGroup, EbmBusStatus::SetPoint), FFUpollingPlan::MetricSetPoint, now);
+        if (isMetricDue(FFUpollingPlan::MetricMotorStatusLowByte, now))
+            telegramCount += registerStatusRequest(bus->getStatus(m_fanAddress, m_fanGroup, EbmBusStatus::MotorStatusLowByte), FFUpollingPlan::MetricMotorStatusLowByte, now);
+        if (isMetricDue(FFUpollingPlan::MetricMotorStatusHighByte, now))
+            telegramCount += registerStatusRequest(bus->getStatus(m_fanAddress, m_fanGroup, EbmBusStatus::MotorStatusHighByte), FFUpollingPlan::MetricMotorStatusHighByte, now);
+        if (isMetricDue(FFUpollingPlan::MetricWarnings, now))
+            telegramCount += registerStatusRequest(bus->getStatus(m_fanAddress, m_fanGroup, EbmBusStatus::Warnings), FFUpollingPlan::MetricWarnings, now);
+        if (isMetricDue(FFUpollingPlan::MetricDCvoltage, now))
+            telegramCount += registerStatusRequest(bus->getStatus(m_fanAddress, m_fanGroup, EbmBusStatus::DCvoltage), FFUpollingPlan::MetricDCvoltage, now);
+        if (isMetricDue(FFUpollingPlan::MetricDCcurrent, now))
+            telegramCount += registerStatusRequest(bus->getStatus(m_fanAddress, m_fanGroup, EbmBusStatus::DCcurrent), FFUpollingPlan::MetricDCcurrent, now);
+        if (isMetricDue(FFUpollingPlan::MetricTemperatureOfPowerModule, now))
+            telegramCount += registerStatusRequest(bus->getStatus(m_fanAddress, m_fanGroup, EbmBusStatus::TemperatureOfPowerModule), FFUpollingPlan::MetricTemperatureOfPowerModule, now);
     }
     bool highPriority = actualSpeedOnly;
-    m_transactionIDs.append(bus->getActualSpeed(m_fanAddress, m_fanGroup, highPriority));
+    m_transactionRegistry->registerTransaction(bus->getActualSpeed(m_fanAddress, m_fanGroup, highPriority), this, TransactionRegistry::RequestActualSpeed);
+    telegramCount++;
+
+    return telegramCount;
 }
 
-void FFU::requestConfig()
+int FFU::requestConfig()
 {
     if (!isConfigured())
-        return;
+        return 0;
 
-    EbmBus* bus = m_ebmbusSystem->getBusByID(m_busID);
+    EbmBusLine* bus = m_ebmbusSystem->getBusByID(m_busID);
     if (bus == nullptr)
-        return;
+        return 0;
+
+    int telegramCount = 0;
 
-    m_transactionIDs.append(bus->readEEPROM(m_fanAddress, m_fanGroup, EbmBusEEPROM::MaxSpeed_LSB));
-    m_transactionIDs.append(bus->readEEPROM(m_fanAddress, m_fanGroup, EbmBusEEPROM::MaxSpeed_Mid));
-    m_transactionIDs.append(bus->readEEPROM(m_fanAddress, m_fanGroup, EbmBusEEPROM::MaxSpeed_MSB));
-    m_transactionIDs.append(bus->readEEPROM(m_fanAddress, m_fanGroup, EbmBusEEPROM::ManufacturingDateCode_Day));
-    m_transactionIDs.append(bus->readEEPROM(m_fanAddress, m_fanGroup, EbmBusEEPROM::ManufacturingDateCode_Month));
-    m_transactionIDs.append(bus->readEEPROM(m_fanAddress, m_fanGroup, EbmBusEEPROM::ManufacturingDateCode_Year));
-    m_transactionIDs.append(bus->readEEPROM(m_fanAddress, m_fanGroup, EbmBusEEPROM::SerialNumber_Byte_0));
-    m_transactionIDs.append(bus->readEEPROM(m_fanAddress, m_fanGroup, EbmBusEEPROM::SerialNumber_Byte_1));
-    m_transactionIDs.append(bus->readEEPROM(m_fanAddress, m_fanGroup, EbmBusEEPROM::SerialNumber_Byte_2));
-    m_transactionIDs.append(bus->readEEPROM(m_fanAddress, m_fanGroup, EbmBusEEPROM::ReferenceDClinkVoltage_LSB));
-    m_transactionIDs.append(bus->readEEPROM(m_fanAddress, m_fanGroup, EbmBusEEPROM::ReferenceDClinkVoltage_MSB));
-    m_transactionIDs.append(bus->readEEPROM(m_fanAddress, m_fanGroup, EbmBusEEPROM::ReferenceDClinkCurrent_LSB));
-    m_transactionIDs.append(bus->readEEPROM(m_fanAddress, m_fanGroup, EbmBusEEPROM::ReferenceDClinkCurrent_MSB));
+    if (!m_configData.speedMax_LSB_valid)
+    {
+        m_transactionRegistry->registerTransaction(bus->readEEPROM(m_fanAddress, m_fanGroup, EbmBusEEPROM::MaxSpeed_LSB), this, TransactionRegistry::RequestConfig);
+        telegramCount++;
+    }
+    if (!m_configData.speedMax_MID_valid)
+    {
+        m_transactionRegistry->registerTransaction(bus->readEEPROM(m_fanAddress, m_fanGroup, EbmBusEEPROM::MaxSpeed_Mid), this, TransactionRegistry::RequestConfig);
+        telegramCount++;
+    }
+    if (!m_configData.speedMax_MSB_valid)
+    {
+        m_transactionRegistry->registerTransaction(bus->readEEPROM(m_fanAddress, m_fanGroup, EbmBusEEPROM::MaxSpeed_MSB), this, TransactionRegistry::RequestConfig);
+        telegramCount++;
+    }
+    if (!m_configData.manufacturingDateCode_Day_valid)
+    {
+        m_transactionRegistry->registerTransaction(bus->readEEPROM(m_fanAddress, m_fanGroup, EbmBusEEPROM::ManufacturingDateCode_Day), this, TransactionRegistry::RequestConfig);
+        telegramCount++;
+    }
+    if (!m_configData.manufacturingDateCode_Month_valid)
+    {
+        m_transactionRegistry->registerTransaction(bus->readEEPROM(m_fanAddress, m_fanGroup, EbmBusEEPROM::ManufacturingDateCode_Month), this, TransactionRegistry::RequestConfig);
+        telegramCount++;
+    }
+    if (!m_configData.manufacturingDateCode_Year_valid)
+    {
+        m_transactionRegistry->registerTransaction(bus->readEEPROM(m_fanAddress, m_fanGroup, EbmBusEEPROM::ManufacturingDateCode_Year), this, TransactionRegistry::RequestConfig);
+        telegramCount++;
+    }
+    if (!m_configData.serialNumber_LSB_valid)
+    {
+        m_transactionRegistry->registerTransaction(bus->readEEPROM(m_fanAddress, m_fanGroup, EbmBusEEPROM::SerialNumber_Byte_0), this, TransactionRegistry::RequestConfig);
+        telegramCount++;
+    }
+    if (!m_configData.serialNumber_MID_valid)
+    {
+        m_transactionRegistry->registerTransaction(bus->readEEPROM(m_fanAddress, m_fanGroup, EbmBusEEPROM::SerialNumber_Byte_1), this, TransactionRegistry::RequestConfig);
+        telegramCount++;
+    }
+    if (!m_configData.serialNumber_MSB_valid)
+    {
+        m_transactionRegistry->registerTransaction(bus->readEEPROM(m_fanAddress, m_fanGroup, EbmBusEEPROM::SerialNumber_Byte_2), this, TransactionRegistry::RequestConfig);
+        telegramCount++;
+    }
+    if (!m_configData.referenceDClinkVoltage_LSB_valid)
+    {
+        m_transactionRegistry->registerTransaction(bus->readEEPROM(m_fanAddress, m_fanGroup, EbmBusEEPROM::ReferenceDClinkVoltage_LSB), this, TransactionRegistry::RequestConfig);
+        telegramCount++;
+    }
+    if (!m_configData.referenceDClinkVoltage_MSB_valid)
+    {
+        m_transactionRegistry->registerTransaction(bus->readEEPROM(m_fanAddress, m_fanGroup, EbmBusEEPROM::ReferenceDClinkVoltage_MSB), this, TransactionRegistry::RequestConfig);
+        telegramCount++;
+    }
+    if (!m_configData.referenceDClinkCurrent_LSB_valid)
+    {
+        m_transactionRegistry->registerTransaction(bus->readEEPROM(m_fanAddress, m_fanGroup, EbmBusEEPROM::ReferenceDClinkCurrent_LSB), this, TransactionRegistry::RequestConfig);
+        telegramCount++;
+    }
+    if (!m_configData.referenceDClinkCurrent_MSB_valid)
+    {
+        m_transactionRegistry->registerTransaction(bus->readEEPROM(m_fanAddress, m_fanGroup, EbmBusEEPROM::ReferenceDClinkCurrent_MSB), this, TransactionRegistry::RequestConfig);
+        telegramCount++;
+    }
+
+    return telegramCount;
+}
+
+bool FFU::needsConfigData()
+{
+    return (isConfigured() && !isConfigDataValid());
+}
+
+int FFU::requestProbe()
+{
+    if (!isConfigured())
+        return 0;
+
+    EbmBusLine* bus = m_ebmbusSystem->getBusByID(m_busID);
+    if (bus == nullptr)
+        return 0;
+
+    m_transactionRegistry->registerTransaction(bus->getActualSpeed(m_fanAddress, m_fanGroup, false), this, TransactionRegistry::RequestActualSpeed);
+
+    return 1;
+}
+
+FFU::LinkState FFU::getLinkState() const
+{
+    return m_linkState;
+}
+
+qint64 FFU::getRefreshAge() const
+{
+    if (!m_refreshTimer.isValid())
+        return -1;
+
+    return m_refreshTimer.elapsed();
+}
+
+void FFU::setPollingPlan(const FFUpollingPlan *pollingPlan)
+{
+    m_pollingPlan = pollingPlan;
+    resetMetrics();
 }
 
 // Make shure m_setpointSpeedRaw is set to the desired value before calling this function
@@ -395,22 +548,22 @@ void FFU::setAutostart(bool enabled)
     if (!isConfigured())
         return;
 
-    EbmBus* bus = m_ebmbusSystem->getBusByID(m_busID);
+    EbmBusLine* bus = m_ebmbusSystem->getBusByID(m_busID);
     if (bus == nullptr)
         return;
 
     if (enabled)
     {
-        m_transactionIDs.append(bus->writeEEPROM(m_fanAddress, m_fanGroup, EbmBusEEPROM::OperationModes_1, 0x0b));
-        m_transactionIDs.append(bus->writeEEPROM(m_fanAddress, m_fanGroup, EbmBusEEPROM::SetTargetValue, m_setpointSpeedRaw));
-        m_transactionIDs.append(bus->softwareReset(m_fanAddress, m_fanGroup));
+        m_transactionRegistry->registerTransaction(bus->writeEEPROM(m_fanAddress, m_fanGroup, EbmBusEEPROM::OperationModes_1, 0x0b), this, TransactionRegistry::RequestEEPROMwrite);
+        m_transactionRegistry->registerTransaction(bus->writeEEPROM(m_fanAddress, m_fanGroup, EbmBusEEPROM::SetTargetValue, m_setpointSpeedRaw), this, TransactionRegistry::RequestEEPROMwrite);
+        m_transactionRegistry->registerTransaction(bus->softwareReset(m_fanAddress, m_fanGroup), this, TransactionRegistry::RequestSoftwareReset);
     }
     else
     {
-        m_transactionIDs.append(bus->writeEEPROM(m_fanAddress, m_fanGroup, EbmBusEEPROM::OperationModes_1, 0x03));
-        m_transactionIDs.append(bus->softwareReset(m_fanAddress, m_fanGroup));
+        m_transactionRegistry->registerTransaction(bus->writeEEPROM(m_fanAddress, m_fanGroup, EbmBusEEPROM::OperationModes_1, 0x03), this, TransactionRegistry::RequestEEPROMwrite);
+        m_transactionRegistry->registerTransaction(bus->softwareReset(m_fanAddress, m_fanGroup), this, TransactionRegistry::RequestSoftwareReset);
         // Now autostart is disabled, so set the ffu manually to the last known speed, because otherwise ffu will stop after the reset
-        m_transactionIDs.append(bus->setSpeedSetpoint(m_fanAddress, m_fanGroup, m_setpointSpeedRaw));
+        m_transactionRegistry->registerTransaction(bus->setSpeedSetpoint(m_fanAddress, m_fanGroup, m_setpointSpeedRaw), this, TransactionRegistry::RequestSetpoint);
     }
 }
 
@@ -419,10 +572,6 @@ void FFU::save()
     if (!m_dataChanged)
         return;
 
-    QFile file(myFilename());
-    if (!file.open(QIODevice::WriteOnly))
-        return;
-
     QString wdata;
 
     wdata.append(QString().sprintf("id=%i ", m_id));
@@ -432,34 +581,29 @@ void FFU::save()
     wdata.append(QString().sprintf("fanGroup=%i ", m_fanGroup));
     wdata.append(QString().sprintf("nmax=%.2lf ", m_speedMaxRPM));      // No need to save this anymore, as it is read from EEPROM in current version of this software
     wdata.append(QString().sprintf("setpointSpeedRaw=%i ", m_setpointSpeedRaw));
+    if (isConfigDataValid())
+    {
+        // Cache of the config data from EEPROM, so it does not need to be read again after a restart
+        wdata.append(QString().sprintf("serialNumber=%u ", m_configData.serialNumber));
+        wdata.append(QString().sprintf("speedMax=%i ", m_configData.speedMax));
+        wdata.append(QString().sprintf("manufacturingDate=%02i.%02i.%02i ", m_configData.manufacturingDateCode_Day, m_configData.manufacturingDateCode_Month, m_configData.manufacturingDateCode_Year));
+        wdata.append(QString().sprintf("referenceDClinkVoltage=%i ", m_configData.referenceDClinkVoltage));
+        wdata.append(QString().sprintf("referenceDClinkCurrent=%i ", m_configData.referenceDClinkCurrent));
+    }
     wdata.append(QString().sprintf("speedSettingLostCount=%i\n", m_actualData.speedSettingLostCount));    // Todo: decide when to save this. Do not write flash to dead!
 
+    m_dataChanged = false;
 
-    file.write(wdata.toUtf8());
-
-    file.close();
-}
-
-void FFU::setFiledirectory(QString path)
-{
-    if (!path.endsWith("/"))
-        path.append("/");
-    m_filepath = path;
-
-    QDir dir;
-    dir.mkpath(path);
+    if (m_persistence != nullptr)
+        m_persistence->write(myRecordKey(), wdata.toUtf8());
 }
 
-void FFU::load(QString filename)
+void FFU::load(const QByteArray &record)
 {
-    QFile file(filename);
-
-    if (!file.open(QIODevice::ReadOnly))
-        return;
-
-    QString rdata = QString().fromUtf8(file.readLine());
+    QString rdata = QString().fromUtf8(record).trimmed();
 
     QStringList dataList = rdata.split(" ");
+    int cachedConfigItems = 0;
     foreach (QString data, dataList)
     {
         QStringList pair = data.split("=");
@@ -494,9 +638,51 @@ void FFU::load(QString filename)
         {
             m_actualData.speedSettingLostCount = value.toInt();
         }
+
+        if (key == "serialNumber")
+        {
+            m_configData.serialNumber = value.toUInt();
+            cachedConfigItems++;
+        }
+
+        if (key == "speedMax")
+        {
+            m_configData.speedMax = value.toInt();
+            cachedConfigItems++;
+        }
+
+        if (key == "manufacturingDate")
+        {
+            QStringList date = value.split(".");
+            if (date.count() == 3)
+            {
+                m_configData.manufacturingDateCode_Day = date.at(0).toInt();
+                m_configData.manufacturingDateCode_Month = date.at(1).toInt();
+                m_configData.manufacturingDateCode_Year = date.at(2).toInt();
+                cachedConfigItems++;
+            }
+        }
+
+        if (key == "referenceDClinkVoltage")
+        {
+            m_configData.referenceDClinkVoltage = value.toInt();
+            cachedConfigItems++;
+        }
+
+        if (key == "referenceDClinkCurrent")
+        {
+            m_configData.referenceDClinkCurrent = value.toInt();
+            cachedConfigItems++;
+        }
     }
 
-    file.close();
+    // Only use the cached config data if it is complete
+    if (cachedConfigItems == 5)
+    {
+        setConfigDataValid(true);
+        m_configDataCached = true;
+        processConfigData();
+    }
 }
 
 void FFU::setAutoSave(bool on)
@@ -508,10 +694,15 @@ void FFU::setAutoSave(bool on)
         disconnect(this, SIGNAL(signal_needsSaving()), this, SLOT(slot_save()));
 }
 
+void FFU::setPersistence(Persistence *persistence)
+{
+    m_persistence = persistence;
+}
+
 void FFU::deleteFromHdd()
 {
-    QFile file(myFilename());
-    file.remove();
+    if (m_persistence != nullptr)
+        m_persistence->remove(myRecordKey());    // Also drops a pending write of this record
 }
 
 void FFU::deleteAllErrors()
@@ -520,21 +711,9 @@ void FFU::deleteAllErrors()
     m_loghandler->slot_entryGone(LogEntry::Warning, "FFU id=" + QString().setNum(m_id), "Warnings present.");
 }
 
-bool FFU::isThisYourTelegram(quint64 telegramID, bool deleteID)
-{
-    bool found = m_transactionIDs.contains(telegramID);
-
-    if (found && deleteID)
-    {
-        m_transactionIDs.removeOne(telegramID);
-    }
-
-    return found;
-}
-
-QString FFU::myFilename()
+QString FFU::myRecordKey()
 {
-    return (m_filepath + QString().sprintf("ffu-%06i.csv", m_id));
+    return QString().sprintf("ffu-%06i", m_id);
 }
 
 bool FFU::isConfigured()
@@ -566,6 +745,23 @@ bool FFU::isConfigDataValid()
     return true;
 }
 
+void FFU::setConfigDataValid(bool valid)
+{
+    m_configData.speedMax_LSB_valid = valid;
+    m_configData.speedMax_MID_valid = valid;
+    m_configData.speedMax_MSB_valid = valid;
+    m_configData.manufacturingDateCode_Day_valid = valid;
+    m_configData.manufacturingDateCode_Month_valid = valid;
+    m_configData.manufacturingDateCode_Year_valid = valid;
+    m_configData.serialNumber_LSB_valid = valid;
+    m_configData.serialNumber_MID_valid = valid;
+    m_configData.serialNumber_MSB_valid = valid;
+    m_configData.referenceDClinkVoltage_LSB_valid = valid;
+    m_configData.referenceDClinkVoltage_MSB_valid = valid;
+    m_configData.referenceDClinkCurrent_LSB_valid = valid;
+    m_configData.referenceDClinkCurrent_MSB_valid = valid;
+}
+
 void FFU::markAsOnline()
 {
     // If we reach this point we are going to parse a telegram for this ffu, so mark it as online
@@ -575,6 +771,72 @@ void FFU::markAsOnline()
         m_actualData.online = true;
     }
     m_actualData.lastSeen = QDateTime::currentDateTime();
+
+    m_consecutiveLostTelegrams = 0;
+    if (m_linkState != LinkOnline)
+    {
+        // The fan might have been replaced while it was offline, so check its serial number against the config data we have
+        if ((m_linkState == LinkOffline) && isConfigDataValid())
+        {
+            m_cachedSerialNumber = m_configData.serialNumber;
+            m_verifyingSerialNumber = true;
+            m_configData.serialNumber_LSB_valid = false;
+            m_configData.serialNumber_MID_valid = false;
+            m_configData.serialNumber_MSB_valid = false;
+        }
+
+        m_linkState = LinkOnline;
+        emit signal_linkStateChanged();
+    }
+}
+
+void FFU::resetMetrics()
+{
+    for (int metric = 0; metric < FFUpollingPlan::MetricCount; metric++)
+    {
+        m_metricLastRequest[metric] = -1;
+        m_metricInterval[metric] = 0;       // Read everything once, the intervals settle by themselves
+        m_metricLastRaw[metric] = -1;
+    }
+}
+
+bool FFU::isMetricDue(FFUpollingPlan::Metric metric, qint64 now) const
+{
+    if (m_pollingPlan == nullptr)
+        return true;
+
+    if (m_metricLastRequest[metric] < 0)
+        return true;
+
+    return ((now - m_metricLastRequest[metric]) >= m_metricInterval[metric]);
+}
+
+int FFU::registerStatusRequest(quint64 telegramID, FFUpollingPlan::Metric metric, qint64 now)
+{
+    m_transactionRegistry->registerTransaction(telegramID, this, TransactionRegistry::RequestStatus);
+    m_metricLastRequest[metric] = now;
+    return 1;
+}
+
+// A changing value is read with every poll, a stable one doubles its interval up to the one given by the plan
+void FFU::updateMetric(int metric, quint8 rawValue)
+{
+    if ((metric < 0) || (m_pollingPlan == nullptr))
+        return;
+
+    FFUpollingPlan::Metric planMetric = (FFUpollingPlan::Metric)metric;
+
+    if ((m_metricLastRaw[metric] >= 0) && (qAbs(rawValue - m_metricLastRaw[metric]) >= m_pollingPlan->threshold(planMetric)))
+    {
+        m_metricInterval[metric] = 0;
+        m_metricLastRaw[metric] = rawValue;
+        return;
+    }
+
+    if (m_metricLastRaw[metric] < 0)
+        m_metricLastRaw[metric] = rawValue;
+
+    m_metricInterval[metric] = qMin(m_pollingPlan->interval(planMetric), qMax(m_metricInterval[metric] * 2, 1000));
 }
 
 void FFU::slot_save()
@@ -594,6 +856,7 @@ void FFU::setBusID(int busID)
         m_busID = busID;
         m_dataChanged = true;
         emit signal_needsSaving();
+        emit signal_addressChanged();
     }
 }
 
@@ -628,6 +891,7 @@ void FFU::setFanAddress(int fanAddress)
         m_fanAddress = fanAddress;
         m_dataChanged = true;
         emit signal_needsSaving();
+        emit signal_addressChanged();
     }
 }
 
@@ -643,6 +907,7 @@ void FFU::setFanGroup(int fanGroup)
         m_fanGroup = fanGroup;
         m_dataChanged = true;
         emit signal_needsSaving();
+        emit signal_addressChanged();
     }
 }
 
@@ -660,6 +925,14 @@ void FFU::slot_transactionLost(quint64 id)
         m_actualData.online = false;
         emit signal_FFUactualDataHasChanged(m_id);
     }
+
+    m_consecutiveLostTelegrams++;
+    LinkState linkState = (m_consecutiveLostTelegrams >= OfflineAfterLostTelegrams) ? LinkOffline : LinkSuspect;
+    if (linkState != m_linkState)
+    {
+        m_linkState = linkState;
+        emit signal_linkStateChanged();
+    }
     if (m_actualData.lostTelegrams % 100 == 0)
         emit signal_FFUactualDataHasChanged(m_id);
 }
@@ -684,6 +957,7 @@ void FFU::slot_status(quint64 telegramID, quint8 fanAddress, quint8 fanGroup, qu
         return;
 
     markAsOnline();
+    updateMetric(FFUpollingPlan::metricOf(statusAddress), rawValue);
 
     switch (statusAddress)
     {
@@ -774,6 +1048,8 @@ void FFU::slot_actualSpeed(quint64 telegramID, quint8 fanAddress, quint8 fanGrou
     markAsOnline();
 
     m_actualData.speedReading = actualRawSpeed;
+    m_refreshTimer.start();
+    emit signal_actualSpeedReceived(m_id);
     emit signal_FFUactualDataHasChanged(m_id);          // actualSpeed is the last data we get from automatic query, so signal new data now
 }
 
@@ -19,16 +19,28 @@
 #include <QObject>
 #include <QMap>
 #include <QDateTime>
+#include <QElapsedTimer>
 #include "ebmbussystem.h"
+#include "transactionregistry.h"
+#include "ffupollingplan.h"
+#include "persistence.h"
 #include "loghandler.h"
 
 class FFU : public QObject
 {
     Q_OBJECT
 public:
-    explicit FFU(QObject *parent, EbmBusSystem *ebmbusSystem, Loghandler* loghandler);
+    explicit FFU(QObject *parent, EbmBusSystem *ebmbusSystem, TransactionRegistry* transactionRegistry, Loghandler* loghandler);
     ~FFU();
 
+    typedef enum {
+        LinkOnline,     // Last telegram has been answered
+        LinkSuspect,    // Some telegrams lost in a row, still polled completely
+        LinkOffline     // Too many telegrams lost in a row, only probed
+    } LinkState;
+
+    static const int OfflineAfterLostTelegrams = 3;
+
     typedef struct {
         bool online;
         quint64 lostTelegrams;
@@ -102,31 +114,43 @@ public:
     QStringList getActualKeys();
     ActualData getActualData() const;
 
-    // This function triggers bus requests to get actual values, status, warnings ans errors
-    void requestStatus(bool actualSpeedOnly = false);
+    // This function triggers bus requests to get actual values, status, warnings ans errors. Returns the number of telegrams sent.
+    int requestStatus(bool actualSpeedOnly = false);
+
+    // This function triggers bus requests to get the missing config data from the ffu. Returns the number of telegrams sent.
+    int requestConfig();
+    bool needsConfigData();
+
+    // This function sends a single actual speed request to check if an offline ffu is back. Returns the number of telegrams sent.
+    int requestProbe();
+
+    LinkState getLinkState() const;
 
-    // This function triggers bus requests to get the necessary config data from the ffu
-    void requestConfig();
+    // Milliseconds since the last actual speed response, -1 if there was none yet
+    qint64 getRefreshAge() const;
+
+    // Status fields are only requested as often as the plan says. Without a plan all fields are read with every poll.
+    void setPollingPlan(const FFUpollingPlan* pollingPlan);
 
     // This enables automatic startup of the fan. Be carful: If set, each setpoint change results in a writecycle of the eeprom
     void setAutostart(bool enabled);
 
     void save();
-    void setFiledirectory(QString path);
-    void load(QString filename);
+    void load(const QByteArray& record);
 
     void setAutoSave(bool on);
 
+    // Records are written to the device journal by persistence in the background. Without persistence nothing is saved.
+    void setPersistence(Persistence* persistence);
+
     void deleteFromHdd();
     void deleteAllErrors();
 
-    bool isThisYourTelegram(quint64 telegramID, bool deleteID = true);
-
 
 private:
     EbmBusSystem* m_ebmbusSystem;
     Loghandler* m_loghandler;
-    QList<quint64> m_transactionIDs;
+    TransactionRegistry* m_transactionRegistry;
 
     int m_id;
     int m_setpointSpeedRaw;
@@ -140,17 +164,35 @@ private:
 
     ActualData m_actualData;
     ConfigData m_configData;
+    LinkState m_linkState;
+    int m_consecutiveLostTelegrams;
+    bool m_configDataCached;            // Config data is saved in the ffu file
+    bool m_verifyingSerialNumber;       // Serial number is read again to check if the config data still belongs to this fan
+    quint32 m_cachedSerialNumber;
+    QElapsedTimer m_refreshTimer;
+
+    const FFUpollingPlan* m_pollingPlan;
+    QElapsedTimer m_pollClock;
+    qint64 m_metricLastRequest[FFUpollingPlan::MetricCount];    // Unit ms of m_pollClock, -1 if never requested
+    int m_metricInterval[FFUpollingPlan::MetricCount];          // Actual interval, shortened while the value is changing
+    int m_metricLastRaw[FFUpollingPlan::MetricCount];           // -1 if not received yet
 
     bool m_dataChanged;
     bool m_autosave;
-    QString m_filepath;
+    Persistence* m_persistence;
 
-    QString myFilename();
+    QString myRecordKey();
 
     bool isConfigured();    // Returns false if either fanAddress or fanGroup or busID is not set
     bool isConfigDataValid();
+    void setConfigDataValid(bool valid);
     void markAsOnline();
 
+    void resetMetrics();
+    bool isMetricDue(FFUpollingPlan::Metric metric, qint64 now) const;
+    int registerStatusRequest(quint64 telegramID, FFUpollingPlan::Metric metric, qint64 now);
+    void updateMetric(int metric, quint8 rawValue);
+
     void setNmax(int maxRpm);
     void setNmaxFromConfigData();
 
@@ -159,7 +201,10 @@ private:
 
 signals:
     void signal_needsSaving();
+    void signal_addressChanged();   // Emitted if busID, fanAddress or fanGroup changed
+    void signal_linkStateChanged();
     void signal_FFUactualDataHasChanged(int id);
+    void signal_actualSpeedReceived(int id);    // Only for new speed readings, actual data also changes on lost telegrams
 
 public slots:
     // High level bus response slots
@@ -15,16 +15,21 @@
 
 #include "ffudatabase.h"
 
-FFUdatabase::FFUdatabase(QObject *parent, EbmBusSystem *ebmbusSystem, Loghandler *loghandler) : QObject(parent)
+FFUdatabase::FFUdatabase(QObject *parent, EbmBusSystem *ebmbusSystem, Persistence *persistence, Loghandler *loghandler) : QObject(parent)
 {
     m_ebmbusSystem = ebmbusSystem;
 
     m_ebmbuslist = ebmbusSystem->ebmbuslist();  // Try to eliminate the use of ebmbuslist here later!
 
+    m_persistence = persistence;
     m_loghandler = loghandler;
 
-    foreach (EbmBus* ebmBus, *m_ebmbuslist)
+    m_unsolicitedResponseCount = 0;
+
+    foreach (EbmBusLine* ebmBus, *m_ebmbuslist)
     {
+        m_busIDs.insert(ebmBus, m_busIDs.count());
+
         // Bus management connections
         connect(ebmBus, SIGNAL(signal_DaisyChainAdressingFinished()), this, SLOT(slot_DaisyChainAdressingFinished()));
         connect(ebmBus, SIGNAL(signal_DaisyChainAddressingGotSerialNumber(quint8,quint8,quint8,quint32)), this, SLOT(slot_DaisyChainAddressingGotSerialNumber(quint8,quint8,quint8,quint32)));
@@ -43,60 +48,54 @@ FFUdatabase::FFUdatabase(QObject *parent, EbmBusSystem *ebmbusSystem, Loghandler
         connect (ebmBus, SIGNAL(signal_transactionLost(quint64)), this, SLOT(slot_transactionLost(quint64)));
     }
 
-    // Timer for fast motor speed polling sequence
-    m_timer_fastSpeedPolling.setSingleShot(true);
-    m_timer_fastSpeedPolling.setInterval(30000);    // 30 Seconds of fast polling
+    // Cyclic poll task to get the status of ffus
+    m_pollingPlan.loadFromSettings();
+    m_pollScheduler = new FFUpollScheduler(this, m_ebmbuslist, &m_transactionRegistry);
 
-    // Timer for cyclic poll task to get the status of ffus
-    connect(&m_timer_pollStatus, SIGNAL(timeout()), this, SLOT(slot_timer_pollStatus_fired()));
-    m_timer_pollStatus.setInterval(2000);
-    m_timer_pollStatus.start();
+    // Timer to end fast motor speed polling of ffus which did not reach their setpoint in time
+    connect(&m_timer_fastSpeedPolling, SIGNAL(timeout()), this, SLOT(slot_timer_fastSpeedPolling_fired()));
+    m_timer_fastSpeedPolling.setInterval(1000);
+    m_fastSpeedPollingClock.start();
 }
 
 void FFUdatabase::loadFromHdd()
 {
-    QString directory = "/var/openffucontrol/ffus/";
-    QDirIterator iterator(directory, QStringList() << "*.csv", QDir::Files, QDirIterator::NoIteratorFlags);
-
-    QStringList filepaths;
-
-    while(iterator.hasNext())
-    {
-        filepaths.append(iterator.next());
-    }
-
-    filepaths.sort();
+    QMap<QString, QByteArray> records = m_persistence->takeRecords("ffu-");
+    if (records.isEmpty())
+        records = m_persistence->importFiles("/var/openffucontrol/ffus/");
 
-    foreach(QString filepath, filepaths)
+    foreach(QByteArray record, records)
     {
-        FFU* newFFU = new FFU(this, m_ebmbusSystem, m_loghandler);
-        newFFU->load(filepath);
-        newFFU->setFiledirectory(directory);
+        FFU* newFFU = new FFU(this, m_ebmbusSystem, &m_transactionRegistry, m_loghandler);
+        newFFU->setPollingPlan(&m_pollingPlan);
+        newFFU->load(record);
+        newFFU->setPersistence(m_persistence);
         connect(newFFU, SIGNAL(signal_FFUactualDataHasChanged(int)), this, SIGNAL(signal_FFUactualDataHasChanged(int)));
+        connect(newFFU, SIGNAL(signal_actualSpeedReceived(int)), this, SLOT(slot_FFUactualSpeedReceived(int)));
+        connect(newFFU, SIGNAL(signal_addressChanged()), this, SLOT(slot_FFUaddressChanged()));
         m_ffus.append(newFFU);
+        indexFFU(newFFU);
     }
 }
 
 void FFUdatabase::saveToHdd()
 {
-    QString path = "/var/openffucontrol/ffus/";
-
-    foreach (FFU* ffu, m_ffus)
+    foreach (FFU* ffu, m_ffus.list())
     {
-        ffu->setFiledirectory(path);
         ffu->save();
     }
 }
 
-QList<EbmBus *>* FFUdatabase::getBusList()
+QList<EbmBusLine*>* FFUdatabase::getBusList()
 {
     return m_ebmbuslist;
 }
 
 QString FFUdatabase::addFFU(int id, int busID, int unit, int fanAddress, int fanGroup)
 {
-    FFU* newFFU = new FFU(this, m_ebmbusSystem, m_loghandler);
-    newFFU->setFiledirectory("/var/openffucontrol/ffus/");
+    FFU* newFFU = new FFU(this, m_ebmbusSystem, &m_transactionRegistry, m_loghandler);
+    newFFU->setPollingPlan(&m_pollingPlan);
+    newFFU->setPersistence(m_persistence);
     newFFU->setAutoSave(false);
     newFFU->setId(id);
     newFFU->setBusID(busID);
@@ -106,7 +105,10 @@ QString FFUdatabase::addFFU(int id, int busID, int unit, int fanAddress, int fan
     newFFU->setAutoSave(true);
     newFFU->save();
     connect(newFFU, SIGNAL(signal_FFUactualDataHasChanged(int)), this, SIGNAL(signal_FFUactualDataHasChanged(int)));
+    connect(newFFU, SIGNAL(signal_actualSpeedReceived(int)), this, SLOT(slot_FFUactualSpeedReceived(int)));
+    connect(newFFU, SIGNAL(signal_addressChanged()), this, SLOT(slot_FFUaddressChanged()));
     m_ffus.append(newFFU);
+    indexFFU(newFFU);
 
     return "OK[FFUdatabase]: Added FFU ID " + QString().setNum(id);
 }
@@ -117,10 +119,15 @@ QString FFUdatabase::deleteFFU(int id)
     if (ffu == nullptr)
         return "Warning[FFUdatabase]: ID " + QString().setNum(id) + " not found.";
 
-    bool ok = m_ffus.removeOne(ffu);
+    bool ok = m_ffus.remove(ffu);
     if (ok)
     {
         disconnect(ffu, SIGNAL(signal_FFUactualDataHasChanged(int)), this, SIGNAL(signal_FFUactualDataHasChanged(int)));
+        disconnect(ffu, SIGNAL(signal_actualSpeedReceived(int)), this, SLOT(slot_FFUactualSpeedReceived(int)));
+        stopFastSpeedPolling(ffu);
+        disconnect(ffu, SIGNAL(signal_addressChanged()), this, SLOT(slot_FFUaddressChanged()));
+        unindexFFU(ffu);
+        m_transactionRegistry.removeOwner(ffu);
         ffu->deleteFromHdd();
         ffu->deleteAllErrors();
         delete ffu;
@@ -131,53 +138,141 @@ QString FFUdatabase::deleteFFU(int id)
 
 QList<FFU *> FFUdatabase::getFFUs(int busNr)
 {
-    QList<FFU *> ffuList;
     if (busNr == -1)
-        return m_ffus;
-    else
-    {
-        foreach (FFU* ffu, m_ffus) {
-            if (ffu->getBusID() == busNr)
-                ffuList.append(ffu);
-        }
-    }
+        return m_ffus.list();
 
-    return ffuList;
+    return m_ffusPerBus.value(busNr).list();
 }
 
 FFU *FFUdatabase::getFFUbyID(int id)
 {
-    foreach (FFU* ffu, m_ffus)
+    return m_ffusByID.value(id, nullptr);    // nullptr if not found
+}
+
+FFU *FFUdatabase::getFFUbyAddress(int busID, int fanAddress, int fanGroup)
+{
+    return m_ffusByAddress.value(addressKey(busID, fanAddress, fanGroup), nullptr);
+}
+
+FFU *FFUdatabase::getFFUbyTelegramID(quint64 telegramID)
+{
+    // Returns nullptr if the transactionID was not initiated by ffu requests, so it came frome somebody else
+    return qobject_cast<FFU*>(m_transactionRegistry.takeOwner(telegramID));
+}
+
+// Responses are dispatched by the address they came from. The telegram id is taken out of the registry anyway
+// to keep it clean and serves as fallback, e.g. if the address of an ffu has changed while a telegram was in flight.
+FFU *FFUdatabase::getFFUbyResponse(QObject *bus, quint64 telegramID, quint8 fanAddress, quint8 fanGroup)
+{
+    FFU* owner = getFFUbyTelegramID(telegramID);
+
+    int busID = m_busIDs.value(qobject_cast<EbmBusLine*>(bus), -1);
+    FFU* ffu = getFFUbyAddress(busID, fanAddress, fanGroup);
+    if (ffu != nullptr)
+        return ffu;
+
+    if (owner == nullptr)
     {
-        if (ffu->getId() == id)
-            return ffu;
+        // Nobody asked for that response and nobody lives at that address, e.g. broadcasts or dci addressing
+        m_unsolicitedResponseCount++;
+#ifdef QT_DEBUG
+        printf("FFUdatabase: Unsolicited response ID: %llu bus: %i fanAddress: %i fanGroup: %i\n", telegramID, busID, fanAddress, fanGroup);
+        fflush(stdout);
+#endif
     }
-    return nullptr;    // Not found
+
+    return owner;
 }
 
-FFU *FFUdatabase::getFFUbyTelegramID(quint64 telegramID)
+Persistence *FFUdatabase::getPersistence()
+{
+    return m_persistence;
+}
+
+TransactionRegistry *FFUdatabase::getTransactionRegistry()
+{
+    return &m_transactionRegistry;
+}
+
+FFUpollScheduler *FFUdatabase::getPollScheduler()
+{
+    return m_pollScheduler;
+}
+
+EbmBusSystem *FFUdatabase::getEbmBusSystem()
+{
+    return m_ebmbusSystem;
+}
+
+quint64 FFUdatabase::getUnsolicitedResponseCount() const
+{
+    return m_unsolicitedResponseCount;
+}
+
+quint32 FFUdatabase::addressKey(int busID, int fanAddress, int fanGroup)
+{
+    return ((quint32)(busID & 0xFFFF) << 16) | ((quint32)(fanGroup & 0xFF) << 8) | (quint32)(fanAddress & 0xFF);
+}
+
+void FFUdatabase::indexFFU(FFU *ffu)
+{
+    unindexFFU(ffu);
+
+    m_ffusByID.insert(ffu->getId(), ffu);
+
+    m_ffusPerBus[ffu->getBusID()].append(ffu);
+    m_indexedBusIDs.insert(ffu, ffu->getBusID());
+
+    m_pollScheduler->addFFU(ffu);
+
+    if ((ffu->getBusID() < 0) || (ffu->getFanAddress() < 0) || (ffu->getFanGroup() < 0))
+        return;     // Not configured yet, so it can not answer anyway
+
+    quint32 key = addressKey(ffu->getBusID(), ffu->getFanAddress(), ffu->getFanGroup());
+    m_ffusByAddress.insert(key, ffu);
+    m_addressKeys.insert(ffu, key);
+}
+
+void FFUdatabase::unindexFFU(FFU *ffu)
 {
-    foreach (FFU* ffu, m_ffus) {
-        bool found = ffu->isThisYourTelegram(telegramID);
-        if (found)
+    m_pollScheduler->removeFFU(ffu);
+
+    // Only remove id and address entries if they still point to this ffu, another one might have been configured the same way
+    if (m_ffusByID.value(ffu->getId(), nullptr) == ffu)
+        m_ffusByID.remove(ffu->getId());
+
+    QHash<FFU*, int>::iterator busIt = m_indexedBusIDs.find(ffu);
+    if (busIt != m_indexedBusIDs.end())
+    {
+        QMap<int, IndexedList<FFU*>>::iterator listIt = m_ffusPerBus.find(busIt.value());
+        if (listIt != m_ffusPerBus.end())
         {
-            return ffu;
+            listIt.value().remove(ffu);
+            if (listIt.value().isEmpty())
+                m_ffusPerBus.erase(listIt);
         }
+        m_indexedBusIDs.erase(busIt);
     }
 
-    return nullptr;    // TransactionID not initiated by ffu requests, so it came frome somebody else
+    QHash<FFU*, quint32>::iterator it = m_addressKeys.find(ffu);
+    if (it == m_addressKeys.end())
+        return;
+
+    if (m_ffusByAddress.value(it.value(), nullptr) == ffu)
+        m_ffusByAddress.remove(it.value());
+    m_addressKeys.erase(it);
 }
 
 void FFUdatabase::slot_remoteControlActivated()
 {
-    foreach (FFU* ffu, m_ffus) {
+    foreach (FFU* ffu, m_ffus.list()) {
         ffu->setRemoteControlled(true);
     }
 }
 
 void FFUdatabase::slot_remoteControlDeactivated()
 {
-    foreach (FFU* ffu, m_ffus) {
+    foreach (FFU* ffu, m_ffus.list()) {
         ffu->setRemoteControlled(false);
     }
 }
@@ -223,7 +318,7 @@ QString FFUdatabase::setFFUdata(int id, QString key, QString value)
         return "Warning[FFUdatabase]: ID " + QString().setNum(id) + " not found.";
 
     if ((key == "nSet") || (key == "rawspeed"))
-        slot_startFastSpeedPollingSequence();
+        startFastSpeedPolling(QList<FFU*>() << ffu);
 
     ffu->setData(key, value);
     return "OK[FFUdatabase]: Setting " + key + " to " + value;
@@ -236,7 +331,7 @@ QString FFUdatabase::setFFUdata(int id, QMap<QString, QString> dataMap)
         return "Warning[FFUdatabase]: ID " + QString().setNum(id) + " not found.";
 
     if (dataMap.keys().contains("nSet") || dataMap.keys().contains("rawspeed"))
-        slot_startFastSpeedPollingSequence();
+        startFastSpeedPolling(QList<FFU*>() << ffu);
 
     QString dataString;
 
@@ -283,8 +378,10 @@ QString FFUdatabase::startDCIaddressing(int busID, QString startAddress, QString
         m_unitIdsPerBus.remove(busID);
         m_unitIdsPerBus.insert(busID, ids);
 
-        m_timer_pollStatus.stop();  // Stop polling units on bus while addressing is in progress
+        m_pollScheduler->setBusPaused(busID, true);  // Stop polling units on bus while addressing is in progress
         m_ebmbuslist->at(busID)->clearTelegramQueue(false); // Drop all pending packets from standard priority queue
+        foreach (FFU* ffu, m_ffusPerBus.value(busID).list())
+            m_transactionRegistry.removeOwner(ffu);         // Those will never be answered
         m_ebmbuslist->at(busID)->startDaisyChainAddressing();
     }
     return "OK[FFUdatabase]: Starting DCI addressing at bus " + QString().setNum(busID) + ". Ignoring startAddress at the moment. Will be fixed later.";
@@ -292,48 +389,50 @@ QString FFUdatabase::startDCIaddressing(int busID, QString startAddress, QString
 
 QString FFUdatabase::broadcast(int busID, QMap<QString, QString> dataMap)
 {
-    if (dataMap.keys().contains("nSet") || dataMap.keys().contains("rawspeed"))
-        slot_startFastSpeedPollingSequence();
+    // A broadcast does not change the setpoints of the ffus, so the speed to converge to is given here
+    if (dataMap.keys().contains("rawspeed"))
+        startFastSpeedPolling(m_ffusPerBus.value(busID).list(), dataMap.value("rawspeed").toInt());
     return m_ebmbusSystem->broadcast(busID, dataMap);
 }
 
 void FFUdatabase::slot_DaisyChainAdressingFinished()
 {
-    int i = 0;
-    QObject* obj = sender();    // Look up who sent that signal
-    foreach (EbmBus* ebmBus, *m_ebmbuslist) {
-        if (ebmBus == qobject_cast<EbmBus*>(obj))
-        {
-            emit signal_DCIaddressingFinished(i);   // And now globally tell everybody which bus finished addressing
-            m_unitIdsPerBus.remove(i);              // And clean up temporary storage for new unit ids
-        }
-        i++;
+    int i = m_busIDs.value(qobject_cast<EbmBusLine*>(sender()), -1);    // Look up who sent that signal
+    if (i != -1)
+    {
+        emit signal_DCIaddressingFinished(i);   // And now globally tell everybody which bus finished addressing
+        m_unitIdsPerBus.remove(i);              // And clean up temporary storage for new unit ids
+        m_pollScheduler->setBusPaused(i, false);    // Start polling again
     }
-    m_timer_pollStatus.start();                     // Start polling again
 }
 
 void FFUdatabase::slot_DaisyChainAddressingGotSerialNumber(quint8 unit, quint8 fanAddress, quint8 fanGroup, quint32 serialNumber)
 {
-    int i = 0;
-    QObject* obj = sender();    // Look up who sent that signal
-    foreach (EbmBus* ebmBus, *m_ebmbuslist) {
-        if (ebmBus == qobject_cast<EbmBus*>(obj))
-        {
-            // Try to lookup unit id from given list
-            int id = -1;
-            QList<int> idList = m_unitIdsPerBus.value(i);
-            if (!idList.isEmpty())
-            {
-                id = idList.takeFirst();
-                m_unitIdsPerBus.insert(i, idList);
-                this->addFFU(id, i, unit, fanAddress, fanGroup);
+    int i = m_busIDs.value(qobject_cast<EbmBusLine*>(sender()), -1);    // Look up who sent that signal
+    if (i == -1)
+        return;
 
-            }
+    // Try to lookup unit id from given list
+    int id = -1;
+    QList<int> idList = m_unitIdsPerBus.value(i);
+    if (!idList.isEmpty())
+    {
+        id = idList.takeFirst();
+        m_unitIdsPerBus.insert(i, idList);
+        this->addFFU(id, i, unit, fanAddress, fanGroup);
 
-            emit signal_DCIaddressingGotSerialNumber(i, unit, fanAddress, fanGroup, serialNumber);   // And now globally tell everybody the serialnumber
-        }
-        i++;
     }
+
+    emit signal_DCIaddressingGotSerialNumber(i, unit, fanAddress, fanGroup, serialNumber);   // And now globally tell everybody the serialnumber
+}
+
+void FFUdatabase::slot_FFUaddressChanged()
+{
+    FFU* ffu = qobject_cast<FFU*>(sender());
+    if (ffu == nullptr)
+        return;
+
+    indexFFU(ffu);
 }
 
 void FFUdatabase::slot_gotResponseRaw(quint64 telegramID, quint8 preamble, quint8 commandAndFanaddress, quint8 fanGroup, QByteArray data)
@@ -366,10 +465,10 @@ void FFUdatabase::slot_transactionLost(quint64 telegramID)
 
 void FFUdatabase::slot_simpleStatus(quint64 telegramID, quint8 fanAddress, quint8 fanGroup, QString status)
 {
-    FFU* ffu = getFFUbyTelegramID(telegramID);
+    FFU* ffu = getFFUbyResponse(sender(), telegramID, fanAddress, fanGroup);
     if (ffu == nullptr)
     {
-        // Somebody other than the ffu requested that response, so do nothing with the response at this point
+        // Nobody requested that response and no ffu is configured at that address, so do nothing with the response at this point
         return;
     }
     ffu->slot_simpleStatus(telegramID, fanAddress, fanGroup, status);
@@ -377,10 +476,10 @@ void FFUdatabase::slot_simpleStatus(quint64 telegramID, quint8 fanAddress, quint
 
 void FFUdatabase::slot_status(quint64 telegramID, quint8 fanAddress, quint8 fanGroup, quint8 statusAddress, QString status, quint8 rawValue)
 {
-    FFU* ffu = getFFUbyTelegramID(telegramID);
+    FFU* ffu = getFFUbyResponse(sender(), telegramID, fanAddress, fanGroup);
     if (ffu == nullptr)
     {
-        // Somebody other than the ffu requested that response, so do nothing with the response at this point
+        // Nobody requested that response and no ffu is configured at that address, so do nothing with the response at this point
         return;
     }
     ffu->slot_status(telegramID, fanAddress, fanGroup, statusAddress, status, rawValue);
@@ -388,10 +487,10 @@ void FFUdatabase::slot_status(quint64 telegramID, quint8 fanAddress, quint8 fanG
 
 void FFUdatabase::slot_actualSpeed(quint64 telegramID, quint8 fanAddress, quint8 fanGroup, quint8 actualRawSpeed)
 {
-    FFU* ffu = getFFUbyTelegramID(telegramID);
+    FFU* ffu = getFFUbyResponse(sender(), telegramID, fanAddress, fanGroup);
     if (ffu == nullptr)
     {
-        // Somebody other than the ffu requested that response, so do nothing with the response at this point
+        // Nobody requested that response and no ffu is configured at that address, so do nothing with the response at this point
         return;
     }
     ffu->slot_actualSpeed(telegramID, fanAddress, fanGroup, actualRawSpeed);
@@ -399,10 +498,10 @@ void FFUdatabase::slot_actualSpeed(quint64 telegramID, quint8 fanAddress, quint8
 
 void FFUdatabase::slot_setPointHasBeenSet(quint64 telegramID, quint8 fanAddress, quint8 fanGroup)
 {
-    FFU* ffu = getFFUbyTelegramID(telegramID);
+    FFU* ffu = getFFUbyResponse(sender(), telegramID, fanAddress, fanGroup);
     if (ffu == nullptr)
     {
-        // Somebody other than the ffu requested that response, so do nothing with the response at this point
+        // Nobody requested that response and no ffu is configured at that address, so do nothing with the response at this point
         return;
     }
     ffu->slot_setPointHasBeenSet(telegramID, fanAddress, fanGroup);
@@ -410,10 +509,10 @@ void FFUdatabase::slot_setPointHasBeenSet(quint64 telegramID, quint8 fanAddress,
 
 void FFUdatabase::slot_EEPROMhasBeenWritten(quint64 telegramID, quint8 fanAddress, quint8 fanGroup)
 {
-    FFU* ffu = getFFUbyTelegramID(telegramID);
+    FFU* ffu = getFFUbyResponse(sender(), telegramID, fanAddress, fanGroup);
     if (ffu == nullptr)
     {
-        // Somebody other than the ffu requested that response, so do nothing with the response at this point
+        // Nobody requested that response and no ffu is configured at that address, so do nothing with the response at this point
         return;
     }
     ffu->slot_EEPROMhasBeenWritten(telegramID, fanAddress, fanGroup);
@@ -421,54 +520,72 @@ void FFUdatabase::slot_EEPROMhasBeenWritten(quint64 telegramID, quint8 fanAddres
 
 void FFUdatabase::slot_EEPROMdata(quint64 telegramID, quint8 fanAddress, quint8 fanGroup, EbmBusEEPROM::EEPROMaddress eepromAddress, quint8 dataByte)
 {
-    FFU* ffu = getFFUbyTelegramID(telegramID);
+    FFU* ffu = getFFUbyResponse(sender(), telegramID, fanAddress, fanGroup);
     if (ffu == nullptr)
     {
-        // Somebody other than the ffu requested that response, so do nothing with the response at this point
+        // Nobody requested that response and no ffu is configured at that address, so do nothing with the response at this point
         return;
     }
     ffu->slot_EEPROMdata(telegramID, fanAddress, fanGroup, eepromAddress, dataByte);
 }
 
-void FFUdatabase::slot_startFastSpeedPollingSequence()
+// Poll the motor speed of the given ffus fast until it matches targetSpeedRaw (their setpoint if -1) or the fast polling time is over
+void FFUdatabase::startFastSpeedPolling(QList<FFU *> ffus, int targetSpeedRaw)
 {
-    if (!m_timer_fastSpeedPolling.isActive())
+    qint64 now = m_fastSpeedPollingClock.elapsed();
+
+    foreach (FFU* ffu, ffus)
     {
-        foreach (EbmBus* ebmBus, *m_ebmbuslist)
-            ebmBus->clearTelegramQueue();               // Drop all other request packets from standard priority queue out of the way
+        m_fastSpeedPollingStart.insert(ffu, now);
+        m_fastSpeedPollingConverged.insert(ffu, 0);
+        if (targetSpeedRaw >= 0)
+            m_fastSpeedPollingTarget.insert(ffu, targetSpeedRaw);
+        else
+            m_fastSpeedPollingTarget.remove(ffu);
+        m_pollScheduler->setPriorityClass(ffu, FFUpollScheduler::PriorityHigh);
     }
-    m_timer_fastSpeedPolling.start();
+
+    if (!m_fastSpeedPollingStart.isEmpty() && !m_timer_fastSpeedPolling.isActive())
+        m_timer_fastSpeedPolling.start();
 }
 
-void FFUdatabase::slot_timer_pollStatus_fired()
+void FFUdatabase::stopFastSpeedPolling(FFU *ffu)
 {
-//    static int currentFFUid = 0;
+    if (!m_fastSpeedPollingStart.contains(ffu))
+        return;
 
-//    if (m_ffus.count() > currentFFUid)
-//    {
-//        FFU* ffu = m_ffus.at(currentFFUid);
-//        ffu->requestStatus();
-//    }
+    m_fastSpeedPollingStart.remove(ffu);
+    m_fastSpeedPollingConverged.remove(ffu);
+    m_fastSpeedPollingTarget.remove(ffu);
+    m_pollScheduler->setPriorityClass(ffu, FFUpollScheduler::PriorityNormal);
 
-//    currentFFUid++;
-//    if (m_ffus.count() <= currentFFUid)
-//        currentFFUid = 0;
+    if (m_fastSpeedPollingStart.isEmpty())
+        m_timer_fastSpeedPolling.stop();
+}
+
+void FFUdatabase::slot_FFUactualSpeedReceived(int id)
+{
+    FFU* ffu = getFFUbyID(id);
+    if ((ffu == nullptr) || !m_fastSpeedPollingStart.contains(ffu))
+        return;
+
+    // Two readings in a row close to the setpoint, so the fan has settled
+    int target = m_fastSpeedPollingTarget.value(ffu, ffu->getSpeedSetpointRaw());
+    int deviation = qAbs((int)ffu->getActualData().speedReading - target);
+    int converged = (deviation <= 3) ? m_fastSpeedPollingConverged.value(ffu) + 1 : 0;
+    m_fastSpeedPollingConverged.insert(ffu, converged);
 
+    if (converged >= 2)
+        stopFastSpeedPolling(ffu);
+}
 
-    bool actualSpeedOnly = m_timer_fastSpeedPolling.isActive();   // This is set to true if we want to do a fast poll of motor speeds after setpoint change
+void FFUdatabase::slot_timer_fastSpeedPolling_fired()
+{
+    qint64 now = m_fastSpeedPollingClock.elapsed();
 
-    foreach (EbmBus* ebmBus, *m_ebmbuslist)
+    foreach (FFU* ffu, m_fastSpeedPollingStart.keys())
     {
-        int sizeOfTelegramQueue = qMax(ebmBus->getSizeOfTelegramQueue(false), ebmBus->getSizeOfTelegramQueue(true));
-        if (sizeOfTelegramQueue < 20)
-        {
-            foreach(FFU* ffu, m_ffus)
-            {
-                if (m_ebmbuslist->indexOf(ebmBus) == ffu->getBusID())
-                {
-                    ffu->requestStatus(actualSpeedOnly);
-                }
-            }
-        }
+        if ((now - m_fastSpeedPollingStart.value(ffu)) >= 30000)      // 30 Seconds of fast polling at most
+            stopFastSpeedPolling(ffu);
     }
 }
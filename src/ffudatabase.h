@@ -24,28 +24,36 @@
 #include <QDir>
 #include <QDirIterator>
 #include <QTimer>
+#include <QElapsedTimer>
 #include <QMap>
+#include <QHash>
 #include <libebmbus/ebmbus.h>
 #include "ffu.h"
+#include "indexedlist.h"
+#include "transactionregistry.h"
+#include "ffupollscheduler.h"
+#include "ffupollingplan.h"
 #include "ebmbussystem.h"
+#include "persistence.h"
 #include "loghandler.h"
 
 class FFUdatabase : public QObject
 {
     Q_OBJECT
 public:
-    explicit FFUdatabase(QObject *parent, EbmBusSystem* ebmbusSystem, Loghandler* loghandler);
+    explicit FFUdatabase(QObject *parent, EbmBusSystem* ebmbusSystem, Persistence* persistence, Loghandler* loghandler);
 
     void loadFromHdd();
     void saveToHdd();
 
-    QList<EbmBus *> *getBusList();
+    QList<EbmBusLine*> *getBusList();
 
     QString addFFU(int id, int busID, int unit = -1, int fanAddress = -1, int fanGroup = -1);
     QString deleteFFU(int id);
 
     QList<FFU*> getFFUs(int busNr = -1);    // If busNr is specified only ffus of that bus are returned
     FFU* getFFUbyID(int id);
+    FFU* getFFUbyAddress(int busID, int fanAddress, int fanGroup);
 
     QString getFFUdata(int id, QString key);
     QMap<QString,QString> getFFUdata(int id, QStringList keys);
@@ -56,16 +64,44 @@ public:
 
     QString broadcast(int busID, QMap<QString,QString> dataMap);
 
+    TransactionRegistry* getTransactionRegistry();
+    Persistence* getPersistence();
+    FFUpollScheduler* getPollScheduler();
+    EbmBusSystem* getEbmBusSystem();
+    quint64 getUnsolicitedResponseCount() const;
+
 private:
     EbmBusSystem* m_ebmbusSystem;
-    QList<EbmBus*>* m_ebmbuslist;
+    QList<EbmBusLine*>* m_ebmbuslist;
+    Persistence* m_persistence;
     Loghandler* m_loghandler;
-    QList<FFU*> m_ffus;
-    QTimer m_timer_pollStatus;
+    IndexedList<FFU*> m_ffus;
+    TransactionRegistry m_transactionRegistry;
+    FFUpollScheduler* m_pollScheduler;
+    FFUpollingPlan m_pollingPlan;
     QTimer m_timer_fastSpeedPolling;
+    QElapsedTimer m_fastSpeedPollingClock;
+    QHash<FFU*, qint64> m_fastSpeedPollingStart;       // Unit ms of m_fastSpeedPollingClock
+    QHash<FFU*, int> m_fastSpeedPollingConverged;     // Number of consecutive speed readings matching the setpoint
+    QHash<FFU*, int> m_fastSpeedPollingTarget;        // Raw speed of a broadcast, which does not change the setpoints
     QMap<int,QList<int>> m_unitIdsPerBus;
+    QHash<EbmBusLine*, int> m_busIDs;
+    QHash<int, FFU*> m_ffusByID;
+    QMap<int, IndexedList<FFU*>> m_ffusPerBus;
+    QHash<FFU*, int> m_indexedBusIDs;
+    QHash<quint32, FFU*> m_ffusByAddress;     // Key is made of busID, fanGroup and fanAddress, see addressKey()
+    QHash<FFU*, quint32> m_addressKeys;
+    quint64 m_unsolicitedResponseCount;
 
     FFU* getFFUbyTelegramID(quint64 telegramID);
+    FFU* getFFUbyResponse(QObject* bus, quint64 telegramID, quint8 fanAddress, quint8 fanGroup);
+
+    static quint32 addressKey(int busID, int fanAddress, int fanGroup);
+    void indexFFU(FFU* ffu);      // Keeps id, bus and address lookups in sync with the ffu
+    void unindexFFU(FFU* ffu);
+
+    void startFastSpeedPolling(QList<FFU*> ffus, int targetSpeedRaw = -1);
+    void stopFastSpeedPolling(FFU* ffu);
 
 signals:
     void signal_DCIaddressingFinished(int busID);
@@ -84,6 +120,10 @@ private slots:
     void slot_gotResponseRaw(quint64 telegramID, quint8 preamble, quint8 commandAndFanaddress, quint8 fanGroup, QByteArray data);
     void slot_DaisyChainAddressingGotSerialNumber(quint8 unit, quint8 fanAddress, quint8 fanGroup, quint32 serialNumber);
 
+    // FFU management slots
+    void slot_FFUaddressChanged();
+    void slot_FFUactualSpeedReceived(int id);
+
     // High level bus response slots
     void slot_transactionFinished();
     void slot_transactionLost(quint64 telegramID);
@@ -95,8 +135,7 @@ private slots:
     void slot_EEPROMdata(quint64 telegramID, quint8 fanAddress, quint8 fanGroup, EbmBusEEPROM::EEPROMaddress eepromAddress, quint8 dataByte);
 
     // Timer slots
-    void slot_startFastSpeedPollingSequence();
-    void slot_timer_pollStatus_fired();
+    void slot_timer_fastSpeedPolling_fired();
 };
 
 #endif // FFUDATABASE_H
@@ -0,0 +1,111 @@
+/**********************************************************************
+** ebmbus-cmd - a commandline tool to control ebm papst fans
+** Copyright (C) 2018 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+#include "ffupollingplan.h"
+
+#include <QSettings>
+
+FFUpollingPlan::FFUpollingPlan()
+{
+    // Defaults: errors are read with every poll, slowly changing values much less often
+    m_interval[MetricSetPoint] = 10000;
+    m_interval[MetricMotorStatusLowByte] = 0;
+    m_interval[MetricMotorStatusHighByte] = 10000;
+    m_interval[MetricWarnings] = 4000;
+    m_interval[MetricDCvoltage] = 20000;
+    m_interval[MetricDCcurrent] = 20000;
+    m_interval[MetricTemperatureOfPowerModule] = 30000;
+
+    m_threshold[MetricSetPoint] = 1;
+    m_threshold[MetricMotorStatusLowByte] = 1;
+    m_threshold[MetricMotorStatusHighByte] = 1;
+    m_threshold[MetricWarnings] = 1;
+    m_threshold[MetricDCvoltage] = 3;       // Analog values are noisy in the last bits
+    m_threshold[MetricDCcurrent] = 3;
+    m_threshold[MetricTemperatureOfPowerModule] = 2;
+}
+
+void FFUpollingPlan::loadFromSettings()
+{
+    QSettings settings("/etc/openffucontrol/ebmbus-cmd/ebmbus-cmd.ini", QSettings::IniFormat);
+    settings.beginGroup("pollingPlanEbmBus");
+
+    for (int metric = 0; metric < MetricCount; metric++)
+    {
+        QString key = name((Metric)metric);
+        m_interval[metric] = qMax(0, settings.value(key, m_interval[metric]).toInt());
+        m_threshold[metric] = qMax(1, settings.value(key + "Threshold", m_threshold[metric]).toInt());
+    }
+
+    settings.endGroup();
+}
+
+int FFUpollingPlan::interval(FFUpollingPlan::Metric metric) const
+{
+    return m_interval[metric];
+}
+
+int FFUpollingPlan::threshold(FFUpollingPlan::Metric metric) const
+{
+    return m_threshold[metric];
+}
+
+int FFUpollingPlan::metricOf(quint8 statusAddress)
+{
+    switch (statusAddress)
+    {
+    case EbmBusStatus::SetPoint:
+        return MetricSetPoint;
+    case EbmBusStatus::MotorStatusLowByte:
+        return MetricMotorStatusLowByte;
+    case EbmBusStatus::MotorStatusHighByte:
+        return MetricMotorStatusHighByte;
+    case EbmBusStatus::Warnings:
+        return MetricWarnings;
+    case EbmBusStatus::DCvoltage:
+        return MetricDCvoltage;
+    case EbmBusStatus::DCcurrent:
+        return MetricDCcurrent;
+    case EbmBusStatus::TemperatureOfPowerModule:
+        return MetricTemperatureOfPowerModule;
+    }
+
+    return -1;
+}
+
+QString FFUpollingPlan::name(FFUpollingPlan::Metric metric)
+{
+    switch (metric)
+    {
+    case MetricSetPoint:
+        return "SetPoint";
+    case MetricMotorStatusLowByte:
+        return "MotorStatusLowByte";
+    case MetricMotorStatusHighByte:
+        return "MotorStatusHighByte";
+    case MetricWarnings:
+        return "Warnings";
+    case MetricDCvoltage:
+        return "DCvoltage";
+    case MetricDCcurrent:
+        return "DCcurrent";
+    case MetricTemperatureOfPowerModule:
+        return "TemperatureOfPowerModule";
+    case MetricCount:
+        break;
+    }
+
+    return QString();
+}
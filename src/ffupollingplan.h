@@ -0,0 +1,55 @@
+/**********************************************************************
+** ebmbus-cmd - a commandline tool to control ebm papst fans
+** Copyright (C) 2018 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+#ifndef FFUPOLLINGPLAN_H
+#define FFUPOLLINGPLAN_H
+
+#include <QString>
+#include <libebmbus/ebmbus.h>
+
+// The polling plan tells how often each status field of an ffu has to be read.
+// Actual speed is not part of the plan, it is read with every poll.
+// A field that changed is read with every poll again and slows down step by step while it stays stable.
+
+class FFUpollingPlan
+{
+public:
+    FFUpollingPlan();
+
+    typedef enum {
+        MetricSetPoint,
+        MetricMotorStatusLowByte,
+        MetricMotorStatusHighByte,
+        MetricWarnings,
+        MetricDCvoltage,
+        MetricDCcurrent,
+        MetricTemperatureOfPowerModule,
+        MetricCount
+    } Metric;
+
+    void loadFromSettings();
+
+    int interval(Metric metric) const;      // Unit ms, 0 means every poll
+    int threshold(Metric metric) const;     // Minimum change of the raw value that counts as changing
+
+    static int metricOf(quint8 statusAddress);    // -1 if the status field is not part of the plan
+    static QString name(Metric metric);
+
+private:
+    int m_interval[MetricCount];
+    int m_threshold[MetricCount];
+};
+
+#endif // FFUPOLLINGPLAN_H
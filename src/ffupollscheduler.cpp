@@ -0,0 +1,325 @@
+/**********************************************************************
+** ebmbus-cmd - a commandline tool to control ebm papst fans
+** Copyright (C) 2018 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+#include "ffupollscheduler.h"
+
+#include <QSettings>
+
+FFUpollScheduler::FFUpollScheduler(QObject *parent, QList<EbmBusLine*> *ebmbuslist, TransactionRegistry *transactionRegistry) : QObject(parent)
+{
+    m_ebmbuslist = ebmbuslist;
+    m_transactionRegistry = transactionRegistry;
+
+    QSettings settings("/etc/openffucontrol/ebmbus-cmd/ebmbus-cmd.ini", QSettings::IniFormat);
+    settings.beginGroup("configEbmBus");
+    m_interval[PriorityNormal] = settings.value("pollInterval", 2000).toInt();
+    m_interval[PriorityHigh] = settings.value("pollIntervalFast", 500).toInt();
+    int tickInterval = settings.value("pollSchedulerTick", 50).toInt();
+    m_minQueueDepth = settings.value("pollMinQueueDepth", 8).toInt();    // One full status poll, so the line never runs dry between ticks
+    m_maxQueueDepth = settings.value("pollMaxQueueDepth", 20).toInt();
+    m_probeIntervalMin = settings.value("offlineProbeIntervalMin", 2000).toInt();
+    m_probeIntervalMax = settings.value("offlineProbeIntervalMax", 60000).toInt();
+    m_configFetchRate = settings.value("configFetchRate", 1.0).toDouble();
+    settings.endGroup();
+
+    m_clock.start();
+    m_lastThroughputUpdate = 0;
+    m_configFetchTokens = 0.0;
+    m_lastSequence = 0;
+
+    for (int busID = 0; busID < m_ebmbuslist->count(); busID++)
+    {
+        EbmBusLine* ebmBus = m_ebmbuslist->at(busID);
+        m_busIDs.insert(ebmBus, busID);
+
+        BusState state;
+        state.paused = false;
+        state.completedTelegrams = 0;
+        state.throughput = 0.0;
+        m_busStates.insert(busID, state);
+
+        // Every telegram ends either finished or lost, so both together give the achieved throughput of the line
+        connect(ebmBus, SIGNAL(signal_transactionFinished()), this, SLOT(slot_telegramCompleted()));
+        connect(ebmBus, SIGNAL(signal_transactionLost(quint64)), this, SLOT(slot_telegramCompleted()));
+    }
+
+    connect(&m_timer_throughput, SIGNAL(timeout()), this, SLOT(slot_timer_throughput_fired()));
+    m_timer_throughput.setInterval(1000);
+    m_timer_throughput.start();
+
+    connect(&m_timer_tick, SIGNAL(timeout()), this, SLOT(slot_timer_tick_fired()));
+    m_timer_tick.setInterval(tickInterval);
+    m_timer_tick.start();
+}
+
+void FFUpollScheduler::addFFU(FFU *ffu)
+{
+    PriorityClass priorityClass = PriorityNormal;
+    if (m_entries.contains(ffu))
+        priorityClass = m_entries.value(ffu).priorityClass;
+    else
+        connect(ffu, SIGNAL(signal_linkStateChanged()), this, SLOT(slot_FFUlinkStateChanged()));
+
+    unschedule(ffu);
+
+    Entry entry;
+    entry.busID = ffu->getBusID();
+    entry.priorityClass = priorityClass;
+    entry.deadline = 0;
+    entry.sequence = 0;
+    entry.probeInterval = 0;
+    m_entries.insert(ffu, entry);
+
+    schedule(ffu, m_clock.elapsed());   // Due immediately, pacing takes care of spreading the requests
+}
+
+void FFUpollScheduler::removeFFU(FFU *ffu)
+{
+    if (!m_entries.contains(ffu))
+        return;
+
+    disconnect(ffu, SIGNAL(signal_linkStateChanged()), this, SLOT(slot_FFUlinkStateChanged()));
+    unschedule(ffu);
+    m_entries.remove(ffu);
+}
+
+void FFUpollScheduler::setPriorityClass(FFU *ffu, FFUpollScheduler::PriorityClass priorityClass)
+{
+    QHash<FFU*, Entry>::iterator it = m_entries.find(ffu);
+    if (it == m_entries.end())
+        return;
+
+    if (it.value().priorityClass == priorityClass)
+        return;
+
+    unschedule(ffu);
+    it.value().priorityClass = priorityClass;
+    schedule(ffu, m_clock.elapsed());
+}
+
+FFUpollScheduler::PriorityClass FFUpollScheduler::getPriorityClass(FFU *ffu) const
+{
+    QHash<FFU*, Entry>::const_iterator it = m_entries.constFind(ffu);
+    if (it == m_entries.constEnd())
+        return PriorityNormal;
+
+    return it.value().priorityClass;
+}
+
+void FFUpollScheduler::setBusPaused(int busID, bool paused)
+{
+    QHash<int, BusState>::iterator it = m_busStates.find(busID);
+    if (it == m_busStates.end())
+        return;
+
+    it.value().paused = paused;
+}
+
+double FFUpollScheduler::getThroughput(int busID) const
+{
+    QHash<int, BusState>::const_iterator it = m_busStates.constFind(busID);
+    if (it == m_busStates.constEnd())
+        return 0.0;
+
+    return it.value().throughput;
+}
+
+int FFUpollScheduler::getScheduledCount(int busID) const
+{
+    QHash<int, BusState>::const_iterator it = m_busStates.constFind(busID);
+    if (it == m_busStates.constEnd())
+        return 0;
+
+    int count = 0;
+    for (int priorityClass = 0; priorityClass < PriorityClassCount; priorityClass++)
+        count += it.value().queues[priorityClass].count();
+
+    return count;
+}
+
+int FFUpollScheduler::getOverdueCount(int busID) const
+{
+    QHash<int, BusState>::const_iterator it = m_busStates.constFind(busID);
+    if (it == m_busStates.constEnd())
+        return 0;
+
+    qint64 now = m_clock.elapsed();
+    int count = 0;
+    for (int priorityClass = 0; priorityClass < PriorityClassCount; priorityClass++)
+    {
+        const QMap<QueueKey, FFU*>& queue = it.value().queues[priorityClass];
+        QMap<QueueKey, FFU*>::const_iterator queueIt = queue.constBegin();
+        while ((queueIt != queue.constEnd()) && (queueIt.key().first <= now))
+        {
+            count++;
+            ++queueIt;
+        }
+    }
+
+    return count;
+}
+
+int FFUpollScheduler::getOfflineCount(int busID) const
+{
+    int count = 0;
+    QHash<FFU*, Entry>::const_iterator it = m_entries.constBegin();
+    while (it != m_entries.constEnd())
+    {
+        if ((it.value().busID == busID) && (it.key()->getLinkState() == FFU::LinkOffline))
+            count++;
+        ++it;
+    }
+
+    return count;
+}
+
+void FFUpollScheduler::schedule(FFU *ffu, qint64 deadline)
+{
+    QHash<FFU*, Entry>::iterator it = m_entries.find(ffu);
+    if (it == m_entries.end())
+        return;
+
+    it.value().deadline = deadline;
+    it.value().sequence = ++m_lastSequence;
+
+    QHash<int, BusState>::iterator busIt = m_busStates.find(it.value().busID);
+    if (busIt == m_busStates.end())
+        return;     // No such bus, so there is nothing to poll
+
+    busIt.value().queues[it.value().priorityClass].insert(QueueKey(deadline, it.value().sequence), ffu);
+}
+
+void FFUpollScheduler::unschedule(FFU *ffu)
+{
+    QHash<FFU*, Entry>::const_iterator it = m_entries.constFind(ffu);
+    if (it == m_entries.constEnd())
+        return;
+
+    QHash<int, BusState>::iterator busIt = m_busStates.find(it.value().busID);
+    if (busIt == m_busStates.end())
+        return;
+
+    busIt.value().queues[it.value().priorityClass].remove(QueueKey(it.value().deadline, it.value().sequence));
+}
+
+// Keep about two ticks worth of telegrams queued at the bus
+int FFUpollScheduler::targetQueueDepth(int busID) const
+{
+    double telegramsPerTick = getThroughput(busID) * (double)m_timer_tick.interval() / 1000.0;
+    return qBound(m_minQueueDepth, (int)(telegramsPerTick * 2.0 + 0.5), m_maxQueueDepth);
+}
+
+// An ffu that answers again goes back to full polling right away
+void FFUpollScheduler::slot_FFUlinkStateChanged()
+{
+    FFU* ffu = qobject_cast<FFU*>(sender());
+    if (ffu == nullptr)
+        return;
+
+    QHash<FFU*, Entry>::iterator it = m_entries.find(ffu);
+    if (it == m_entries.end())
+        return;
+
+    if ((ffu->getLinkState() != FFU::LinkOnline) || (it.value().probeInterval == 0))
+        return;
+
+    unschedule(ffu);
+    it.value().probeInterval = 0;
+    schedule(ffu, m_clock.elapsed());
+}
+
+void FFUpollScheduler::slot_telegramCompleted()
+{
+    int busID = m_busIDs.value(sender(), -1);
+    QHash<int, BusState>::iterator it = m_busStates.find(busID);
+    if (it == m_busStates.end())
+        return;
+
+    it.value().completedTelegrams++;
+}
+
+void FFUpollScheduler::slot_timer_tick_fired()
+{
+    qint64 now = m_clock.elapsed();
+
+    m_configFetchTokens = qMin(qMax(1.0, m_configFetchRate), m_configFetchTokens + m_configFetchRate * (double)m_timer_tick.interval() / 1000.0);
+
+    for (int busID = 0; busID < m_ebmbuslist->count(); busID++)
+    {
+        QHash<int, BusState>::iterator busIt = m_busStates.find(busID);
+        if ((busIt == m_busStates.end()) || busIt.value().paused)
+            continue;
+
+        EbmBusLine* ebmBus = m_ebmbuslist->at(busID);
+        int sizeOfTelegramQueue = ebmBus->getSizeOfTelegramQueue(false) + ebmBus->getSizeOfTelegramQueue(true);
+        int budget = targetQueueDepth(busID) - sizeOfTelegramQueue;
+
+        // Higher priority classes are served first, inside a class the earliest deadline goes first
+        for (int priorityClass = 0; (priorityClass < PriorityClassCount) && (budget > 0); priorityClass++)
+        {
+            QMap<QueueKey, FFU*>& queue = busIt.value().queues[priorityClass];
+
+            while ((budget > 0) && !queue.isEmpty() && (queue.firstKey().first <= now))
+            {
+                FFU* ffu = queue.first();
+                queue.erase(queue.begin());
+
+                if (m_transactionRegistry->pendingCount(ffu) > 0)
+                {
+                    // Last poll is still in flight, look again next tick
+                    schedule(ffu, now + m_timer_tick.interval());
+                    continue;
+                }
+
+                Entry& entry = m_entries[ffu];
+                if (ffu->getLinkState() == FFU::LinkOffline)
+                {
+                    // Each unanswered telegram costs requestTimeout x telegramRepeatCount of airtime, so only probe with one
+                    entry.probeInterval = qBound(m_probeIntervalMin, entry.probeInterval * 2, m_probeIntervalMax);
+                    budget -= ffu->requestProbe();
+                    schedule(ffu, now + entry.probeInterval);
+                    continue;
+                }
+
+                entry.probeInterval = 0;
+                if (ffu->needsConfigData() && (m_configFetchTokens >= 1.0))
+                {
+                    m_configFetchTokens -= 1.0;
+                    budget -= ffu->requestConfig();
+                }
+                budget -= ffu->requestStatus(priorityClass == PriorityHigh);
+                schedule(ffu, now + m_interval[priorityClass]);
+            }
+        }
+    }
+}
+
+void FFUpollScheduler::slot_timer_throughput_fired()
+{
+    qint64 now = m_clock.elapsed();
+    qint64 elapsed = now - m_lastThroughputUpdate;
+    m_lastThroughputUpdate = now;
+    if (elapsed <= 0)
+        return;
+
+    QHash<int, BusState>::iterator it = m_busStates.begin();
+    while (it != m_busStates.end())
+    {
+        double telegramsPerSecond = (double)it.value().completedTelegrams * 1000.0 / (double)elapsed;
+        it.value().throughput = 0.7 * it.value().throughput + 0.3 * telegramsPerSecond;   // Smooth out single slow seconds
+        it.value().completedTelegrams = 0;
+        ++it;
+    }
+}
@@ -0,0 +1,117 @@
+/**********************************************************************
+** ebmbus-cmd - a commandline tool to control ebm papst fans
+** Copyright (C) 2018 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+#ifndef FFUPOLLSCHEDULER_H
+#define FFUPOLLSCHEDULER_H
+
+#include <QObject>
+#include <QList>
+#include <QHash>
+#include <QMap>
+#include <QPair>
+#include <QTimer>
+#include <QElapsedTimer>
+#include "ebmbusline.h"
+#include "ffu.h"
+#include "transactionregistry.h"
+
+// The poll scheduler gives each ffu a refresh deadline and hands out status requests in deadline order.
+// Per bus it only keeps as many telegrams queued as the line is able to transmit within a few scheduler
+// ticks, so requests are spread evenly over time instead of being enqueued in bursts.
+// Offline ffus only get a single probe telegram with exponential back-off until they answer again.
+// Reading missing EEPROM config data is rate limited for the whole fleet, so cold starts do not flood the buses.
+
+class FFUpollScheduler : public QObject
+{
+    Q_OBJECT
+public:
+    explicit FFUpollScheduler(QObject *parent, QList<EbmBusLine*>* ebmbuslist, TransactionRegistry* transactionRegistry);
+
+    typedef enum {
+        PriorityHigh,       // Actual speed only, e.g. after a setpoint change
+        PriorityNormal,     // Full status
+        PriorityClassCount
+    } PriorityClass;
+
+    void addFFU(FFU* ffu);      // Adding an ffu again moves it to the bus it is configured for now
+    void removeFFU(FFU* ffu);
+
+    void setPriorityClass(FFU* ffu, PriorityClass priorityClass);
+    PriorityClass getPriorityClass(FFU* ffu) const;
+
+    void setBusPaused(int busID, bool paused);
+
+    double getThroughput(int busID) const;          // Telegrams per second, measured
+    int getScheduledCount(int busID) const;
+    int getOverdueCount(int busID) const;
+    int getOfflineCount(int busID) const;
+
+private:
+    typedef struct {
+        int busID;
+        PriorityClass priorityClass;
+        qint64 deadline;
+        quint64 sequence;       // Makes the queue key unique, see QueueKey
+        int probeInterval;      // Back-off for offline ffus, 0 while online
+    } Entry;
+
+    // Deadline and a sequence number. Many ffus share a deadline, e.g. after startup, and a unique key
+    // lets unschedule() find an ffu directly instead of walking all ffus with the same deadline.
+    typedef QPair<qint64, quint64> QueueKey;
+
+    typedef struct {
+        QMap<QueueKey, FFU*> queues[PriorityClassCount];
+        bool paused;
+        quint64 completedTelegrams;
+        double throughput;
+    } BusState;
+
+    QList<EbmBusLine*>* m_ebmbuslist;
+    TransactionRegistry* m_transactionRegistry;
+
+    QHash<FFU*, Entry> m_entries;
+    quint64 m_lastSequence;
+    QHash<int, BusState> m_busStates;
+    QHash<QObject*, int> m_busIDs;
+
+    QElapsedTimer m_clock;
+    QTimer m_timer_tick;
+    QTimer m_timer_throughput;
+    qint64 m_lastThroughputUpdate;
+
+    int m_interval[PriorityClassCount];
+    int m_minQueueDepth;
+    int m_maxQueueDepth;
+    int m_probeIntervalMin;
+    int m_probeIntervalMax;
+    double m_configFetchRate;       // Unit ffus per second
+    double m_configFetchTokens;
+
+    void schedule(FFU* ffu, qint64 deadline);
+    void unschedule(FFU* ffu);
+    int targetQueueDepth(int busID) const;
+
+signals:
+
+public slots:
+
+private slots:
+    void slot_FFUlinkStateChanged();
+    void slot_telegramCompleted();
+    void slot_timer_tick_fired();
+    void slot_timer_throughput_fired();
+};
+
+#endif // FFUPOLLSCHEDULER_H
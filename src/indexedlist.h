@@ -0,0 +1,81 @@
+/**********************************************************************
+** ebmbus-cmd - a commandline tool to control ebm papst fans
+** Copyright (C) 2018 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+
+#ifndef INDEXEDLIST_H
+#define INDEXEDLIST_H
+
+#include <QList>
+#include <QHash>
+
+// List of unique elements which can be removed in constant time, e.g. devices deleted one by one from a bus.
+// The order is not kept: a removed element is replaced by the last one.
+
+template <typename T>
+class IndexedList
+{
+public:
+    void append(const T& value)
+    {
+        if (m_positions.contains(value))
+            return;
+        m_positions.insert(value, m_list.count());
+        m_list.append(value);
+    }
+
+    bool remove(const T& value)
+    {
+        typename QHash<T, int>::iterator it = m_positions.find(value);
+        if (it == m_positions.end())
+            return false;
+
+        int position = it.value();
+        m_positions.erase(it);
+
+        T last = m_list.takeLast();
+        if (position < m_list.count())
+        {
+            m_list[position] = last;
+            m_positions.insert(last, position);
+        }
+        return true;
+    }
+
+    bool contains(const T& value) const
+    {
+        return m_positions.contains(value);
+    }
+
+    int count() const
+    {
+        return m_list.count();
+    }
+
+    bool isEmpty() const
+    {
+        return m_list.isEmpty();
+    }
+
+    const QList<T>& list() const
+    {
+        return m_list;
+    }
+
+private:
+    QList<T> m_list;
+    QHash<T, int> m_positions;      // Index of each element in m_list
+};
+
+#endif // INDEXEDLIST_H
@@ -0,0 +1,135 @@
+/**********************************************************************
+** ebmbus-cmd - a commandline tool to control ebm papst fans
+** Copyright (C) 2018 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+
+#include "livesubscription.h"
+
+#include <algorithm>
+
+LiveSubscription::LiveSubscription(LiveSubscription::Filter filter)
+{
+    m_filter = filter;
+    subscriberCount = 0;
+}
+
+QString LiveSubscription::key(const LiveSubscription::Filter &filter)
+{
+    QList<int> busIDs = filter.busIDs.toList();
+    QList<int> ids = filter.ids.toList();
+    QStringList fields = filter.fields.toList();
+    std::sort(busIDs.begin(), busIDs.end());
+    std::sort(ids.begin(), ids.end());
+    fields.sort();
+
+    QString key;
+    key.append(filter.ffus ? "F" : "-");
+    key.append(filter.auxFans ? "A" : "-");
+    key.append(" bus=");
+    foreach (int busID, busIDs)
+        key.append(QString().setNum(busID) + ",");
+    key.append(" ids=");
+    foreach (int id, ids)
+        key.append(QString().setNum(id) + ",");
+    key.append(" fields=" + fields.join(","));
+
+    return key;
+}
+
+QString LiveSubscription::key() const
+{
+    return key(m_filter);
+}
+
+bool LiveSubscription::matches(const DeviceSnapshot::Device &device, bool isFFU) const
+{
+    if (isFFU ? !m_filter.ffus : !m_filter.auxFans)
+        return false;
+    if (!m_filter.busIDs.isEmpty() && !m_filter.busIDs.contains(device.busID))
+        return false;
+    if (!m_filter.ids.isEmpty() && !m_filter.ids.contains(device.id))
+        return false;
+    return true;
+}
+
+QByteArray LiveSubscription::formatLine(int id, const QMap<QString, QString> &actualData, const QMap<QString, QString> *previousData, bool isFFU) const
+{
+    const char* errorPrefix = isFFU ? "Error[FFU]:" : "Error[AuxFan]:";
+
+    if (m_filter.fields.isEmpty())
+        return DeviceSnapshot::formatActualLine(id, actualData, previousData, errorPrefix);
+
+    QMap<QString, QString> projectedData = project(actualData);
+    if (previousData == nullptr)
+        return DeviceSnapshot::formatActualLine(id, projectedData, nullptr, errorPrefix);
+
+    QMap<QString, QString> projectedPreviousData = project(*previousData);
+    return DeviceSnapshot::formatActualLine(id, projectedData, &projectedPreviousData, errorPrefix);
+}
+
+QByteArray LiveSubscription::fullLine(const DeviceSnapshot::Device &device, bool isFFU)
+{
+    if (m_filter.fields.isEmpty())
+        return device.actualLine;   // Already formatted by the snapshot publisher
+
+    QHash<int, QByteArray>& lines = isFFU ? m_ffuLines : m_auxFanLines;
+    QHash<int, QByteArray>::const_iterator it = lines.constFind(device.id);
+    if (it != lines.constEnd())
+        return it.value();
+
+    QByteArray line = formatLine(device.id, device.actualData, nullptr, isFFU);
+    lines.insert(device.id, line);
+    return line;
+}
+
+void LiveSubscription::invalidate(int id, bool isFFU)
+{
+    if (isFFU)
+        m_ffuLines.remove(id);
+    else
+        m_auxFanLines.remove(id);
+}
+
+void LiveSubscription::dropUnmatchedLines()
+{
+    QHash<int, QByteArray>::iterator it = m_ffuLines.begin();
+    while (it != m_ffuLines.end())
+    {
+        if (matchingFFUs.contains(it.key()))
+            ++it;
+        else
+            it = m_ffuLines.erase(it);
+    }
+
+    it = m_auxFanLines.begin();
+    while (it != m_auxFanLines.end())
+    {
+        if (matchingAuxFans.contains(it.key()))
+            ++it;
+        else
+            it = m_auxFanLines.erase(it);
+    }
+}
+
+QMap<QString, QString> LiveSubscription::project(const QMap<QString, QString> &data) const
+{
+    QMap<QString, QString> projectedData;
+    foreach (QString field, m_filter.fields)
+    {
+        QMap<QString, QString>::const_iterator it = data.constFind(field);
+        if (it != data.constEnd())
+            projectedData.insert(field, it.value());
+    }
+    return projectedData;
+}
@@ -0,0 +1,72 @@
+/**********************************************************************
+** ebmbus-cmd - a commandline tool to control ebm papst fans
+** Copyright (C) 2018 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+
+#ifndef LIVESUBSCRIPTION_H
+#define LIVESUBSCRIPTION_H
+
+#include <QString>
+#include <QStringList>
+#include <QSet>
+#include <QHash>
+#include <QByteArray>
+#include "devicesnapshot.h"
+
+// What a live client wants to see: device types, buses, ids and fields. Empty sets mean all.
+// Clients with the same filter share one LiveSubscription, so its frame and lines are formatted once for all of them.
+
+class LiveSubscription
+{
+public:
+    typedef struct {
+        bool ffus;
+        bool auxFans;
+        QSet<int> busIDs;
+        QSet<int> ids;
+        QSet<QString> fields;
+    } Filter;
+
+    explicit LiveSubscription(Filter filter);
+
+    static QString key(const Filter& filter);  // Equal for equal filters
+    QString key() const;
+
+    int subscriberCount;
+
+    bool matches(const DeviceSnapshot::Device& device, bool isFFU) const;  // Used to build the subscriber sets only
+
+    // Devices matching the filter in the current snapshot, kept up to date by RemoteServer
+    QSet<int> matchingFFUs;
+    QSet<int> matchingAuxFans;
+
+    // Line with the subscribed fields; only the changed ones if previousData is given
+    QByteArray formatLine(int id, const QMap<QString, QString>& actualData, const QMap<QString, QString>* previousData, bool isFFU) const;
+
+    // Line with all subscribed fields of a device, cached until invalidate() is called for the device
+    QByteArray fullLine(const DeviceSnapshot::Device& device, bool isFFU);
+    void invalidate(int id, bool isFFU);
+    void dropUnmatchedLines();     // Of devices not in matchingFFUs/matchingAuxFans any more, e.g. deleted or moved to another bus
+
+    QByteArray frame;   // Changes of the last snapshot
+
+private:
+    Filter m_filter;
+    QHash<int, QByteArray> m_ffuLines;
+    QHash<int, QByteArray> m_auxFanLines;
+
+    QMap<QString, QString> project(const QMap<QString, QString>& data) const;
+};
+
+#endif // LIVESUBSCRIPTION_H
@@ -22,13 +22,7 @@ Loghandler::Loghandler(QObject *parent) : QObject(parent)
 
 bool Loghandler::hasActiveErrors()
 {
-    foreach (LogEntry* e, m_logentries)
-    {
-        if (e->isActiveErrorOrWarning())
-            return true;
-    }
-
-    return false;
+    return !m_activeErrorsAndWarnings.isEmpty();
 }
 
 QString Loghandler::toString(LogEntry::LoggingCategory category, bool onlyActive)
@@ -44,33 +38,31 @@ QString Loghandler::toString(LogEntry::LoggingCategory category, bool onlyActive
     return str;
 }
 
-LogEntry *Loghandler::findOrMakeLogEntry(LogEntry::LoggingCategory loggingCategory, QString module, QString text, bool justFind)
+// Devices come and go by the hundreds, e.g. by delete-ffu --bus, so entries are looked up by a hash
+QString Loghandler::entryKey(LogEntry::LoggingCategory loggingCategory, const QString &module, const QString &text)
 {
-    foreach(LogEntry* entry, m_logentries)
-    {
-        if (entry->loggingCategory() != loggingCategory)
-            continue;
-        if (entry->module() != module)
-            continue;
-        if (entry->text() != text)
-            continue;
+    return QString().setNum(loggingCategory) + "\n" + module + "\n" + text;
+}
 
+LogEntry *Loghandler::findOrMakeLogEntry(LogEntry::LoggingCategory loggingCategory, QString module, QString text, bool justFind)
+{
+    QString key = entryKey(loggingCategory, module, text);
+    LogEntry* entry = m_logentriesByKey.value(key, nullptr);
+    if ((entry != nullptr) || justFind)
         return entry;
-    }
-    if (justFind)
-        return nullptr;
-    else
-    {
-        LogEntry* entry = new LogEntry(loggingCategory, module, text);
-        m_logentries.append(entry);
-        return entry;
-    }
+
+    entry = new LogEntry(loggingCategory, module, text);
+    m_logentries.append(entry);
+    m_logentriesByKey.insert(key, entry);
+    return entry;
 }
 
 void Loghandler::slot_newEntry(LogEntry::LoggingCategory loggingCategory, QString module, QString text)
 {
     LogEntry* entry = findOrMakeLogEntry(loggingCategory, module, text);
     entry->setActive();
+    if (entry->isActiveErrorOrWarning())
+        m_activeErrorsAndWarnings.insert(entry);
     emit signal_newError();
 }
 
@@ -79,7 +71,10 @@ void Loghandler::slot_entryGone(LogEntry::LoggingCategory loggingCategory, QStri
     // First search the original ticket
     LogEntry* entry = findOrMakeLogEntry(loggingCategory, module, text, true);
     if (entry != nullptr)
+    {
         entry->setInactive();
+        m_activeErrorsAndWarnings.remove(entry);
+    }
 
     if (!hasActiveErrors())
         emit signal_allErrorsGone();
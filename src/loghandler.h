@@ -18,6 +18,8 @@
 
 #include <QObject>
 #include <QList>
+#include <QHash>
+#include <QSet>
 #include <QString>
 
 #include "logentry.h"
@@ -33,6 +35,9 @@ public:
 
 private:
     QList<LogEntry*> m_logentries;
+    QHash<QString, LogEntry*> m_logentriesByKey;        // See entryKey()
+    QSet<LogEntry*> m_activeErrorsAndWarnings;
+    static QString entryKey(LogEntry::LoggingCategory loggingCategory, const QString& module, const QString& text);
     LogEntry* findOrMakeLogEntry(LogEntry::LoggingCategory loggingCategory, QString module, QString text, bool justFind = false);
 
 signals:
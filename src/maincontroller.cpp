@@ -14,6 +14,7 @@
 **********************************************************************/
 
 #include <stdio.h>
+#include <QSettings>
 #include "maincontroller.h"
 
 
@@ -58,10 +59,15 @@ MainController::MainController(QObject *parent) :
     connect(m_ups, SIGNAL(signal_shutdownDueToPowerloss()), m_osControl, SLOT(slot_shutdownNOW()));
     connect(m_ups, SIGNAL(signal_powerGoodAgain()), this, SLOT(slot_mainsPowerRestored()));
 
-    m_ffudatabase = new FFUdatabase(this, m_ebmbusSystem, m_loghandler);
+    // Device records are written in the background, see persistence.h
+    m_persistence = new Persistence(this);
+    QSettings settings("/etc/openffucontrol/ebmbus-cmd/ebmbus-cmd.ini", QSettings::IniFormat);
+    m_shutdownFlushTimeout = settings.value("persistence/shutdownFlushTimeout", 2000).toInt();
+
+    m_ffudatabase = new FFUdatabase(this, m_ebmbusSystem, m_persistence, m_loghandler);
     m_ffudatabase->loadFromHdd();
 
-    m_auxfandatabase = new AuxFanDatabase(this, m_ebmModbusSystem, m_loghandler);
+    m_auxfandatabase = new AuxFanDatabase(this, m_ebmModbusSystem, m_persistence, m_loghandler);
     m_auxfandatabase->loadFromHdd();
 
     m_remotecontroller = new RemoteController(this, m_ffudatabase, m_auxfandatabase, m_loghandler);
@@ -89,6 +95,7 @@ MainController::MainController(QObject *parent) :
 
 MainController::~MainController()
 {
+    m_persistence->flush(m_shutdownFlushTimeout);
 }
 
 // This is a periodic timer function for visualisation and operation
@@ -263,6 +270,10 @@ void MainController::slot_shutdownNOW()
 {
     m_lightbutton_operation->slot_setLight(LightButton::LED_OFF);
     m_lightbutton_error->slot_setLight(LightButton::LED_ON);
+
+    // Pending device records must be on disk before the operating system powers off
+    if (!m_persistence->flush(m_shutdownFlushTimeout))
+        fprintf(stderr, "MainController::slot_shutdownNOW(): Writing pending device records timed out after %i ms.\n", m_shutdownFlushTimeout);
 }
 
 void MainController::slot_mainsPowerRestored()
@@ -29,6 +29,7 @@
 #include "remotecontroller.h"
 #include "ffudatabase.h"
 #include "auxfandatabase.h"
+#include "persistence.h"
 #include "loghandler.h"
 
 class MainController : public QObject
@@ -56,6 +57,9 @@ private:
     UninterruptiblePowerSupply* m_ups;
     OperatingSystemControl* m_osControl;
 
+    Persistence* m_persistence;
+    int m_shutdownFlushTimeout;
+
     FFUdatabase* m_ffudatabase;
     AuxFanDatabase* m_auxfandatabase;
 
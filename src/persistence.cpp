@@ -0,0 +1,300 @@
+/**********************************************************************
+** ebmbus-cmd - a commandline tool to control ebm papst fans
+** Copyright (C) 2018 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+#include "persistence.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QDirIterator>
+#include <QSettings>
+#include <QElapsedTimer>
+#include <QMutexLocker>
+#include <stdio.h>
+
+PersistenceWorker::PersistenceWorker(QObject *parent) : QObject(parent)
+{
+    m_fsyncPolicy = FsyncBatch;
+    m_batchesInFlight = 0;
+
+    m_statistics.batches = 0;
+    m_statistics.writes = 0;
+    m_statistics.removals = 0;
+    m_statistics.bytes = 0;
+    m_statistics.fsyncs = 0;
+    m_statistics.errors = 0;
+    m_statistics.compactions = 0;
+    m_statistics.journalSize = 0;
+    m_statistics.journalRecords = 0;
+    m_statistics.lastBatchLatency = 0;
+    m_statistics.maxBatchLatency = 0;
+    m_statistics.totalBatchLatency = 0;
+}
+
+void PersistenceWorker::setFsyncPolicy(PersistenceWorker::FsyncPolicy fsyncPolicy)
+{
+    m_fsyncPolicy = fsyncPolicy;
+}
+
+// Called from the main thread before a batch is sent to the worker, so waitForIdle knows about it
+void PersistenceWorker::announceBatch()
+{
+    QMutexLocker locker(&m_mutex);
+    m_batchesInFlight++;
+}
+
+bool PersistenceWorker::waitForIdle(int timeout)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    QMutexLocker locker(&m_mutex);
+    while (m_batchesInFlight > 0)
+    {
+        qint64 remaining = timeout - timer.elapsed();
+        if (remaining <= 0)
+            return false;
+        m_idle.wait(&m_mutex, (unsigned long)remaining);
+    }
+
+    return true;
+}
+
+PersistenceWorker::Statistics PersistenceWorker::getStatistics()
+{
+    QMutexLocker locker(&m_mutex);
+    return m_statistics;
+}
+
+bool PersistenceWorker::openJournal(QString filename)
+{
+    bool ok = m_journal.open(filename);
+    m_statistics.journalSize = m_journal.size();
+    m_statistics.journalRecords = m_journal.records().count();
+    return ok;
+}
+
+QHash<QString, QByteArray> PersistenceWorker::journalRecords() const
+{
+    return m_journal.records();
+}
+
+void PersistenceWorker::slot_processBatch(PersistenceBatch writes, QStringList removals)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    bool sync = (m_fsyncPolicy == FsyncBatch);
+
+    // All records of the batch are appended with a single write
+    qint64 bytes = m_journal.append(writes, removals, sync);
+
+    bool compacted = false;
+    if ((bytes >= 0) && m_journal.needsCompaction())
+        compacted = m_journal.compact(sync);
+
+    qint64 latency = timer.elapsed();
+
+    QMutexLocker locker(&m_mutex);
+    m_statistics.batches++;
+    if (bytes >= 0)
+    {
+        m_statistics.writes += writes.count();
+        m_statistics.removals += removals.count();
+        m_statistics.bytes += bytes;
+        if (sync && (bytes > 0))
+            m_statistics.fsyncs++;
+    }
+    else
+        m_statistics.errors++;
+    if (compacted)
+        m_statistics.compactions++;
+    m_statistics.journalSize = m_journal.size();
+    m_statistics.journalRecords = m_journal.records().count();
+    m_statistics.lastBatchLatency = latency;
+    m_statistics.maxBatchLatency = qMax(m_statistics.maxBatchLatency, latency);
+    m_statistics.totalBatchLatency += latency;
+    m_batchesInFlight--;
+    m_idle.wakeAll();
+}
+
+Persistence::Persistence(QObject *parent) : QObject(parent)
+{
+    qRegisterMetaType<PersistenceBatch>("PersistenceBatch");
+
+    m_coalescedWrites = 0;
+    m_journalOpen = false;
+
+    QSettings settings("/etc/openffucontrol/ebmbus-cmd/ebmbus-cmd.ini", QSettings::IniFormat);
+    settings.beginGroup("persistence");
+    int writeDelay = settings.value("writeDelay", 5000).toInt();
+    QString fsyncPolicy = settings.value("fsyncPolicy", "batch").toString();
+    QString journalFile = settings.value("journalFile", "/var/openffucontrol/devices.journal").toString();
+    settings.endGroup();
+
+    m_worker = new PersistenceWorker(nullptr);     // parent must be 0 in order to be moved to workerThread later
+    if (fsyncPolicy == "never")
+        m_worker->setFsyncPolicy(PersistenceWorker::FsyncNever);
+    else
+    {
+        if (fsyncPolicy == "always")
+            fprintf(stderr, "Persistence::Persistence(): fsyncPolicy=always is deprecated, a write cycle is a single append to the journal now. Using batch.\n");
+        m_worker->setFsyncPolicy(PersistenceWorker::FsyncBatch);
+    }
+
+    m_journalOpen = m_worker->openJournal(journalFile);
+    if (m_journalOpen)
+        m_loadedRecords = m_worker->journalRecords();
+    else
+        fprintf(stderr, "Persistence::Persistence(): Unable to open device journal %s. Changes will not be saved.\n", journalFile.toLocal8Bit().data());
+
+    m_worker->moveToThread(&m_workerThread);
+    connect(&m_workerThread, &QThread::finished, m_worker, &QObject::deleteLater);
+    connect(this, &Persistence::signal_processBatch, m_worker, &PersistenceWorker::slot_processBatch);
+    m_workerThread.start(QThread::LowPriority);
+
+    // Records are collected from the first change on, so a record changing all the time is still written regularly
+    connect(&m_timer_writeDelay, &QTimer::timeout, this, &Persistence::slot_timer_writeDelay_fired);
+    m_timer_writeDelay.setSingleShot(true);
+    m_timer_writeDelay.setInterval(writeDelay);
+}
+
+Persistence::~Persistence()
+{
+    flush(5000);
+    m_workerThread.quit();
+    m_workerThread.wait();
+}
+
+QMap<QString, QByteArray> Persistence::takeRecords(QString prefix)
+{
+    QMap<QString, QByteArray> records;
+
+    QHash<QString, QByteArray>::iterator it = m_loadedRecords.begin();
+    while (it != m_loadedRecords.end())
+    {
+        if (it.key().startsWith(prefix))
+        {
+            records.insert(it.key(), it.value());
+            it = m_loadedRecords.erase(it);
+        }
+        else
+            ++it;
+    }
+
+    return records;
+}
+
+QMap<QString, QByteArray> Persistence::importFiles(QString directory)
+{
+    QMap<QString, QByteArray> records;
+    QStringList filepaths;
+
+    QDirIterator iterator(directory, QStringList() << "*.csv", QDir::Files, QDirIterator::NoIteratorFlags);
+    while (iterator.hasNext())
+    {
+        QString filepath = iterator.next();
+        QFile file(filepath);
+        if (!file.open(QIODevice::ReadOnly))
+            continue;
+        QByteArray content = file.readAll();
+        file.close();
+
+        QString key = QFileInfo(filepath).completeBaseName();
+        records.insert(key, content);
+        write(key, content);
+        filepaths.append(filepath);
+    }
+
+    if (records.isEmpty())
+        return records;
+
+    // The files are the only copy of the records until the journal has them
+    if (!m_journalOpen)
+    {
+        fprintf(stderr, "Persistence::importFiles(): No device journal, keeping the files of %s.\n", directory.toLocal8Bit().data());
+        return records;
+    }
+
+    quint64 errorsBefore = getStatistics().errors;
+    if (!flush(30000))
+    {
+        fprintf(stderr, "Persistence::importFiles(): Migration of %s timed out, keeping the files.\n", directory.toLocal8Bit().data());
+        return records;
+    }
+    if (getStatistics().errors != errorsBefore)
+    {
+        fprintf(stderr, "Persistence::importFiles(): Migration of %s failed to write the journal, keeping the files.\n", directory.toLocal8Bit().data());
+        return records;
+    }
+
+    foreach (QString filepath, filepaths)
+        QFile::rename(filepath, filepath + ".migrated");
+
+    fprintf(stdout, "Persistence: Migrated %i records from %s to the device journal.\n", records.count(), directory.toLocal8Bit().data());
+
+    return records;
+}
+
+void Persistence::write(QString key, QByteArray content)
+{
+    if (m_pendingWrites.contains(key))
+        m_coalescedWrites++;
+
+    m_pendingWrites.insert(key, content);
+    m_pendingRemovals.remove(key);
+
+    if (!m_timer_writeDelay.isActive())
+        m_timer_writeDelay.start();
+}
+
+void Persistence::remove(QString key)
+{
+    m_pendingWrites.remove(key);
+    m_pendingRemovals.insert(key);
+
+    if (!m_timer_writeDelay.isActive())
+        m_timer_writeDelay.start();
+}
+
+bool Persistence::flush(int timeout)
+{
+    m_timer_writeDelay.stop();
+    slot_timer_writeDelay_fired();
+
+    return m_worker->waitForIdle(timeout);
+}
+
+quint64 Persistence::getCoalescedWrites() const
+{
+    return m_coalescedWrites;
+}
+
+PersistenceWorker::Statistics Persistence::getStatistics()
+{
+    return m_worker->getStatistics();
+}
+
+void Persistence::slot_timer_writeDelay_fired()
+{
+    if (m_pendingWrites.isEmpty() && m_pendingRemovals.isEmpty())
+        return;
+
+    m_worker->announceBatch();
+    emit signal_processBatch(m_pendingWrites, m_pendingRemovals.toList());
+
+    m_pendingWrites.clear();
+    m_pendingRemovals.clear();
+}
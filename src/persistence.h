@@ -0,0 +1,132 @@
+/**********************************************************************
+** ebmbus-cmd - a commandline tool to control ebm papst fans
+** Copyright (C) 2018 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+#ifndef PERSISTENCE_H
+#define PERSISTENCE_H
+
+#include <QObject>
+#include <QThread>
+#include <QTimer>
+#include <QMap>
+#include <QStringList>
+#include <QSet>
+#include <QByteArray>
+#include <QMutex>
+#include <QWaitCondition>
+#include "devicejournal.h"
+
+// Device records are not written to flash directly. Persistence collects them for some seconds, so many
+// changes of the same record end up in a single write, and a worker thread appends them to the device
+// journal (see devicejournal.h) in the background.
+// Records are identified by a key like "ffu-000042".
+
+typedef QMap<QString, QByteArray> PersistenceBatch;     // Key and content
+
+class PersistenceWorker : public QObject
+{
+    Q_OBJECT
+public:
+    explicit PersistenceWorker(QObject *parent = nullptr);
+
+    typedef enum {
+        FsyncBatch,     // Once per batch, as a batch is a single append to the journal
+        FsyncNever
+    } FsyncPolicy;
+
+    typedef struct {
+        quint64 batches;
+        quint64 writes;
+        quint64 removals;
+        quint64 bytes;
+        quint64 fsyncs;
+        quint64 errors;
+        quint64 compactions;
+        qint64 journalSize;
+        int journalRecords;
+        qint64 lastBatchLatency;    // Unit ms
+        qint64 maxBatchLatency;
+        qint64 totalBatchLatency;
+    } Statistics;
+
+    void setFsyncPolicy(FsyncPolicy fsyncPolicy);
+
+    // Must be called before the worker is moved to its thread
+    bool openJournal(QString filename);
+    QHash<QString, QByteArray> journalRecords() const;
+
+    void announceBatch();
+    bool waitForIdle(int timeout);
+    Statistics getStatistics();
+
+private:
+    FsyncPolicy m_fsyncPolicy;
+
+    QMutex m_mutex;
+    QWaitCondition m_idle;
+    int m_batchesInFlight;
+    Statistics m_statistics;
+
+    DeviceJournal m_journal;
+
+signals:
+
+public slots:
+    void slot_processBatch(PersistenceBatch writes, QStringList removals);
+};
+
+class Persistence : public QObject
+{
+    Q_OBJECT
+public:
+    explicit Persistence(QObject *parent = nullptr);
+    ~Persistence();
+
+    // Records found in the journal at startup with keys starting with prefix. They are handed out only once.
+    QMap<QString, QByteArray> takeRecords(QString prefix);
+
+    // Migration of the csv files of earlier versions: each file becomes a record named like the file without suffix.
+    // The files are renamed to *.migrated once the records are in the journal, otherwise they are kept.
+    QMap<QString, QByteArray> importFiles(QString directory);
+
+    void write(QString key, QByteArray content);
+    void remove(QString key);
+
+    // Hands over all pending records and waits until they are on disk. Returns false if that took longer than timeout ms.
+    bool flush(int timeout);
+
+    quint64 getCoalescedWrites() const;
+    PersistenceWorker::Statistics getStatistics();
+
+private:
+    QThread m_workerThread;
+    PersistenceWorker* m_worker;
+    QTimer m_timer_writeDelay;
+    bool m_journalOpen;
+
+    QHash<QString, QByteArray> m_loadedRecords;
+    PersistenceBatch m_pendingWrites;
+    QSet<QString> m_pendingRemovals;     // A set, so deleting many devices does not search a list for each one
+    quint64 m_coalescedWrites;
+
+signals:
+    void signal_processBatch(PersistenceBatch writes, QStringList removals);
+
+public slots:
+
+private slots:
+    void slot_timer_writeDelay_fired();
+};
+
+#endif // PERSISTENCE_H
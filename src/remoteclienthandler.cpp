@@ -14,15 +14,25 @@
 **********************************************************************/
 
 #include "remoteclienthandler.h"
+#include "remoteserver.h"
 
-RemoteClientHandler::RemoteClientHandler(QObject *parent, QTcpSocket *socket, FFUdatabase *ffuDB, AuxFanDatabase *auxFanDB, Loghandler* loghandler) : QObject(parent)
+#include <QSettings>
+#include <algorithm>
+
+RemoteClientHandler::RemoteClientHandler(RemoteServer *server, QTcpSocket *socket, quint64 clientID, DeviceSnapshotPublisher *snapshotPublisher) : QObject(server)
 {
     this->socket = socket;
-    m_ffuDB = ffuDB;
-    m_auxFanDB = auxFanDB;
-    m_loghandler = loghandler;
+    m_server = server;
+    m_clientID = clientID;
+    m_snapshotPublisher = snapshotPublisher;
+
+    m_subscription = nullptr;
+    m_waitingForResponse = false;
 
-    m_livemode = false;
+    QSettings settings("/etc/openffucontrol/ebmbus-cmd/ebmbus-cmd.ini", QSettings::IniFormat);
+    settings.beginGroup("remoteController");
+    m_liveBufferLimit = settings.value("liveBufferLimit", 65536).toLongLong();
+    settings.endGroup();
 
 #ifdef QT_DEBUG
     QString debugStr;
@@ -44,15 +54,212 @@ RemoteClientHandler::RemoteClientHandler(QObject *parent, QTcpSocket *socket, FF
 
     connect(socket, SIGNAL(readyRead()), this, SLOT(slot_read_ready()));
     connect(socket, SIGNAL(disconnected()), this, SLOT(slot_disconnected()));
-    connect(m_ffuDB, SIGNAL(signal_DCIaddressingFinished(int)), this, SLOT(slot_DCIaddressingFinished(int)));
-    connect(m_ffuDB, SIGNAL(signal_DCIaddressingGotSerialNumber(int,quint8,quint8,quint8,quint32)), this, SLOT(slot_DCIaddressingGotSerialNumber(int,quint8,quint8,quint8,quint32)));
-    connect(m_ffuDB, SIGNAL(signal_FFUactualDataHasChanged(int)), this, SLOT(slot_FFUactualDataHasChanged(int)));
-    connect(m_auxFanDB, &AuxFanDatabase::signal_AuxFanActualDataHasChanged, this, &RemoteClientHandler::slot_AuxFanActualDataHasChanged);
+    connect(socket, SIGNAL(bytesWritten(qint64)), this, SLOT(slot_bytesWritten()));
+}
+
+quint64 RemoteClientHandler::getClientID() const
+{
+    return m_clientID;
+}
+
+void RemoteClientHandler::write(QByteArray data)
+{
+    socket->write(data);
+}
+
+QByteArray RemoteClientHandler::formatDataResponse(int id, QMap<QString, QString> responseData)
+{
+    QByteArray output;
+
+    if (responseData.value("actualData").toInt() == 1)
+    {
+        output.append("ActualData from id=" + QString().setNum(id).toUtf8());
+        responseData.remove("actualData");  // Remove special treatment marker
+    }
+    else
+        output.append("Data from id=" + QString().setNum(id).toUtf8());
+    QString errors;
+    foreach(QString key, responseData.keys())
+    {
+        QString response = responseData.value(key);
+        if (!response.startsWith("Error[FFU]:"))
+            output.append(" " + key.toUtf8() + "=" + response.toUtf8());
+        else
+            errors.append(response + "\r\n");
+    }
+    output.append("\r\n");
+    if (!errors.isEmpty())
+    {
+        output.append(errors.toUtf8());
+    }
+
+    return output;
+}
+
+// Returns false if a key is not part of the snapshot, the command has to be executed in the main thread then
+bool RemoteClientHandler::getFromSnapshot(int id, QStringList keys, QByteArray *response)
+{
+    DeviceSnapshotPtr snapshot = m_snapshotPublisher->current();
+    const DeviceSnapshot::Device* device = snapshot->findDevice(id);
+    QMap<QString,QString> responseData;
+
+    if (device != nullptr)
+    {
+        if (keys.contains("actual"))
+        {
+            responseData = device->actualData;
+            responseData.insert("actualData", "1");
+        }
+        else
+        {
+            foreach (QString key, keys)
+            {
+                if (device->staticData.contains(key))
+                    responseData.insert(key, device->staticData.value(key));
+                else if (device->actualData.contains(key))
+                    responseData.insert(key, device->actualData.value(key));
+                else
+                    return false;
+            }
+        }
+    }
+
+    *response = formatDataResponse(id, responseData);
+    return true;
+}
+
+// Writes an error to the client and returns false if a parameter cannot be parsed
+bool RemoteClientHandler::parseFilter(RemoteCommandData data, LiveSubscription::Filter *filter)
+{
+    filter->ffus = true;
+    filter->auxFans = true;
+
+    QString type = data.value("type");
+    if (type == "ffu")
+        filter->auxFans = false;
+    else if (type == "auxfan")
+        filter->ffus = false;
+    else if (!type.isEmpty())
+    {
+        socket->write("Error[Commandparser]: parameter \"type\" must be ffu or auxfan. Abort.\r\n");
+        return false;
+    }
+
+    if (data.contains("bus") && !parseIntegerList(data.value("bus"), &filter->busIDs))
+    {
+        socket->write("Error[Commandparser]: parameter \"bus\" cannot be parsed. Abort.\r\n");
+        return false;
+    }
+
+    if (data.contains("ids") && !parseIntegerList(data.value("ids"), &filter->ids))
+    {
+        socket->write("Error[Commandparser]: parameter \"ids\" cannot be parsed. Abort.\r\n");
+        return false;
+    }
+
+    if (data.contains("fields"))
+    {
+        if (data.value("fields") == "query")
+        {
+            socket->write("Error[Commandparser]: parameter \"fields\" needs a value. Abort.\r\n");
+            return false;
+        }
+        foreach (QString field, data.value("fields").split(",", QString::SkipEmptyParts))
+            filter->fields.insert(field);
+    }
+
+    return true;
+}
+
+// All matching devices of one snapshot in one response, so the client gets a consistent state of the fleet
+QByteArray RemoteClientHandler::getManyFromSnapshot(LiveSubscription::Filter filter)
+{
+    DeviceSnapshotPtr snapshot = m_snapshotPublisher->current();
+    LiveSubscription selection(filter);
+    QStringList fields = filter.fields.toList();
+    fields.sort();
+
+    QList<const DeviceSnapshot::Device*> devices;
+    QList<bool> isFFU;
+    if (!filter.ids.isEmpty() && (filter.ids.count() < snapshot->ffus.count() + snapshot->auxFans.count()))
+    {
+        // Few ids of many devices, look them up instead of going through all devices
+        QList<int> ids = filter.ids.toList();
+        std::sort(ids.begin(), ids.end());
+        foreach (int id, ids)
+        {
+            bool ffu;
+            const DeviceSnapshot::Device* device = snapshot->findDevice(id, &ffu);
+            if ((device != nullptr) && selection.matches(*device, ffu))
+            {
+                devices.append(device);
+                isFFU.append(ffu);
+            }
+        }
+    }
+    else
+    {
+        QMap<int, DeviceSnapshot::Device>::const_iterator it;
+        for (it = snapshot->ffus.constBegin(); it != snapshot->ffus.constEnd(); ++it)
+        {
+            if (selection.matches(it.value(), true))
+            {
+                devices.append(&it.value());
+                isFFU.append(true);
+            }
+        }
+        for (it = snapshot->auxFans.constBegin(); it != snapshot->auxFans.constEnd(); ++it)
+        {
+            if (selection.matches(it.value(), false))
+            {
+                devices.append(&it.value());
+                isFFU.append(false);
+            }
+        }
+    }
+
+    QByteArray output;
+    for (int i = 0; i < devices.count(); i++)
+    {
+        const DeviceSnapshot::Device* device = devices.at(i);
+        if (fields.isEmpty())
+        {
+            output.append(device->actualLine);  // Preformatted by the snapshot publisher
+            continue;
+        }
+
+        const char* errorPrefix = isFFU.at(i) ? "Error[FFU]:" : "Error[AuxFan]:";
+        output.append("Data from id=" + QByteArray().setNum(device->id));
+        foreach (QString field, fields)
+        {
+            QString value;
+            if (device->staticData.contains(field))
+                value = device->staticData.value(field);
+            else if (device->actualData.contains(field))
+                value = device->actualData.value(field);
+            else
+                continue;
+            if (!value.startsWith(errorPrefix))
+                output.append(" " + field.toUtf8() + "=" + value.toUtf8());
+        }
+        output.append("\r\n");
+    }
+
+    output.append("OK[Commandparser]: get-many returned " + QByteArray().setNum(devices.count()) + " devices.\r\n");
+    return output;
+}
+
+void RemoteClientHandler::slot_commandExecuted(QByteArray response)
+{
+    socket->write(response);
+    m_waitingForResponse = false;
+
+    slot_read_ready();  // Continue with commands received meanwhile
 }
 
 void RemoteClientHandler::slot_read_ready()
 {
-    while (socket->canReadLine())
+    while (!m_waitingForResponse && socket->canReadLine())
     {
         // Data format:
         // COMMAND [--key][=value] [--key][=value]...
@@ -113,8 +320,11 @@ void RemoteClientHandler::slot_read_ready()
                           "COMMANDS:\r\n"
                           "    hostname\r\n"
                           "        Show the hostname of the controller.\r\n"
-                          "    startlive\r\n"
+                          "    startlive [--bus=BUSNRS] [--ids=IDS] [--fields=FIELDS] [--type=ffu|auxfan]\r\n"
                           "        Show data of ffus in realtime. Can be stopped with stoplive\r\n"
+                          "        All devices are sent once, after that only fields which changed.\r\n"
+                          "        BUSNRS and IDS are comma separated lists of numbers or ranges like 5-9, FIELDS of actual keys.\r\n"
+                          "        Only devices and fields matching all given filters are shown.\r\n"
                           "    stoplive\r\n"
                           "        Stop live showing of ffu data.\r\n"
                           "    list\r\n"
@@ -127,6 +337,9 @@ void RemoteClientHandler::slot_read_ready()
                           "    buffers\r\n"
                           "        Show buffer levels.\r\n"
                           "\r\n"
+                          "    bus-stats\r\n"
+                          "        Show request timeout, telegram repeat count, link statistics and round trips per second of each bus line.\r\n"
+                          "\r\n"
                           "    button --button=BUTTONNAME\r\n"
                           "        Simulate a button click.\r\n"
                           "        Possible BUTTONNAMEs: operation, error, speed0, speed50, speed100.r\n"
@@ -157,11 +370,24 @@ void RemoteClientHandler::slot_read_ready()
                           "        If IDS is set, rbu will automatically insert new ffus with the given ids.\r\n"
                           "        IDS are given in comma separated format or as just one id, in that case it is autoincremented for each unit.\r\n"
                           "\r\n"
+                          "    modbus-commission --bus=BUSNR [--baudrate=RATE] [--parity=E|O|N]\r\n"
+                          "        Switch all auxiliary fans of modbus line BUSNR and the line itself to RATE and parity.\r\n"
+                          "        RATE defaults to the highest rate supported by the fans, parity to the current one of the line.\r\n"
+                          "        If a fan does not follow, all fans are set back to the current parameters.\r\n"
+                          "\r\n"
                           "    set --parameter=VALUE\r\n"
                           "\r\n"
                           "    get --parameter\r\n"
                           "        parameter 'actual' lists all actual values of the selected ffu.\r\n"
                           "\r\n"
+                          "    get-many --ids=IDS|--bus=BUSNRS|--all [--fields=FIELDS] [--type=ffu|auxfan]\r\n"
+                          "        Show many devices at once, all from the same moment. IDS and BUSNRS are comma separated lists\r\n"
+                          "        of numbers or ranges like 5-9. Without FIELDS all actual values are shown.\r\n"
+                          "        FIELDS may contain actual and static keys like busID, unit or nSet.\r\n"
+                          "\r\n"
+                          "    dump [--fields=FIELDS] [--type=ffu|auxfan]\r\n"
+                          "        Same as get-many --all.\r\n"
+                          "\r\n"
                           "    raw-set --bus=BUSNR --KEY=VALUE\r\n"
                           "\r\n"
                           "    raw-get --bus=BUSNR --KEY1 [--KEY2 ...]\r\n");
@@ -176,10 +402,21 @@ void RemoteClientHandler::slot_read_ready()
         // ************************************************** startlive **************************************************
         else if (command == "startlive")
         {
+            LiveSubscription::Filter filter;
+            if (!parseFilter(data, &filter))
+                continue;
+
+            stopLive();     // A running live show is replaced
+
             QString line;
             line = "Liveshow=on\n";
             socket->write(line.toUtf8());
-            m_livemode = true;
+            m_subscription = m_server->subscribe(filter);
+
+            // All devices are sent once with all fields, later frames only contain changes
+            m_livePendingFFUs = m_subscription->matchingFFUs;
+            m_livePendingAuxFans = m_subscription->matchingAuxFans;
+            flushLive();
         }
         // ************************************************** stoplive **************************************************
         else if (command == "stoplive")
@@ -187,329 +424,54 @@ void RemoteClientHandler::slot_read_ready()
             QString line;
             line = "Liveshow=off\n";
             socket->write(line.toUtf8());
-            m_livemode = false;
+            stopLive();
         }
         // ************************************************** list **************************************************
         else if (command == "list")
         {
-            QList<FFU*> ffus = m_ffuDB->getFFUs();
-            foreach(FFU* ffu, ffus)
+            DeviceSnapshotPtr snapshot = m_snapshotPublisher->current();
+            QByteArray output;
+            foreach (const DeviceSnapshot::Device& ffu, snapshot->ffus)
             {
                 QString line;
 
-                line.sprintf("FFU id=%i busID=%i unit=%i fanAddress=%i fanGroup=%i nSet=%i\r\n", ffu->getId(), ffu->getBusID(), ffu->getUnit(), ffu->getFanAddress(), ffu->getFanGroup(), ffu->getSpeedSetpoint());
+                line.sprintf("FFU id=%i busID=%i unit=%i fanAddress=%i fanGroup=%i nSet=%i\r\n", ffu.id, ffu.busID, ffu.staticData.value("unit").toInt(),
+                             ffu.staticData.value("fanAddress").toInt(), ffu.staticData.value("fanGroup").toInt(), ffu.staticData.value("nSet").toInt());
 
-                socket->write(line.toUtf8());
+                output.append(line.toUtf8());
             }
+            socket->write(output);
         }
         // ************************************************** list-auxfans **************************************************
         else if (command == "list-auxfans")
         {
-            QList<AuxFan*> auxFans = m_auxFanDB->getAuxFans();
-            foreach(AuxFan* auxFan, auxFans)
+            DeviceSnapshotPtr snapshot = m_snapshotPublisher->current();
+            QByteArray output;
+            foreach (const DeviceSnapshot::Device& auxFan, snapshot->auxFans)
             {
                 QString line;
 
-                line.sprintf("AuxFan id=%i busID=%i fanAddress=%i nSet=%i\r\n", auxFan->getId(), auxFan->getBusID(), auxFan->getFanAddress(), auxFan->getSpeedSetpoint());
-
-                socket->write(line.toUtf8());
-            }
-        }
-        // ************************************************** log **************************************************
-        else if (command == "log")
-        {
-            socket->write(m_loghandler->toString(LogEntry::Info).toUtf8() + "\n");
-            socket->write(m_loghandler->toString(LogEntry::Warning).toUtf8() + "\n");
-            socket->write(m_loghandler->toString(LogEntry::Error).toUtf8() + "\n");
-        }
-        // ************************************************** buffers **************************************************
-        else if (command == "buffers")
-        {
-            int i = 0;
-            foreach(EbmBus* bus, *m_ffuDB->getBusList())
-            {
-                int telegramQueueLevel_standardPriority = bus->getSizeOfTelegramQueue(false);
-                int telegramQueueLevel_highPriority = bus->getSizeOfTelegramQueue(true);
-                QString line;
-                line.sprintf("EbmBus line %i: TelegramQueueLevel_standardPriority=%i TelegramQueueLevel_highPriority=%i\r\n",
-                             i, telegramQueueLevel_standardPriority, telegramQueueLevel_highPriority);
-                socket->write(line.toUtf8());
-                i++;
-            }
-        }
-        // ************************************************** button **************************************************
-        else if (command == "button")
-        {
-            QString button = data.value("button");
-            if (button.isEmpty())
-            {
-                socket->write("Error[Commandparser]: parameter \"button\" not specified. Abort.\r\n");
-                continue;
-            }
-
-            if (button == "operation")
-                emit signal_buttonSimulated_operation_clicked();
-            else if (button == "error")
-                emit signal_buttonSimulated_error_clicked();
-            else if (button == "speed0")
-                emit signal_buttonSimulated_speed_0_clicked();
-            else if (button == "speed50")
-                emit signal_buttonSimulated_speed_50_clicked();
-            else if (button == "speed100")
-                emit signal_buttonSimulated_speed_100_clicked();
-        }
-        // ************************************************** button-leds **************************************************
-        else if (command == "button-leds")
-        {
-            QString response;
-            response.sprintf("Button-LED[operation]=.\r\n");
-            response.sprintf("Button-LED[error]=.\r\n");
-            response.sprintf("Button-LED[speed0]=.\r\n");
-            response.sprintf("Button-LED[speed50]=.\r\n");
-            response.sprintf("Button-LED[speed100]=.\r\n");
-
-            response = "Not implemented yet.\r\n";  // TBD. Implementation
-
-            socket->write(response.toUtf8());
-        }
-        // ************************************************** add-ffu **************************************************
-        else if ((command == "add-ffu") || (command == "add-auxfan"))
-        {
-            bool ok;
-
-            QString busString = data.value("bus");
-            int bus = busString.toInt(&ok);
-            if (busString.isEmpty() || !ok)
-            {
-                socket->write("Error[Commandparser]: parameter \"bus\" not specified or bus cannot be parsed. Abort.\r\n");
-                continue;
-            }
-
-            QString idString = data.value("id");
-            int id = idString.toInt(&ok);
-            if (idString.isEmpty() || !ok)
-            {
-                socket->write("Error[Commandparser]: parameter \"id\" not specified or id can not be parsed. Abort.\r\n");
-                continue;
-            }
-
-            QString unitString = data.value("unit");
-            int unit = unitString.toInt(&ok);
-            if ((unitString.isEmpty() || !ok) && (command == "add-ffu"))
-            {
-                socket->write("Error[Commandparser]: parameter \"unit\" not specified or id can not be parsed. Abort.\r\n");
-                continue;
-            }
-
-            QString addressString = data.value("fanAddress");
-            int fanAddress = addressString.toInt(&ok);
-            if ((addressString.isEmpty() || !ok) && (command == "add-auxfan"))
-            {
-                socket->write("Error[Commandparser]: parameter \"fanAddress\" not specified or id can not be parsed. Abort.\r\n");
-                continue;
-            }
-
-#ifdef DEBUG
-            socket->write("add-ffu bus=" + QString().setNum(bus).toUtf8() + " id=" + QString().setNum(id).toUtf8() + " unit=" + QString().setNum(unit).toUtf8() + "\r\n");
-#endif
-            QString response;
-            if (command == "add-ffu")
-                response = m_ffuDB->addFFU(id, bus, unit);
-            else if (command == "add-auxfan")
-                response = m_auxFanDB->addAuxFan(id, bus, fanAddress);
-            socket->write(response.toUtf8() + "\r\n");
-        }
-        // ************************************************** delete-ffu **************************************************
-        else if (command == "delete-ffu")
-        {
-            bool ok;
-            QString response;
-            bool noID = false;
-            bool noBus = false;
-
-            QString idString = data.value("id");
-            int id = idString.toInt(&ok);
-            if (idString.isEmpty() || !ok)
-            {
-                noID = true;
-            }
-            else
-            {
-                response += m_ffuDB->deleteFFU(id) + "\n";
-            }
-
-            QString busString = data.value("bus");
-            int bus = busString.toInt(&ok);
-            if (busString.isEmpty() || !ok)
-            {
-                noBus = true;
-            }
-            else
-            {
-                foreach (FFU* ffu, m_ffuDB->getFFUs(bus))
-                {
-                    response += m_ffuDB->deleteFFU(ffu->getId()) + "\n";
-                }
-            }
-
-            if (noID && noBus)
-                response = "Error[Commandparser]: Neither parameter \"id\" nor parameter \"bus\" specified. Abort.\r\n";
-
-
-#ifdef DEBUG
-            socket->write("delete-ffu id=" + QString().setNum(id).toUtf8() + "\r\n");
-#endif
-
-
-            socket->write(response.toUtf8() + "\r\n");
-        }
-        // ************************************************** delete-auxfan **************************************************
-        else if (command == "delete-auxfan")
-        {
-            bool ok;
-            QString response;
-            bool noID = false;
-            bool noBus = false;
-
-            QString idString = data.value("id");
-            int id = idString.toInt(&ok);
-            if (idString.isEmpty() || !ok)
-            {
-                noID = true;
-            }
-            else
-            {
-                response += m_ffuDB->deleteFFU(id) + "\n";
-            }
-
-            QString busString = data.value("bus");
-            int bus = busString.toInt(&ok);
-            if (busString.isEmpty() || !ok)
-            {
-                noBus = true;
-            }
-            else
-            {
-                foreach (AuxFan* auxFan, m_auxFanDB->getAuxFans(bus))
-                {
-                    response += m_auxFanDB->deleteAuxFan(auxFan->getId()) + "\n";
-                }
-            }
-
-            if (noID && noBus)
-                response = "Error[Commandparser]: Neither parameter \"id\" nor parameter \"bus\" specified. Abort.\r\n";
-
-
-#ifdef DEBUG
-            socket->write("delete-auxfan id=" + QString().setNum(id).toUtf8() + "\r\n");
-#endif
-
-
-            socket->write(response.toUtf8() + "\r\n");
-        }
-        // ************************************************** broadcast **************************************************
-        else if (command == "broadcast")
-        {
-            bool ok;
-
-            QString busString = data.value("bus");
-            int bus = busString.toInt(&ok);
-            if (busString.isEmpty() || !ok)
-            {
-                socket->write("Error[Commandparser]: parameter \"bus\" not specified or bus cannot be parsed. Abort.\r\n");
-                continue;
-            }
-
-#ifdef DEBUG
-            socket->write("broadcast bus=" + QString().setNum(bus).toUtf8() + " speed=" + speed.toUtf8() + "\r\n");
-#endif
-
-            data.remove("bus"); // busNr should no be passed to broadcast, so we remove it here.
-            QString response = m_ffuDB->broadcast(bus, data);
-            socket->write(response.toUtf8() + "\r\n");
-        }
-        // ************************************************** dci-address **************************************************
-        else if (command == "dci-address")
-        {
-            bool ok;
-
-            QString busString = data.value("bus");
-            int bus = busString.toInt(&ok);
-            if (busString.isEmpty() || !ok)
-            {
-                socket->write("Error[Commandparser]: parameter \"bus\" not specified or bus cannot be parsed. Abort.\r\n");
-                continue;
-            }
-
-            QString startAdr = data.value("startAdr");
-            if (startAdr.isEmpty())
-            {
-                socket->write("Error[Commandparser]: parameter \"startAdr\" not specified. Abort.\r\n");
-                continue;
-            }
-
-            QString idsString = data.value("ids");
-
-#ifdef DEBUG
-            socket->write("dci-address bus=" + QString().setNum(bus).toUtf8() + " startAdr=" + startAdr.toUtf8() + "\r\n");
-#endif
-
-            QString response = m_ffuDB->startDCIaddressing(bus, "tbd.", idsString);
-            socket->write(response.toUtf8() + "\r\n");
-        }
-        // ************************************************** raw-set **************************************************
-        else if (command == "raw-set")
-        {
-            socket->write("Not implemented yet. Running in echo mode.\r\n");
+                line.sprintf("AuxFan id=%i busID=%i fanAddress=%i nSet=%i\r\n", auxFan.id, auxFan.busID, auxFan.staticData.value("fanAddress").toInt(),
+                             auxFan.staticData.value("nSet").toInt());
 
-            QString bus = data.value("bus");
-            if (bus.isEmpty())
-            {
-                socket->write("Error[Commandparser]: parameter \"bus\" not specified. Abort.\r\n");
-                continue;
+                output.append(line.toUtf8());
             }
-
-#ifdef DEBUG
-            socket->write("raw-set bus=" + bus.toUtf8() + "\r\n");
-#endif
+            socket->write(output);
         }
-        // ************************************************** raw-get **************************************************
-        else if (command == "raw-get")
+        // ************************************************** get-many **************************************************
+        else if ((command == "get-many") || (command == "dump"))
         {
-            socket->write("Not implemented yet. Running in echo mode.\r\n");
-
-            QString bus = data.value("bus");
-            if (bus.isEmpty())
-            {
-                socket->write("Error[Commandparser]: parameter \"bus\" not specified. Abort.\r\n");
+            LiveSubscription::Filter filter;
+            if (!parseFilter(data, &filter))
                 continue;
-            }
 
-#ifdef DEBUG
-            socket->write("raw-get bus=" + bus.toUtf8() + "\r\n");
-#endif
-        }
-        // ************************************************** set **************************************************
-        else if (command == "set")
-        {
-            bool ok;
-            QString idString = data.value("id");
-            int id = idString.toInt(&ok);
-            if (idString.isEmpty() || !ok)
+            if ((command == "get-many") && !data.contains("all") && filter.busIDs.isEmpty() && filter.ids.isEmpty())
             {
-                socket->write("Error[Commandparser]: parameter \"id\" not specified or id can not be parsed. Abort.\r\n");
+                socket->write("Error[Commandparser]: Neither parameter \"ids\", \"bus\" nor \"all\" specified. Abort.\r\n");
                 continue;
             }
 
-#ifdef DEBUG
-            socket->write("set id=" + QString().setNum(id).toUtf8() + "\r\n");
-#endif
-            QString response;
-            if (m_ffuDB->getFFUbyID(id) != nullptr)
-                response = m_ffuDB->setFFUdata(id, data);
-            else if (m_auxFanDB->getAuxFanByID(id) != nullptr)
-                response = m_auxFanDB->setAuxFanData(id, data);
-            socket->write(response.toUtf8() + "\r\n");
+            socket->write(getManyFromSnapshot(filter));
         }
         // ************************************************** get **************************************************
         else if (command == "get")
@@ -523,42 +485,21 @@ void RemoteClientHandler::slot_read_ready()
                 continue;
             }
 
-#ifdef DEBUG
-            socket->write("get id=" + id.toUtf8() + "\r\n");
-#endif
-            QMap<QString,QString> responseData;
-
-            if (m_ffuDB->getFFUbyID(id) != nullptr)
-                responseData = m_ffuDB->getFFUdata(id, data.keys("query"));
-            else if (m_auxFanDB->getAuxFanByID(id) != nullptr)
-                responseData = m_auxFanDB->getAuxFanData(id, data.keys("query"));
-            if (responseData.value("actualData").toInt() == 1)
-            {
-                socket->write("ActualData from id=" + QString().setNum(id).toUtf8());
-                responseData.remove("actualData");  // Remove special treatment marker
-            }
+            QByteArray response;
+            if (getFromSnapshot(id, data.keys("query"), &response))
+                socket->write(response);
             else
-                socket->write("Data from id=" + QString().setNum(id).toUtf8());
-            QString errors;
-            foreach(QString key, responseData.keys())
             {
-                QString response = responseData.value(key);
-                if (!response.startsWith("Error[FFU]:"))
-                    socket->write(" " + key.toUtf8() + "=" + response.toUtf8());
-                else
-                    errors.append(response + "\r\n");
-            }
-            socket->write("\r\n");
-            if (!errors.isEmpty())
-            {
-                socket->write(errors.toUtf8());
+                m_waitingForResponse = true;
+                emit signal_executeCommand(m_clientID, command, data);
             }
         }
-        // ************************************************** UNSUPPORTED COMMAND **************************************************
+        // ************************************************** all other commands **************************************************
         else
         {
-            // If control reaches this point, we have an unsupported command
-            socket->write("ERROR: Command not supported: " + command.toUtf8() + "\r\n");
+            // Changes and everything not in the snapshot are handled by the main thread, see RemoteCommandExecutor
+            m_waitingForResponse = true;
+            emit signal_executeCommand(m_clientID, command, data);
         }
     }
 }
@@ -584,48 +525,105 @@ void RemoteClientHandler::slot_disconnected()
     emit signal_connectionClosed(this->socket, this);
 }
 
-void RemoteClientHandler::slot_DCIaddressingFinished(int busID)
+void RemoteClientHandler::liveUpdate(DeviceSnapshotPtr snapshot)
 {
-    socket->write("dci-address successful on bus=" + QByteArray().setNum(busID) + "\r\n");
+    m_liveSnapshot = snapshot;
+
+    if (m_subscription == nullptr)
+        return;
+
+    if (m_livePendingFFUs.isEmpty() && m_livePendingAuxFans.isEmpty() && (socket->bytesToWrite() < m_liveBufferLimit))
+    {
+        if (!m_subscription->frame.isEmpty())
+            socket->write(m_subscription->frame);
+        return;
+    }
+
+    foreach (int id, snapshot->changedFFUs)
+    {
+        if (m_subscription->matchingFFUs.contains(id))
+            m_livePendingFFUs.insert(id);
+    }
+    foreach (int id, snapshot->changedAuxFans)
+    {
+        if (m_subscription->matchingAuxFans.contains(id))
+            m_livePendingAuxFans.insert(id);
+    }
+
+    flushLive();
 }
 
-void RemoteClientHandler::slot_DCIaddressingGotSerialNumber(int busID, quint8 unit, quint8 fanAddress, quint8 fanGroup, quint32 serialNumber)
+void RemoteClientHandler::stopLive()
 {
-    QString response;
-    response.sprintf("dci-address bus=%i unit=%i serial=%i fanAddress=%i fanGroup=%i\r\n", busID, unit, serialNumber, fanAddress, fanGroup);
-    socket->write(response.toUtf8());
+    if (m_subscription != nullptr)
+        m_server->unsubscribe(m_subscription);
+    m_subscription = nullptr;
+    m_livePendingFFUs.clear();
+    m_livePendingAuxFans.clear();
 }
 
-void RemoteClientHandler::slot_FFUactualDataHasChanged(int id)
+bool RemoteClientHandler::parseIntegerList(QString string, QSet<int> *values)
 {
-    if (m_livemode)
+    foreach (QString part, string.split(",", QString::SkipEmptyParts))
     {
-        socket->write("ActualData from id=" + QString().setNum(id).toUtf8());
-        QMap<QString,QString> responseData = m_ffuDB->getFFUdata(id, QStringList() << "actual");
-        responseData.remove("actualData");  // Remove special treatment marker
-        foreach(QString key, responseData.keys())
+        bool ok;
+        QStringList range = part.split("-");
+        if (range.length() == 1)
         {
-            QString response = responseData.value(key);
-            if (!response.startsWith("Error[FFU]:"))
-                socket->write(" " + key.toUtf8() + "=" + response.toUtf8());
+            values->insert(part.toInt(&ok));
+            if (!ok)
+                return false;
         }
-        socket->write("\r\n");
+        else if (range.length() == 2)
+        {
+            bool okLast;
+            int first = range.at(0).toInt(&ok);
+            int last = range.at(1).toInt(&okLast);
+            if (!ok || !okLast || (last < first) || (last - first > MaxRangeLength))
+                return false;
+            for (int value = first; value <= last; value++)
+                values->insert(value);
+        }
+        else
+            return false;
     }
+
+    return !values->isEmpty();
 }
 
-void RemoteClientHandler::slot_AuxFanActualDataHasChanged(int id)
+void RemoteClientHandler::slot_bytesWritten()
 {
-    if (m_livemode)
+    if ((m_subscription != nullptr) && (!m_livePendingFFUs.isEmpty() || !m_livePendingAuxFans.isEmpty()))
+        flushLive();
+}
+
+void RemoteClientHandler::flushLive()
+{
+    qint64 space = m_liveBufferLimit - socket->bytesToWrite();
+    if (space <= 0)
+        return;     // Client is behind, the pending devices are sent with their newest state later
+
+    const DeviceSnapshot* snapshot = m_liveSnapshot.data();
+    QByteArray output;
+
+    QSet<int>::iterator it = m_livePendingFFUs.begin();
+    while ((it != m_livePendingFFUs.end()) && (output.size() < space))
     {
-        socket->write("ActualData from id=" + QString().setNum(id).toUtf8());
-        QMap<QString,QString> responseData = m_auxFanDB->getAuxFanData(id, QStringList() << "actual");
-        responseData.remove("actualData");  // Remove special treatment marker
-        foreach(QString key, responseData.keys())
-        {
-            QString response = responseData.value(key);
-            if (!response.startsWith("Error[AuxFan]:"))
-                socket->write(" " + key.toUtf8() + "=" + response.toUtf8());
-        }
-        socket->write("\r\n");
+        QMap<int, DeviceSnapshot::Device>::const_iterator device = snapshot->ffus.constFind(*it);
+        if (device != snapshot->ffus.constEnd())
+            output.append(m_subscription->fullLine(device.value(), true));
+        it = m_livePendingFFUs.erase(it);
     }
+
+    it = m_livePendingAuxFans.begin();
+    while ((it != m_livePendingAuxFans.end()) && (output.size() < space))
+    {
+        QMap<int, DeviceSnapshot::Device>::const_iterator device = snapshot->auxFans.constFind(*it);
+        if (device != snapshot->auxFans.constEnd())
+            output.append(m_subscription->fullLine(device.value(), false));
+        it = m_livePendingAuxFans.erase(it);
+    }
+
+    if (!output.isEmpty())
+        socket->write(output);
 }
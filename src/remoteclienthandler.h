@@ -22,46 +22,73 @@
 #include <QTcpSocket>
 #include <QList>
 #include <QMap>
+#include <QSet>
 #include <QByteArray>
 #include <QRegExp>
 #include <QHostInfo>
 
-#include "ffudatabase.h"
-#include "auxfandatabase.h"
-#include "loghandler.h"
+#include "devicesnapshot.h"
+#include "livesubscription.h"
+#include "remotecommandexecutor.h"
+
+class RemoteServer;
+
+// Serves one remote client in the network thread. Commands reading devices are answered from the current
+// device snapshot, all others are queued to the RemoteCommandExecutor of the main thread. Commands of a
+// client are answered in order, so reading stops until the response of a queued command is back.
 
 class RemoteClientHandler : public QObject
 {
     Q_OBJECT
 public:
-    explicit RemoteClientHandler(QObject *parent, QTcpSocket* socket, FFUdatabase* ffuDB, AuxFanDatabase* auxFanDB, Loghandler *loghandler);
+    explicit RemoteClientHandler(RemoteServer *server, QTcpSocket* socket, quint64 clientID, DeviceSnapshotPublisher* snapshotPublisher);
+
+    quint64 getClientID() const;
+    void write(QByteArray data);
+
+    void liveUpdate(DeviceSnapshotPtr snapshot);    // Called for each snapshot after the frames of the subscriptions are built
+    void stopLive();
+
+    static bool parseIntegerList(QString string, QSet<int>* values);    // Like "1,2,5-9"
+
+    static QByteArray formatDataResponse(int id, QMap<QString,QString> responseData);
 
 private:
+    static const int MaxRangeLength = 65536;
+
     QTcpSocket* socket;
-    FFUdatabase* m_ffuDB;
-    AuxFanDatabase* m_auxFanDB;
-    Loghandler* m_loghandler;
-    bool m_livemode;
+    RemoteServer* m_server;
+    quint64 m_clientID;
+    DeviceSnapshotPublisher* m_snapshotPublisher;
+    bool m_waitingForResponse;
+
+    // Live mode sends the shared frames of the subscription, which only contain fields changed since the previous
+    // snapshot. Devices changed while the socket has more than m_liveBufferLimit bytes to write are kept pending,
+    // and are sent with their newest line from the current snapshot once the client caught up. Frames are only
+    // sent again when nothing is pending, as a client has to know all fields of a device before it gets deltas.
+    qint64 m_liveBufferLimit;
+    LiveSubscription* m_subscription;
+    DeviceSnapshotPtr m_liveSnapshot;   // The snapshot the last frame was built from, pending devices are sent from it
+    QSet<int> m_livePendingFFUs;
+    QSet<int> m_livePendingAuxFans;
+
+    bool getFromSnapshot(int id, QStringList keys, QByteArray* response);
+    bool parseFilter(RemoteCommandData data, LiveSubscription::Filter* filter);
+    QByteArray getManyFromSnapshot(LiveSubscription::Filter filter);
+    void flushLive();
 
 signals:
     void signal_broadcast(QByteArray data);
     void signal_connectionClosed(QTcpSocket* socket, RemoteClientHandler* remoteClientHandler);
-
-    void signal_buttonSimulated_operation_clicked();
-    void signal_buttonSimulated_error_clicked();
-    void signal_buttonSimulated_speed_0_clicked();
-    void signal_buttonSimulated_speed_50_clicked();
-    void signal_buttonSimulated_speed_100_clicked();
+    void signal_executeCommand(quint64 clientID, QString command, RemoteCommandData data);
 
 public slots:
+    void slot_commandExecuted(QByteArray response);
 
 private slots:
     void slot_read_ready();
     void slot_disconnected();
-    void slot_DCIaddressingFinished(int busID);
-    void slot_DCIaddressingGotSerialNumber(int busID, quint8 unit, quint8 fanAddress, quint8 fanGroup, quint32 serialNumber);
-    void slot_FFUactualDataHasChanged(int id);
-    void slot_AuxFanActualDataHasChanged(int id);
+    void slot_bytesWritten();
 };
 
 #endif // REMOTECLIENTHANDLER_H
@@ -0,0 +1,526 @@
+/**********************************************************************
+** ebmbus-cmd - a commandline tool to control ebm papst fans
+** Copyright (C) 2018 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+
+#include "remotecommandexecutor.h"
+#include "remoteclienthandler.h"
+
+RemoteCommandExecutor::RemoteCommandExecutor(QObject *parent, FFUdatabase *ffuDB, AuxFanDatabase *auxFanDB, Loghandler *loghandler, DeviceSnapshotPublisher *snapshotPublisher) : QObject(parent)
+{
+    qRegisterMetaType<RemoteCommandData>("RemoteCommandData");
+
+    m_ffuDB = ffuDB;
+    m_auxFanDB = auxFanDB;
+    m_loghandler = loghandler;
+    m_snapshotPublisher = snapshotPublisher;
+}
+
+void RemoteCommandExecutor::slot_executeCommand(quint64 clientID, QString command, RemoteCommandData data)
+{
+    QByteArray response = execute(command, data);
+
+    // The client must see its own changes with its next command, which is served from the snapshot again
+    if ((command == "add-ffu") || (command == "add-auxfan") || (command == "delete-ffu") || (command == "delete-auxfan"))
+        m_snapshotPublisher->publish(true);
+    else if (command == "set")
+    {
+        // set changes a single device, so only that one is read again
+        int id = data.value("id").toInt();
+        if (m_ffuDB->getFFUbyID(id) != nullptr)
+            m_snapshotPublisher->markFFUdirty(id);
+        else if (m_auxFanDB->getAuxFanByID(id) != nullptr)
+            m_snapshotPublisher->markAuxFanDirty(id);
+        m_snapshotPublisher->publish(false);
+    }
+
+    emit signal_commandExecuted(clientID, response);
+}
+
+QByteArray RemoteCommandExecutor::execute(QString command, RemoteCommandData data)
+{
+    QByteArray output;
+
+    // ************************************************** log **************************************************
+    if (command == "log")
+    {
+        output.append(m_loghandler->toString(LogEntry::Info).toUtf8() + "\n");
+        output.append(m_loghandler->toString(LogEntry::Warning).toUtf8() + "\n");
+        output.append(m_loghandler->toString(LogEntry::Error).toUtf8() + "\n");
+    }
+    // ************************************************** bus-stats **************************************************
+    else if (command == "bus-stats")
+    {
+        EbmBusLinkTuner* linkTuner = m_ffuDB->getEbmBusSystem()->getLinkTuner();
+        for (int i = 0; i < m_ffuDB->getBusList()->count(); i++)
+        {
+            EbmBusLinkTuner::LineStatistics statistics = linkTuner->getLineStatistics(i);
+            QString line;
+            line.sprintf("EbmBus line %i: RequestTimeout=%i TelegramRepeatCount=%i Finished=%llu Lost=%llu Repeated=%llu LossRate=%.1lf RepeatRate=%.1lf ResponseTime50=%i ResponseTime95=%i Adjustments=%llu Throughput=%.1lf RoundTripsPerSecond=%.1lf",
+                         i, statistics.requestTimeout, statistics.telegramRepeatCount, statistics.finished, statistics.lost, statistics.repeated,
+                         statistics.lossRate, statistics.repeatRate, statistics.responseTime50, statistics.responseTime95, statistics.adjustments,
+                         m_ffuDB->getPollScheduler()->getThroughput(i), statistics.responseTime50 > 0 ? 1000.0 / statistics.responseTime50 : 0.0);
+            foreach (QString interface, m_ffuDB->getEbmBusSystem()->getInterfaces(i))
+                line.append(" " + interface + ":" + SerialInterfaceTuning::describe(interface).replace(" ", ","));
+            output.append(line.toUtf8() + "\r\n");
+        }
+
+        // Round trips per second tell what a modbus line is able to transmit with its current interface settings
+        int busID = 0;
+        foreach (EbmModbus* modbus, *m_auxFanDB->getEbmModbusSystem()->ebmModbuslist())
+        {
+            EbmModbus::TimingStatistics timing = modbus->getTimingStatistics();
+            qint64 avgRoundTrip = timing.transactions > 0 ? timing.totalDuration / (qint64)timing.transactions : 0;
+            QString line;
+            line.sprintf("EbmModBus line %i: Transactions=%llu AvgRoundTrip=%lli MaxRoundTrip=%lli RoundTripsPerSecond=%.1lf %s:",
+                         busID, timing.transactions, avgRoundTrip, timing.maxDuration, avgRoundTrip > 0 ? 1000000.0 / avgRoundTrip : 0.0,
+                         modbus->getInterface().toUtf8().data());
+            line.append(SerialInterfaceTuning::describe(modbus->getInterface()).replace(" ", ","));
+            output.append(line.toUtf8() + "\r\n");
+            busID++;
+        }
+    }
+    // ************************************************** buffers **************************************************
+    else if (command == "buffers")
+    {
+        int i = 0;
+        foreach(EbmBusLine* bus, *m_ffuDB->getBusList())
+        {
+            int telegramQueueLevel_standardPriority = bus->getSizeOfTelegramQueue(false);
+            int telegramQueueLevel_highPriority = bus->getSizeOfTelegramQueue(true);
+            QString line;
+            line.sprintf("EbmBus line %i: TelegramQueueLevel_standardPriority=%i TelegramQueueLevel_highPriority=%i TelemetryQueueLevel=%i QueueOverflows=%llu Throughput=%.1lf ScheduledFFUs=%i OverdueFFUs=%i OfflineFFUs=%i\r\n",
+                         i, telegramQueueLevel_standardPriority, telegramQueueLevel_highPriority, bus->getTelemetryQueueLevel(), bus->getQueueOverflows(),
+                         m_ffuDB->getPollScheduler()->getThroughput(i), m_ffuDB->getPollScheduler()->getScheduledCount(i), m_ffuDB->getPollScheduler()->getOverdueCount(i),
+                         m_ffuDB->getPollScheduler()->getOfflineCount(i));
+            output.append(line.toUtf8());
+            i++;
+        }
+
+        QString line;
+        line.sprintf("TransactionRegistry: PendingFFUtransactions=%i ExpiredFFUtransactions=%llu PendingAuxFanTransactions=%i ExpiredAuxFanTransactions=%llu\r\n",
+                     m_ffuDB->getTransactionRegistry()->count(), m_ffuDB->getTransactionRegistry()->expiredCount(),
+                     m_auxFanDB->getTransactionRegistry()->count(), m_auxFanDB->getTransactionRegistry()->expiredCount());
+        output.append(line.toUtf8());
+
+        line.sprintf("EbmBus dispatch: UnsolicitedResponses=%llu\r\n", m_ffuDB->getUnsolicitedResponseCount());
+        output.append(line.toUtf8());
+
+        EbmModbusSystem* ebmModbusSystem = m_auxFanDB->getEbmModbusSystem();
+        i = 0;
+        foreach (EbmModbus* modbus, *ebmModbusSystem->ebmModbuslist())
+        {
+            EbmModbus::TimingStatistics timing = modbus->getTimingStatistics();
+            line.sprintf("EbmModBus line %i: RequestQueueLevel_write=%i RequestQueueLevel_speed=%i RequestQueueLevel_diagnostics=%i Transactions=%llu LastDuration=%lli MaxDuration=%lli AvgDuration=%lli GapWait=%lli InterFrameGap=%i Baudrate=%i Parity=%c\r\n",
+                         i, ebmModbusSystem->getSizeOfRequestQueue(i, EbmModbusSystem::PriorityWrite), ebmModbusSystem->getSizeOfRequestQueue(i, EbmModbusSystem::PrioritySpeed),
+                         ebmModbusSystem->getSizeOfRequestQueue(i, EbmModbusSystem::PriorityDiagnostics),
+                         timing.transactions, timing.lastDuration, timing.maxDuration,
+                         timing.transactions > 0 ? timing.totalDuration / (qint64)timing.transactions : 0,
+                         timing.totalGapWait, modbus->getInterFrameGap(), modbus->getBaudrate(), modbus->getParity());
+            output.append(line.toUtf8());
+
+            QMap<quint16, EbmModbus::SlaveTiming> slaveTimings = modbus->getSlaveTimings();
+            QMap<quint16, EbmModbus::SlaveTiming>::const_iterator slaveIt = slaveTimings.constBegin();
+            while (slaveIt != slaveTimings.constEnd())
+            {
+                line.sprintf("EbmModBus line %i slave %i: ResponseTimeout=%i ResponseTime95=%lli Samples=%i Timeouts=%llu ConsecutiveTimeouts=%i\r\n",
+                             i, slaveIt.key(), slaveIt.value().responseTimeout, slaveIt.value().responseTime95, slaveIt.value().samples,
+                             slaveIt.value().timeouts, slaveIt.value().consecutiveTimeouts);
+                output.append(line.toUtf8());
+                ++slaveIt;
+            }
+            i++;
+        }
+
+        AuxFanPollScheduler* pollScheduler = m_auxFanDB->getPollScheduler();
+        foreach (int busID, pollScheduler->getBusIDs())
+        {
+            AuxFanPollScheduler::LineStatistics pollStatistics = pollScheduler->getLineStatistics(busID);
+            line.sprintf("AuxFan polling line %i: Fans=%i BackedOffFans=%i Utilisation=%i%% Polls=%llu OverduePolls=%llu Refreshes=%llu AvgRefreshAge=%lli MaxRefreshAge=%lli OldestAge=%lli\r\n",
+                         busID, pollStatistics.fans, pollStatistics.backedOffFans, pollStatistics.utilisation, pollStatistics.polls, pollStatistics.overduePolls,
+                         pollStatistics.refreshes, pollStatistics.avgRefreshAge, pollStatistics.maxRefreshAge, pollStatistics.oldestAge);
+            output.append(line.toUtf8());
+        }
+
+        line.sprintf("EbmModBus block reads: RegisterReads=%llu BlockReads=%llu FramesSaved=%llu DroppedDuplicateReads=%llu ReplacedWrites=%llu\r\n",
+                     ebmModbusSystem->getRegisterReadCount(), ebmModbusSystem->getBlockReadCount(), ebmModbusSystem->getFramesSaved(),
+                     ebmModbusSystem->getDroppedReadCount(), ebmModbusSystem->getReplacedWriteCount());
+        output.append(line.toUtf8());
+
+        Persistence* persistence = m_ffuDB->getPersistence();
+        PersistenceWorker::Statistics persistenceStatistics = persistence->getStatistics();
+        line.sprintf("Persistence: Writes=%llu Coalesced=%llu Removals=%llu Fsyncs=%llu Bytes=%llu Errors=%llu LastLatency=%lli MaxLatency=%lli AvgLatency=%lli JournalSize=%lli JournalRecords=%i Compactions=%llu\r\n",
+                     persistenceStatistics.writes, persistence->getCoalescedWrites(), persistenceStatistics.removals, persistenceStatistics.fsyncs,
+                     persistenceStatistics.bytes, persistenceStatistics.errors, persistenceStatistics.lastBatchLatency, persistenceStatistics.maxBatchLatency,
+                     persistenceStatistics.batches > 0 ? persistenceStatistics.totalBatchLatency / (qint64)persistenceStatistics.batches : 0,
+                     persistenceStatistics.journalSize, persistenceStatistics.journalRecords, persistenceStatistics.compactions);
+        output.append(line.toUtf8());
+    }
+    // ************************************************** button **************************************************
+    else if (command == "button")
+    {
+        QString button = data.value("button");
+        if (button.isEmpty())
+        {
+            output.append("Error[Commandparser]: parameter \"button\" not specified. Abort.\r\n");
+            return output;
+        }
+
+        if (button == "operation")
+            emit signal_buttonSimulated_operation_clicked();
+        else if (button == "error")
+            emit signal_buttonSimulated_error_clicked();
+        else if (button == "speed0")
+            emit signal_buttonSimulated_speed_0_clicked();
+        else if (button == "speed50")
+            emit signal_buttonSimulated_speed_50_clicked();
+        else if (button == "speed100")
+            emit signal_buttonSimulated_speed_100_clicked();
+    }
+    // ************************************************** button-leds **************************************************
+    else if (command == "button-leds")
+    {
+        QString response;
+        response.sprintf("Button-LED[operation]=.\r\n");
+        response.sprintf("Button-LED[error]=.\r\n");
+        response.sprintf("Button-LED[speed0]=.\r\n");
+        response.sprintf("Button-LED[speed50]=.\r\n");
+        response.sprintf("Button-LED[speed100]=.\r\n");
+
+        response = "Not implemented yet.\r\n";  // TBD. Implementation
+
+        output.append(response.toUtf8());
+    }
+    // ************************************************** add-ffu **************************************************
+    else if ((command == "add-ffu") || (command == "add-auxfan"))
+    {
+        bool ok;
+
+        QString busString = data.value("bus");
+        int bus = busString.toInt(&ok);
+        if (busString.isEmpty() || !ok)
+        {
+            output.append("Error[Commandparser]: parameter \"bus\" not specified or bus cannot be parsed. Abort.\r\n");
+            return output;
+        }
+
+        QString idString = data.value("id");
+        int id = idString.toInt(&ok);
+        if (idString.isEmpty() || !ok)
+        {
+            output.append("Error[Commandparser]: parameter \"id\" not specified or id can not be parsed. Abort.\r\n");
+            return output;
+        }
+
+        QString unitString = data.value("unit");
+        int unit = unitString.toInt(&ok);
+        if ((unitString.isEmpty() || !ok) && (command == "add-ffu"))
+        {
+            output.append("Error[Commandparser]: parameter \"unit\" not specified or id can not be parsed. Abort.\r\n");
+            return output;
+        }
+
+        QString addressString = data.value("fanAddress");
+        int fanAddress = addressString.toInt(&ok);
+        if ((addressString.isEmpty() || !ok) && (command == "add-auxfan"))
+        {
+            output.append("Error[Commandparser]: parameter \"fanAddress\" not specified or id can not be parsed. Abort.\r\n");
+            return output;
+        }
+
+#ifdef DEBUG
+        output.append("add-ffu bus=" + QString().setNum(bus).toUtf8() + " id=" + QString().setNum(id).toUtf8() + " unit=" + QString().setNum(unit).toUtf8() + "\r\n");
+#endif
+        QString response;
+        if (command == "add-ffu")
+            response = m_ffuDB->addFFU(id, bus, unit);
+        else if (command == "add-auxfan")
+            response = m_auxFanDB->addAuxFan(id, bus, fanAddress);
+        output.append(response.toUtf8() + "\r\n");
+    }
+    // ************************************************** delete-ffu **************************************************
+    else if (command == "delete-ffu")
+    {
+        bool ok;
+        QString response;
+        bool noID = false;
+        bool noBus = false;
+
+        QString idString = data.value("id");
+        int id = idString.toInt(&ok);
+        if (idString.isEmpty() || !ok)
+        {
+            noID = true;
+        }
+        else
+        {
+            response += m_ffuDB->deleteFFU(id) + "\n";
+        }
+
+        QString busString = data.value("bus");
+        int bus = busString.toInt(&ok);
+        if (busString.isEmpty() || !ok)
+        {
+            noBus = true;
+        }
+        else
+        {
+            foreach (FFU* ffu, m_ffuDB->getFFUs(bus))
+            {
+                response += m_ffuDB->deleteFFU(ffu->getId()) + "\n";
+            }
+        }
+
+        if (noID && noBus)
+            response = "Error[Commandparser]: Neither parameter \"id\" nor parameter \"bus\" specified. Abort.\r\n";
+
+
+#ifdef DEBUG
+        output.append("delete-ffu id=" + QString().setNum(id).toUtf8() + "\r\n");
+#endif
+
+
+        output.append(response.toUtf8() + "\r\n");
+    }
+    // ************************************************** delete-auxfan **************************************************
+    else if (command == "delete-auxfan")
+    {
+        bool ok;
+        QString response;
+        bool noID = false;
+        bool noBus = false;
+
+        QString idString = data.value("id");
+        int id = idString.toInt(&ok);
+        if (idString.isEmpty() || !ok)
+        {
+            noID = true;
+        }
+        else
+        {
+            response += m_ffuDB->deleteFFU(id) + "\n";
+        }
+
+        QString busString = data.value("bus");
+        int bus = busString.toInt(&ok);
+        if (busString.isEmpty() || !ok)
+        {
+            noBus = true;
+        }
+        else
+        {
+            foreach (AuxFan* auxFan, m_auxFanDB->getAuxFans(bus))
+            {
+                response += m_auxFanDB->deleteAuxFan(auxFan->getId()) + "\n";
+            }
+        }
+
+        if (noID && noBus)
+            response = "Error[Commandparser]: Neither parameter \"id\" nor parameter \"bus\" specified. Abort.\r\n";
+
+
+#ifdef DEBUG
+        output.append("delete-auxfan id=" + QString().setNum(id).toUtf8() + "\r\n");
+#endif
+
+
+        output.append(response.toUtf8() + "\r\n");
+    }
+    // ************************************************** broadcast **************************************************
+    else if (command == "broadcast")
+    {
+        bool ok;
+
+        QString busString = data.value("bus");
+        int bus = busString.toInt(&ok);
+        if (busString.isEmpty() || !ok)
+        {
+            output.append("Error[Commandparser]: parameter \"bus\" not specified or bus cannot be parsed. Abort.\r\n");
+            return output;
+        }
+
+#ifdef DEBUG
+        output.append("broadcast bus=" + QString().setNum(bus).toUtf8() + " speed=" + speed.toUtf8() + "\r\n");
+#endif
+
+        data.remove("bus"); // busNr should no be passed to broadcast, so we remove it here.
+        QString response = m_ffuDB->broadcast(bus, data);
+        output.append(response.toUtf8() + "\r\n");
+    }
+    // ************************************************** dci-address **************************************************
+    else if (command == "dci-address")
+    {
+        bool ok;
+
+        QString busString = data.value("bus");
+        int bus = busString.toInt(&ok);
+        if (busString.isEmpty() || !ok)
+        {
+            output.append("Error[Commandparser]: parameter \"bus\" not specified or bus cannot be parsed. Abort.\r\n");
+            return output;
+        }
+
+        QString startAdr = data.value("startAdr");
+        if (startAdr.isEmpty())
+        {
+            output.append("Error[Commandparser]: parameter \"startAdr\" not specified. Abort.\r\n");
+            return output;
+        }
+
+        QString idsString = data.value("ids");
+
+#ifdef DEBUG
+        output.append("dci-address bus=" + QString().setNum(bus).toUtf8() + " startAdr=" + startAdr.toUtf8() + "\r\n");
+#endif
+
+        QString response = m_ffuDB->startDCIaddressing(bus, "tbd.", idsString);
+        output.append(response.toUtf8() + "\r\n");
+    }
+    // ************************************************** modbus-commission **************************************************
+    else if (command == "modbus-commission")
+    {
+        bool ok;
+
+        QString busString = data.value("bus");
+        int bus = busString.toInt(&ok);
+        if (busString.isEmpty() || !ok)
+        {
+            output.append("Error[Commandparser]: parameter \"bus\" not specified or bus cannot be parsed. Abort.\r\n");
+            return output;
+        }
+
+        EbmModbus* modbus = m_auxFanDB->getEbmModbusSystem()->getBusByID(bus);
+        if (modbus == nullptr)
+        {
+            output.append("Error[Commandparser]: modbus line not found. Abort.\r\n");
+            return output;
+        }
+
+        int baudrate = EbmModbus::supportedBaudrates().last();
+        QString baudrateString = data.value("baudrate");
+        if (!baudrateString.isEmpty())
+        {
+            baudrate = baudrateString.toInt(&ok);
+            if (!ok)
+            {
+                output.append("Error[Commandparser]: parameter \"baudrate\" cannot be parsed. Abort.\r\n");
+                return output;
+            }
+        }
+
+        char parity = modbus->getParity();
+        QString parityString = data.value("parity").toUpper();
+        if (!parityString.isEmpty())
+        {
+            if (parityString.length() != 1)
+            {
+                output.append("Error[Commandparser]: parameter \"parity\" must be E, O or N. Abort.\r\n");
+                return output;
+            }
+            parity = parityString.at(0).toLatin1();
+        }
+
+#ifdef DEBUG
+        output.append("modbus-commission bus=" + QString().setNum(bus).toUtf8() + " baudrate=" + QString().setNum(baudrate).toUtf8() + "\r\n");
+#endif
+
+        QString response = m_auxFanDB->startCommissioning(bus, baudrate, parity);
+        output.append(response.toUtf8() + "\r\n");
+    }
+    // ************************************************** raw-set **************************************************
+    else if (command == "raw-set")
+    {
+        output.append("Not implemented yet. Running in echo mode.\r\n");
+
+        QString bus = data.value("bus");
+        if (bus.isEmpty())
+        {
+            output.append("Error[Commandparser]: parameter \"bus\" not specified. Abort.\r\n");
+            return output;
+        }
+
+#ifdef DEBUG
+        output.append("raw-set bus=" + bus.toUtf8() + "\r\n");
+#endif
+    }
+    // ************************************************** raw-get **************************************************
+    else if (command == "raw-get")
+    {
+        output.append("Not implemented yet. Running in echo mode.\r\n");
+
+        QString bus = data.value("bus");
+        if (bus.isEmpty())
+        {
+            output.append("Error[Commandparser]: parameter \"bus\" not specified. Abort.\r\n");
+            return output;
+        }
+
+#ifdef DEBUG
+        output.append("raw-get bus=" + bus.toUtf8() + "\r\n");
+#endif
+    }
+    // ************************************************** set **************************************************
+    else if (command == "set")
+    {
+        bool ok;
+        QString idString = data.value("id");
+        int id = idString.toInt(&ok);
+        if (idString.isEmpty() || !ok)
+        {
+            output.append("Error[Commandparser]: parameter \"id\" not specified or id can not be parsed. Abort.\r\n");
+            return output;
+        }
+
+#ifdef DEBUG
+        output.append("set id=" + QString().setNum(id).toUtf8() + "\r\n");
+#endif
+        QString response;
+        if (m_ffuDB->getFFUbyID(id) != nullptr)
+            response = m_ffuDB->setFFUdata(id, data);
+        else if (m_auxFanDB->getAuxFanByID(id) != nullptr)
+            response = m_auxFanDB->setAuxFanData(id, data);
+        output.append(response.toUtf8() + "\r\n");
+    }
+    // ************************************************** get **************************************************
+    else if (command == "get")
+    {
+        bool ok;
+        QString idString = data.value("id");
+        int id = idString.toInt(&ok);
+        if (idString.isEmpty() || !ok)
+        {
+            output.append("Error[Commandparser]: parameter \"id\" not specified or id can not be parsed. Abort.\r\n");
+            return output;
+        }
+
+#ifdef DEBUG
+        output.append("get id=" + id.toUtf8() + "\r\n");
+#endif
+        QMap<QString,QString> responseData;
+
+        if (m_ffuDB->getFFUbyID(id) != nullptr)
+            responseData = m_ffuDB->getFFUdata(id, data.keys("query"));
+        else if (m_auxFanDB->getAuxFanByID(id) != nullptr)
+            responseData = m_auxFanDB->getAuxFanData(id, data.keys("query"));
+        output.append(RemoteClientHandler::formatDataResponse(id, responseData));
+    }
+    // ************************************************** UNSUPPORTED COMMAND **************************************************
+    else
+    {
+        // If control reaches this point, we have an unsupported command
+        output.append("ERROR: Command not supported: " + command.toUtf8() + "\r\n");
+    }
+
+    return output;
+}
@@ -0,0 +1,63 @@
+/**********************************************************************
+** ebmbus-cmd - a commandline tool to control ebm papst fans
+** Copyright (C) 2018 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+
+#ifndef REMOTECOMMANDEXECUTOR_H
+#define REMOTECOMMANDEXECUTOR_H
+
+#include <QObject>
+#include <QMap>
+#include <QString>
+#include <QByteArray>
+
+#include "ffudatabase.h"
+#include "auxfandatabase.h"
+#include "loghandler.h"
+#include "devicesnapshot.h"
+
+typedef QMap<QString, QString> RemoteCommandData;   // Key/value pairs of a remote command
+
+// Executes the remote commands which change devices or read state not contained in the device snapshots.
+// Lives in the main thread, the client handlers of the network thread queue their commands here and get the
+// response back by signal_commandExecuted.
+
+class RemoteCommandExecutor : public QObject
+{
+    Q_OBJECT
+public:
+    explicit RemoteCommandExecutor(QObject *parent, FFUdatabase* ffuDB, AuxFanDatabase* auxFanDB, Loghandler* loghandler, DeviceSnapshotPublisher* snapshotPublisher);
+
+private:
+    FFUdatabase* m_ffuDB;
+    AuxFanDatabase* m_auxFanDB;
+    Loghandler* m_loghandler;
+    DeviceSnapshotPublisher* m_snapshotPublisher;
+
+    QByteArray execute(QString command, RemoteCommandData data);
+
+signals:
+    void signal_commandExecuted(quint64 clientID, QByteArray response);
+
+    void signal_buttonSimulated_operation_clicked();
+    void signal_buttonSimulated_error_clicked();
+    void signal_buttonSimulated_speed_0_clicked();
+    void signal_buttonSimulated_speed_50_clicked();
+    void signal_buttonSimulated_speed_100_clicked();
+
+public slots:
+    void slot_executeCommand(quint64 clientID, QString command, RemoteCommandData data);
+};
+
+#endif // REMOTECOMMANDEXECUTOR_H
@@ -26,19 +26,42 @@ RemoteController::RemoteController(QObject *parent, FFUdatabase *ffuDB, AuxFanDa
     m_loghandler = loghandler;
     m_activated = true;
     m_noConnection = true;
+    m_clientCount = 0;
 
     connect(&m_timer_connectionTimeout, SIGNAL(timeout()), this, SLOT(slot_connectionTimeout()));
     connect(this, SIGNAL(signal_connected()), &m_timer_connectionTimeout, SLOT(stop()));
     m_timer_connectionTimeout.setSingleShot(true);
     m_timer_connectionTimeout.start(30000); // 30 Sec.
 
-    connect(&m_server, SIGNAL(newConnection()),  this, SLOT(slot_new_connection()));
-    m_server.listen(QHostAddress::LocalHost, 16001);    // Restrict to localhost (ssh tunnel endpoint)
+    m_snapshotPublisher = new DeviceSnapshotPublisher(this, m_ffuDB, m_auxFanDB);
+
+    m_executor = new RemoteCommandExecutor(this, m_ffuDB, m_auxFanDB, m_loghandler, m_snapshotPublisher);
+    connect(m_executor, SIGNAL(signal_buttonSimulated_operation_clicked()), this, SIGNAL(signal_buttonSimulated_operation_clicked()));
+    connect(m_executor, SIGNAL(signal_buttonSimulated_error_clicked()), this, SIGNAL(signal_buttonSimulated_error_clicked()));
+    connect(m_executor, SIGNAL(signal_buttonSimulated_speed_0_clicked()), this, SIGNAL(signal_buttonSimulated_speed_0_clicked()));
+    connect(m_executor, SIGNAL(signal_buttonSimulated_speed_50_clicked()), this, SIGNAL(signal_buttonSimulated_speed_50_clicked()));
+    connect(m_executor, SIGNAL(signal_buttonSimulated_speed_100_clicked()), this, SIGNAL(signal_buttonSimulated_speed_100_clicked()));
+
+    connect(m_ffuDB, SIGNAL(signal_DCIaddressingFinished(int)), this, SLOT(slot_DCIaddressingFinished(int)));
+    connect(m_ffuDB, SIGNAL(signal_DCIaddressingGotSerialNumber(int,quint8,quint8,quint8,quint32)), this, SLOT(slot_DCIaddressingGotSerialNumber(int,quint8,quint8,quint8,quint32)));
+
+    // All connections to the server are queued, as it lives in the network thread
+    m_server = new RemoteServer(nullptr, m_snapshotPublisher);  // parent must be 0 in order to be moved to m_networkThread
+    m_server->moveToThread(&m_networkThread);
+    connect(&m_networkThread, &QThread::finished, m_server, &QObject::deleteLater);
+    connect(m_server, SIGNAL(signal_executeCommand(quint64,QString,RemoteCommandData)), m_executor, SLOT(slot_executeCommand(quint64,QString,RemoteCommandData)));
+    connect(m_executor, SIGNAL(signal_commandExecuted(quint64,QByteArray)), m_server, SLOT(slot_commandExecuted(quint64,QByteArray)));
+    connect(m_server, SIGNAL(signal_clientCountChanged(int)), this, SLOT(slot_clientCountChanged(int)));
+    connect(this, SIGNAL(signal_writeToClients(QByteArray)), m_server, SLOT(slot_writeToClients(QByteArray)));
+    m_networkThread.start();
+
+    QMetaObject::invokeMethod(m_server, "slot_listen", Qt::QueuedConnection);
 }
 
 RemoteController::~RemoteController()
 {
-
+    m_networkThread.quit();
+    m_networkThread.wait();
 }
 
 bool RemoteController::isConnected()
@@ -75,56 +98,42 @@ void RemoteController::slot_deactivate()
     emit signal_deactivated();
 }
 
-void RemoteController::slot_new_connection()
+void RemoteController::slot_broadcast(QByteArray data)
 {
-    QTcpSocket* newSocket = m_server.nextPendingConnection();
-    this->m_socket_list.append(newSocket);
-
-    RemoteClientHandler* remoteClientHandler = new RemoteClientHandler(this, newSocket, m_ffuDB, m_auxFanDB, m_loghandler);
-    connect(remoteClientHandler, SIGNAL(signal_broadcast(QByteArray)),
-            this, SLOT(slot_broadcast(QByteArray)));
-    connect(remoteClientHandler, SIGNAL(signal_connectionClosed(QTcpSocket*,RemoteClientHandler*)),
-            this, SLOT(slot_connectionClosed(QTcpSocket*,RemoteClientHandler*)));
-
-    connect(remoteClientHandler, SIGNAL(signal_buttonSimulated_operation_clicked()), this, SIGNAL(signal_buttonSimulated_operation_clicked()));
-    connect(remoteClientHandler, SIGNAL(signal_buttonSimulated_error_clicked()), this, SIGNAL(signal_buttonSimulated_error_clicked()));
-    connect(remoteClientHandler, SIGNAL(signal_buttonSimulated_speed_0_clicked()), this, SIGNAL(signal_buttonSimulated_speed_0_clicked()));
-    connect(remoteClientHandler, SIGNAL(signal_buttonSimulated_speed_50_clicked()), this, SIGNAL(signal_buttonSimulated_speed_50_clicked()));
-    connect(remoteClientHandler, SIGNAL(signal_buttonSimulated_speed_100_clicked()), this, SIGNAL(signal_buttonSimulated_speed_100_clicked()));
+    emit signal_writeToClients(data + "\r\n");
+}
 
-    if (m_noConnection)
+void RemoteController::slot_clientCountChanged(int count)
+{
+    if ((m_clientCount == 0) && (count > 0))
     {
         m_noConnection = false;
         m_loghandler->slot_entryGone(LogEntry::Error, "Remotecontroller", "No connection to server.");
         emit signal_connected();
     }
-}
-
-void RemoteController::slot_broadcast(QByteArray data)
-{
-    foreach(QTcpSocket* socket, this->m_socket_list)
-    {
-        socket->write(data + "\r\n");
-    }
-}
-
-void RemoteController::slot_connectionClosed(QTcpSocket *socket, RemoteClientHandler *remoteClientHandler)
-{
-    this->m_socket_list.removeOne(socket);
-    delete remoteClientHandler;
-#ifdef QT_DEBUG
-    fprintf (stdout, "ClientHandler deleted\r\n");
-#endif
-
-    if (m_socket_list.isEmpty())
+    else if ((m_clientCount > 0) && (count == 0))
     {
         m_noConnection = true;
         m_loghandler->slot_newEntry(LogEntry::Error, "Remotecontroller", "No connection to server.");
         emit signal_disconnected();
     }
+
+    m_clientCount = count;
 }
 
 void RemoteController::slot_connectionTimeout()
 {
     m_loghandler->slot_newEntry(LogEntry::Error, "Remotecontroller", "No connection to server.");
 }
+
+void RemoteController::slot_DCIaddressingFinished(int busID)
+{
+    emit signal_writeToClients("dci-address successful on bus=" + QByteArray().setNum(busID) + "\r\n");
+}
+
+void RemoteController::slot_DCIaddressingGotSerialNumber(int busID, quint8 unit, quint8 fanAddress, quint8 fanGroup, quint32 serialNumber)
+{
+    QString response;
+    response.sprintf("dci-address bus=%i unit=%i serial=%i fanAddress=%i fanGroup=%i\r\n", busID, unit, serialNumber, fanAddress, fanGroup);
+    emit signal_writeToClients(response.toUtf8());
+}
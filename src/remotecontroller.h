@@ -18,15 +18,19 @@
 
 #include <QObject>
 #include <QtNetwork>
-#include <QTcpServer>
-#include <QTcpSocket>
-#include <QList>
+#include <QThread>
 #include <iostream>
-#include "remoteclienthandler.h"
+#include "remoteserver.h"
+#include "remotecommandexecutor.h"
+#include "devicesnapshot.h"
 #include "ffudatabase.h"
 #include "auxfandatabase.h"
 #include "loghandler.h"
 
+// The tcp server and all client handlers run in a network thread of their own, so remote clients do not delay
+// the processing of bus responses in the main thread. They read devices from snapshots (see devicesnapshot.h)
+// and queue all other commands back to the RemoteCommandExecutor in the main thread.
+
 class RemoteController : public QObject
 {
     Q_OBJECT
@@ -39,8 +43,11 @@ public:
     bool isEnabled();   // Returns true if remote controller is supposed to control ffus remotely
 
 private:
-    QTcpServer m_server;
-    QList<QTcpSocket*> m_socket_list;
+    QThread m_networkThread;
+    RemoteServer* m_server;
+    RemoteCommandExecutor* m_executor;
+    DeviceSnapshotPublisher* m_snapshotPublisher;
+    int m_clientCount;
     FFUdatabase* m_ffuDB;
     AuxFanDatabase* m_auxFanDB;
     Loghandler* m_loghandler;
@@ -60,15 +67,18 @@ signals:
     void signal_buttonSimulated_speed_50_clicked();
     void signal_buttonSimulated_speed_100_clicked();
 
+    void signal_writeToClients(QByteArray data);
+
 public slots:
     void slot_activate();
     void slot_deactivate();
 
 private slots:
-    void slot_new_connection();
     void slot_broadcast(QByteArray data);
-    void slot_connectionClosed(QTcpSocket* socket, RemoteClientHandler* remoteClientHandler);
+    void slot_clientCountChanged(int count);
     void slot_connectionTimeout();
+    void slot_DCIaddressingFinished(int busID);
+    void slot_DCIaddressingGotSerialNumber(int busID, quint8 unit, quint8 fanAddress, quint8 fanGroup, quint32 serialNumber);
 };
 
 #endif // REMOTECONTROLLER_H
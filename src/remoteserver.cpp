@@ -0,0 +1,196 @@
+/**********************************************************************
+** ebmbus-cmd - a commandline tool to control ebm papst fans
+** Copyright (C) 2018 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+
+#include "remoteserver.h"
+
+RemoteServer::RemoteServer(QObject *parent, DeviceSnapshotPublisher *snapshotPublisher) : QObject(parent)
+{
+    m_tcpServer = nullptr;
+    m_snapshotPublisher = snapshotPublisher;
+    m_lastClientID = 0;
+}
+
+RemoteServer::~RemoteServer()
+{
+    qDeleteAll(m_subscriptions);
+}
+
+LiveSubscription *RemoteServer::subscribe(LiveSubscription::Filter filter)
+{
+    QString key = LiveSubscription::key(filter);
+    LiveSubscription* subscription = m_subscriptions.value(key, nullptr);
+    if (subscription == nullptr)
+    {
+        subscription = new LiveSubscription(filter);
+        m_subscriptions.insert(key, subscription);
+        rebuildSubscriberSets();
+    }
+    subscription->subscriberCount++;
+
+    return subscription;
+}
+
+void RemoteServer::unsubscribe(LiveSubscription *subscription)
+{
+    subscription->subscriberCount--;
+    if (subscription->subscriberCount > 0)
+        return;
+
+    m_subscriptions.remove(subscription->key());
+    delete subscription;
+    rebuildSubscriberSets();
+}
+
+void RemoteServer::rebuildSubscriberSets()
+{
+    m_ffuSubscribers.clear();
+    m_auxFanSubscribers.clear();
+
+    foreach (LiveSubscription* subscription, m_subscriptions)
+    {
+        subscription->matchingFFUs.clear();
+        subscription->matchingAuxFans.clear();
+
+        foreach (const DeviceSnapshot::Device& device, m_liveSnapshot->ffus)
+        {
+            if (!subscription->matches(device, true))
+                continue;
+            subscription->matchingFFUs.insert(device.id);
+            m_ffuSubscribers[device.id].append(subscription);
+        }
+        foreach (const DeviceSnapshot::Device& device, m_liveSnapshot->auxFans)
+        {
+            if (!subscription->matches(device, false))
+                continue;
+            subscription->matchingAuxFans.insert(device.id);
+            m_auxFanSubscribers[device.id].append(subscription);
+        }
+
+        // Lines are only invalidated for devices with subscribers, so a device coming back must not find an old one
+        subscription->dropUnmatchedLines();
+    }
+}
+
+void RemoteServer::slot_listen()
+{
+    m_liveSnapshot = m_snapshotPublisher->current();
+    connect(m_snapshotPublisher, SIGNAL(signal_published(DeviceSnapshotPtr)), this, SLOT(slot_snapshotPublished(DeviceSnapshotPtr)));
+
+    m_tcpServer = new QTcpServer(this);
+    connect(m_tcpServer, SIGNAL(newConnection()), this, SLOT(slot_newConnection()));
+    m_tcpServer->listen(QHostAddress::LocalHost, 16001);    // Restrict to localhost (ssh tunnel endpoint)
+}
+
+void RemoteServer::slot_writeToClients(QByteArray data)
+{
+    foreach (RemoteClientHandler* remoteClientHandler, m_clients)
+        remoteClientHandler->write(data);
+}
+
+void RemoteServer::slot_commandExecuted(quint64 clientID, QByteArray response)
+{
+    RemoteClientHandler* remoteClientHandler = m_clients.value(clientID, nullptr);
+    if (remoteClientHandler == nullptr)
+        return;     // Client is gone meanwhile
+
+    remoteClientHandler->slot_commandExecuted(response);
+}
+
+void RemoteServer::slot_newConnection()
+{
+    while (m_tcpServer->hasPendingConnections())
+    {
+        QTcpSocket* newSocket = m_tcpServer->nextPendingConnection();
+        quint64 clientID = ++m_lastClientID;
+
+        RemoteClientHandler* remoteClientHandler = new RemoteClientHandler(this, newSocket, clientID, m_snapshotPublisher);
+        m_clients.insert(clientID, remoteClientHandler);
+
+        connect(remoteClientHandler, SIGNAL(signal_broadcast(QByteArray)), this, SLOT(slot_writeToClients(QByteArray)));
+        connect(remoteClientHandler, SIGNAL(signal_connectionClosed(QTcpSocket*,RemoteClientHandler*)),
+                this, SLOT(slot_connectionClosed(QTcpSocket*,RemoteClientHandler*)));
+        connect(remoteClientHandler, SIGNAL(signal_executeCommand(quint64,QString,RemoteCommandData)),
+                this, SIGNAL(signal_executeCommand(quint64,QString,RemoteCommandData)));
+
+        remoteClientHandler->liveUpdate(m_liveSnapshot);
+
+        emit signal_clientCountChanged(m_clients.count());
+    }
+}
+
+void RemoteServer::slot_snapshotPublished(DeviceSnapshotPtr snapshot)
+{
+    DeviceSnapshotPtr previous = m_liveSnapshot;
+    m_liveSnapshot = snapshot;
+
+    if (snapshot->layoutVersion != previous->layoutVersion)
+        rebuildSubscriberSets();
+
+    foreach (LiveSubscription* subscription, m_subscriptions)
+        subscription->frame.clear();
+
+    foreach (int id, snapshot->changedFFUs)
+    {
+        QList<LiveSubscription*> subscribers = m_ffuSubscribers.value(id);
+        if (subscribers.isEmpty())
+            continue;
+
+        const DeviceSnapshot::Device& device = snapshot->ffus.constFind(id).value();
+        QMap<int, DeviceSnapshot::Device>::const_iterator previousDevice = previous->ffus.constFind(id);
+        foreach (LiveSubscription* subscription, subscribers)
+        {
+            subscription->invalidate(id, true);
+            if (previousDevice == previous->ffus.constEnd())
+                subscription->frame.append(subscription->fullLine(device, true));
+            else
+                subscription->frame.append(subscription->formatLine(id, device.actualData, &previousDevice.value().actualData, true));
+        }
+    }
+    foreach (int id, snapshot->changedAuxFans)
+    {
+        QList<LiveSubscription*> subscribers = m_auxFanSubscribers.value(id);
+        if (subscribers.isEmpty())
+            continue;
+
+        const DeviceSnapshot::Device& device = snapshot->auxFans.constFind(id).value();
+        QMap<int, DeviceSnapshot::Device>::const_iterator previousDevice = previous->auxFans.constFind(id);
+        foreach (LiveSubscription* subscription, subscribers)
+        {
+            subscription->invalidate(id, false);
+            if (previousDevice == previous->auxFans.constEnd())
+                subscription->frame.append(subscription->fullLine(device, false));
+            else
+                subscription->frame.append(subscription->formatLine(id, device.actualData, &previousDevice.value().actualData, false));
+        }
+    }
+
+    // Every handler gets the snapshot, live or not, so a client starting live mode begins with the same base
+    foreach (RemoteClientHandler* remoteClientHandler, m_clients)
+        remoteClientHandler->liveUpdate(snapshot);
+}
+
+void RemoteServer::slot_connectionClosed(QTcpSocket *socket, RemoteClientHandler *remoteClientHandler)
+{
+    m_clients.remove(remoteClientHandler->getClientID());
+    remoteClientHandler->stopLive();
+    remoteClientHandler->deleteLater();
+    socket->deleteLater();
+#ifdef QT_DEBUG
+    fprintf (stdout, "ClientHandler deleted\r\n");
+#endif
+
+    emit signal_clientCountChanged(m_clients.count());
+}
@@ -0,0 +1,73 @@
+/**********************************************************************
+** ebmbus-cmd - a commandline tool to control ebm papst fans
+** Copyright (C) 2018 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+
+#ifndef REMOTESERVER_H
+#define REMOTESERVER_H
+
+#include <QObject>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QHash>
+#include <QByteArray>
+#include "remoteclienthandler.h"
+#include "devicesnapshot.h"
+#include "livesubscription.h"
+
+// Lives in the network thread together with the tcp server and all client handlers, see RemoteController.
+// Live updates are encoded here once per published snapshot and subscription: the subscribed fields changed
+// since the previous snapshot go into one frame, which is handed to all clients of the subscription as the same
+// shared QByteArray. Which subscriptions a device belongs to is looked up in subscriber sets, which are only
+// rebuilt when devices or subscriptions come and go.
+
+class RemoteServer : public QObject
+{
+    Q_OBJECT
+public:
+    explicit RemoteServer(QObject *parent, DeviceSnapshotPublisher* snapshotPublisher);
+    ~RemoteServer();
+
+    LiveSubscription* subscribe(LiveSubscription::Filter filter);
+    void unsubscribe(LiveSubscription* subscription);
+
+private:
+    QTcpServer* m_tcpServer;    // Created in slot_listen, so it belongs to the network thread
+    DeviceSnapshotPublisher* m_snapshotPublisher;
+    QHash<quint64, RemoteClientHandler*> m_clients;
+    quint64 m_lastClientID;
+    DeviceSnapshotPtr m_liveSnapshot;   // Previous snapshot, the base of the next frame
+
+    QHash<QString, LiveSubscription*> m_subscriptions;      // By filter key
+    QHash<int, QList<LiveSubscription*> > m_ffuSubscribers;     // By device id
+    QHash<int, QList<LiveSubscription*> > m_auxFanSubscribers;
+
+    void rebuildSubscriberSets();
+
+signals:
+    void signal_clientCountChanged(int count);
+    void signal_executeCommand(quint64 clientID, QString command, RemoteCommandData data);
+
+public slots:
+    void slot_listen();
+    void slot_writeToClients(QByteArray data);
+    void slot_commandExecuted(quint64 clientID, QByteArray response);
+
+private slots:
+    void slot_newConnection();
+    void slot_snapshotPublished(DeviceSnapshotPtr snapshot);
+    void slot_connectionClosed(QTcpSocket* socket, RemoteClientHandler* remoteClientHandler);
+};
+
+#endif // REMOTESERVER_H
@@ -0,0 +1,130 @@
+/**********************************************************************
+** ebmbus-cmd - a commandline tool to control ebm papst fans
+** Copyright (C) 2018 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+#include "serialinterfacetuning.h"
+
+#include <QSettings>
+#include <QFile>
+#include <QFileInfo>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/serial.h>
+
+void SerialInterfaceTuning::apply(QString interface)
+{
+    if (interface.isEmpty())
+        return;
+
+    QString name = QFileInfo(interface).fileName();
+
+    QSettings settings("/etc/openffucontrol/ebmbus-cmd/ebmbus-cmd.ini", QSettings::IniFormat);
+    settings.beginGroup("serialTuning");
+    bool lowLatency = settings.value(name + "LowLatency", settings.value("lowLatency", false)).toBool();
+    int latencyTimer = settings.value(name + "LatencyTimer", settings.value("latencyTimer", -1)).toInt();    // -1 leaves the driver default
+    settings.endGroup();
+
+    if (lowLatency)
+        setLowLatency(interface, true);
+
+    if (latencyTimer >= 0)
+        setLatencyTimer(interface, latencyTimer);
+
+    fprintf(stderr, "SerialInterfaceTuning::apply(): %s: %s\n", interface.toUtf8().data(), describe(interface).toUtf8().data());
+}
+
+QString SerialInterfaceTuning::describe(QString interface)
+{
+    return QString().sprintf("LowLatency=%i LatencyTimer=%i", getLowLatency(interface), getLatencyTimer(interface));
+}
+
+bool SerialInterfaceTuning::setLowLatency(QString interface, bool lowLatency)
+{
+    int fd = ::open(interface.toLocal8Bit().data(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd < 0)
+    {
+        fprintf(stderr, "SerialInterfaceTuning::setLowLatency(): Unable to open %s: %s\n", interface.toLocal8Bit().data(), strerror(errno));
+        return false;
+    }
+
+    // The flag stays with the driver's port, so it is still set when the bus opens the interface later on
+    struct serial_struct serial;
+    bool ok = (ioctl(fd, TIOCGSERIAL, &serial) == 0);
+    if (ok)
+    {
+        if (lowLatency)
+            serial.flags |= ASYNC_LOW_LATENCY;
+        else
+            serial.flags &= ~ASYNC_LOW_LATENCY;
+        ok = (ioctl(fd, TIOCSSERIAL, &serial) == 0);
+    }
+    if (!ok)
+        fprintf(stderr, "SerialInterfaceTuning::setLowLatency(): Unable to set low latency mode of %s: %s\n", interface.toLocal8Bit().data(), strerror(errno));
+
+    ::close(fd);
+    return ok;
+}
+
+int SerialInterfaceTuning::getLowLatency(QString interface)
+{
+    int fd = ::open(interface.toLocal8Bit().data(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd < 0)
+        return -1;
+
+    struct serial_struct serial;
+    int lowLatency = -1;
+    if (ioctl(fd, TIOCGSERIAL, &serial) == 0)
+        lowLatency = (serial.flags & ASYNC_LOW_LATENCY) ? 1 : 0;
+
+    ::close(fd);
+    return lowLatency;
+}
+
+// Udev links like /dev/ffu-bus0 are resolved to the tty, the latency timer is an attribute of the usb serial port
+QString SerialInterfaceTuning::latencyTimerPath(QString interface)
+{
+    QString name = QFileInfo(QFileInfo(interface).canonicalFilePath()).fileName();
+    return "/sys/bus/usb-serial/devices/" + name + "/latency_timer";
+}
+
+bool SerialInterfaceTuning::setLatencyTimer(QString interface, int latencyTimer)
+{
+    QFile file(latencyTimerPath(interface));
+    if (!file.exists())
+        return false;   // No usb serial adapter, nothing to do
+
+    if (!file.open(QIODevice::WriteOnly) || (file.write(QByteArray::number(qBound(1, latencyTimer, 255)) + "\n") < 0))
+    {
+        fprintf(stderr, "SerialInterfaceTuning::setLatencyTimer(): Unable to write %s.\n", file.fileName().toLocal8Bit().data());
+        return false;
+    }
+
+    file.close();
+    return true;
+}
+
+int SerialInterfaceTuning::getLatencyTimer(QString interface)
+{
+    QFile file(latencyTimerPath(interface));
+    if (!file.open(QIODevice::ReadOnly))
+        return -1;
+
+    bool ok;
+    int latencyTimer = file.readAll().trimmed().toInt(&ok);
+    return ok ? latencyTimer : -1;
+}
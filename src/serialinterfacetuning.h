@@ -0,0 +1,42 @@
+/**********************************************************************
+** ebmbus-cmd - a commandline tool to control ebm papst fans
+** Copyright (C) 2018 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+#ifndef SERIALINTERFACETUNING_H
+#define SERIALINTERFACETUNING_H
+
+#include <QString>
+
+// USB serial adapters hold back received bytes until their latency timer expires (16 ms by default for FTDI),
+// which adds to every request/response cycle on the buses. Before an interface is opened, its driver can be put
+// to low latency mode (ASYNC_LOW_LATENCY) and the latency timer in sysfs can be lowered.
+//
+// Configured in section [serialTuning] of the ini file, with defaults for all interfaces and overrides per
+// interface name, e.g. ttyUSB0LowLatency=false or ttyUSB0LatencyTimer=2.
+
+class SerialInterfaceTuning
+{
+public:
+    static void apply(QString interface);       // interface is the device path, e.g. /dev/ttyUSB0
+    static QString describe(QString interface); // Current settings of the driver, e.g. "LowLatency=1 LatencyTimer=1"
+
+private:
+    static bool setLowLatency(QString interface, bool lowLatency);
+    static int getLowLatency(QString interface);        // -1 if unknown
+    static QString latencyTimerPath(QString interface);
+    static bool setLatencyTimer(QString interface, int latencyTimer);
+    static int getLatencyTimer(QString interface);      // -1 if not an usb serial adapter with latency timer
+};
+
+#endif // SERIALINTERFACETUNING_H
@@ -0,0 +1,88 @@
+/**********************************************************************
+** ebmbus-cmd - a commandline tool to control ebm papst fans
+** Copyright (C) 2018 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+#include <utility>
+
+// Bounded lock-free queue for exactly one producer thread and one consumer thread.
+// Capacity is rounded up to a power of two. push() returns false if the queue is full, pop() if it is empty.
+// Neither blocks, so the consumer has to be woken up by other means, e.g. a queued slot call.
+// Head and tail are kept a cache line apart by padding. alignas() would make the owning objects over-aligned,
+// which plain new does not honour before C++17.
+
+template <typename T>
+class SpscQueue
+{
+public:
+    explicit SpscQueue(std::size_t capacity)
+    {
+        std::size_t size = 2;
+        while (size < capacity)
+            size *= 2;
+        m_slots.resize(size);
+        m_mask = size - 1;
+        m_head.store(0, std::memory_order_relaxed);
+        m_tail.store(0, std::memory_order_relaxed);
+    }
+
+    // Producer side
+    bool push(T item)
+    {
+        std::size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head.load(std::memory_order_acquire) > m_mask)
+            return false;
+
+        m_slots[tail & m_mask] = std::move(item);
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side
+    bool pop(T* item)
+    {
+        std::size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire))
+            return false;
+
+        *item = std::move(m_slots[head & m_mask]);
+        m_slots[head & m_mask] = T();   // Do not keep shared data like QByteArrays alive in the slot
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Either side, only a snapshot
+    std::size_t size() const
+    {
+        return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+    }
+
+private:
+    static const std::size_t CacheLineSize = 64;
+
+    std::vector<T> m_slots;
+    std::size_t m_mask;
+    char m_padding0[CacheLineSize];
+    std::atomic<std::size_t> m_head;     // Next slot to read, written by the consumer only
+    char m_padding1[CacheLineSize - sizeof(std::atomic<std::size_t>)];
+    std::atomic<std::size_t> m_tail;     // Next slot to write, written by the producer only
+    char m_padding2[CacheLineSize - sizeof(std::atomic<std::size_t>)];
+};
+
+#endif // SPSCQUEUE_H
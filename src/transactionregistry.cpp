@@ -0,0 +1,126 @@
+/**********************************************************************
+** ebmbus-cmd - a commandline tool to control ebm papst fans
+** Copyright (C) 2018 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+#include "transactionregistry.h"
+
+TransactionRegistry::TransactionRegistry(QObject *parent) : QObject(parent)
+{
+    m_expiredCount = 0;
+    m_clock.start();
+
+    connect(&m_timer_expiry, SIGNAL(timeout()), this, SLOT(slot_timer_expiry_fired()));
+    setExpiryTime(60000);   // Telegrams are either answered or lost within some seconds, so one minute is plenty
+    m_timer_expiry.start();
+}
+
+void TransactionRegistry::registerTransaction(quint64 telegramID, QObject *owner, TransactionRegistry::RequestKind kind)
+{
+    if (telegramID == 0)
+        return;     // 0 is reserved for errors, so there will never be a response
+
+    Transaction transaction;
+    transaction.owner = owner;
+    transaction.kind = kind;
+    transaction.enqueueTime = m_clock.elapsed();
+
+    QHash<quint64, Transaction>::iterator it = m_transactions.find(telegramID);
+    if (it != m_transactions.end())
+        removePending(it.value().owner, telegramID);    // Telegram id reused, so the old entry is orphaned anyway
+
+    m_transactions.insert(telegramID, transaction);
+    m_pendingPerOwner[owner].insert(telegramID);
+}
+
+QObject *TransactionRegistry::takeOwner(quint64 telegramID, Transaction *transaction)
+{
+    QHash<quint64, Transaction>::iterator it = m_transactions.find(telegramID);
+    if (it == m_transactions.end())
+        return nullptr;    // TransactionID not initiated by our devices, so it came from somebody else
+
+    if (transaction != nullptr)
+        *transaction = it.value();
+
+    QObject* owner = it.value().owner;
+    m_transactions.erase(it);
+    removePending(owner, telegramID);
+
+    return owner;
+}
+
+void TransactionRegistry::removeOwner(QObject *owner)
+{
+    QHash<QObject*, QSet<quint64>>::iterator ownerIt = m_pendingPerOwner.find(owner);
+    if (ownerIt == m_pendingPerOwner.end())
+        return;
+
+    foreach (quint64 telegramID, ownerIt.value())
+        m_transactions.remove(telegramID);
+    m_pendingPerOwner.erase(ownerIt);
+}
+
+int TransactionRegistry::pendingCount(QObject *owner) const
+{
+    QHash<QObject*, QSet<quint64>>::const_iterator it = m_pendingPerOwner.constFind(owner);
+    if (it == m_pendingPerOwner.constEnd())
+        return 0;
+
+    return it.value().count();
+}
+
+int TransactionRegistry::count() const
+{
+    return m_transactions.count();
+}
+
+quint64 TransactionRegistry::expiredCount() const
+{
+    return m_expiredCount;
+}
+
+void TransactionRegistry::setExpiryTime(int milliseconds)
+{
+    m_expiryTime = milliseconds;
+    m_timer_expiry.setInterval(qMax(1000, milliseconds / 4));
+}
+
+void TransactionRegistry::removePending(QObject *owner, quint64 telegramID)
+{
+    QHash<QObject*, QSet<quint64>>::iterator it = m_pendingPerOwner.find(owner);
+    if (it == m_pendingPerOwner.end())
+        return;
+
+    it.value().remove(telegramID);
+    if (it.value().isEmpty())
+        m_pendingPerOwner.erase(it);
+}
+
+// Drop all entries which neither got a response nor a transactionLost signal in time
+void TransactionRegistry::slot_timer_expiry_fired()
+{
+    qint64 now = m_clock.elapsed();
+
+    QHash<quint64, Transaction>::iterator it = m_transactions.begin();
+    while (it != m_transactions.end())
+    {
+        if ((now - it.value().enqueueTime) > m_expiryTime)
+        {
+            removePending(it.value().owner, it.key());
+            it = m_transactions.erase(it);
+            m_expiredCount++;
+        }
+        else
+            ++it;
+    }
+}
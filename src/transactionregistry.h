@@ -0,0 +1,85 @@
+/**********************************************************************
+** ebmbus-cmd - a commandline tool to control ebm papst fans
+** Copyright (C) 2018 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+#ifndef TRANSACTIONREGISTRY_H
+#define TRANSACTIONREGISTRY_H
+
+#include <QObject>
+#include <QHash>
+#include <QSet>
+#include <QTimer>
+#include <QElapsedTimer>
+
+// The transaction registry remembers which device requested which telegram, so bus responses
+// can be routed back to their owner in constant time. Entries of telegrams that never got
+// a response or a transactionLost signal (e.g. dropped by clearTelegramQueue) expire after some time.
+
+class TransactionRegistry : public QObject
+{
+    Q_OBJECT
+public:
+    explicit TransactionRegistry(QObject *parent = nullptr);
+
+    typedef enum {
+        RequestUnknown,
+        RequestStatus,
+        RequestActualSpeed,
+        RequestConfig,
+        RequestSetpoint,
+        RequestEEPROMwrite,
+        RequestSoftwareReset,
+        RequestRegisterRead,
+        RequestRegisterWrite
+    } RequestKind;
+
+    typedef struct {
+        QObject* owner;
+        RequestKind kind;
+        qint64 enqueueTime;     // Milliseconds of the registry's monotonic clock
+    } Transaction;
+
+    void registerTransaction(quint64 telegramID, QObject* owner, RequestKind kind = RequestUnknown);
+
+    // Returns the owner of the telegram and removes the entry, or nullptr if nobody registered it
+    QObject* takeOwner(quint64 telegramID, Transaction* transaction = nullptr);
+
+    // Drops all pending transactions of an owner, e.g. if a device is deleted
+    void removeOwner(QObject* owner);
+
+    int pendingCount(QObject* owner) const;
+    int count() const;
+    quint64 expiredCount() const;
+
+    void setExpiryTime(int milliseconds);
+
+private:
+    QHash<quint64, Transaction> m_transactions;
+    QHash<QObject*, QSet<quint64>> m_pendingPerOwner;     // Telegram ids of each owner, so an owner is removed without a scan
+    QElapsedTimer m_clock;
+    QTimer m_timer_expiry;
+    int m_expiryTime;
+    quint64 m_expiredCount;
+
+    void removePending(QObject* owner, quint64 telegramID);
+
+signals:
+
+public slots:
+
+private slots:
+    void slot_timer_expiry_fired();
+};
+
+#endif // TRANSACTIONREGISTRY_H
@@ -0,0 +1,70 @@
+#**********************************************************************
+#* ebmbus-cmd - a commandline tool to control ebm papst fans
+#* Copyright (C) 2018 Smart Micro Engineering GmbH
+#* This program is free software: you can redistribute it and/or modify
+#* it under the terms of the GNU General Public License as published by
+#* the Free Software Foundation, either version 3 of the License, or
+#* (at your option) any later version.
+#* This program is distributed in the hope that it will be useful,
+#* but WITHOUT ANY WARRANTY; without even the implied warranty of
+#* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+#* GNU General Public License for more details.
+#* You should have received a copy of the GNU General Public License
+#* along with this program. If not, see <http://www.gnu.org/licenses/>.
+#*********************************************************************/
+
+
+QT += core
+QT -= gui
+
+CONFIG += c++11
+
+TARGET = benchmarks
+CONFIG += console
+CONFIG -= app_bundle
+
+TEMPLATE = app
+
+OBJECTS_DIR = .obj/
+MOC_DIR = .moc/
+
+SRC = ../../src
+INCLUDEPATH += $$SRC
+
+SOURCES += main.cpp \
+    $$SRC/ffu.cpp \
+    $$SRC/ffudatabase.cpp \
+    $$SRC/ffupollscheduler.cpp \
+    $$SRC/ffupollingplan.cpp \
+    $$SRC/transactionregistry.cpp \
+    $$SRC/logentry.cpp \
+    $$SRC/loghandler.cpp \
+    $$SRC/persistence.cpp \
+    $$SRC/devicejournal.cpp \
+    $$SRC/ebmbussystem.cpp \
+    $$SRC/ebmbusline.cpp \
+    $$SRC/ebmbuslinktuner.cpp \
+    $$SRC/serialinterfacetuning.cpp \
+    $$SRC/daisychaininterface.cpp \
+    $$SRC/revpidio.cpp
+
+HEADERS += \
+    $$SRC/ffu.h \
+    $$SRC/ffudatabase.h \
+    $$SRC/ffupollscheduler.h \
+    $$SRC/ffupollingplan.h \
+    $$SRC/transactionregistry.h \
+    $$SRC/logentry.h \
+    $$SRC/loghandler.h \
+    $$SRC/persistence.h \
+    $$SRC/devicejournal.h \
+    $$SRC/ebmbussystem.h \
+    $$SRC/ebmbusline.h \
+    $$SRC/ebmbuslinktuner.h \
+    $$SRC/serialinterfacetuning.h \
+    $$SRC/daisychaininterface.h \
+    $$SRC/revpidio.h \
+    $$SRC/spscqueue.h \
+    $$SRC/indexedlist.h
+
+LIBS     += -lebmbus
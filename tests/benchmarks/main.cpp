@@ -0,0 +1,330 @@
+/**********************************************************************
+** ebmbus-cmd - a commandline tool to control ebm papst fans
+** Copyright (C) 2018 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+// Benchmarks of the device bookkeeping, the response routing and the startup. They run without any bus hardware,
+// so the ebmbus system has no lines. Only the startup benchmark touches the disk, in a temporary directory.
+// Run on the target or a development machine and compare the numbers of the different device counts.
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QList>
+#include <QMap>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QTemporaryDir>
+#include <algorithm>
+#include <random>
+#include <stdio.h>
+#include "devicejournal.h"
+#include "ebmbussystem.h"
+#include "ffu.h"
+#include "ffudatabase.h"
+#include "ffupollingplan.h"
+#include "loghandler.h"
+#include "transactionregistry.h"
+
+static const int BusCount = 4;
+static const int PendingTelegramsPerDevice = 2;
+static const int TelegramsPerPoll = 8;              // Telegrams of a full status poll of an ffu
+
+static double msecs(const QElapsedTimer& timer)
+{
+    return timer.nsecsElapsed() / 1000000.0;
+}
+
+typedef struct {
+    int busID;
+    int fanAddress;
+    int fanGroup;
+} FFUaddress;
+
+// Spreads the ffus over BusCount buses with unique addresses on each bus
+static FFUaddress ffuAddress(int id)
+{
+    int slot = id / BusCount;
+
+    FFUaddress address;
+    address.busID = id % BusCount;
+    address.fanAddress = slot % 250 + 1;
+    address.fanGroup = slot / 250 + 1;
+    return address;
+}
+
+// An ffu database without bus lines or persistence, with ffus 1 to deviceCount added by populate()
+class BenchmarkDatabase
+{
+public:
+    BenchmarkDatabase() :
+        ebmbusSystem(nullptr, nullptr),
+        ffuDatabase(nullptr, &ebmbusSystem, nullptr, &loghandler),
+        random(42)
+    {
+    }
+
+    void populate(int deviceCount)
+    {
+        for (int id = 1; id <= deviceCount; id++)
+        {
+            FFUaddress address = ffuAddress(id);
+            ffuDatabase.addFFU(id, address.busID, 0, address.fanAddress, address.fanGroup);
+        }
+    }
+
+    TransactionRegistry* transactionRegistry()
+    {
+        return ffuDatabase.getTransactionRegistry();
+    }
+
+    EbmBusSystem ebmbusSystem;
+    Loghandler loghandler;
+    FFUdatabase ffuDatabase;
+    std::mt19937 random;
+};
+
+// Add, look up and delete ffus. Every ffu has telegrams in flight and an active error, like an ffu that
+// went offline, so deleting it also has to clean up the transaction registry and the loghandler.
+static void benchmarkDeviceDatabase(int deviceCount)
+{
+    BenchmarkDatabase database;
+    FFUdatabase& ffuDatabase = database.ffuDatabase;
+    Loghandler& loghandler = database.loghandler;
+    TransactionRegistry* transactionRegistry = database.transactionRegistry();
+    QElapsedTimer timer;
+
+    timer.start();
+    database.populate(deviceCount);
+    double addTime = msecs(timer);
+
+    QList<int> ids;
+    for (int id = 1; id <= deviceCount; id++)
+        ids.append(id);
+
+    quint64 telegramID = 0;
+    foreach (FFU* ffu, ffuDatabase.getFFUs())
+    {
+        for (int i = 0; i < PendingTelegramsPerDevice; i++)
+            transactionRegistry->registerTransaction(++telegramID, ffu, TransactionRegistry::RequestStatus);
+        loghandler.slot_newEntry(LogEntry::Error, "FFU id=" + QString().setNum(ffu->getId()), "Not online.");
+    }
+
+    std::shuffle(ids.begin(), ids.end(), database.random);
+    int found = 0;
+    timer.start();
+    foreach (int id, ids)
+    {
+        if (ffuDatabase.getFFUbyID(id) != nullptr)
+            found++;
+    }
+    double lookupTime = msecs(timer);
+
+    // Delete a whole bus first, like decommissioning a line, then the rest in random order
+    QList<FFU*> firstBus = ffuDatabase.getFFUs(0);
+    timer.start();
+    foreach (FFU* ffu, firstBus)
+        ffuDatabase.deleteFFU(ffu->getId());
+    double deleteBusTime = msecs(timer);
+
+    QList<int> remainingIDs;
+    foreach (FFU* ffu, ffuDatabase.getFFUs())
+        remainingIDs.append(ffu->getId());
+    std::shuffle(remainingIDs.begin(), remainingIDs.end(), database.random);
+    timer.start();
+    foreach (int id, remainingIDs)
+        ffuDatabase.deleteFFU(id);
+    double deleteRestTime = msecs(timer);
+
+    fprintf(stdout, "devices=%i add=%.1fms lookup=%.1fms (found %i) deleteBus=%.1fms (%i ffus) deleteRest=%.1fms (%i ffus) "
+                    "leftover: ffus=%i transactions=%i activeErrors=%s\n",
+            deviceCount, addTime, lookupTime, found, deleteBusTime, firstBus.count(), deleteRestTime, remainingIDs.count(),
+            ffuDatabase.getFFUs().count(), transactionRegistry->count(), loghandler.hasActiveErrors() ? "yes" : "no");
+    fflush(stdout);
+}
+
+// Route responses to their ffus like FFUdatabase::getFFUbyTelegramID() does. The time per response should stay flat
+// from 10 to 10,000 devices.
+static void benchmarkTransactionRouting(int deviceCount)
+{
+    BenchmarkDatabase database;
+    database.populate(deviceCount);
+    TransactionRegistry* transactionRegistry = database.transactionRegistry();
+    QList<FFU*> ffus = database.ffuDatabase.getFFUs();
+    QElapsedTimer timer;
+
+    // Enough rounds for about 100,000 responses, whatever the device count
+    int rounds = qMax(1, 100000 / (deviceCount * TelegramsPerPoll));
+    quint64 telegramID = 0;
+    qint64 registerTime = 0;
+    qint64 routeTime = 0;
+    int responses = 0;
+    int misrouted = 0;
+
+    for (int round = 0; round < rounds; round++)
+    {
+        // Every ffu has a full poll in flight, then the responses come back in some order
+        QList<quint64> telegramIDs;
+        QList<FFU*> owners;
+        timer.start();
+        foreach (FFU* ffu, ffus)
+        {
+            for (int i = 0; i < TelegramsPerPoll; i++)
+            {
+                transactionRegistry->registerTransaction(++telegramID, ffu, TransactionRegistry::RequestStatus);
+                telegramIDs.append(telegramID);
+                owners.append(ffu);
+            }
+        }
+        registerTime += timer.nsecsElapsed();
+
+        QList<int> order;
+        for (int i = 0; i < telegramIDs.count(); i++)
+            order.append(i);
+        std::shuffle(order.begin(), order.end(), database.random);
+
+        timer.start();
+        foreach (int i, order)
+        {
+            if (qobject_cast<FFU*>(transactionRegistry->takeOwner(telegramIDs.at(i))) != owners.at(i))
+                misrouted++;
+        }
+        routeTime += timer.nsecsElapsed();
+        responses += order.count();
+    }
+
+    fprintf(stdout, "devices=%i responses=%i register=%.0fns/telegram route=%.0fns/response misrouted=%i leftover=%i\n",
+            deviceCount, responses, (double)registerTime / responses, (double)routeTime / responses, misrouted, transactionRegistry->count());
+    fflush(stdout);
+}
+
+static QByteArray ffuRecord(int id)
+{
+    // Same layout as FFU::save() writes, with cached config data
+    FFUaddress address = ffuAddress(id);
+    return QString().sprintf("id=%i bus=%i unit=0 fanAddress=%i fanGroup=%i nmax=1410.00 setpointSpeedRaw=170 serialNumber=%u speedMax=1410 "
+                             "manufacturingDate=12.05.18 referenceDClinkVoltage=8000 referenceDClinkCurrent=2000 speedSettingLostCount=0\n",
+                             id, address.busID, address.fanAddress, address.fanGroup, 20180000u + id).toUtf8();
+}
+
+// Startup with a large installation: load all device records and create the ffus from them, once from the
+// device journal and once from one csv file per ffu, as before the journal. The files are in the page cache
+// after writing them, so this measures the cpu and syscall cost, not the disk.
+static void benchmarkStartup(int deviceCount)
+{
+    QTemporaryDir directory;
+    if (!directory.isValid())
+    {
+        fprintf(stderr, "benchmarkStartup(): Unable to create a temporary directory.\n");
+        return;
+    }
+
+    EbmBusSystem ebmbusSystem(nullptr, nullptr);
+    Loghandler loghandler;
+    TransactionRegistry transactionRegistry;
+    FFUpollingPlan pollingPlan;
+    QElapsedTimer timer;
+
+    QMap<QString, QByteArray> records;
+    for (int id = 1; id <= deviceCount; id++)
+        records.insert(QString().sprintf("ffu-%06i", id), ffuRecord(id));
+
+    QString journalFile = directory.path() + "/devices.journal";
+    QString csvDirectory = directory.path() + "/ffus/";
+    QDir().mkpath(csvDirectory);
+
+    DeviceJournal writer;
+    if (!writer.open(journalFile) || (writer.append(records, QStringList(), false) < 0))
+    {
+        fprintf(stderr, "benchmarkStartup(): Unable to write %s.\n", journalFile.toLocal8Bit().data());
+        return;
+    }
+    writer.close();
+
+    QMap<QString, QByteArray>::const_iterator it = records.constBegin();
+    while (it != records.constEnd())
+    {
+        QFile file(csvDirectory + it.key() + ".csv");
+        if (file.open(QIODevice::WriteOnly))
+            file.write(it.value());
+        ++it;
+    }
+
+    // Journal
+    timer.start();
+    DeviceJournal journal;
+    journal.open(journalFile);
+    double journalLoadTime = msecs(timer);
+    QList<FFU*> ffus;
+    foreach (QByteArray record, journal.records())
+    {
+        FFU* ffu = new FFU(nullptr, &ebmbusSystem, &transactionRegistry, &loghandler);
+        ffu->setPollingPlan(&pollingPlan);
+        ffu->load(record);
+        ffus.append(ffu);
+    }
+    double journalTotalTime = msecs(timer);
+    int journalCount = ffus.count();
+    qDeleteAll(ffus);
+    ffus.clear();
+
+    // One csv file per ffu
+    timer.start();
+    QMap<QString, QByteArray> csvRecords;
+    QDirIterator iterator(csvDirectory, QStringList() << "*.csv", QDir::Files, QDirIterator::NoIteratorFlags);
+    while (iterator.hasNext())
+    {
+        QString filepath = iterator.next();
+        QFile file(filepath);
+        if (!file.open(QIODevice::ReadOnly))
+            continue;
+        csvRecords.insert(QFileInfo(filepath).completeBaseName(), file.readAll());
+    }
+    double csvLoadTime = msecs(timer);
+    foreach (QByteArray record, csvRecords)
+    {
+        FFU* ffu = new FFU(nullptr, &ebmbusSystem, &transactionRegistry, &loghandler);
+        ffu->setPollingPlan(&pollingPlan);
+        ffu->load(record);
+        ffus.append(ffu);
+    }
+    double csvTotalTime = msecs(timer);
+    int csvCount = ffus.count();
+    qDeleteAll(ffus);
+
+    fprintf(stdout, "devices=%i journal: load=%.1fms total=%.1fms (%i ffus, %lli bytes) csv: load=%.1fms total=%.1fms (%i ffus)\n",
+            deviceCount, journalLoadTime, journalTotalTime, journalCount, journal.size(), csvLoadTime, csvTotalTime, csvCount);
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+
+    fprintf(stdout, "Device database\n");
+    benchmarkDeviceDatabase(1000);
+    benchmarkDeviceDatabase(5000);
+
+    fprintf(stdout, "Transaction routing\n");
+    benchmarkTransactionRouting(10);
+    benchmarkTransactionRouting(100);
+    benchmarkTransactionRouting(1000);
+    benchmarkTransactionRouting(10000);
+
+    fprintf(stdout, "Startup\n");
+    benchmarkStartup(1000);
+    benchmarkStartup(10000);
+
+    return 0;
+}
@@ -0,0 +1,254 @@
+/**********************************************************************
+** ebmbus-cmd - a commandline tool to control ebm papst fans
+** Copyright (C) 2018 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+// Tests and benchmarks of the modbus lines against simulated slaves on pseudo terminals, so no hardware is needed.
+// Returns 0 if all tests passed, the benchmark results are only printed.
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QHash>
+#include <QList>
+#include <QSettings>
+#include <QTemporaryDir>
+#include <QTimer>
+#include <stdio.h>
+#include "ebmmodbussystem.h"
+#include "loghandler.h"
+#include "modbusslavesimulator.h"
+
+static const int Baudrate = 19200;
+static const int SlavesPerLine = 8;
+
+typedef struct {
+    int answered;
+    int lost;
+    int misrouted;
+    double throughput;      // Unit transactions per second
+} LineResult;
+
+// Polls all slaves of lineCount simulated lines through EbmModbusSystem, like the auxfan poll does. Each line has
+// its own worker thread, so the throughput should grow with the number of lines.
+static bool pollLines(int lineCount, int rounds, LineResult* result)
+{
+    QTemporaryDir directory;
+    if (!directory.isValid())
+    {
+        fprintf(stderr, "pollLines(): Unable to create a temporary directory.\n");
+        return false;
+    }
+
+    QList<ModbusSlaveSimulator*> simulators;
+    for (int line = 0; line < lineCount; line++)
+    {
+        ModbusSlaveSimulator* simulator = new ModbusSlaveSimulator(nullptr, line + 1, Baudrate);
+        simulators.append(simulator);
+        if (!simulator->open())
+        {
+            qDeleteAll(simulators);
+            return false;
+        }
+        simulator->start();
+    }
+
+    QString settingsFile = directory.path() + "/ebmbus-cmd.ini";
+    {
+        QSettings settings(settingsFile, QSettings::IniFormat);
+        settings.beginGroup("configEbmModBus");
+        settings.setValue("lineStateFile", directory.path() + "/modbus-lines.ini");
+        settings.endGroup();
+        settings.beginGroup("interfacesEbmModBus");
+        for (int line = 0; line < lineCount; line++)
+        {
+            QString key = QString().sprintf("ebmmodbus%i", line);
+            settings.setValue(key, simulators.at(line)->getInterfaceName());
+            settings.setValue(key + "Baudrate", Baudrate);
+            settings.setValue(key + "Parity", "E");
+        }
+        settings.endGroup();
+    }
+
+    result->answered = 0;
+    result->lost = 0;
+    result->misrouted = 0;
+    result->throughput = 0.0;
+    bool ok = true;
+
+    {
+        Loghandler loghandler;
+        EbmModbusSystem ebmModbusSystem(nullptr, &loghandler, settingsFile);
+        if (ebmModbusSystem.ebmModbuslist()->count() != lineCount)
+        {
+            fprintf(stderr, "pollLines(): Expected %i lines, got %i.\n", lineCount, ebmModbusSystem.ebmModbuslist()->count());
+            ok = false;
+        }
+
+        QHash<quint64, quint16> expectedValues;     // Key is the telegram id
+        int outstanding = 0;
+        int round = 0;
+        QEventLoop loop;
+
+        auto issueRound = [&]()
+        {
+            for (int line = 0; line < lineCount; line++)
+            {
+                for (int adr = 1; adr <= SlavesPerLine; adr++)
+                {
+                    quint64 telegramID = ebmModbusSystem.readInputRegister(line, adr, EbmModbus::INPUT_REG_D010_ActualSpeed);
+                    expectedValues.insert(telegramID, (line + 1) * 1000 + adr);
+                    outstanding++;
+                }
+            }
+        };
+
+        auto finishTelegram = [&]()
+        {
+            outstanding--;
+            if (outstanding > 0)
+                return;
+            round++;
+            if (round < rounds)
+                issueRound();
+            else
+                loop.quit();
+        };
+
+        QObject::connect(&ebmModbusSystem, &EbmModbusSystem::signal_receivedInputRegisterData,
+                         [&](quint64 telegramID, quint16 adr, EbmModbus::EbmModbusInputRegister reg, quint16 rawdata)
+        {
+            Q_UNUSED(adr);
+            Q_UNUSED(reg);
+            if (expectedValues.take(telegramID) != rawdata)
+                result->misrouted++;
+            result->answered++;
+            finishTelegram();
+        });
+        QObject::connect(&ebmModbusSystem, &EbmModbusSystem::signal_transactionLost, [&](quint64 telegramID)
+        {
+            expectedValues.remove(telegramID);
+            result->lost++;
+            finishTelegram();
+        });
+
+        QTimer::singleShot(60000, &loop, SLOT(quit()));     // Guard against a hanging line
+
+        QElapsedTimer timer;
+        timer.start();
+        issueRound();
+        loop.exec();
+        result->throughput = result->answered * 1000.0 / qMax((qint64)1, timer.elapsed());
+    }
+
+    qDeleteAll(simulators);
+
+    int expected = lineCount * SlavesPerLine * rounds;
+    if ((result->answered != expected) || (result->lost != 0) || (result->misrouted != 0))
+        ok = false;
+
+    fprintf(stdout, "lines=%i answered=%i/%i lost=%i misrouted=%i throughput=%.1f transactions/s\n",
+            lineCount, result->answered, expected, result->lost, result->misrouted, result->throughput);
+    fflush(stdout);
+
+    return ok;
+}
+
+// N lines must serve about N times the transactions of one line. The simulated line time dominates, so this
+// holds on a single core as well.
+static bool testParallelLines()
+{
+    fprintf(stdout, "Parallel lines\n");
+
+    LineResult single;
+    if (!pollLines(1, 8, &single))
+        return false;
+
+    bool ok = true;
+    QList<int> lineCounts = QList<int>() << 2 << 4;
+    foreach (int lineCount, lineCounts)
+    {
+        LineResult result;
+        if (!pollLines(lineCount, 8, &result))
+            ok = false;
+        else if (result.throughput < 0.6 * lineCount * single.throughput)
+        {
+            fprintf(stdout, "FAIL: %i lines are not served in parallel.\n", lineCount);
+            ok = false;
+        }
+    }
+
+    return ok;
+}
+
+// Transactions per second of one line at several baudrates. The ideal is the simulated line time of request
+// and answer plus the reaction time of the slave and the inter-frame gap. Before the gap was computed, every
+// transaction waited a fixed 100 ms.
+static void benchmarkThroughput()
+{
+    fprintf(stdout, "Throughput of one line\n");
+
+    QList<int> baudrates = QList<int>() << 9600 << 19200 << 38400 << 115200;
+    foreach (int baudrate, baudrates)
+    {
+        const int transactions = 100;
+        const int reactionTime = 1000;
+        ModbusSlaveSimulator simulator(nullptr, 1, baudrate, reactionTime);
+        if (!simulator.open())
+            return;
+        simulator.start();
+
+        EbmModbus ebmModbus(nullptr, simulator.getSlavePath());
+        ebmModbus.setLineParameters(baudrate, 'E');
+        if (!ebmModbus.open())
+        {
+            fprintf(stderr, "benchmarkThroughput(): Unable to open %s.\n", simulator.getSlavePath().toLocal8Bit().data());
+            return;
+        }
+
+        int lost = 0;
+        QObject::connect(&ebmModbus, &EbmModbus::signal_transactionLost, [&](quint64) { lost++; });
+
+        QElapsedTimer timer;
+        timer.start();
+        for (int i = 0; i < transactions; i++)
+            ebmModbus.slot_readInputRegisterData(i, 1, EbmModbus::INPUT_REG_D010_ActualSpeed);
+        qint64 elapsed = timer.nsecsElapsed() / 1000;
+        ebmModbus.close();
+
+        // Read input register request is 8 characters, the answer with one register 7 characters, 11 bits each
+        qint64 lineTime = 15 * 11 * 1000000LL / baudrate;
+        qint64 ideal = lineTime + reactionTime + ebmModbus.getInterFrameGap();
+        EbmModbus::TimingStatistics statistics = ebmModbus.getTimingStatistics();
+
+        fprintf(stdout, "baudrate=%i transactions=%i lost=%i throughput=%.1f/s (ideal %.1f/s, fixed 100 ms clearance %.1f/s) "
+                        "average=%lldus max=%lldus gapWait=%lldus\n",
+                baudrate, transactions, lost, transactions * 1000000.0 / qMax((qint64)1, elapsed), 1000000.0 / ideal, 1000000.0 / (lineTime + reactionTime + 100000),
+                statistics.totalDuration / qMax((qint64)1, (qint64)statistics.transactions), statistics.maxDuration,
+                statistics.totalGapWait / qMax((qint64)1, (qint64)statistics.transactions));
+        fflush(stdout);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+
+    bool ok = true;
+    ok &= testParallelLines();
+
+    benchmarkThroughput();
+
+    fprintf(stdout, "%s\n", ok ? "PASS" : "FAIL");
+    return ok ? 0 : 1;
+}
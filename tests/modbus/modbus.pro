@@ -0,0 +1,50 @@
+#**********************************************************************
+#* ebmbus-cmd - a commandline tool to control ebm papst fans
+#* Copyright (C) 2018 Smart Micro Engineering GmbH
+#* This program is free software: you can redistribute it and/or modify
+#* it under the terms of the GNU General Public License as published by
+#* the Free Software Foundation, either version 3 of the License, or
+#* (at your option) any later version.
+#* This program is distributed in the hope that it will be useful,
+#* but WITHOUT ANY WARRANTY; without even the implied warranty of
+#* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+#* GNU General Public License for more details.
+#* You should have received a copy of the GNU General Public License
+#* along with this program. If not, see <http://www.gnu.org/licenses/>.
+#*********************************************************************/
+
+
+QT += core
+QT -= gui
+
+CONFIG += c++11
+
+TARGET = modbustests
+CONFIG += console
+CONFIG -= app_bundle
+
+TEMPLATE = app
+
+OBJECTS_DIR = .obj/
+MOC_DIR = .moc/
+
+SRC = ../../src
+INCLUDEPATH += $$SRC
+
+SOURCES += main.cpp \
+    modbusslavesimulator.cpp \
+    $$SRC/ebmmodbussystem.cpp \
+    $$SRC/ebmmodbus.cpp \
+    $$SRC/serialinterfacetuning.cpp \
+    $$SRC/logentry.cpp \
+    $$SRC/loghandler.cpp
+
+HEADERS += \
+    modbusslavesimulator.h \
+    $$SRC/ebmmodbussystem.h \
+    $$SRC/ebmmodbus.h \
+    $$SRC/serialinterfacetuning.h \
+    $$SRC/logentry.h \
+    $$SRC/loghandler.h
+
+LIBS     += -lmodbus
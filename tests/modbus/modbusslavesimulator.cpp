@@ -0,0 +1,194 @@
+/**********************************************************************
+** ebmbus-cmd - a commandline tool to control ebm papst fans
+** Copyright (C) 2018 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+#include "modbusslavesimulator.h"
+#include <QRegExp>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <termios.h>
+
+ModbusSlaveSimulator::ModbusSlaveSimulator(QObject *parent, int lineValue, int baudrate, int reactionTime) : QThread(parent)
+{
+    m_fd = -1;
+    m_lineValue = lineValue;
+    m_baudrate = baudrate;
+    m_reactionTime = reactionTime;
+    m_stop = false;
+    m_transactions = 0;
+}
+
+ModbusSlaveSimulator::~ModbusSlaveSimulator()
+{
+    stop();
+    if (m_fd >= 0)
+        ::close(m_fd);
+}
+
+bool ModbusSlaveSimulator::open()
+{
+    m_fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if ((m_fd < 0) || (grantpt(m_fd) != 0) || (unlockpt(m_fd) != 0))
+    {
+        fprintf(stderr, "ModbusSlaveSimulator::open(): Unable to create a pseudo terminal: %s\n", strerror(errno));
+        return false;
+    }
+
+    m_slavePath = QString(ptsname(m_fd));
+
+    // Raw mode until the master has opened and configured the slave side, so nothing is echoed back to us
+    struct termios tio;
+    if (tcgetattr(m_fd, &tio) == 0)
+    {
+        cfmakeraw(&tio);
+        tcsetattr(m_fd, TCSANOW, &tio);
+    }
+
+    return true;
+}
+
+void ModbusSlaveSimulator::stop()
+{
+    m_stop = true;
+    wait();
+}
+
+QString ModbusSlaveSimulator::getSlavePath() const
+{
+    return m_slavePath;
+}
+
+QString ModbusSlaveSimulator::getInterfaceName() const
+{
+    return QString(m_slavePath).remove(QRegExp("^/dev/"));
+}
+
+quint64 ModbusSlaveSimulator::getTransactions() const
+{
+    return m_transactions;
+}
+
+quint16 ModbusSlaveSimulator::crc16(const quint8 *data, int length)
+{
+    quint16 crc = 0xFFFF;
+    for (int i = 0; i < length; i++)
+    {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++)
+        {
+            if (crc & 0x0001)
+                crc = (crc >> 1) ^ 0xA001;
+            else
+                crc >>= 1;
+        }
+    }
+    return crc;
+}
+
+qint64 ModbusSlaveSimulator::lineTime(int characters) const
+{
+    return (qint64)characters * BitsPerCharacter * 1000000 / m_baudrate;
+}
+
+void ModbusSlaveSimulator::run()
+{
+    QByteArray buffer;
+
+    while (!m_stop)
+    {
+        struct pollfd pfd;
+        pfd.fd = m_fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, 50) <= 0)
+            continue;
+        if (!(pfd.revents & POLLIN))
+        {
+            QThread::msleep(10);    // POLLHUP while the slave side is closed, e.g. while the line is reopened
+            continue;
+        }
+
+        char data[256];
+        ssize_t count = ::read(m_fd, data, sizeof(data));
+        if (count <= 0)
+            continue;
+        buffer.append(data, (int)count);
+
+        while (buffer.size() >= RequestSize)
+        {
+            QByteArray request = buffer.left(RequestSize);
+            const quint8* bytes = (const quint8*)request.constData();
+            quint16 crc = crc16(bytes, RequestSize - 2);
+            if ((bytes[RequestSize - 2] != (crc & 0xFF)) || (bytes[RequestSize - 1] != (crc >> 8)))
+            {
+                buffer.clear();     // Out of sync, the master will time out and send the next request
+                break;
+            }
+            buffer.remove(0, RequestSize);
+
+            QByteArray response = answer(request);
+            if (response.isEmpty())
+                continue;   // Broadcast
+
+            QThread::usleep(lineTime(request.size() + response.size()) + m_reactionTime);
+            if (::write(m_fd, response.constData(), response.size()) == response.size())
+                m_transactions++;
+        }
+    }
+}
+
+QByteArray ModbusSlaveSimulator::answer(const QByteArray &request)
+{
+    const quint8* bytes = (const quint8*)request.constData();
+    quint8 adr = bytes[0];
+    quint8 function = bytes[1];
+    quint16 count = (bytes[4] << 8) | bytes[5];
+
+    if (adr == 0)
+        return QByteArray();
+
+    QByteArray response;
+    response.append((char)adr);
+
+    if (((function == 0x03) || (function == 0x04)) && (count >= 1) && (count <= 125))
+    {
+        quint16 value = m_lineValue * 1000 + adr;
+        response.append((char)function);
+        response.append((char)(count * 2));
+        for (int i = 0; i < count; i++)
+        {
+            response.append((char)(value >> 8));
+            response.append((char)(value & 0xFF));
+        }
+    }
+    else if (function == 0x06)
+    {
+        response = request.left(RequestSize - 2);
+    }
+    else
+    {
+        response.append((char)(function | 0x80));
+        response.append((char)0x01);    // Illegal function
+    }
+
+    quint16 crc = crc16((const quint8*)response.constData(), response.size());
+    response.append((char)(crc & 0xFF));
+    response.append((char)(crc >> 8));
+    return response;
+}
@@ -0,0 +1,65 @@
+/**********************************************************************
+** ebmbus-cmd - a commandline tool to control ebm papst fans
+** Copyright (C) 2018 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+#ifndef MODBUSSLAVESIMULATOR_H
+#define MODBUSSLAVESIMULATOR_H
+
+#include <QThread>
+#include <QString>
+#include <atomic>
+
+// Simulates a modbus RTU line full of slaves at the master side of a pseudo terminal. EbmModbus opens
+// the slave side like a serial interface. A pty transfers bytes instantly, so each answer is delayed by
+// the time request and response would take on a real line at the given baudrate, plus the reaction time of the slave.
+//
+// Register reads (0x03, 0x04) of any slave return lineValue * 1000 + slave address for every register,
+// so a test can tell on which line a request was served. Writes (0x06) are acknowledged.
+
+class ModbusSlaveSimulator : public QThread
+{
+    Q_OBJECT
+public:
+    explicit ModbusSlaveSimulator(QObject *parent, int lineValue, int baudrate, int reactionTime = 1000);   // reactionTime unit us
+    ~ModbusSlaveSimulator();
+
+    bool open();        // Creates the pty, call before start()
+    void stop();
+
+    QString getSlavePath() const;       // e.g. /dev/pts/3
+    QString getInterfaceName() const;   // e.g. pts/3, as configured in [interfacesEbmModBus]
+    quint64 getTransactions() const;
+
+    static quint16 crc16(const quint8* data, int length);
+
+protected:
+    void run();
+
+private:
+    int m_fd;
+    QString m_slavePath;
+    int m_lineValue;
+    int m_baudrate;
+    int m_reactionTime;
+    std::atomic<bool> m_stop;
+    std::atomic<quint64> m_transactions;
+
+    static const int BitsPerCharacter = 11;     // Start bit, 8 data bits, parity or second stop bit, stop bit
+    static const int RequestSize = 8;           // All supported requests: address, function, register, value or count, crc
+
+    qint64 lineTime(int characters) const;      // Unit us
+    QByteArray answer(const QByteArray& request);
+};
+
+#endif // MODBUSSLAVESIMULATOR_H